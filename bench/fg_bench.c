@@ -0,0 +1,168 @@
+/**
+ * @file fg_bench.c
+ * @brief Measures foreground job latency while background jobs exit
+ *
+ * Runs ./tsh -p with the given options on a pipe and times short foreground
+ * jobs (`/bin/sleep 0.005`), each followed by `echo` so that its completion
+ * can be seen: first with no other job, then while N background jobs exit,
+ * spread evenly over a few seconds. For each phase, the median and 99th
+ * percentile of the time from sending the command to reading the echo are
+ * printed, along with the wakeups of the shell per foreground wait and the
+ * child events it handled, as reported by the stats builtin.
+ *
+ * The shell is started with -s posix_spawn before the given options, as the
+ * fork wrapper of tsh (wrapper.c) spins for up to 100 ms after each fork.
+ *
+ * Usage: bench/fg_bench [-n bg-jobs] [tsh options...]
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QUIET_NS 1e9  // Time spent measuring without background jobs
+#define SPREAD_NS 3e9 // Time over which the background jobs exit
+#define HEADSTART 2.0 // Seconds before the first background job exits
+#define MAX_ROUNDS 100000
+
+static FILE *to_shell;   // Commands for the shell
+static FILE *from_shell; // Its output
+
+/*
+ * now_ns - Monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * read_until - Read the output of the shell up to a line starting with
+ * prefix, and return that line
+ */
+static const char *read_until(const char *prefix) {
+    static char line[4096];
+    while (fgets(line, sizeof(line), from_shell) != NULL) {
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            return line;
+        }
+    }
+    fprintf(stderr, "fg_bench: the shell exited\n");
+    exit(1);
+}
+
+/*
+ * compare_double - qsort comparator for ascending doubles
+ */
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * run_phase - Time foreground jobs until deadline, and print the results
+ */
+static void run_phase(const char *name, double deadline) {
+    static double latency[MAX_ROUNDS];
+    unsigned long waits, wakeups, wait_wakeups, events;
+    int rounds = 0;
+
+    fprintf(to_shell, "stats -r\necho ready\n");
+    fflush(to_shell);
+    read_until("ready");
+    while (rounds < MAX_ROUNDS && (rounds == 0 || now_ns() < deadline)) {
+        double start = now_ns();
+        fprintf(to_shell, "/bin/sleep 0.005\necho mark %d\n", rounds);
+        fflush(to_shell);
+        read_until("mark");
+        latency[rounds++] = now_ns() - start;
+    }
+
+    fprintf(to_shell, "stats\n");
+    fflush(to_shell);
+    if (sscanf(read_until("fg-waits"),
+               "fg-waits %lu fg-wakeups %lu wait-wakeups %lu "
+               "child-events %lu",
+               &waits, &wakeups, &wait_wakeups, &events) != 4) {
+        fprintf(stderr, "fg_bench: cannot parse the stats builtin\n");
+        exit(1);
+    }
+    qsort(latency, (size_t)rounds, sizeof(latency[0]), compare_double);
+    printf("%8s %8d %14.0f %14.0f %14.2f %14lu\n", name, rounds,
+           latency[rounds / 2] / 1e3, latency[rounds * 99 / 100] / 1e3,
+           waits > 0 ? (double)wakeups / waits : 0.0, events);
+}
+
+int main(int argc, char **argv) {
+    int bg_jobs = 1000;
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        bg_jobs = atoi(argv[2]);
+        first = 3;
+    }
+
+    // ./tsh -p -s posix_spawn [options...]
+    char *tsh_argv[argc + 4];
+    int tsh_argc = 0;
+    tsh_argv[tsh_argc++] = "./tsh";
+    tsh_argv[tsh_argc++] = "-p";
+    tsh_argv[tsh_argc++] = "-s";
+    tsh_argv[tsh_argc++] = "posix_spawn";
+    for (int i = first; i < argc; i++) {
+        tsh_argv[tsh_argc++] = argv[i];
+    }
+    tsh_argv[tsh_argc] = NULL;
+
+    int in[2], out[2];
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t shell = fork();
+    if (shell < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (shell == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execv(tsh_argv[0], tsh_argv);
+        perror("./tsh");
+        _exit(1);
+    }
+    close(in[0]);
+    close(out[1]);
+    to_shell = fdopen(in[1], "w");
+    from_shell = fdopen(out[0], "r");
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%8s %8s %14s %14s %14s %14s\n", "phase", "rounds",
+           "median (us)", "p99 (us)", "wakeups/wait", "child events");
+    run_phase("quiet", now_ns() + QUIET_NS);
+
+    // Background jobs exit one after the other over SPREAD_NS, starting
+    // HEADSTART seconds from now, while the foreground jobs are timed
+    double start = now_ns();
+    for (int i = 0; i < bg_jobs; i++) {
+        fprintf(to_shell, "/bin/sleep %.4f &\n",
+                HEADSTART + SPREAD_NS / 1e9 * i / bg_jobs);
+    }
+    fflush(to_shell);
+    run_phase("noisy", start + HEADSTART * 1e9 + SPREAD_NS);
+
+    fprintf(to_shell, "quit\n");
+    fclose(to_shell);
+    waitpid(shell, NULL, 0);
+    fclose(from_shell);
+    return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * @file jobs_bench.c
+ * @brief Measures the latency of the jobs builtin against the job count
+ *
+ * For each job count N, the job list is filled with N running jobs, five of
+ * which are then stopped, and the time taken by `jobs` (list_jobs) and by
+ * `jobs -s` (list_jobs_states with only ST) is measured with the output
+ * going to /dev/null. No processes are created; the PIDs are made up.
+ *
+ * Usage: bench/jobs_bench [max-jobs]
+ */
+
+#include "csapp.h"
+#include "tsh_helper.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define STOPPED 5   // Stopped jobs in each configuration
+#define BUDGET 2e8  // Nanoseconds spent measuring each configuration
+
+/*
+ * now_ns - Monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * time_listing - Average time of one listing of the given states
+ */
+static double time_listing(int fd, unsigned states) {
+    long iters = 0;
+    double start = now_ns();
+    double elapsed;
+    do {
+        list_jobs_states(fd, states);
+        iters++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BUDGET);
+    return elapsed / iters;
+}
+
+int main(int argc, char **argv) {
+    int max_jobs = argc > 1 ? atoi(argv[1]) : 100000;
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+        perror("open /dev/null");
+        exit(1);
+    }
+
+    // The job list expects the signals of its handlers to be blocked
+    sigset_t mask_all;
+    sigfillset(&mask_all);
+    sigprocmask(SIG_BLOCK, &mask_all, NULL);
+
+    printf("%10s %16s %16s\n", "jobs", "jobs (ns)", "jobs -s (ns)");
+    for (int n = 10; n <= max_jobs; n *= 10) {
+        init_job_list();
+        for (int i = 0; i < n; i++) {
+            add_job(1000 + i, BG, "/bin/sleep 1000 &");
+        }
+        for (int i = 0; i < STOPPED; i++) {
+            job_set_state(job_from_pid(1000 + i * (n / STOPPED)), ST);
+        }
+
+        double all = time_listing(fd, JOB_STATE_BIT(FG) | JOB_STATE_BIT(BG) |
+                                          JOB_STATE_BIT(ST));
+        double stopped = time_listing(fd, JOB_STATE_BIT(ST));
+        printf("%10d %16.0f %16.0f\n", n, all, stopped);
+        destroy_job_list();
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file parse_bench.c
+ * @brief Compares the scalar and vectorized scanners of parseline
+ *
+ * First, random command lines made of white space, quotes, redirections and
+ * word characters are parsed with every supported scanner, and the results
+ * are checked to be identical to the scalar path. Then generated command
+ * lines of increasing length are parsed repeatedly with each scanner, and
+ * the time per line and the throughput are reported.
+ *
+ * Usage: bench/parse_bench [fuzz-iterations]
+ */
+
+#include "tsh_helper.h"
+#include "tsh_scan.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BUDGET 2e8 // Nanoseconds spent measuring each configuration
+
+static const scan_impl impls[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+#define NIMPLS (sizeof(impls) / sizeof(impls[0]))
+
+/*
+ * now_ns - Monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * same_tokens - Whether two parses of a line agree
+ */
+static bool same_tokens(parseline_return ra, const struct cmdline_tokens *a,
+                        parseline_return rb, const struct cmdline_tokens *b) {
+    if (ra != rb) {
+        return false;
+    }
+    if (ra == PARSELINE_ERROR || ra == PARSELINE_EMPTY) {
+        return true;
+    }
+    if (a->argc != b->argc || a->builtin != b->builtin ||
+        (a->infile == NULL) != (b->infile == NULL) ||
+        (a->outfile == NULL) != (b->outfile == NULL) ||
+        (a->infile != NULL && strcmp(a->infile, b->infile) != 0) ||
+        (a->outfile != NULL && strcmp(a->outfile, b->outfile) != 0)) {
+        return false;
+    }
+    for (int i = 0; i <= a->argc; i++) {
+        if ((a->argv[i] == NULL) != (b->argv[i] == NULL) ||
+            (a->argv[i] != NULL && strcmp(a->argv[i], b->argv[i]) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * random_line - Fill buf with len random characters that exercise every
+ * class the scanners distinguish. Lines with quotes are mostly rejected for
+ * an unmatched quote, so half of the lines have none.
+ */
+static void random_line(char *buf, size_t len, bool quotes) {
+    static const char alphabet[] = "   \t\r\n<>&abcxyz/._-''\"\"";
+    size_t n = sizeof(alphabet) - 1 - (quotes ? 0 : 4);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = alphabet[rand() % n];
+    }
+    buf[len] = '\0';
+}
+
+/*
+ * generated_line - A command line of about len bytes: a command, many
+ * arguments, some quoted, and both redirections
+ */
+static char *generated_line(size_t len) {
+    char *line = malloc(len + 64);
+    size_t n = (size_t)sprintf(line, "/bin/echo");
+    for (int i = 0; n < len; i++) {
+        if (i % 8 == 7) {
+            n += (size_t)sprintf(line + n, " \"quoted arg %d\"", i);
+        } else {
+            n += (size_t)sprintf(line + n, " file%06d.txt", i);
+        }
+    }
+    sprintf(line + n, " < in.txt > out.txt &");
+    return line;
+}
+
+int main(int argc, char **argv) {
+    long fuzz = argc > 1 ? atol(argv[1]) : 20000;
+    struct cmdline_tokens ref = {0};
+    struct cmdline_tokens tok = {0};
+
+    // Check that every scanner matches the scalar path, without the parse
+    // errors that parseline prints
+    FILE *err = stderr;
+    stderr = fopen("/dev/null", "w");
+    char *buf = malloc(4096 + 1);
+    srand(1);
+    for (long iter = 0; iter < fuzz; iter++) {
+        size_t len = (size_t)(rand() % 4096);
+        random_line(buf, len, iter % 2 == 0);
+        scan_mode = SCAN_SCALAR;
+        parseline_return rref = parseline(buf, &ref);
+        for (size_t i = 1; i < NIMPLS; i++) {
+            if (!scan_supported(impls[i])) {
+                continue;
+            }
+            scan_mode = impls[i];
+            parseline_return r = parseline(buf, &tok);
+            if (!same_tokens(rref, &ref, r, &tok)) {
+                printf("MISMATCH (%s) on line: %s\n", scan_impl_name(impls[i]),
+                       buf);
+                return 1;
+            }
+        }
+    }
+    free(buf);
+    fclose(stderr);
+    stderr = err;
+    printf("%ld random lines parsed identically by every scanner\n\n", fuzz);
+
+    printf("%10s %8s %14s %10s\n", "bytes", "scanner", "ns/line", "MB/s");
+    for (size_t len = 64; len <= 4 * 1024 * 1024; len *= 8) {
+        char *line = generated_line(len);
+        size_t actual = strlen(line);
+        for (size_t i = 0; i < NIMPLS; i++) {
+            if (!scan_supported(impls[i])) {
+                continue;
+            }
+            scan_mode = impls[i];
+            long iters = 0;
+            double start = now_ns();
+            double elapsed;
+            do {
+                parseline(line, &tok);
+                iters++;
+                elapsed = now_ns() - start;
+            } while (elapsed < BUDGET);
+            double per_line = elapsed / iters;
+            printf("%10zu %8s %14.0f %10.0f\n", actual,
+                   scan_impl_name(impls[i]), per_line,
+                   actual / per_line * 1e3);
+        }
+        free(line);
+    }
+
+    free_tokens(&ref);
+    free_tokens(&tok);
+    return 0;
+}
@@ -0,0 +1,191 @@
+/**
+ * @file prio_bench.c
+ * @brief Measures foreground job latency while busy background jobs run
+ *
+ * Runs ./tsh -p with the given options on a pipe and times short CPU-bound
+ * foreground jobs (this program with --work, about 5 ms of computation on
+ * an idle machine), each followed by `echo` so that its completion can be
+ * seen: first with no other job, then while N background jobs (this
+ * program with --spin) keep every CPU busy. For each phase, the median and
+ * 99th percentile of the time from sending the command to reading the echo
+ * are printed. Comparing a run without and with --bg-prio shows how much of
+ * the CPU the background jobs take from the foreground.
+ *
+ * The shell is started with -s posix_spawn before the given options, as the
+ * fork wrapper of tsh (wrapper.c) spins for up to 100 ms after each fork.
+ *
+ * Usage: bench/prio_bench [-n bg-jobs] [tsh options...]
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WORK_NS 5e6   // Computation of a foreground job on an idle CPU
+#define PHASE_NS 3e9  // Time spent measuring in each phase
+#define SPIN_EXTRA 1  // Seconds the background jobs outlast the phase
+#define CALIBRATE 1e7 // Iterations timed to calibrate the work
+#define MAX_ROUNDS 100000
+
+static FILE *to_shell;   // Commands for the shell
+static FILE *from_shell; // Its output
+
+/*
+ * now_ns - Monotonic time in nanoseconds
+ */
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * burn - Compute for a number of iterations
+ */
+static void burn(long iterations) {
+    for (volatile long i = 0; i < iterations; i++) {
+    }
+}
+
+/*
+ * spin - Compute for a number of seconds of wall time
+ */
+static void spin(double seconds) {
+    double deadline = now_ns() + seconds * 1e9;
+    while (now_ns() < deadline) {
+        burn(10000);
+    }
+}
+
+/*
+ * read_until - Read the output of the shell up to a line starting with
+ * prefix, and return that line
+ */
+static const char *read_until(const char *prefix) {
+    static char line[4096];
+    while (fgets(line, sizeof(line), from_shell) != NULL) {
+        if (strncmp(line, prefix, strlen(prefix)) == 0) {
+            return line;
+        }
+    }
+    fprintf(stderr, "prio_bench: the shell exited\n");
+    exit(1);
+}
+
+/*
+ * compare_double - qsort comparator for ascending doubles
+ */
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * run_phase - Time foreground jobs of the given work until deadline, and
+ * print the results
+ */
+static void run_phase(const char *name, const char *self, long work,
+                      double deadline) {
+    static double latency[MAX_ROUNDS];
+    int rounds = 0;
+
+    while (rounds < MAX_ROUNDS && (rounds == 0 || now_ns() < deadline)) {
+        double start = now_ns();
+        fprintf(to_shell, "%s --work %ld\necho mark %d\n", self, work, rounds);
+        fflush(to_shell);
+        read_until("mark");
+        latency[rounds++] = now_ns() - start;
+    }
+
+    qsort(latency, (size_t)rounds, sizeof(latency[0]), compare_double);
+    printf("%8s %8d %14.0f %14.0f\n", name, rounds, latency[rounds / 2] / 1e3,
+           latency[rounds * 99 / 100] / 1e3);
+}
+
+int main(int argc, char **argv) {
+    // The jobs run by the shell
+    if (argc == 3 && strcmp(argv[1], "--work") == 0) {
+        burn(atol(argv[2]));
+        return 0;
+    }
+    if (argc == 3 && strcmp(argv[1], "--spin") == 0) {
+        spin(atof(argv[2]));
+        return 0;
+    }
+
+    int bg_jobs = 2 * (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        bg_jobs = atoi(argv[2]);
+        first = 3;
+    }
+
+    // Iterations of the foreground work
+    double start = now_ns();
+    burn((long)CALIBRATE);
+    long work = (long)(CALIBRATE * WORK_NS / (now_ns() - start));
+
+    // ./tsh -p -s posix_spawn [options...]
+    char *tsh_argv[argc + 4];
+    int tsh_argc = 0;
+    tsh_argv[tsh_argc++] = "./tsh";
+    tsh_argv[tsh_argc++] = "-p";
+    tsh_argv[tsh_argc++] = "-s";
+    tsh_argv[tsh_argc++] = "posix_spawn";
+    for (int i = first; i < argc; i++) {
+        tsh_argv[tsh_argc++] = argv[i];
+    }
+    tsh_argv[tsh_argc] = NULL;
+
+    int in[2], out[2];
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t shell = fork();
+    if (shell < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (shell == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execv(tsh_argv[0], tsh_argv);
+        perror("./tsh");
+        _exit(1);
+    }
+    close(in[0]);
+    close(out[1]);
+    to_shell = fdopen(in[1], "w");
+    from_shell = fdopen(out[0], "r");
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%8s %8s %14s %14s\n", "phase", "rounds", "median (us)",
+           "p99 (us)");
+    run_phase("quiet", argv[0], work, now_ns() + PHASE_NS);
+
+    // Background jobs spin for the whole phase, and exit shortly after
+    for (int i = 0; i < bg_jobs; i++) {
+        fprintf(to_shell, "%s --spin %.1f &\n", argv[0],
+                PHASE_NS / 1e9 + SPIN_EXTRA);
+    }
+    fprintf(to_shell, "echo started\n");
+    fflush(to_shell);
+    read_until("started");
+    run_phase("loaded", argv[0], work, now_ns() + PHASE_NS);
+
+    fprintf(to_shell, "wait\nquit\n");
+    fclose(to_shell);
+    waitpid(shell, NULL, 0);
+    fclose(from_shell);
+    return 0;
+}
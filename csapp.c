@@ -18,6 +18,7 @@
 #include <string.h>     /* memset() */
 #include <sys/socket.h> /* struct sockaddr */
 #include <sys/types.h>  /* struct sockaddr */
+#include <sys/uio.h>    /* writev() */
 #include <unistd.h>     /* STDIN_FILENO */
 
 /************************************
@@ -53,54 +54,110 @@ handler_t *Signal(int signum, handler_t *handler) {
 
 /* Private sio functions */
 
-/* sio_reverse - Reverse a string (from K&R) */
-static void sio_reverse(char s[], size_t len) {
-    size_t i, j;
-    for (i = 0, j = len - 1; i < j; i++, j--) {
-        char c = s[i];
-        s[i] = s[j];
-        s[j] = c;
-    }
-}
+/* Pairs of decimal digits, "00" to "99", for sio_utoa */
+static const char sio_digit_pairs[] = "00010203040506070809"
+                                      "10111213141516171819"
+                                      "20212223242526272829"
+                                      "30313233343536373839"
+                                      "40414243444546474849"
+                                      "50515253545556575859"
+                                      "60616263646566676869"
+                                      "70717273747576777879"
+                                      "80818283848586878889"
+                                      "90919293949596979899";
 
-/* write_digits - write digit values of v in base b to string */
-static size_t write_digits(uintmax_t v, char s[], unsigned char b) {
-    size_t i = 0;
-    do {
-        unsigned char c = v % b;
-        if (c < 10) {
-            s[i++] = (char)(c + '0');
+/*
+ * sio_utoa - Convert a uintmax_t to a base b string (8, 10 or 16), writing
+ *    it backwards so that it ends just before end, and return its start.
+ *    Decimal digits are converted two at a time, octal and hexadecimal ones
+ *    with shifts, so no reversal is needed.
+ */
+static char *sio_utoa(uintmax_t v, char *end, unsigned char b) {
+    char *s = end;
+    if (b == 10) {
+        while (v >= 100) {
+            size_t pair = (size_t)(v % 100) * 2;
+            v /= 100;
+            s -= 2;
+            s[0] = sio_digit_pairs[pair];
+            s[1] = sio_digit_pairs[pair + 1];
+        }
+        if (v >= 10) {
+            s -= 2;
+            s[0] = sio_digit_pairs[v * 2];
+            s[1] = sio_digit_pairs[v * 2 + 1];
         } else {
-            s[i++] = (char)(c - 10 + 'a');
+            *--s = (char)('0' + v);
         }
-    } while ((v /= b) > 0);
-    return i;
+    } else {
+        unsigned shift = b == 16 ? 4 : 3;
+        do {
+            *--s = "0123456789abcdef"[v & (b - 1)];
+        } while ((v >>= shift) > 0);
+    }
+    return s;
 }
 
-/* Based on K&R itoa() */
-/* intmax_to_string - Convert an intmax_t to a base b string */
-static size_t intmax_to_string(intmax_t v, char s[], unsigned char b) {
-    bool neg = v < 0;
-    size_t len;
-
-    if (neg) {
-        len = write_digits((uintmax_t)-v, s, b);
-        s[len++] = '-';
-    } else {
-        len = write_digits((uintmax_t)v, s, b);
+/* sio_itoa - Convert an intmax_t to a base b string, as sio_utoa */
+static char *sio_itoa(intmax_t v, char *end, unsigned char b) {
+    if (v >= 0) {
+        return sio_utoa((uintmax_t)v, end, b);
     }
+    char *s = sio_utoa((uintmax_t)0 - (uintmax_t)v, end, b);
+    *--s = '-';
+    return s;
+}
 
-    s[len] = '\0';
-    sio_reverse(s, len);
-    return len;
+/*
+ * sio_writevn - Robustly write every buffer of an iovec array, which it
+ *    updates as it goes
+ */
+static ssize_t sio_writevn(int fd, struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+
+    while (iovcnt > 0) {
+        ssize_t nwritten = writev(fd, iov, iovcnt);
+        if (nwritten < 0) {
+            if (errno != EINTR) {
+                return -1; /* errno set by writev() */
+            }
+
+            /* Interrupted by sig handler return, call writev() again */
+            nwritten = 0;
+        }
+        total += (size_t)nwritten;
+        while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+            nwritten -= (ssize_t)iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + nwritten;
+            iov->iov_len -= (size_t)nwritten;
+        }
+    }
+    return (ssize_t)total;
 }
 
-/* uintmax_to_string - Convert a uintmax_t to a base b string */
-static size_t uintmax_to_string(uintmax_t v, char s[], unsigned char b) {
-    size_t len = write_digits(v, s, b);
-    s[len] = '\0';
-    sio_reverse(s, len);
-    return len;
+/*
+ * sio_put - Append n bytes to a sio_t. If they do not fit, the buffered
+ *    bytes and these are written together, so that a long string is never
+ *    copied.
+ */
+static void sio_put(sio_t *sp, const char *str, size_t n) {
+    if (sp->sio_written < 0) {
+        return;
+    }
+    if (n <= SIO_BUFSIZE - sp->sio_cnt) {
+        memcpy(sp->sio_buf + sp->sio_cnt, str, n);
+        sp->sio_cnt += n;
+        return;
+    }
+
+    struct iovec iov[2] = {{sp->sio_buf, sp->sio_cnt}, {(void *)str, n}};
+    ssize_t ret = sio_writevn(sp->sio_fd, iov, 2);
+    sp->sio_written = ret < 0 ? -1 : sp->sio_written + ret;
+    sp->sio_cnt = 0;
 }
 
 /* Public Sio functions */
@@ -281,36 +338,30 @@ static size_t _handle_format(const char *fmt, va_list argp,
         }
         }
 
-        // Convert int type to string
+        // Convert int type to string, at the end of the buffer
+        char *end = data->buf + sizeof(data->buf);
         switch (convert_type) {
         case 'd':
-            data->str = data->buf;
-            data->len = intmax_to_string(convert_value.s, data->buf, 10);
-            handled = true;
+            data->str = sio_itoa(convert_value.s, end, 10);
             break;
         case 'u':
-            data->str = data->buf;
-            data->len = uintmax_to_string(convert_value.u, data->buf, 10);
-            handled = true;
+            data->str = sio_utoa(convert_value.u, end, 10);
             break;
         case 'x':
-            data->str = data->buf;
-            data->len = uintmax_to_string(convert_value.u, data->buf, 16);
-            handled = true;
+            data->str = sio_utoa(convert_value.u, end, 16);
             break;
         case 'o':
-            data->str = data->buf;
-            data->len = uintmax_to_string(convert_value.u, data->buf, 8);
-            handled = true;
+            data->str = sio_utoa(convert_value.u, end, 8);
             break;
         case 'p':
-            strcpy(data->buf, "0x");
-            data->str = data->buf;
-            data->len =
-                uintmax_to_string(convert_value.u, data->buf + 2, 16) + 2;
-            handled = true;
+            data->str = sio_utoa(convert_value.u, end, 16) - 2;
+            memcpy((char *)data->str, "0x", 2);
             break;
         }
+        if (convert_type != '\0') {
+            data->len = (size_t)(end - data->str);
+            handled = true;
+        }
     }
 
     // Didn't match a format above
@@ -336,38 +387,106 @@ static size_t _handle_format(const char *fmt, va_list argp,
  * This is a reentrant and async-signal-safe implementation of vdprintf, used
  * to implement the associated formatted sio functions.
  *
- * This function writes directly to a file descriptor (using the `rio_writen`
- * function from csapp), as opposed to a `FILE *` from the standard library.
- * However, since these writes are unbuffered, this is not very efficient, and
- * should only be used when async-signal-safety is necessary.
+ * This function writes directly to a file descriptor, as opposed to a
+ * `FILE *` from the standard library. The output is collected in a sio_t on
+ * the stack and written with a single system call, unless it is longer than
+ * SIO_BUFSIZE. To write several formatted strings at once, use a sio_t with
+ * `sio_printfb` and `sio_flushb` instead.
  *
  * The only supported format specifiers are the following:
  *  -  Int types: %d, %i, %u, %x, %o (with size specifiers l, z)
  *  -  Others: %c, %s, %%, %p
  */
 ssize_t sio_vdprintf(int fileno, const char *fmt, va_list argp) {
+    sio_t out;
+    sio_initb(&out, fileno);
+    sio_vprintfb(&out, fmt, argp);
+    return sio_flushb(&out);
+}
+
+/**
+ * @brief   Associates a file descriptor with an empty output buffer.
+ * @param sp   The buffer.
+ * @param fd   The file descriptor it is written to.
+ *
+ * @remark   This function is async-signal-safe.
+ */
+void sio_initb(sio_t *sp, int fd) {
+    sp->sio_fd = fd;
+    sp->sio_cnt = 0;
+    sp->sio_written = 0;
+}
+
+/**
+ * @brief   Appends formatted output to a buffer.
+ * @param sp    The buffer, as set up by `sio_initb`.
+ * @param fmt   The format string used to determine the output.
+ * @param ...   The arguments for the format string.
+ * @return      The number of bytes formatted, or -1 if a write of the
+ *              buffer has failed.
+ *
+ * @remark   This function is async-signal-safe.
+ * @see      sio_vprintfb
+ */
+ssize_t sio_printfb(sio_t *sp, const char *fmt, ...) {
+    va_list argp;
+    va_start(argp, fmt);
+    ssize_t ret = sio_vprintfb(sp, fmt, argp);
+    va_end(argp);
+    return ret;
+}
+
+/**
+ * @brief   Appends formatted output to a buffer from a va_list.
+ * @param sp     The buffer, as set up by `sio_initb`.
+ * @param fmt    The format string used to determine the output.
+ * @param argp   The arguments for the format string.
+ * @return       The number of bytes formatted, or -1 if a write of the
+ *               buffer has failed.
+ *
+ * @remark   This function is async-signal-safe.
+ *
+ * Nothing is written until `sio_flushb` is called, or a string does not fit
+ * in what is left of the buffer, in which case the buffered bytes and that
+ * string are written with a single writev. The
+ * format specifiers are those of `sio_vdprintf`.
+ */
+ssize_t sio_vprintfb(sio_t *sp, const char *fmt, va_list argp) {
     size_t pos = 0;
-    ssize_t num_written = 0;
+    size_t num_formatted = 0;
 
     while (fmt[pos] != '\0') {
         // Int to string conversion
         struct _format_data data;
-        memset(&data, 0, sizeof(data));
 
         // Handle format characters
         pos += _handle_format(&fmt[pos], argp, &data);
 
-        // Write output
-        if (data.len > 0) {
-            ssize_t ret = rio_writen(fileno, (const void *)data.str, data.len);
-            if (ret < 0 || (size_t)ret != data.len) {
-                return -1;
-            }
-            num_written += data.len;
-        }
+        // Buffer output
+        sio_put(sp, data.str, data.len);
+        num_formatted += data.len;
     }
 
-    return num_written;
+    return sp->sio_written < 0 ? -1 : (ssize_t)num_formatted;
+}
+
+/**
+ * @brief   Writes out a buffer, and empties it.
+ * @param sp   The buffer, as set up by `sio_initb`.
+ * @return     The number of bytes written since `sio_initb` or the last
+ *             call, or -1 if any write failed.
+ *
+ * @remark   This function is async-signal-safe.
+ */
+ssize_t sio_flushb(sio_t *sp) {
+    ssize_t written = sp->sio_written;
+    if (written >= 0 && sp->sio_cnt > 0) {
+        ssize_t ret = rio_writen(sp->sio_fd, sp->sio_buf, sp->sio_cnt);
+        written = ret < 0 ? -1 : written + ret;
+    }
+    sp->sio_cnt = 0;
+    sp->sio_written = 0;
+    return written;
 }
 
 /* Async-signal-safe assertion support*/
@@ -10,7 +10,8 @@
  *
  * - The SIO (safe I/O) package, which implements an async-signal-safe variant
  *   of printf and related calls. (The Sio_puts and Sio_putl functions in the
- *   textbook have been removed.)
+ *   textbook have been removed.) It also provides the sio_t, which collects
+ *   formatted output so that it can be written in one system call.
  *
  * - Error-checking wrapper functions (similar to those used by Stevens),
  *   which are used heavily in the textbook. However, most have been removed
@@ -46,6 +47,15 @@
 #define DEF_MODE S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH
 #define DEF_UMASK S_IWGRP | S_IWOTH
 
+/* Persistent state for buffered signal-safe output (Sio) */
+#define SIO_BUFSIZE 8192
+typedef struct {
+    int sio_fd;                /* Descriptor the buffer is written to */
+    size_t sio_cnt;            /* Unwritten bytes in internal buf */
+    ssize_t sio_written;       /* Bytes written so far, or -1 on error */
+    char sio_buf[SIO_BUFSIZE]; /* Internal buffer */
+} sio_t;
+
 /* Persistent state for the robust I/O (Rio) package */
 #define RIO_BUFSIZE 8192
 typedef struct {
@@ -76,6 +86,12 @@ ssize_t sio_dprintf(int fileno, const char *fmt, ...)
 ssize_t sio_eprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 ssize_t sio_vdprintf(int fileno, const char *fmt, va_list argp)
     __attribute__((format(printf, 2, 0)));
+void sio_initb(sio_t *sp, int fd);
+ssize_t sio_printfb(sio_t *sp, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+ssize_t sio_vprintfb(sio_t *sp, const char *fmt, va_list argp)
+    __attribute__((format(printf, 2, 0)));
+ssize_t sio_flushb(sio_t *sp);
 
 #define sio_assert(expr)                                                       \
     ((expr) ? (void)0 : __sio_assert_fail(#expr, __FILE__, __LINE__, __func__))
@@ -11,25 +11,92 @@
  * signals to be blocked.
  * - built-in commands:
  *  - The quit command terminates the shell.
- *  - The jobs command lists all background jobs.
+ *  - The jobs command lists all background jobs; -r and -s restrict it to
+ *  running or stopped jobs, -l adds every process of each job and -v the
+ *  resources each job has used.
+ *  - time cmd runs cmd in the foreground and reports its wall time, CPU
+ *  time, max RSS, page faults and context switches.
+ *  - perfstat cmd does the same and also reports the performance counters
+ *  of cmd (tsh_perf.c); --perf opens them on every job, for jobs -v.
+ *  - history -j lists recently completed jobs with their exit status and
+ *  timings, from a ring that --history-file maps from a file
+ *  (tsh_history.c); -f, -s N and -p prefix filter it.
+ *  - wait waits for the background jobs to terminate, wait job... for some
+ *  of them, and wait -n for the next one; only the exits of the jobs waited
+ *  for wake the shell up (tsh_loop.c).
+ *  - stats shows how often the shell woke up while waiting for jobs and
+ *  how full the queue of reaped children got, and stats -r also resets the
+ *  counts.
  *  - The bg job command resumes job by sending it a SIGCONT signal, and then runs it in the background. The job argument can be either a PID or a JID.
  *  - The fg job command resumes job by sending it a SIGCONT signal, and then runs it in the foreground. The job argument can be either a PID or a JID.
  *
  * - sigchld handler is the main handler. It deals with actions after receiving other 
  * signals (SIGINT, SIGTSTP, SIGCONT)
  * - I/O redirection gives only write permission to the owner for output redirection
+ * - jobs are started by spawn_job (tsh_spawn.c); the -s option selects the
+ * fork, vfork, posix_spawn, clone3 or zygote (pre-forked helpers) engine
+ * - command names without a / are looked up in $PATH through a hash table
+ * (tsh_path.c), and missing programs or redirection files are reported
+ * before any process is created. The hash builtin lists the table; hash -r
+ * empties it and hash name... adds to it.
+ * - reading commands and waiting for the foreground job are done by the event
+ * loop (tsh_loop.c); with --pidfd, jobs are tracked through pidfds in an
+ * epoll set instead of the SIGCHLD handler, and with --signalfd, signals are
+ * read from a signalfd by the loop instead of interrupting it
+ * - with -P, a pipeline (cmd | cmd ...) is one job in one process group;
+ * cat and tee stages are run by the shell with splice/tee, and --pipe-size
+ * sets the capacity of the pipes. Without -P, | is an ordinary argument as
+ * in the reference shell, which the traces rely on
+ * - echo, true, false, cat and printf (also as /bin/... or /usr/bin/...) are
+ * run in the shell without fork or exec (tsh_builtin.c), producing the same
+ * output as coreutils; --external runs them as programs again
+ * - parallel [-j N] [-k] cmd ::: args runs cmd over args, N at a time, as a
+ * single job (tsh_parallel.c)
+ * - --bg-max N runs at most N background jobs at once; later ones are
+ * QUEUED and started in order as running ones finish. --psi-cpu and
+ * --psi-memory also hold launches back while a PSI trigger reports pressure
+ * (tsh_admit.c)
+ * - after %J... cmd starts cmd in the background once the listed jobs have
+ * exited successfully (tsh_after.c); dag file runs a make-like graph of
+ * dependent commands as one job and reports its critical path (tsh_dag.c)
+ * - --subreaper makes the shell adopt the orphaned processes of its jobs,
+ * which it reaps and attributes to their job; a job is done once its whole
+ * process group has exited (tsh_reaper.c)
+ * - --cgroup dir starts every job in a cgroup v2 of its own below dir: it is
+ * signalled through the cgroup, frozen whole once stopped and thawed by bg
+ * and fg, killed whole with cgroup.kill when terminated by a signal, and
+ * jobs -v shows its cpu, memory and io accounting (tsh_cgroup.c)
+ * - --bg-prio runs background jobs with a lower CPU, I/O and OOM priority
+ * (SCHED_IDLE or SCHED_BATCH, a nice offset, the idle I/O class and a
+ * higher oom_score_adj), and fg restores that of the shell; prio shows the
+ * policy of each job, prio job policy changes it and prio -d policy the
+ * default (tsh_prio.c)
  * 
  * @author Yuqiao Hu <yuqiaohu@andrew.cmu.edu>
  */
 
 #include "csapp.h"
+#include "tsh_admit.h"
+#include "tsh_after.h"
+#include "tsh_arena.h"
+#include "tsh_builtin.h"
+#include "tsh_cgroup.h"
+#include "tsh_events.h"
 #include "tsh_helper.h"
+#include "tsh_history.h"
+#include "tsh_loop.h"
+#include "tsh_path.h"
+#include "tsh_perf.h"
+#include "tsh_prio.h"
+#include "tsh_reaper.h"
+#include "tsh_spawn.h"
 
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -52,11 +119,24 @@
 #define dbg_requires(...)
 #define dbg_assert(...)
 #define dbg_ensures(...)
-#define MODE S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH
 #endif
 
 /* Function prototypes */
 void eval(const char *cmdline);
+static bool jobs_states(const struct cmdline_tokens *token, unsigned *states,
+                        unsigned *details);
+static bool time_prefix(struct cmdline_tokens *token, parseline_return result,
+                        struct timespec *begin);
+static void time_report(pid_t pid, const struct timespec *begin);
+static void hash_builtin(const struct cmdline_tokens *token);
+static void history_builtin(const struct cmdline_tokens *token);
+static void util_builtin(const struct cmdline_tokens *token);
+static void after_builtin(const struct cmdline_tokens *token);
+static void wait_builtin(const struct cmdline_tokens *token);
+static void stats_builtin(const struct cmdline_tokens *token);
+static void prio_builtin(const struct cmdline_tokens *token);
+static bool start_queued(jid_t jid, const sigset_t *prev);
+static int option_count(const char *opt, const char *arg);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
@@ -64,14 +144,56 @@ void sigint_handler(int sig);
 void sigquit_handler(int sig);
 void cleanup(void);
 
+/* Options without a short form */
+enum {
+    OPT_PIDFD = 256,
+    OPT_SIGNALFD,
+    OPT_PIPE_SIZE,
+    OPT_EXTERNAL,
+    OPT_BG_MAX,
+    OPT_PSI_CPU,
+    OPT_PSI_MEMORY,
+    OPT_PERF,
+    OPT_HISTORY_FILE,
+    OPT_SUBREAPER,
+    OPT_CGROUP,
+    OPT_BG_PRIO,
+};
+
+/* Long forms of the command-line options */
+static const struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"verbose", no_argument, NULL, 'v'},
+    {"no-prompt", no_argument, NULL, 'p'},
+    {"pipelines", no_argument, NULL, 'P'},
+    {"spawn", required_argument, NULL, 's'},
+    {"pidfd", no_argument, NULL, OPT_PIDFD},
+    {"signalfd", no_argument, NULL, OPT_SIGNALFD},
+    {"pipe-size", required_argument, NULL, OPT_PIPE_SIZE},
+    {"external", no_argument, NULL, OPT_EXTERNAL},
+    {"bg-max", required_argument, NULL, OPT_BG_MAX},
+    {"psi-cpu", required_argument, NULL, OPT_PSI_CPU},
+    {"psi-memory", required_argument, NULL, OPT_PSI_MEMORY},
+    {"perf", no_argument, NULL, OPT_PERF},
+    {"history-file", required_argument, NULL, OPT_HISTORY_FILE},
+    {"subreaper", no_argument, NULL, OPT_SUBREAPER},
+    {"cgroup", required_argument, NULL, OPT_CGROUP},
+    {"bg-prio", no_argument, NULL, OPT_BG_PRIO},
+    {NULL, 0, NULL, 0},
+};
+
 /**
  * @brief the main routine for a shell program
  *
  */
 int main(int argc, char **argv) {
-    char c;
-    char cmdline[MAXLINE_TSH]; // Cmdline for fgets
-    bool emit_prompt = true;   // Emit prompt (default)
+    int c;
+    char *cmdline;              // Cmdline from loop_readline
+    bool emit_prompt = true;    // Emit prompt (default)
+    const char *history = NULL; // File to map the job history from
+    bool subreaper = false;     // Become a child subreaper
+    const char *cgroup = NULL;  // Directory to create job cgroups in
+    bool bg_prio = false;       // Lower the priority of background jobs
 
     // Redirect stderr to stdout (so that driver will get all output
     // on the pipe connected to stdout)
@@ -81,7 +203,7 @@ int main(int argc, char **argv) {
     }
 
     // Parse the command line
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt_long(argc, argv, "hvpPs:", long_options, NULL)) != EOF) {
         switch (c) {
         case 'h': // Prints help message
             usage();
@@ -92,6 +214,55 @@ int main(int argc, char **argv) {
         case 'p': // Disables prompt printing
             emit_prompt = false;
             break;
+        case 'P': // Treats | as a pipeline separator
+            pipelines = true;
+            break;
+        case 's': // Selects the process launch engine
+            if (!spawn_engine_parse(optarg, &spawn_mode)) {
+                fprintf(stderr, "Unknown spawn engine: %s\n", optarg);
+                usage();
+            }
+            break;
+        case OPT_PIDFD: // Tracks jobs with pidfds in an epoll set
+            loop_mode = LOOP_PIDFD;
+            break;
+        case OPT_SIGNALFD: // Reads signals from a signalfd in the loop
+            loop_signalfd = true;
+            break;
+        case OPT_PIPE_SIZE: // Sets the capacity of pipeline pipes
+            spawn_pipe_size = atoi(optarg);
+            if (spawn_pipe_size <= 0) {
+                fprintf(stderr, "Invalid pipe size: %s\n", optarg);
+                usage();
+            }
+            break;
+        case OPT_EXTERNAL: // Runs utilities as external programs
+            builtin_external = true;
+            break;
+        case OPT_BG_MAX: // Limits the number of running background jobs
+            admit_bg_max = option_count("--bg-max", optarg);
+            break;
+        case OPT_PSI_CPU: // Holds launches back under CPU pressure
+            admit_psi_cpu = option_count("--psi-cpu", optarg);
+            break;
+        case OPT_PSI_MEMORY: // Holds launches back under memory pressure
+            admit_psi_memory = option_count("--psi-memory", optarg);
+            break;
+        case OPT_PERF: // Opens performance counters on every job
+            perf_enabled = true;
+            break;
+        case OPT_HISTORY_FILE: // Keeps the job history in a file
+            history = optarg;
+            break;
+        case OPT_SUBREAPER: // Adopts and reaps the orphans of jobs
+            subreaper = true;
+            break;
+        case OPT_CGROUP: // Starts every job in a cgroup of its own
+            cgroup = optarg;
+            break;
+        case OPT_BG_PRIO: // Lowers the priority of background jobs
+            bg_prio = true;
+            break;
         default:
             usage();
         }
@@ -110,8 +281,9 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    // Initialize the job list
+    // Initialize the job list, and the ring of jobs that have completed
     init_job_list();
+    history_init(history);
 
     // Register a function to clean up the job list on program termination.
     // The function may not run in the case of abnormal termination (e.g. when
@@ -132,6 +304,27 @@ int main(int argc, char **argv) {
 
     Signal(SIGQUIT, sigquit_handler);
 
+    // Adopt the orphaned processes of jobs, before any job is started
+    if (subreaper) {
+        reaper_init();
+    }
+    if (cgroup != NULL) {
+        cgroup_init(cgroup);
+    }
+    if (bg_prio) {
+        prio_init();
+    }
+
+    // Set up the event loop; it blocks the signals it reads from a signalfd
+    loop_init();
+    admit_init(start_queued);
+
+    // Prepare the launch engine; zygote helpers must not inherit handlers
+    sigset_t prev_all;
+    loop_block_signals(&prev_all);
+    spawn_init();
+    loop_restore_signals(&prev_all);
+
     // Execute the shell's read/eval loop
     while (true) {
         if (emit_prompt) {
@@ -141,23 +334,13 @@ int main(int argc, char **argv) {
             fflush(stdout);
         }
 
-        if ((fgets(cmdline, MAXLINE_TSH, stdin) == NULL) && ferror(stdin)) {
-            perror("fgets error");
-            exit(1);
-        }
-
-        if (feof(stdin)) {
+        // Read a line without its trailing newline
+        if ((cmdline = loop_readline()) == NULL) {
             // End of file (Ctrl-D)
             printf("\n");
             return 0;
         }
 
-        // Remove any trailing newline
-        char *newline = strchr(cmdline, '\n');
-        if (newline != NULL) {
-            *newline = '\0';
-        }
-
         // Evaluate the command line
         eval(cmdline);
     }
@@ -184,11 +367,15 @@ int main(int argc, char **argv) {
  */
 void eval(const char *cmdline) {
     parseline_return parse_result;
-    struct cmdline_tokens token;
+    static struct cmdline_tokens token; // buffers are reused between lines
     pid_t pid;
-    sigset_t mask_all, prev_all;
+    int nprocs;
+    sigset_t prev_all;
     jid_t jid;
     char *num;
+    struct timespec begin;
+    bool timed;
+    bool counted;
 
     // Parse command line
     parse_result = parseline(cmdline, &token);
@@ -197,116 +384,143 @@ void eval(const char *cmdline) {
         return;
     }
 
-    sigfillset(&mask_all);
-    // not a built-in command
-    if (token.builtin == BUILTIN_NONE) {
-        sigprocmask(SIG_BLOCK, &mask_all, &prev_all); // block four signals
-        if ((pid = fork()) == 0) {                    // child runs user job
-            // input redirection
-            if (token.infile != NULL) {
-                int fd = open(token.infile, O_RDONLY, 0);
-                if (fd != -1) {
-                    dup2(fd, STDIN_FILENO);
-                    close(fd);
-                } else {
-                    if (errno == 2) {
-                        sio_printf("%s: No such file or directory\n",
-                                   token.infile);
-                    } else if (errno == 13) {
-                        sio_printf("%s: Permission denied\n", token.infile);
-                    }
-                    _exit(0);
-                }
+    // time cmd: run cmd as a job, so that reaping it yields its usage;
+    // perfstat cmd also opens performance counters on it
+    counted = perf_enabled || token.builtin == BUILTIN_PERFSTAT;
+    timed = token.builtin == BUILTIN_TIME || token.builtin == BUILTIN_PERFSTAT;
+    if (timed && !time_prefix(&token, parse_result, &begin)) {
+        return;
+    }
+
+    // builtins run in the shell and cannot be part of a pipeline
+    if (token.builtin != BUILTIN_NONE && token.nstages > 1) {
+        printf("%s: builtin cannot be used in a pipeline\n", token.argv[0]);
+        return;
+    }
+
+    // utilities run in the shell unless they are a job of their own: in the
+    // background, or reading the terminal, a pipe or a device, where Ctrl-C
+    // must reach them
+    if (token.builtin == BUILTIN_UTIL && parse_result == PARSELINE_FG &&
+        !timed && builtin_util_inline(&token)) {
+        util_builtin(&token);
+        return;
+    }
+
+    // not a built-in command (or a utility run as a job)
+    if (token.builtin == BUILTIN_NONE || token.builtin == BUILTIN_UTIL) {
+        struct spawn_proc procs[token.nstages];
+
+        loop_block_signals(&prev_all); // block four signals
+
+        // background job over the limits: keep it until there is room
+        if (parse_result == PARSELINE_BG && admit_hold()) {
+            jid = add_job(0, QUEUED, cmdline);
+            if (jid != 0 && !admit_enqueue(jid)) {
+                delete_job(jid);
+                jid = 0;
             }
-            // output redirection
-            if (token.outfile != NULL) {
-                int fd =
-                    open(token.outfile, O_CREAT | O_TRUNC | O_WRONLY, MODE);
-                if (fd != -1) {
-                    dup2(fd, STDOUT_FILENO);
-                    close(fd);
-                } else {
-                    if (errno == 2) {
-                        sio_printf("%s: No such file or directory\n",
-                                   token.outfile);
-                    } else if (errno == 13) {
-                        sio_printf("%s: Permission denied\n", token.outfile);
-                    }
-                    _exit(0);
-                }
+            if (jid != 0) {
+                sio_printf("[%d] (-) %s\n", jid, cmdline);
             }
-            sigprocmask(SIG_SETMASK, &prev_all, NULL); // unblock all signals
-            setpgid(0, 0);
-            if (execve(token.argv[0], token.argv, environ) < 0) {
-                if (errno == 2) {
-                    sio_printf("%s: No such file or directory\n",
-                               token.argv[0]);
-                } else if (errno == 13) {
-                    sio_printf("%s: Permission denied\n", token.argv[0]);
-                }
-                _exit(0);
+            loop_restore_signals(&prev_all);
+            return;
+        }
+
+        int cgroup_fd = cgroup_create();
+        nprocs = spawn_job(&token, loop_child_mask(&prev_all), procs,
+                           loop_mode == LOOP_PIDFD, counted, cgroup_fd);
+        if (nprocs == 0) {
+            cgroup_discard(cgroup_fd);
+            loop_restore_signals(&prev_all);
+            return;
+        }
+
+        // the whole pipeline is one job, identified by its first process
+        pid = procs[0].pid;
+        jid = add_job(pid, parse_result == PARSELINE_FG ? FG : BG, cmdline);
+        if (jid != 0) {
+            cgroup_assign(cgroup_fd, jid);
+        } else {
+            cgroup_discard(cgroup_fd);
+        }
+        for (int i = 0; i < nprocs; i++) {
+            if (i > 0 && jid != 0) {
+                job_add_process(jid, procs[i].pid);
             }
+            loop_watch_job(procs[i].pid, procs[i].pidfd);
         }
 
         // foreground job
         if (parse_result == PARSELINE_FG) {
-            add_job(pid, FG, cmdline);
-            while ((fg_job() != 0) && (pid == job_get_pid(fg_job()))) {
-                // wait for child process to terminate
-                sigsuspend(&prev_all);
+            loop_wait_fg(pid, &prev_all);
+            if (timed) {
+                time_report(pid, &begin);
             }
-            sigprocmask(SIG_SETMASK, &prev_all, NULL);
+            loop_restore_signals(&prev_all);
         }
         // background job
         if (parse_result == PARSELINE_BG) {
-            sigprocmask(SIG_BLOCK, &mask_all, NULL);
-            add_job(pid, BG, cmdline);
-            jid = job_from_pid(pid);
-            sigprocmask(SIG_SETMASK, &prev_all, NULL);
+            // announce the job before a fast child can be reaped
             sio_printf("[%d] (%d) %s\n", jid, pid, cmdline);
+            loop_restore_signals(&prev_all);
         }
         return;
     }
 
     // if built-in command
     if (token.builtin == BUILTIN_QUIT) { // quit command
+        cgroup_destroy(); // _exit skips cleanup, which would remove them
         _exit(0);
     }
     if (token.builtin == BUILTIN_JOBS) { // lists all background jobs
-        sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
-        if (token.outfile != NULL) {
-            int fd = open(token.outfile, O_CREAT | O_TRUNC | O_WRONLY, MODE);
-            if (fd != -1) {
-                if (!list_jobs(fd)) {
-                    sio_printf("Fails to write into job list.\n");
-                }
-                close(fd);
-            } else {
-                if (errno == 2) {
-                    sio_printf("%s: No such file or directory\n",
-                               token.outfile);
-                } else if (errno == 13) {
-                    sio_printf("%s: Permission denied\n", token.outfile);
-                }
-            }
-        } else {
-            if (!list_jobs(STDOUT_FILENO)) {
+        unsigned states;
+        unsigned details;
+        if (!jobs_states(&token, &states, &details)) {
+            return;
+        }
+        loop_block_signals(&prev_all);
+        int fd = token.outfile != NULL ? redirect_open(token.outfile, true)
+                                       : STDOUT_FILENO;
+        if (fd != -1) {
+            if (!list_jobs_details(fd, states, details)) {
                 sio_printf("Fails to write into job list.\n");
             }
+            if (fd != STDOUT_FILENO) {
+                close(fd);
+            }
         }
-        sigprocmask(SIG_SETMASK, &prev_all, NULL);
+        loop_restore_signals(&prev_all);
+    }
+    if (token.builtin == BUILTIN_HASH) { // command hash table
+        hash_builtin(&token);
+    }
+    if (token.builtin == BUILTIN_HISTORY) { // completed jobs
+        history_builtin(&token);
+    }
+    if (token.builtin == BUILTIN_AFTER) { // job started by other jobs
+        after_builtin(&token);
+    }
+    if (token.builtin == BUILTIN_WAIT) { // wait for background jobs
+        wait_builtin(&token);
+    }
+    if (token.builtin == BUILTIN_STATS) { // wakeups of the shell
+        stats_builtin(&token);
+    }
+    if (token.builtin == BUILTIN_PRIO) { // policies of background jobs
+        prio_builtin(&token);
     }
     if (token.builtin == BUILTIN_BG) { // bg command
-        sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+        loop_block_signals(&prev_all);
         if (token.argc == 1) {
             sio_printf("bg command requires PID or %%jobid argument\n");
-            sigprocmask(SIG_SETMASK, &prev_all, NULL);
+            loop_restore_signals(&prev_all);
             return;
         }
         char *arg = token.argv[1];
         if (arg[0] != '%' && (!isdigit(arg[0]))) {
             sio_printf("bg: argument must be a PID or %%jobid\n");
-            sigprocmask(SIG_SETMASK, &prev_all, NULL);
+            loop_restore_signals(&prev_all);
             return;
         }
         if (arg[0] == '%') {
@@ -314,9 +528,16 @@ void eval(const char *cmdline) {
             jid = strtol(num, NULL, 10);
             if (!job_exists(jid)) {
                 sio_printf("%s: No such job\n", arg);
-                sigprocmask(SIG_SETMASK, &prev_all, NULL);
+                loop_restore_signals(&prev_all);
                 return;
             }
+            if (job_get_state(jid) == QUEUED) {
+                after_drop(jid); // started now, whatever it waits for
+                if (!admit_start_now(jid, &prev_all)) {
+                    loop_restore_signals(&prev_all);
+                    return;
+                }
+            }
             pid = job_get_pid(jid);
         } else {
             num = arg;
@@ -324,26 +545,28 @@ void eval(const char *cmdline) {
             jid = job_from_pid(pid);
             if (!job_exists(jid)) {
                 sio_printf("%s: No such job\n", arg);
-                sigprocmask(SIG_SETMASK, &prev_all, NULL);
+                loop_restore_signals(&prev_all);
                 return;
             }
         }
         sio_printf("[%d] (%d) %s\n", jid, pid, job_get_cmdline(jid));
-        kill(-pid, SIGCONT);
+        if (!cgroup_resume(jid)) {
+            kill(-pid, SIGCONT);
+        }
         job_set_state(jid, BG);
-        sigprocmask(SIG_SETMASK, &prev_all, NULL);
+        loop_restore_signals(&prev_all);
     }
     if (token.builtin == BUILTIN_FG) { // fg command
-        sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
+        loop_block_signals(&prev_all);
         if (token.argc == 1) {
             sio_printf("fg command requires PID or %%jobid argument\n");
-            sigprocmask(SIG_SETMASK, &prev_all, NULL);
+            loop_restore_signals(&prev_all);
             return;
         }
         char *arg = token.argv[1];
         if (arg[0] != '%' && (!isdigit(arg[0]))) {
             sio_printf("fg: argument must be a PID or %%jobid\n");
-            sigprocmask(SIG_SETMASK, &prev_all, NULL);
+            loop_restore_signals(&prev_all);
             return;
         }
         if (arg[0] == '%') {
@@ -351,9 +574,16 @@ void eval(const char *cmdline) {
             jid = strtol(num, NULL, 10);
             if (!job_exists(jid)) {
                 sio_printf("%s: No such job\n", arg);
-                sigprocmask(SIG_SETMASK, &prev_all, NULL);
+                loop_restore_signals(&prev_all);
                 return;
             }
+            if (job_get_state(jid) == QUEUED) {
+                after_drop(jid); // started now, whatever it waits for
+                if (!admit_start_now(jid, &prev_all)) {
+                    loop_restore_signals(&prev_all);
+                    return;
+                }
+            }
             pid = job_get_pid(jid);
         } else {
             num = arg;
@@ -361,17 +591,589 @@ void eval(const char *cmdline) {
             jid = job_from_pid(pid);
             if (!job_exists(jid)) {
                 sio_printf("%s: No such job\n", arg);
-                sigprocmask(SIG_SETMASK, &prev_all, NULL);
+                loop_restore_signals(&prev_all);
                 return;
             }
         }
-        kill(-pid, SIGCONT);
+        if (!cgroup_resume(jid)) {
+            kill(-pid, SIGCONT);
+        }
         job_set_state(jid, FG);
-        while ((fg_job() != 0) && (pid == job_get_pid(fg_job()))) {
-            sigsuspend(&prev_all);
+        loop_wait_fg(pid, &prev_all);
+        loop_restore_signals(&prev_all);
+    }
+}
+
+/**
+ * @brief Start a QUEUED background job from its command line, for
+ * tsh_admit.c. The job is deleted if it cannot be started.
+ *
+ * @pre All signals are blocked.
+ */
+static bool start_queued(jid_t jid, const sigset_t *prev) {
+    static struct cmdline_tokens token; // eval's tokens may be in use
+
+    if (parseline(job_get_cmdline(jid), &token) != PARSELINE_BG) {
+        delete_job(jid);
+        after_job_exit(jid, true, true);
+        return false;
+    }
+
+    struct spawn_proc procs[token.nstages];
+    int cgroup_fd = cgroup_create();
+    int nprocs = spawn_job(&token, loop_child_mask(prev), procs,
+                           loop_mode == LOOP_PIDFD, perf_enabled, cgroup_fd);
+    if (nprocs == 0) {
+        cgroup_discard(cgroup_fd);
+        delete_job(jid);
+        after_job_exit(jid, true, true);
+        return false;
+    }
+    if (!job_set_pid(jid, procs[0].pid)) {
+        kill(-procs[0].pid, SIGKILL); // cannot be tracked
+        cgroup_discard(cgroup_fd);
+        delete_job(jid);
+        after_job_exit(jid, true, true);
+        return false;
+    }
+    cgroup_assign(cgroup_fd, jid);
+    job_set_state(jid, BG);
+    for (int i = 0; i < nprocs; i++) {
+        if (i > 0) {
+            job_add_process(jid, procs[i].pid);
+        }
+        loop_watch_job(procs[i].pid, procs[i].pidfd);
+    }
+    return true;
+}
+
+/**
+ * @brief Append a word to a command line, quoted if parseline would not
+ * read it back as one word otherwise.
+ */
+static char *append_word(char *out, const char *word) {
+    bool plain = *word != '\0' && strchr("<>|'\"", *word) == NULL;
+    for (const char *p = word; plain && *p != '\0'; p++) {
+        plain = !isspace((unsigned char)*p);
+    }
+    char quote = strchr(word, '"') == NULL ? '"' : '\'';
+    *out++ = ' ';
+    if (!plain) {
+        *out++ = quote;
+    }
+    out = stpcpy(out, word);
+    if (!plain) {
+        *out++ = quote;
+    }
+    return out;
+}
+
+/**
+ * @brief Add a job that starts once other jobs have completed.
+ *
+ * after [-a|-f] job... [--] command: the jobs are %jid or PID arguments,
+ * and the command, with the redirections of the line, becomes a QUEUED
+ * background job (see tsh_after.h).
+ */
+static void after_builtin(const struct cmdline_tokens *token) {
+    after_cond cond = AFTER_OK;
+    jid_t deps[token->argc];
+    int ndeps = 0;
+    sigset_t prev_all;
+    int i = 1;
+
+    for (; i < token->argc && token->argv[i][0] == '-' &&
+           strcmp(token->argv[i], "--") != 0;
+         i++) {
+        if (strcmp(token->argv[i], "-a") == 0) {
+            cond = AFTER_ANY;
+        } else if (strcmp(token->argv[i], "-f") == 0) {
+            cond = AFTER_FAIL;
+        } else {
+            sio_printf("after: usage: after [-a|-f] job... [--] command\n");
+            return;
+        }
+    }
+
+    loop_block_signals(&prev_all);
+    for (; i < token->argc; i++) {
+        const char *arg = token->argv[i];
+        char *end;
+        jid_t jid;
+        if (strcmp(arg, "--") == 0) {
+            i++;
+            break;
+        }
+        if (arg[0] == '%') {
+            jid = strtol(arg + 1, &end, 10);
+        } else if (isdigit(arg[0])) {
+            jid = job_from_pid(strtol(arg, &end, 10));
+        } else {
+            break; // the command
+        }
+        if (*end != '\0' || !job_exists(jid)) {
+            sio_printf("%s: No such job\n", arg);
+            loop_restore_signals(&prev_all);
+            return;
+        }
+        deps[ndeps++] = jid;
+    }
+    if (ndeps == 0 || i == token->argc) {
+        sio_printf("after: usage: after [-a|-f] job... [--] command\n");
+        loop_restore_signals(&prev_all);
+        return;
+    }
+
+    // the command line of the new job, as if typed with a trailing &
+    size_t len = sizeof(" < \"\" > \"\" &");
+    for (int w = i; w < token->argc; w++) {
+        len += strlen(token->argv[w]) + 3;
+    }
+    len += token->infile != NULL ? strlen(token->infile) : 0;
+    len += token->outfile != NULL ? strlen(token->outfile) : 0;
+    char *cmdline = malloc(len);
+    if (cmdline == NULL) {
+        sio_printf("after: Out of memory\n");
+        loop_restore_signals(&prev_all);
+        return;
+    }
+    char *out = cmdline;
+    for (int w = i; w < token->argc; w++) {
+        out = append_word(out, token->argv[w]);
+    }
+    if (token->infile != NULL) {
+        out = append_word(stpcpy(out, " <"), token->infile);
+    }
+    if (token->outfile != NULL) {
+        out = append_word(stpcpy(out, " >"), token->outfile);
+    }
+    strcpy(out, " &");
+
+    jid_t jid = add_job(0, QUEUED, cmdline + 1);
+    if (jid != 0 && !after_add(jid, deps, ndeps, cond)) {
+        delete_job(jid);
+        jid = 0;
+    }
+    if (jid != 0) {
+        sio_printf("[%d] (-) %s\n", jid, cmdline + 1);
+    } else {
+        sio_printf("after: Out of memory\n");
+    }
+    free(cmdline);
+    loop_restore_signals(&prev_all);
+}
+
+/**
+ * @brief Look up the job named by a %jid or PID argument.
+ *
+ * @return its JID, or 0 after printing a message if there is no such job
+ * @pre All signals are blocked.
+ */
+static jid_t job_arg(const char *arg) {
+    char *end = NULL;
+    jid_t jid = 0;
+    if (arg[0] == '%') {
+        jid = strtol(arg + 1, &end, 10);
+    } else if (isdigit(arg[0])) {
+        jid = job_from_pid(strtol(arg, &end, 10));
+    }
+    if (end == NULL || *end != '\0' || !job_exists(jid)) {
+        sio_printf("%s: No such job\n", arg);
+        return 0;
+    }
+    return jid;
+}
+
+/**
+ * @brief Whether no background job is left to wait for, running or queued.
+ */
+static bool no_bg_jobs(const void *arg) {
+    return job_count(BG) == 0 && job_count(QUEUED) == 0;
+}
+
+/**
+ * @brief Whether a job has completed since the history held *arg jobs, or
+ * none is left to complete.
+ */
+static bool job_completed(const void *arg) {
+    return history_count() != *(const uint64_t *)arg || no_bg_jobs(NULL);
+}
+
+/**
+ * @brief Wait for background jobs to terminate.
+ *
+ * wait waits for every running or queued background job, wait -n for the
+ * first of them to finish, whose exit status is printed (a termination by
+ * signal is reported as usual), and wait job... for each %jid or PID given,
+ * in turn. Stopped jobs are not waited for. Ctrl-C or Ctrl-Z ends the wait,
+ * and is not forwarded to any job.
+ */
+static void wait_builtin(const struct cmdline_tokens *token) {
+    jid_t jids[token->argc];
+    int njids = 0;
+    bool next = token->argc == 2 && strcmp(token->argv[1], "-n") == 0;
+    sigset_t prev_all;
+
+    loop_block_signals(&prev_all);
+    for (int i = 1; i < token->argc && !next; i++) {
+        if ((jids[njids] = job_arg(token->argv[i])) != 0) {
+            njids++;
         }
-        sigprocmask(SIG_SETMASK, &prev_all, NULL);
     }
+
+    if (next) {
+        uint64_t count = history_count();
+        struct history_entry entry;
+        if (loop_wait_jobs(job_completed, &count, &prev_all) == 0 &&
+            history_get(count, &entry) && entry.sig == 0) {
+            sio_printf("Job [%d] (%d) exited with status %d\n", entry.jid,
+                       entry.pid, entry.code);
+        }
+    } else if (token->argc == 1) {
+        loop_wait_jobs(no_bg_jobs, NULL, &prev_all);
+    }
+    for (int i = 0; i < njids; i++) {
+        if (loop_wait_job(jids[i], &prev_all) != 0) {
+            break;
+        }
+    }
+    loop_restore_signals(&prev_all);
+}
+
+/**
+ * @brief Show the wakeup counters of the loop and the usage of the command
+ * line arena: stats, or stats -r to also reset the counters.
+ */
+static void stats_builtin(const struct cmdline_tokens *token) {
+    bool reset = token->argc == 2 && strcmp(token->argv[1], "-r") == 0;
+    sigset_t prev_all;
+
+    if (token->argc > 1 && !reset) {
+        sio_printf("stats: usage: stats [-r]\n");
+        return;
+    }
+    loop_block_signals(&prev_all);
+    struct loop_stats stats = loop_stats;
+    struct events_stats queued;
+    struct arena_stats arena;
+    events_get_stats(&queued, reset);
+    arena_get_stats(&arena);
+    if (reset) {
+        memset(&loop_stats, 0, sizeof(loop_stats));
+    }
+    loop_restore_signals(&prev_all);
+    sio_printf("fg-waits %lu fg-wakeups %lu wait-wakeups %lu "
+               "child-events %lu\n",
+               stats.fg_waits, stats.fg_wakeups, stats.wait_wakeups,
+               stats.child_events);
+    sio_printf("queued-events %lu queue-overflows %lu queue-max-depth %lu\n",
+               queued.posted, queued.overflows,
+               (unsigned long)queued.max_depth);
+    sio_printf("arena-strings %lu arena-refs %lu arena-mapped %lu "
+               "arena-free %lu\n",
+               (unsigned long)arena.strings, (unsigned long)arena.refs,
+               (unsigned long)arena.mapped, (unsigned long)arena.free_bytes);
+}
+
+/**
+ * @brief Show or change the policies of background jobs (tsh_prio.h).
+ *
+ * prio lists the default policy and that of every job; prio -d policy sets
+ * the default for the jobs added from then on; prio job shows the policy of
+ * a %jid or PID, and prio job policy changes it, or resets it to the
+ * default with `auto`. A job in the background moves to its new policy at
+ * once.
+ */
+static void prio_builtin(const struct cmdline_tokens *token) {
+    char spec[PRIO_SPEC_SIZE];
+    struct prio_policy policy;
+    sigset_t prev_all;
+    jid_t jid;
+
+    if (token->argc > 3 || (token->argc == 2 &&
+                            strcmp(token->argv[1], "-d") == 0)) {
+        sio_printf("prio: usage: prio [-d policy | job [policy | auto]]\n");
+        return;
+    }
+    if (!prio_enabled) {
+        sio_printf("prio: background jobs keep the priority of the shell "
+                   "(--bg-prio)\n");
+        return;
+    }
+
+    loop_block_signals(&prev_all);
+    if (token->argc == 1) {
+        sio_printf("default %s\n", prio_format(spec, &prio_default));
+        list_jobs_details(STDOUT_FILENO,
+                          JOB_STATE_BIT(FG) | JOB_STATE_BIT(BG) |
+                              JOB_STATE_BIT(ST) | JOB_STATE_BIT(QUEUED),
+                          JOB_LIST_PRIO);
+    } else if (strcmp(token->argv[1], "-d") == 0) {
+        if (prio_parse(token->argv[2], &prio_default)) {
+            sio_printf("default %s\n", prio_format(spec, &prio_default));
+        } else {
+            sio_printf("prio: %s: invalid policy\n", token->argv[2]);
+        }
+    } else if ((jid = job_arg(token->argv[1])) != 0) {
+        job_get_prio(jid, &policy);
+        if (token->argc == 3 && strcmp(token->argv[2], "auto") == 0) {
+            policy = prio_default;
+        } else if (token->argc == 3 && !prio_parse(token->argv[2], &policy)) {
+            sio_printf("prio: %s: invalid policy\n", token->argv[2]);
+            loop_restore_signals(&prev_all);
+            return;
+        }
+        if (token->argc == 3 && !job_set_prio(jid, &policy)) {
+            sio_printf("prio: %s: cannot apply all of it\n", token->argv[1]);
+        }
+        sio_printf("[%d] %s\n", jid, prio_format(spec, &policy));
+    }
+    loop_restore_signals(&prev_all);
+}
+
+/**
+ * @brief Parse the positive count argument of an option, or exit with the
+ * usage message.
+ */
+static int option_count(const char *opt, const char *arg) {
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value <= 0 || value > INT_MAX) {
+        fprintf(stderr, "Invalid %s: %s\n", opt, arg);
+        usage();
+    }
+    return (int)value;
+}
+
+/**
+ * @brief Run an in-process utility in the shell, with its < and > files.
+ */
+static void util_builtin(const struct cmdline_tokens *token) {
+    int in_fd = STDIN_FILENO;
+    int out_fd = STDOUT_FILENO;
+    if (token->infile != NULL &&
+        (in_fd = redirect_open(token->infile, false)) < 0) {
+        return;
+    }
+    if (token->outfile != NULL &&
+        (out_fd = redirect_open(token->outfile, true)) < 0) {
+        if (in_fd != STDIN_FILENO) {
+            close(in_fd);
+        }
+        return;
+    }
+
+    fflush(stdout); // the utility writes to the descriptor directly
+    builtin_util_run(token->argc, token->argv, in_fd, out_fd);
+    if (in_fd != STDIN_FILENO) {
+        close(in_fd);
+    }
+    if (out_fd != STDOUT_FILENO) {
+        close(out_fd);
+    }
+}
+
+/**
+ * @brief Run the hash builtin.
+ *
+ * Without arguments, lists the command hash table (to the > file, if any).
+ * -r empties the table. Other arguments are command names to look up and
+ * remember.
+ */
+static void hash_builtin(const struct cmdline_tokens *token) {
+    if (token->argc == 1) {
+        int fd = STDOUT_FILENO;
+        if (token->outfile != NULL &&
+            (fd = redirect_open(token->outfile, true)) < 0) {
+            return;
+        }
+        if (!path_hash_list(fd)) {
+            sio_printf("Fails to write into hash table.\n");
+        }
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+        return;
+    }
+
+    for (int i = 1; i < token->argc; i++) {
+        struct path_cmd cmd;
+        if (strcmp(token->argv[i], "-r") == 0) {
+            path_hash_reset();
+        } else if (token->argv[i][0] == '-') {
+            sio_printf("hash: %s: invalid option\n", token->argv[i]);
+            sio_printf("hash: usage: hash [-r] [name ...]\n");
+            return;
+        } else if (strchr(token->argv[i], '/') == NULL &&
+                   !path_resolve(token->argv[i], &cmd)) {
+            sio_printf("hash: %s: not found\n", token->argv[i]);
+        }
+    }
+}
+
+/**
+ * @brief Strip the time or perfstat prefix of a command line, leaving the
+ * command to time, and record when it starts.
+ *
+ * The command runs as a foreground job even if it is an in-process utility,
+ * since only a reaped process reports the resources it used.
+ *
+ * @return false, after printing a message, if the command cannot be timed
+ */
+static bool time_prefix(struct cmdline_tokens *token, parseline_return result,
+                        struct timespec *begin) {
+    const char *name = token->argv[0];
+    if (result == PARSELINE_BG) {
+        sio_printf("%s: background jobs cannot be timed\n", name);
+        return false;
+    }
+    if (token->argc == 1) {
+        sio_printf("%s: usage: %s command\n", name, name);
+        return false;
+    }
+
+    // drop argv[0], up to the NULL that ends the last command
+    int n = token->stages[token->nstages - 1];
+    while (token->argv[n] != NULL) {
+        n++;
+    }
+    memmove(token->argv, token->argv + 1, (size_t)n * sizeof(*token->argv));
+    for (int i = 1; i < token->nstages; i++) {
+        token->stages[i]--;
+    }
+    token->argc--;
+
+    token->builtin = builtin_lookup(token->argc, token->argv);
+    if (token->builtin == BUILTIN_UTIL && token->nstages > 1) {
+        token->builtin = BUILTIN_NONE;
+    }
+    if (token->builtin != BUILTIN_NONE && token->builtin != BUILTIN_UTIL) {
+        sio_printf("%s: %s: builtins cannot be timed\n", name,
+                   token->argv[0]);
+        return false;
+    }
+    clock_gettime(CLOCK_MONOTONIC, begin);
+    return true;
+}
+
+/**
+ * @brief Report the resources used by a timed job once it has terminated;
+ * a job that stopped instead is not reported.
+ *
+ * @pre All signals are blocked.
+ */
+static void time_report(pid_t pid, const struct timespec *begin) {
+    struct history_entry done;
+    if (job_from_pid(pid) != 0 || !history_find(pid, &done)) {
+        return;
+    }
+    done.usage.launched = *begin;
+    clock_gettime(CLOCK_MONOTONIC, &done.usage.ended);
+    sio_t out;
+    sio_initb(&out, STDERR_FILENO);
+    print_usage(&out, "", &done.usage);
+    sio_flushb(&out);
+}
+
+/**
+ * @brief List the completed jobs, as selected by the options of the history
+ * command: -j (required), -f, -v, -s N and -p prefix.
+ */
+static void history_builtin(const struct cmdline_tokens *token) {
+    struct history_query query = {false, NULL, 0, false};
+    bool jobs = false;
+    sigset_t prev_all;
+
+    for (int i = 1; i < token->argc; i++) {
+        const char *arg = token->argv[i];
+        bool valid = arg[0] == '-' && arg[1] != '\0';
+        for (const char *opt = arg + 1; valid && *opt != '\0'; opt++) {
+            if (*opt == 'j') {
+                jobs = true;
+            } else if (*opt == 'f') {
+                query.failed = true;
+            } else if (*opt == 'v') {
+                query.with_usage = true;
+            } else if ((*opt == 's' || *opt == 'p') && opt[1] == '\0' &&
+                       i + 1 < token->argc) {
+                const char *value = token->argv[++i];
+                if (*opt == 'p') {
+                    query.prefix = value;
+                } else if ((query.slowest = atoi(value)) <= 0) {
+                    valid = false;
+                }
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid) {
+            jobs = false;
+            break;
+        }
+    }
+    if (!jobs) {
+        sio_printf("history: usage: history -j [-fv] [-s N] [-p prefix]\n");
+        return;
+    }
+
+    loop_block_signals(&prev_all);
+    int fd = token->outfile != NULL ? redirect_open(token->outfile, true)
+                                    : STDOUT_FILENO;
+    if (fd != -1) {
+        if (!history_list(fd, &query)) {
+            sio_printf("history: write error\n");
+        }
+        if (fd != STDOUT_FILENO) {
+            close(fd);
+        }
+    }
+    loop_restore_signals(&prev_all);
+}
+
+/**
+ * @brief Parse the options of the jobs command into a set of job states.
+ *
+ * -r lists running jobs, -s lists stopped jobs, -q lists jobs queued by
+ * --bg-max or --psi-*, and neither lists every job. -l adds every process
+ * in the process group of each job, including those the job created, and
+ * -v adds the resource usage of each job.
+ *
+ * @return false, after printing a usage message, if an option is invalid
+ */
+static bool jobs_states(const struct cmdline_tokens *token, unsigned *states,
+                        unsigned *details) {
+    unsigned selected = 0;
+    *details = 0;
+    for (int i = 1; i < token->argc; i++) {
+        const char *arg = token->argv[i];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            sio_printf("jobs: usage: jobs [-lqrsv]\n");
+            return false;
+        }
+        for (const char *opt = arg + 1; *opt != '\0'; opt++) {
+            if (*opt == 'r') {
+                selected |= JOB_STATE_BIT(BG) | JOB_STATE_BIT(FG);
+            } else if (*opt == 's') {
+                selected |= JOB_STATE_BIT(ST);
+            } else if (*opt == 'q') {
+                selected |= JOB_STATE_BIT(QUEUED);
+            } else if (*opt == 'l') {
+                *details |= JOB_LIST_MEMBERS;
+            } else if (*opt == 'v') {
+                *details |= JOB_LIST_USAGE;
+            } else {
+                sio_printf("jobs: -%c: invalid option\n", *opt);
+                sio_printf("jobs: usage: jobs [-lqrsv]\n");
+                return false;
+            }
+        }
+    }
+    if (selected == 0) {
+        selected = JOB_STATE_BIT(FG) | JOB_STATE_BIT(BG) | JOB_STATE_BIT(ST) |
+                   JOB_STATE_BIT(QUEUED);
+    }
+    *states = selected;
+    return true;
 }
 
 /*****************
@@ -382,33 +1184,22 @@ void eval(const char *cmdline) {
  * @brief deal with event when a child process has stopped or terminated
  * @default action: Ignore
  *
+ * The children are only reaped here and posted to the loop (tsh_events.c),
+ * which updates the job list and prints the notifications. Once the queue
+ * is full, the rest are left for the loop to reap. With --subreaper, the
+ * process group of each child is read before it is reaped, so that orphans
+ * of a job can be attributed to it (tsh_reaper.c).
  */
 void sigchld_handler(int sig) {
     int olderrno = errno;
-    pid_t pid;
-    jid_t jid;
+    pid_t pid, pgid;
     int status;
-    sigset_t mask_all, prev_all;
+    struct rusage ru;
 
-    sigfillset(&mask_all);
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED)) >
-           0) { // reap zombie children
-        sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
-        jid = job_from_pid(pid);
-        if (WIFSTOPPED(status)) {
-            job_set_state(jid, ST);
-            sio_printf("Job [%d] (%d) stopped by signal %d\n", jid, pid,
-                       WSTOPSIG(status));
-        } else if (WIFSIGNALED(status)) {
-            sio_printf("Job [%d] (%d) terminated by signal %d\n", jid, pid,
-                       WTERMSIG(status));
-            delete_job(jid);
-        } else if (WIFCONTINUED(status)) {
-            job_set_state(jid, FG);
-        } else {
-            delete_job(jid);
-        }
-        sigprocmask(SIG_SETMASK, &prev_all, NULL);
+    // Reap zombie children, with the resources they used
+    while (events_room() &&
+           (pid = reaper_wait(&status, &ru, &pgid, loop_fg_group)) > 0) {
+        events_post(pid, pgid, status, &ru);
     }
     errno = olderrno;
 }
@@ -419,18 +1210,11 @@ void sigchld_handler(int sig) {
  */
 void sigint_handler(int sig) {
     int olderrno = errno;
-    pid_t pid;
-    jid_t jid;
     sigset_t mask_all, prev_all;
 
     sigfillset(&mask_all);
     sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
-    jid = fg_job();
-    if (jid) {
-        pid = job_get_pid(jid);
-        // send this sigint to foreground process
-        kill(-pid, SIGINT);
-    }
+    fg_forward(SIGINT); // send this sigint to the foreground process group
     sigprocmask(SIG_SETMASK, &prev_all, NULL);
     errno = olderrno;
 }
@@ -441,19 +1225,11 @@ void sigint_handler(int sig) {
  */
 void sigtstp_handler(int sig) {
     int olderrno = errno;
-    pid_t pid;
-    jid_t jid;
     sigset_t mask_all, prev_all;
 
     sigfillset(&mask_all);
     sigprocmask(SIG_BLOCK, &mask_all, &prev_all);
-    jid = fg_job();
-    if (jid) {
-        pid = job_get_pid(jid);
-        // send this sigtstp to foreground process
-        // -pid to send to all processes within the group
-        kill(-pid, SIGTSTP);
-    }
+    fg_forward(SIGTSTP); // send this sigtstp to the foreground process group
     sigprocmask(SIG_SETMASK, &prev_all, NULL);
     errno = olderrno;
 }
@@ -471,4 +1247,7 @@ void cleanup(void) {
     Signal(SIGCHLD, SIG_DFL); // Handles terminated or stopped child
 
     destroy_job_list();
+    arena_destroy(); // after the job list has released its command lines
+    path_destroy();
+    cgroup_destroy();
 }
@@ -0,0 +1,203 @@
+/**
+ * @file tsh_admit.c
+ * @brief Admission control for background jobs
+ *
+ * See tsh_admit.h for the policy. Queued jobs are kept, in the order they
+ * were typed, in a ring buffer of job IDs; the job list itself only orders
+ * jobs by JID, and JIDs are recycled. A pressure hold is the time until
+ * which launches are held back, pushed forward by every trigger
+ * notification.
+ */
+
+#include "csapp.h"
+#include "tsh_admit.h"
+#include "tsh_helper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_QUEUE 16 // Initial capacity of the queue
+
+/* Global variables */
+int admit_bg_max = 0;     // Most running BG jobs, 0 for no limit
+int admit_psi_cpu = 0;    // CPU stall (us per window) that holds, or 0
+int admit_psi_memory = 0; // Memory stall (us per window) that holds, or 0
+
+/* Static variables */
+static admit_start_fn *start_job = NULL; // Launches a queued job
+static jid_t *queue = NULL;              // Ring buffer of queued jobs
+static size_t queue_cap = 0;             // Allocated entries of queue
+static size_t queue_head = 0;            // Index of the oldest entry
+static size_t queue_len = 0;             // Number of queued jobs
+static struct pollfd triggers[2];        // PSI trigger descriptors
+static int ntriggers = 0;                // Entries used in triggers
+static bool held = false;                // A pressure hold is active
+static struct timespec hold_end;         // When the hold ends
+
+/*
+ * add_trigger - Register a PSI trigger for stall_us microseconds of "some"
+ * stall per window on a pressure file
+ */
+static void add_trigger(const char *path, int stall_us) {
+    char spec[64];
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    int len = snprintf(spec, sizeof(spec), "some %d %d", stall_us,
+                       PSI_WINDOW_US);
+    if (fd < 0 || write(fd, spec, (size_t)len + 1) < 0) {
+        fprintf(stderr, "%s: cannot register PSI trigger: %s\n", path,
+                strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    triggers[ntriggers].fd = fd;
+    triggers[ntriggers].events = POLLPRI;
+    ntriggers++;
+}
+
+/*
+ * admit_init - Set up admission control
+ * Not async-signal-safe
+ */
+void admit_init(admit_start_fn *start) {
+    start_job = start;
+    if (admit_psi_cpu > 0) {
+        add_trigger("/proc/pressure/cpu", admit_psi_cpu);
+    }
+    if (admit_psi_memory > 0) {
+        add_trigger("/proc/pressure/memory", admit_psi_memory);
+    }
+}
+
+/*
+ * pressured - Whether launches are held back by pressure. Pending trigger
+ * notifications are collected first; each one starts a new hold.
+ */
+static bool pressured(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (ntriggers > 0 && poll(triggers, (nfds_t)ntriggers, 0) > 0) {
+        for (int i = 0; i < ntriggers; i++) {
+            if (triggers[i].revents & POLLPRI) {
+                held = true;
+                hold_end = now;
+                hold_end.tv_sec += PSI_WINDOW_US / 1000000;
+                hold_end.tv_nsec += (PSI_WINDOW_US % 1000000) * 1000L;
+                if (hold_end.tv_nsec >= 1000000000L) {
+                    hold_end.tv_sec++;
+                    hold_end.tv_nsec -= 1000000000L;
+                }
+            }
+        }
+    }
+
+    if (held && (now.tv_sec > hold_end.tv_sec ||
+                 (now.tv_sec == hold_end.tv_sec &&
+                  now.tv_nsec >= hold_end.tv_nsec))) {
+        held = false;
+    }
+    return held;
+}
+
+/*
+ * capped - Whether the limit of running background jobs is reached
+ */
+static bool capped(void) {
+    return admit_bg_max > 0 && job_count(BG) >= admit_bg_max;
+}
+
+/*
+ * admit_hold - Whether a new background job must be queued
+ * Not async-signal-safe
+ */
+bool admit_hold(void) {
+    return queue_len > 0 || capped() || pressured();
+}
+
+/*
+ * admit_enqueue - Add a QUEUED job at the end of the queue
+ * Not async-signal-safe
+ */
+bool admit_enqueue(jid_t jid) {
+    if (queue_len == queue_cap) {
+        size_t cap = queue_cap == 0 ? MIN_QUEUE : 2 * queue_cap;
+        jid_t *ring = malloc(cap * sizeof(*ring));
+        if (ring == NULL) {
+            return false;
+        }
+        for (size_t i = 0; i < queue_len; i++) {
+            ring[i] = queue[(queue_head + i) % queue_cap];
+        }
+        free(queue);
+        queue = ring;
+        queue_cap = cap;
+        queue_head = 0;
+    }
+    queue[(queue_head + queue_len) % queue_cap] = jid;
+    queue_len++;
+    return true;
+}
+
+/*
+ * admit_start_now - Start a QUEUED job, taking it out of the queue
+ * Not async-signal-safe
+ */
+bool admit_start_now(jid_t jid, const sigset_t *prev) {
+    for (size_t i = 0; i < queue_len; i++) {
+        if (queue[(queue_head + i) % queue_cap] != jid) {
+            continue;
+        }
+        for (; i + 1 < queue_len; i++) {
+            queue[(queue_head + i) % queue_cap] =
+                queue[(queue_head + i + 1) % queue_cap];
+        }
+        queue_len--;
+        break;
+    }
+    return start_job(jid, prev);
+}
+
+/*
+ * admit_waiting - Whether any job is queued
+ * Async-signal-safe
+ */
+bool admit_waiting(void) {
+    return queue_len > 0;
+}
+
+/*
+ * admit_run - Start queued jobs while the limits allow
+ * Not async-signal-safe
+ */
+void admit_run(const sigset_t *prev) {
+    while (queue_len > 0 && !capped() && !pressured()) {
+        jid_t jid = queue[queue_head];
+        queue_head = (queue_head + 1) % queue_cap;
+        queue_len--;
+        start_job(jid, prev);
+    }
+}
+
+/*
+ * admit_timeout - Milliseconds until the pressure hold ends, or -1
+ * Not async-signal-safe
+ */
+int admit_timeout(void) {
+    if (queue_len == 0 || !pressured()) {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (hold_end.tv_sec - now.tv_sec) * 1000L +
+              (hold_end.tv_nsec - now.tv_nsec + 999999L) / 1000000L;
+    return ms > 0 ? (int)ms : 1;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file tsh_admit.h
+ * @brief Admission control for background jobs
+ *
+ * By default every background job starts as soon as it is typed. With
+ * `--bg-max N`, at most N jobs run in the background at once: a job typed
+ * while N jobs are in the `BG` state is added to the job list as `QUEUED`,
+ * without a process, and announced as `[jid] (-) cmdline`. Queued jobs are
+ * started in the order they were typed, by `admit_run`, as running jobs
+ * finish or stop. `fg` and `bg` start a queued job right away.
+ *
+ * With `--psi-cpu US` or `--psi-memory US`, the shell also holds back new
+ * launches while the system is under pressure. A PSI trigger is registered
+ * on /proc/pressure/cpu or /proc/pressure/memory for US microseconds of
+ * stall ("some") within a window of `PSI_WINDOW_US`. The kernel notifies the
+ * trigger descriptor with POLLPRI when the threshold is crossed. The shell
+ * checks the descriptors, without blocking, whenever it decides whether to
+ * start a job, and never reads the pressure files. Each notification holds
+ * launches for one window; launches resume once a whole window passes
+ * without one.
+ *
+ * The loop (tsh_loop.c) calls `admit_run` whenever it wakes up while jobs
+ * are queued, and sleeps no longer than `admit_timeout`, so queued jobs
+ * start as soon as SIGCHLD frees a slot or a pressure hold ends.
+ */
+
+#ifndef TSH_ADMIT_H
+#define TSH_ADMIT_H
+
+#include "tsh_helper.h"
+
+#include <signal.h>
+#include <stdbool.h>
+
+/** @brief Window of the PSI triggers, and how long a notification holds */
+#define PSI_WINDOW_US 1000000
+
+/* Defined in tsh_admit.c */
+extern int admit_bg_max;     ///< Most running BG jobs, 0 for no limit
+extern int admit_psi_cpu;    ///< CPU stall (us per window) that holds, or 0
+extern int admit_psi_memory; ///< Memory stall (us per window) that holds, or 0
+
+/**
+ * @brief Starts a queued job.
+ *
+ * Called by the admission code, with all signals blocked, to launch the
+ * command line of a QUEUED job. It must set the PID and the state of the
+ * job, or delete the job if it could not be started.
+ *
+ * @param[in] jid   The QUEUED job.
+ * @param[in] prev  The signal mask to derive the job's mask from.
+ * @return true if the job was started.
+ */
+typedef bool admit_start_fn(jid_t jid, const sigset_t *prev);
+
+/**
+ * @brief Sets up admission control: records how to start queued jobs and
+ * registers the PSI triggers that were asked for.
+ *
+ * A trigger that cannot be registered (e.g. on a kernel without PSI) is
+ * reported and left out.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void admit_init(admit_start_fn *start);
+
+/**
+ * @brief Returns whether a new background job must be queued rather than
+ * started: the limit is reached, the system is under pressure, or other
+ * jobs are already waiting.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool admit_hold(void);
+
+/**
+ * @brief Adds a QUEUED job at the end of the queue.
+ *
+ * @return false if there is no memory left for the queue.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool admit_enqueue(jid_t jid);
+
+/**
+ * @brief Starts a QUEUED job now, whatever the limits, taking it out of the
+ * queue if it is in it (for `fg` and `bg`).
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool admit_start_now(jid_t jid, const sigset_t *prev);
+
+/**
+ * @brief Returns whether any job is queued.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool admit_waiting(void);
+
+/**
+ * @brief Starts queued jobs, in order, for as long as the limits allow.
+ *
+ * @param[in] prev  The signal mask to derive the jobs' masks from.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void admit_run(const sigset_t *prev);
+
+/**
+ * @brief Returns how long the loop may sleep before `admit_run` has to be
+ * called again, in milliseconds: until the current pressure hold ends, or
+ * -1 if nothing is queued or nothing is held.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int admit_timeout(void);
+
+#endif /* TSH_ADMIT_H */
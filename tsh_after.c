@@ -0,0 +1,148 @@
+/**
+ * @file tsh_after.c
+ * @brief Jobs that start when other jobs complete (`after` builtin)
+ *
+ * See tsh_after.h for the semantics. Every waiting job has a `waiter`,
+ * which lists the jobs it waits for by JID; an entry is cleared when that
+ * job terminates, so a JID that is recycled later is never mistaken for it.
+ * The array of waiters only grows or shrinks with signals blocked, and the
+ * loop's event dispatch updates the entries in place.
+ */
+
+#include "csapp.h"
+#include "tsh_admit.h"
+#include "tsh_after.h"
+#include "tsh_helper.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A job waiting for other jobs */
+struct waiter {
+    jid_t jid;       // The QUEUED job
+    after_cond cond; // Exit status the dependencies must have
+    int pending;     // Dependencies that have not terminated
+    bool failed;     // One of the dependencies failed
+    int ndeps;       // Entries of deps
+    jid_t *deps;     // The dependencies, 0 once terminated
+};
+
+/* Static variables */
+static struct waiter *waiters = NULL; // Waiting jobs, in order of creation
+static int nwaiters = 0;              // Entries used in waiters
+static int waiters_cap = 0;           // Allocated entries of waiters
+
+/*
+ * after_add - Make a QUEUED job wait for other jobs
+ * Not async-signal-safe
+ */
+bool after_add(jid_t jid, const jid_t *deps, int ndeps, after_cond cond) {
+    if (nwaiters == waiters_cap) {
+        int cap = waiters_cap == 0 ? 16 : 2 * waiters_cap;
+        struct waiter *bigger =
+            realloc(waiters, (size_t)cap * sizeof(*bigger));
+        if (bigger == NULL) {
+            return false;
+        }
+        waiters = bigger;
+        waiters_cap = cap;
+    }
+    jid_t *copy = malloc((size_t)ndeps * sizeof(*copy));
+    if (copy == NULL) {
+        return false;
+    }
+    memcpy(copy, deps, (size_t)ndeps * sizeof(*copy));
+
+    struct waiter *w = &waiters[nwaiters++];
+    w->jid = jid;
+    w->cond = cond;
+    w->pending = ndeps;
+    w->failed = false;
+    w->ndeps = ndeps;
+    w->deps = copy;
+    return true;
+}
+
+/*
+ * after_job_exit - Record the termination of a process of a job
+ * Async-signal-safe
+ */
+void after_job_exit(jid_t jid, bool failed, bool done) {
+    for (int i = 0; i < nwaiters; i++) {
+        struct waiter *w = &waiters[i];
+        for (int d = 0; d < w->ndeps; d++) {
+            if (w->deps[d] != jid) {
+                continue;
+            }
+            w->failed |= failed;
+            if (done) {
+                w->deps[d] = 0;
+                w->pending--;
+            }
+        }
+    }
+}
+
+/*
+ * remove_waiter - Remove an entry of waiters, keeping the others in order
+ */
+static void remove_waiter(int i) {
+    free(waiters[i].deps);
+    memmove(&waiters[i], &waiters[i + 1],
+            (size_t)(nwaiters - i - 1) * sizeof(*waiters));
+    nwaiters--;
+}
+
+/*
+ * after_drop - Stop a job from waiting for other jobs
+ * Not async-signal-safe
+ */
+bool after_drop(jid_t jid) {
+    for (int i = 0; i < nwaiters; i++) {
+        if (waiters[i].jid == jid) {
+            remove_waiter(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * after_waiting - Whether any job waits for other jobs
+ * Async-signal-safe
+ */
+bool after_waiting(void) {
+    return nwaiters > 0;
+}
+
+/*
+ * after_run - Queue or cancel the jobs whose dependencies have terminated.
+ * A cancellation may release other jobs, so scan until nothing changes.
+ * Not async-signal-safe
+ */
+void after_run(void) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < nwaiters;) {
+            struct waiter *w = &waiters[i];
+            if (w->pending > 0) {
+                i++;
+                continue;
+            }
+
+            jid_t jid = w->jid;
+            bool run = w->cond == AFTER_ANY ||
+                       (w->cond == AFTER_OK) == !w->failed;
+            remove_waiter(i);
+            if (run && admit_enqueue(jid)) {
+                continue;
+            }
+            sio_printf("Job [%d] (-) cancelled\n", jid);
+            delete_job(jid);
+            after_job_exit(jid, true, true);
+            changed = true;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+/**
+ * @file tsh_after.h
+ * @brief Jobs that start when other jobs complete (`after` builtin)
+ *
+ * `after [-a|-f] job... [--] command` adds `command` to the job list as a
+ * QUEUED background job that starts once every listed job (`%jid` or PID)
+ * has terminated: by default only if all of them exited with status 0, with
+ * `-f` only if one of them failed, and with `-a` whatever their status. If
+ * the condition does not hold, the job is cancelled, which counts as a
+ * failure for the jobs that wait for it in turn. A job that waits for a
+ * QUEUED job, e.g. another `after` job, waits until that one has run.
+ *
+ * The loop reports the termination of every process with `after_job_exit`
+ * when its event dispatch applies the event to the job list; it only marks
+ * the dependencies. `after_run`, called by the loop when it wakes up, then hands
+ * the released jobs to the admission queue (tsh_admit.h), so they start
+ * right away unless `--bg-max` or pressure holds them back.
+ */
+
+#ifndef TSH_AFTER_H
+#define TSH_AFTER_H
+
+#include "tsh_helper.h"
+
+#include <signal.h>
+#include <stdbool.h>
+
+/**
+ * @brief Exit status the jobs waited for must have
+ */
+typedef enum after_cond {
+    AFTER_OK,   ///< All of them exited with status 0 (default)
+    AFTER_FAIL, ///< At least one of them failed (`-f`)
+    AFTER_ANY,  ///< Any status (`-a`)
+} after_cond;
+
+/**
+ * @brief Makes a QUEUED job wait for other jobs.
+ *
+ * @param[in] jid    The QUEUED job to start later.
+ * @param[in] deps   The jobs it waits for; they must exist.
+ * @param[in] ndeps  The number of entries in `deps`, at least 1.
+ * @param[in] cond   The exit status the jobs must have.
+ *
+ * @return false if there is no memory left.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool after_add(jid_t jid, const jid_t *deps, int ndeps, after_cond cond);
+
+/**
+ * @brief Records that a process of a job has terminated, or that a QUEUED
+ * job has been dropped without running.
+ *
+ * @param[in] jid     The job.
+ * @param[in] failed  Whether the process failed (non-zero exit status or
+ *                    killed by a signal).
+ * @param[in] done    Whether this was the last process of the job.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void after_job_exit(jid_t jid, bool failed, bool done);
+
+/**
+ * @brief Stops a job from waiting for other jobs, e.g. because `fg` or `bg`
+ * starts it right away.
+ *
+ * @return false if the job was not waiting.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool after_drop(jid_t jid);
+
+/**
+ * @brief Returns whether any job waits for other jobs.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool after_waiting(void);
+
+/**
+ * @brief Queues the jobs whose dependencies have all terminated and whose
+ * condition holds for admission, and cancels the others.
+ *
+ * A cancelled job is reported as `Job [jid] (-) cancelled` and deleted.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void after_run(void);
+
+#endif /* TSH_AFTER_H */
@@ -0,0 +1,231 @@
+/**
+ * @file tsh_arena.c
+ * @brief Async-signal-safe storage for interned strings
+ *
+ * See tsh_arena.h for an overview. Every string lives in a block whose
+ * header links it into a bucket of the intern table while it is in use, and
+ * into the free list of its size class once it has been released. Blocks of
+ * the size classes are never returned to the kernel until arena_destroy.
+ */
+
+#include "tsh_arena.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define MIN_SHIFT 4                          // Smallest class: 16 bytes
+#define MAX_SHIFT 12                         // Largest class: 4 KiB
+#define NCLASSES (MAX_SHIFT - MIN_SHIFT + 1) // Number of size classes
+#define CHUNK_SIZE (64 * 1024)               // Memory mapped per chunk
+#define NBUCKETS 4096 // Buckets of the intern table (a power of two)
+
+// Header of a stored string
+struct block {
+    struct block *next; // Next block in the bucket or on the free list
+    uint32_t hash;      // Hash of data
+    uint32_t refs;      // References handed out by arena_intern
+    size_t size;        // Size of the block, header included
+    char data[];        // The string
+};
+
+// Header of a chunk, followed by the blocks carved from it
+struct chunk {
+    struct chunk *next; // Previously mapped chunk
+    size_t pad;         // Keeps the first block 16-byte aligned
+};
+
+/* Static variables */
+static struct block *buckets[NBUCKETS];      // Intern table
+static struct block *free_lists[NCLASSES];   // Released blocks by class
+static struct chunk *chunks = NULL;          // Every chunk mapped so far
+static char *bump = NULL;                    // Next unused byte of a chunk
+static char *bump_end = NULL;                // End of the current chunk
+static struct arena_stats stats;             // Usage counters
+
+/*
+ * hash_string - FNV-1a hash of a string of known length
+ * Async-signal-safe
+ */
+static uint32_t hash_string(const char *str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * size_class - Smallest class holding size bytes, or NCLASSES if none does
+ * Async-signal-safe
+ */
+static int size_class(size_t size) {
+    int cls = 0;
+    while (cls < NCLASSES && ((size_t)1 << (cls + MIN_SHIFT)) < size) {
+        cls++;
+    }
+    return cls;
+}
+
+/*
+ * map - Map zero-filled memory, returning NULL on failure
+ * Async-signal-safe
+ */
+static void *map(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ * block_alloc - Get a block of at least size bytes: from the free list of
+ * its class, from the current chunk, from a new chunk, or, for large
+ * strings, from a mapping of its own
+ * Async-signal-safe
+ */
+static struct block *block_alloc(size_t size) {
+    struct block *b;
+    int cls = size_class(size);
+
+    if (cls == NCLASSES) {
+        b = map(size);
+        if (b == NULL) {
+            return NULL;
+        }
+        b->size = size;
+        stats.mapped += size;
+        return b;
+    }
+
+    size_t bsize = (size_t)1 << (cls + MIN_SHIFT);
+    if (free_lists[cls] != NULL) {
+        b = free_lists[cls];
+        free_lists[cls] = b->next;
+        stats.free_bytes -= bsize;
+        return b;
+    }
+
+    if (bump == NULL || (size_t)(bump_end - bump) < bsize) {
+        struct chunk *c = map(CHUNK_SIZE);
+        if (c == NULL) {
+            return NULL;
+        }
+        c->next = chunks;
+        chunks = c;
+        bump = (char *)(c + 1);
+        bump_end = (char *)c + CHUNK_SIZE;
+        stats.mapped += CHUNK_SIZE;
+    }
+    b = (struct block *)bump;
+    bump += bsize;
+    b->size = bsize;
+    return b;
+}
+
+/*
+ * block_free - Return a block to its free list, or unmap a large block
+ * Async-signal-safe
+ */
+static void block_free(struct block *b) {
+    int cls = size_class(b->size);
+    if (cls == NCLASSES) {
+        stats.mapped -= b->size;
+        munmap(b, b->size);
+        return;
+    }
+    b->next = free_lists[cls];
+    free_lists[cls] = b;
+    stats.free_bytes += b->size;
+}
+
+/*
+ * arena_intern - Store a string, sharing equal strings
+ * Async-signal-safe
+ */
+const char *arena_intern(const char *str) {
+    size_t len = strlen(str);
+    uint32_t hash = hash_string(str, len);
+    struct block **bucket = &buckets[hash & (NBUCKETS - 1)];
+
+    for (struct block *b = *bucket; b != NULL; b = b->next) {
+        if (b->hash == hash && strcmp(b->data, str) == 0) {
+            b->refs++;
+            stats.refs++;
+            return b->data;
+        }
+    }
+
+    struct block *b = block_alloc(offsetof(struct block, data) + len + 1);
+    if (b == NULL) {
+        return NULL;
+    }
+    memcpy(b->data, str, len + 1);
+    b->hash = hash;
+    b->refs = 1;
+    b->next = *bucket;
+    *bucket = b;
+    stats.strings++;
+    stats.refs++;
+    return b->data;
+}
+
+/*
+ * arena_release - Drop a reference, freeing the string with the last one
+ * Async-signal-safe
+ */
+void arena_release(const char *str) {
+    if (str == NULL) {
+        return;
+    }
+    struct block *b =
+        (struct block *)(uintptr_t)(str - offsetof(struct block, data));
+    stats.refs--;
+    if (--b->refs > 0) {
+        return;
+    }
+
+    struct block **link = &buckets[b->hash & (NBUCKETS - 1)];
+    while (*link != b) {
+        link = &(*link)->next;
+    }
+    *link = b->next;
+    stats.strings--;
+    block_free(b);
+}
+
+/*
+ * arena_get_stats - Report usage counters
+ * Async-signal-safe
+ */
+void arena_get_stats(struct arena_stats *out) {
+    *out = stats;
+}
+
+/*
+ * arena_destroy - Unmap every chunk and every large block
+ * Async-signal-safe
+ */
+void arena_destroy(void) {
+    for (size_t i = 0; i < NBUCKETS; i++) {
+        struct block *b = buckets[i];
+        while (b != NULL) {
+            struct block *next = b->next;
+            if (size_class(b->size) == NCLASSES) {
+                munmap(b, b->size);
+            }
+            b = next;
+        }
+        buckets[i] = NULL;
+    }
+    while (chunks != NULL) {
+        struct chunk *next = chunks->next;
+        munmap(chunks, CHUNK_SIZE);
+        chunks = next;
+    }
+    memset(free_lists, 0, sizeof(free_lists));
+    memset(&stats, 0, sizeof(stats));
+    bump = NULL;
+    bump_end = NULL;
+}
@@ -0,0 +1,73 @@
+/**
+ * @file tsh_arena.h
+ * @brief Async-signal-safe storage for interned strings
+ *
+ * The job list keeps the command line of every job in this arena instead of
+ * on the malloc heap. Strings are interned: storing a string that is already
+ * present returns the existing copy and increments its reference count, so a
+ * command that is launched thousands of times occupies a single block.
+ *
+ * Memory comes from mmap, in chunks that are carved into power-of-two size
+ * classes by a bump pointer. Released blocks go onto a free list for their
+ * class and are reused before the chunk is extended. Strings too large for
+ * the biggest class get a mapping of their own. Neither path calls malloc,
+ * so the arena can be used from a signal handler.
+ */
+
+#ifndef TSH_ARENA_H
+#define TSH_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Usage counters of the arena, for diagnostics.
+ */
+struct arena_stats {
+    size_t strings;    ///< Distinct strings currently stored
+    size_t refs;       ///< References held on those strings
+    size_t mapped;     ///< Bytes mapped from the kernel
+    size_t free_bytes; ///< Bytes sitting on the free lists
+};
+
+/**
+ * @brief Stores a string, or takes another reference on an equal one.
+ *
+ * @param[in] str  The NUL-terminated string to store.
+ *
+ * @return A copy of `str` owned by the arena, valid until the matching call
+ *         to `arena_release`, or NULL if no memory could be mapped.
+ *
+ * @pre Any signals whose handlers use the arena must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+const char *arena_intern(const char *str);
+
+/**
+ * @brief Drops a reference returned by `arena_intern`.
+ *
+ * The string is freed when its last reference is dropped.
+ *
+ * @param[in] str  A string returned by `arena_intern`, or NULL.
+ *
+ * @pre Any signals whose handlers use the arena must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void arena_release(const char *str);
+
+/**
+ * @brief Reports the current usage of the arena.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void arena_get_stats(struct arena_stats *stats);
+
+/**
+ * @brief Unmaps all memory used by the arena.
+ *
+ * Every string previously returned by `arena_intern` becomes invalid.
+ *
+ * @pre No handler that uses the arena may run during or after this call.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void arena_destroy(void);
+
+#endif /* TSH_ARENA_H */
@@ -0,0 +1,862 @@
+/**
+ * @file tsh_builtin.c
+ * @brief Registry of builtin commands and in-process utilities
+ *
+ * See tsh_builtin.h for an overview. Each utility is a function that writes
+ * to an `out` buffer, flushed when full and when the utility is done, so
+ * that output reaches the descriptor in the same chunks as with the stdio
+ * buffering of coreutils. Error messages go straight to stderr and start
+ * with argv[0], as those of the external programs do.
+ *
+ * The behavior follows GNU coreutils: `echo` takes the -n, -e and -E
+ * options, and with -e interprets backslash escapes. `printf` reuses its
+ * format until the arguments are used up and accepts the same conversions
+ * and flags, with integer and floating arguments parsed by strtoimax and
+ * strtold. Utilities given --help or --version, `printf` with a `%q` or
+ * `\u` it does not handle, and `cat` with options are left to the external
+ * programs by the `accepts` check of their registry entry.
+ */
+
+#define _GNU_SOURCE // asprintf
+
+#include "csapp.h"
+#include "tsh_builtin.h"
+#include "tsh_dag.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_parallel.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Bytes moved per sendfile call by cat */
+#define CAT_CHUNK (1 << 20)
+
+/* Buffered output of a utility */
+struct out {
+    int fd;           // Descriptor written to
+    const char *name; // argv[0], to start error messages with
+    size_t len;       // Bytes in buf
+    bool failed;      // A write failed; nothing more is written
+    char buf[MAXBUF]; // Pending output
+};
+
+/* How a backslash escape is interpreted */
+enum esc_mode {
+    ESC_ECHO,   // echo -e: \0ooo or \ooo, \x without digits is literal
+    ESC_FORMAT, // printf format: \ooo, \" is a quote
+    ESC_ARG,    // printf %b: \0ooo or \ooo, \" is a quote
+};
+
+/* Result of a backslash escape */
+enum esc_result {
+    ESC_OK,    // Written
+    ESC_STOP,  // \c: produce no further output
+    ESC_ERROR, // Malformed, message printed
+};
+
+/* An entry of the registry */
+struct builtin {
+    const char *name;    // Command name
+    builtin_state state; // What parseline reports, BUILTIN_UTIL for utilities
+    int (*run)(int argc, char **argv, int in_fd, int out_fd);
+    bool (*accepts)(int argc, char **argv);     // Handled in-process
+    bool (*may_block)(const struct cmdline_tokens *token); // NULL: never
+    bool job; // Always a job of its own; there is no external program
+};
+
+/* Global variables */
+bool builtin_external = false; // Never run utilities in-process
+
+/*****************
+ * Output
+ *****************/
+
+/*
+ * out_flush - Write out the buffered output
+ */
+static void out_flush(struct out *o) {
+    if (!o->failed && o->len > 0 && rio_writen(o->fd, o->buf, o->len) < 0) {
+        o->failed = true;
+    }
+    o->len = 0;
+}
+
+/*
+ * out_put - Append n bytes to the output
+ */
+static void out_put(struct out *o, const void *data, size_t n) {
+    const char *p = data;
+    while (n > 0) {
+        if (o->len == sizeof(o->buf)) {
+            out_flush(o);
+        }
+        size_t chunk = sizeof(o->buf) - o->len;
+        chunk = chunk < n ? chunk : n;
+        memcpy(o->buf + o->len, p, chunk);
+        o->len += chunk;
+        p += chunk;
+        n -= chunk;
+    }
+}
+
+/*
+ * out_char - Append one byte to the output
+ */
+static void out_char(struct out *o, char c) {
+    out_put(o, &c, 1);
+}
+
+/*
+ * out_error - Print an error message after the output so far, as the
+ * error() function used by coreutils does
+ */
+static void out_error(struct out *o, const char *fmt, ...) {
+    va_list ap;
+    out_flush(o);
+    sio_eprintf("%s: ", o->name);
+    va_start(ap, fmt);
+    sio_vdprintf(STDERR_FILENO, fmt, ap);
+    va_end(ap);
+    sio_eprintf("\n");
+}
+
+/*
+ * out_done - Flush the output and return the exit status of the utility,
+ * reporting a write error as coreutils does
+ */
+static int out_done(struct out *o, int status) {
+    out_flush(o);
+    if (o->failed) {
+        sio_eprintf("%s: write error: %s\n", o->name, strerror(errno));
+        return 1;
+    }
+    return status;
+}
+
+/*
+ * put_escape - Interpret the escape after a backslash at *sp, advancing *sp
+ * past it
+ */
+static enum esc_result put_escape(struct out *o, const char **sp,
+                                  enum esc_mode mode) {
+    static const char simple[] = "\\\\a\ab\be\033f\fn\nr\rt\tv\v";
+    const char *s = *sp;
+    char c = *s;
+
+    if (c == 'c') {
+        *sp = s + 1;
+        return ESC_STOP;
+    }
+    if (c == '"' && mode != ESC_ECHO) {
+        out_char(o, '"');
+        *sp = s + 1;
+        return ESC_OK;
+    }
+    for (const char *p = simple; c != '\0' && *p != '\0'; p += 2) {
+        if (*p == c) {
+            out_char(o, p[1]);
+            *sp = s + 1;
+            return ESC_OK;
+        }
+    }
+
+    if (c == 'x') {
+        if (!isxdigit((unsigned char)s[1])) {
+            if (mode != ESC_ECHO) {
+                out_error(o, "missing hexadecimal number in escape");
+                return ESC_ERROR;
+            }
+            out_put(o, "\\x", 2);
+            *sp = s + 1;
+            return ESC_OK;
+        }
+        unsigned value = 0;
+        int digits = 0;
+        for (s++; digits < 2 && isxdigit((unsigned char)*s); s++, digits++) {
+            value = value * 16 + (isdigit((unsigned char)*s)
+                                      ? (unsigned)(*s - '0')
+                                      : (unsigned)(tolower(*s) - 'a' + 10));
+        }
+        out_char(o, (char)value);
+        *sp = s;
+        return ESC_OK;
+    }
+
+    if (c >= '0' && c <= '7') {
+        if (c == '0' && mode != ESC_FORMAT) {
+            s++; // \0ooo: the leading 0 is not one of the digits
+        }
+        unsigned value = 0;
+        for (int digits = 0; digits < 3 && *s >= '0' && *s <= '7';
+             s++, digits++) {
+            value = value * 8 + (unsigned)(*s - '0');
+        }
+        out_char(o, (char)value);
+        *sp = s;
+        return ESC_OK;
+    }
+
+    // Not an escape: the backslash stands for itself
+    out_char(o, '\\');
+    if (c != '\0') {
+        out_char(o, c);
+        s++;
+    }
+    *sp = s;
+    return ESC_OK;
+}
+
+/*
+ * put_escaped - Write a string, interpreting its backslash escapes
+ */
+static enum esc_result put_escaped(struct out *o, const char *s,
+                                   enum esc_mode mode) {
+    while (*s != '\0') {
+        const char *bs = strchrnul(s, '\\');
+        out_put(o, s, (size_t)(bs - s));
+        if (*bs == '\0') {
+            break;
+        }
+        s = bs + 1;
+        enum esc_result r = put_escape(o, &s, mode);
+        if (r != ESC_OK) {
+            return r;
+        }
+    }
+    return ESC_OK;
+}
+
+/*****************
+ * Utilities
+ *****************/
+
+/*
+ * no_help - Accept anything but a lone --help or --version, which print
+ * the documentation of the external program
+ */
+static bool no_help(int argc, char **argv) {
+    return argc != 2 || (strcmp(argv[1], "--help") != 0 &&
+                         strcmp(argv[1], "--version") != 0);
+}
+
+/*
+ * any_args - Accept any arguments
+ */
+static bool any_args(int argc, char **argv) {
+    return true;
+}
+
+/*
+ * util_true - true
+ */
+static int util_true(int argc, char **argv, int in_fd, int out_fd) {
+    return 0;
+}
+
+/*
+ * util_false - false
+ */
+static int util_false(int argc, char **argv, int in_fd, int out_fd) {
+    return 1;
+}
+
+/*
+ * util_echo - echo [-neE] [string...]
+ */
+static int util_echo(int argc, char **argv, int in_fd, int out_fd) {
+    struct out o = {.fd = out_fd, .name = argv[0]};
+    bool newline = true;
+    bool escapes = false;
+
+    int i = 1;
+    for (; i < argc; i++) {
+        const char *arg = argv[i];
+        if (arg[0] != '-' || arg[1] == '\0' ||
+            arg[1 + strspn(arg + 1, "neE")] != '\0') {
+            break; // the first operand that is not all options
+        }
+        for (const char *p = arg + 1; *p != '\0'; p++) {
+            if (*p == 'n') {
+                newline = false;
+            } else {
+                escapes = *p == 'e';
+            }
+        }
+    }
+
+    for (; i < argc; i++) {
+        if (!escapes) {
+            out_put(&o, argv[i], strlen(argv[i]));
+        } else if (put_escaped(&o, argv[i], ESC_ECHO) == ESC_STOP) {
+            return out_done(&o, 0);
+        }
+        if (i + 1 < argc) {
+            out_char(&o, ' ');
+        }
+    }
+    if (newline) {
+        out_char(&o, '\n');
+    }
+    return out_done(&o, 0);
+}
+
+/*
+ * cat_copy - Copy a descriptor to the output, with sendfile where the kernel
+ * supports it for the pair of files
+ */
+static bool cat_copy(int in_fd, int out_fd) {
+    ssize_t n;
+    bool moved = false;
+    while ((n = sendfile(out_fd, in_fd, NULL, CAT_CHUNK)) > 0) {
+        moved = true;
+        if (loop_interrupted()) {
+            return false;
+        }
+    }
+    if (n == 0) {
+        return true;
+    }
+    if (moved || (errno != EINVAL && errno != ENOSYS)) {
+        return false;
+    }
+
+    char buf[MAXBUF];
+    while ((n = read(in_fd, buf, sizeof(buf))) != 0) {
+        if (loop_interrupted()) {
+            return false;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 || rio_writen(out_fd, buf, (size_t)n) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * cat_accepts - cat with file operands only, no options
+ */
+static bool cat_accepts(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && argv[i][1] != '\0') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * regular_file - Whether a path names a regular file, or nothing at all
+ */
+static bool regular_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) < 0 || S_ISREG(st.st_mode);
+}
+
+/*
+ * cat_may_block - Whether cat reads something other than regular files: the
+ * terminal, a pipe, a FIFO or a device, which may never end
+ */
+static bool cat_may_block(const struct cmdline_tokens *token) {
+    static char *const stdin_only[] = {"-", NULL};
+    char *const *files = token->argc > 1 ? token->argv + 1 : stdin_only;
+    for (; *files != NULL; files++) {
+        const char *file = strcmp(*files, "-") == 0 ? token->infile : *files;
+        if (file == NULL || !regular_file(file)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * util_cat - cat [file...]
+ */
+static int util_cat(int argc, char **argv, int in_fd, int out_fd) {
+    static char *const stdin_only[] = {"-", NULL};
+    char *const *files = argc > 1 ? argv + 1 : stdin_only;
+    int status = 0;
+
+    for (; *files != NULL; files++) {
+        const char *file = *files;
+        bool is_stdin = strcmp(file, "-") == 0;
+        int fd = is_stdin ? in_fd : open(file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            sio_eprintf("%s: %s: %s\n", argv[0], file, strerror(errno));
+            status = 1;
+            continue;
+        }
+        errno = 0;
+        if (!cat_copy(fd, out_fd) && !loop_interrupted()) {
+            sio_eprintf("%s: %s: %s\n", argv[0], file, strerror(errno));
+            status = 1;
+        }
+        if (!is_stdin) {
+            close(fd);
+        }
+        if (loop_interrupted()) {
+            return 1; // Ctrl-C, as there is no job to forward it to
+        }
+    }
+    return status;
+}
+
+/*
+ * printf_conversion - Parse the directive at s, just after its '%', as
+ * coreutils printf does. Returns a pointer past the directive, or NULL if
+ * the directive is not valid.
+ */
+static const char *printf_conversion(const char *s, bool *star_width,
+                                     bool *star_precision, size_t *spec_len,
+                                     char *conv) {
+    char ok[UCHAR_MAX + 1] = {0};
+    const char *start = s;
+    for (const char *p = "aAcdeEfFgGiosuxX"; *p != '\0'; p++) {
+        ok[(unsigned char)*p] = 1;
+    }
+
+    for (;; s++) {
+        if (*s == '\'') {
+            ok['a'] = ok['A'] = ok['c'] = ok['e'] = ok['E'] = 0;
+            ok['o'] = ok['s'] = ok['x'] = ok['X'] = 0;
+        } else if (*s == '#') {
+            ok['c'] = ok['d'] = ok['i'] = ok['s'] = ok['u'] = 0;
+        } else if (*s == '0') {
+            ok['c'] = ok['s'] = 0;
+        } else if (*s != '-' && *s != '+' && *s != ' ') {
+            break;
+        }
+    }
+    if ((*star_width = *s == '*')) {
+        s++;
+    } else {
+        s += strspn(s, "0123456789");
+    }
+    *star_precision = false;
+    if (*s == '.') {
+        ok['c'] = 0;
+        s++;
+        if ((*star_precision = *s == '*')) {
+            s++;
+        } else {
+            s += strspn(s, "0123456789");
+        }
+    }
+    *spec_len = (size_t)(s - start);
+    s += strspn(s, "lLhjtz"); // length modifiers are ignored
+    *conv = *s;
+    return ok[(unsigned char)*s] ? s + 1 : NULL;
+}
+
+/*
+ * printf_accepts - printf with a valid format that needs no unsupported
+ * conversion or escape
+ */
+static bool printf_accepts(int argc, char **argv) {
+    int first = argc > 1 && strcmp(argv[1], "--") == 0 ? 2 : 1;
+    if (argc <= first || (first == 1 && argv[1][0] == '-')) {
+        return false;
+    }
+    for (int i = first; i < argc; i++) {
+        if (strstr(argv[i], "\\u") != NULL || strstr(argv[i], "\\U") != NULL) {
+            return false;
+        }
+    }
+
+    for (const char *f = argv[first]; (f = strchr(f, '%')) != NULL;) {
+        f++;
+        if (*f == '%' || *f == 'b') {
+            f++;
+            continue;
+        }
+        bool star_width, star_precision;
+        size_t len;
+        char conv;
+        if ((f = printf_conversion(f, &star_width, &star_precision, &len,
+                                   &conv)) == NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * printf_check - Report a numeric argument that was not fully converted
+ */
+static void printf_check(struct out *o, const char *arg, const char *end,
+                         int *status) {
+    if (errno != 0) {
+        out_error(o, "'%s': %s", arg, strerror(errno));
+        *status = 1;
+    } else if (*end != '\0') {
+        out_error(o, "'%s': %s", arg,
+                  end == arg ? "expected a numeric value"
+                             : "value not completely converted");
+        *status = 1;
+    }
+}
+
+/*
+ * printf_char_constant - Whether arg is a character constant ('c or "c), in
+ * which case its value is the code of the character
+ */
+static bool printf_char_constant(struct out *o, const char *arg,
+                                 intmax_t *value) {
+    if (arg[0] != '\'' && arg[0] != '"') {
+        return false;
+    }
+    *value = (unsigned char)arg[1];
+    if (arg[1] != '\0' && arg[2] != '\0') {
+        out_error(o,
+                  "warning: %s: character(s) following character constant "
+                  "have been ignored",
+                  arg + 2);
+    }
+    return true;
+}
+
+/*
+ * printf_intmax - Parse a signed integer argument
+ */
+static intmax_t printf_intmax(struct out *o, const char *arg, int *status) {
+    intmax_t value;
+    if (printf_char_constant(o, arg, &value)) {
+        return value;
+    }
+    char *end;
+    errno = 0;
+    value = strtoimax(arg, &end, 0);
+    printf_check(o, arg, end, status);
+    return value;
+}
+
+/*
+ * printf_uintmax - Parse an unsigned integer argument
+ */
+static uintmax_t printf_uintmax(struct out *o, const char *arg, int *status) {
+    intmax_t c;
+    if (printf_char_constant(o, arg, &c)) {
+        return (uintmax_t)c;
+    }
+    char *end;
+    errno = 0;
+    uintmax_t value = strtoumax(arg, &end, 0);
+    printf_check(o, arg, end, status);
+    return value;
+}
+
+/*
+ * printf_double - Parse a floating point argument
+ */
+static long double printf_double(struct out *o, const char *arg, int *status) {
+    intmax_t c;
+    if (printf_char_constant(o, arg, &c)) {
+        return (long double)c;
+    }
+    char *end;
+    errno = 0;
+    long double value = strtold(arg, &end);
+    printf_check(o, arg, end, status);
+    return value;
+}
+
+/*
+ * Format one value with a directive, passing the * field width and precision
+ * where the directive has them
+ */
+#define PRINTF_VALUE(o, spec, star_width, star_precision, width, precision,   \
+                     value)                                                    \
+    do {                                                                       \
+        char *str_;                                                            \
+        int len_;                                                              \
+        if ((star_width) && (star_precision)) {                                \
+            len_ = asprintf(&str_, spec, width, precision, value);             \
+        } else if (star_width) {                                               \
+            len_ = asprintf(&str_, spec, width, value);                        \
+        } else if (star_precision) {                                           \
+            len_ = asprintf(&str_, spec, precision, value);                    \
+        } else {                                                               \
+            len_ = asprintf(&str_, spec, value);                               \
+        }                                                                      \
+        if (len_ >= 0) {                                                       \
+            out_put(o, str_, (size_t)len_);                                    \
+            free(str_);                                                        \
+        }                                                                      \
+    } while (0)
+
+/*
+ * printf_star - Parse the argument of a * field width or precision
+ */
+static int printf_star(struct out *o, char ***args, int *nargs, int *status) {
+    if (*nargs == 0) {
+        return 0;
+    }
+    (*nargs)--;
+    intmax_t value = printf_intmax(o, *(*args)++, status);
+    return value < INT_MIN ? INT_MIN : value > INT_MAX ? INT_MAX : (int)value;
+}
+
+/*
+ * printf_format - Output the format once. Returns the number of arguments
+ * used, or -1 if output must stop.
+ */
+static int printf_format(struct out *o, const char *format, char **args,
+                         int nargs, int *status) {
+    int before = nargs;
+    const char *f = format;
+
+    while (*f != '\0') {
+        const char *stop = strpbrk(f, "%\\");
+        if (stop == NULL) {
+            out_put(o, f, strlen(f));
+            break;
+        }
+        out_put(o, f, (size_t)(stop - f));
+        f = stop + 1;
+
+        if (*stop == '\\') {
+            enum esc_result r = put_escape(o, &f, ESC_FORMAT);
+            if (r != ESC_OK) {
+                *status |= r == ESC_ERROR;
+                return -1;
+            }
+            continue;
+        }
+        if (*f == '%') {
+            out_char(o, '%');
+            f++;
+            continue;
+        }
+        if (*f == 'b') {
+            f++;
+            if (nargs > 0) {
+                nargs--;
+                enum esc_result r = put_escaped(o, *args++, ESC_ARG);
+                if (r != ESC_OK) {
+                    *status |= r == ESC_ERROR;
+                    return -1;
+                }
+            }
+            continue;
+        }
+
+        // %[flags][width][.precision]conversion, validated by printf_accepts
+        bool star_width, star_precision;
+        size_t len;
+        char conv;
+        const char *directive = f;
+        f = printf_conversion(f, &star_width, &star_precision, &len, &conv);
+        int width = star_width ? printf_star(o, &args, &nargs, status) : 0;
+        int precision = -1;
+        if (star_precision) {
+            precision = printf_star(o, &args, &nargs, status);
+            precision = precision < 0 ? -1 : precision;
+        }
+        const char *arg = "";
+        if (nargs > 0) {
+            nargs--;
+            arg = *args++;
+        }
+
+        char spec[len + 4];
+        spec[0] = '%';
+        memcpy(spec + 1, directive, len);
+        char *end = spec + 1 + len;
+        switch (conv) {
+        case 'd':
+        case 'i':
+            *end++ = 'j';
+            *end++ = conv;
+            *end = '\0';
+            PRINTF_VALUE(o, spec, star_width, star_precision, width, precision,
+                         printf_intmax(o, arg, status));
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            *end++ = 'j';
+            *end++ = conv;
+            *end = '\0';
+            PRINTF_VALUE(o, spec, star_width, star_precision, width, precision,
+                         printf_uintmax(o, arg, status));
+            break;
+        case 'c':
+            *end++ = 'c';
+            *end = '\0';
+            PRINTF_VALUE(o, spec, star_width, star_precision, width, precision,
+                         arg[0]);
+            break;
+        case 's':
+            *end++ = 's';
+            *end = '\0';
+            PRINTF_VALUE(o, spec, star_width, star_precision, width, precision,
+                         arg);
+            break;
+        default: // floating point
+            *end++ = 'L';
+            *end++ = conv;
+            *end = '\0';
+            PRINTF_VALUE(o, spec, star_width, star_precision, width, precision,
+                         printf_double(o, arg, status));
+            break;
+        }
+    }
+    return before - nargs;
+}
+
+/*
+ * util_printf - printf format [argument...]
+ */
+static int util_printf(int argc, char **argv, int in_fd, int out_fd) {
+    struct out o = {.fd = out_fd, .name = argv[0]};
+    int status = 0;
+    int first = strcmp(argv[1], "--") == 0 ? 2 : 1;
+    const char *format = argv[first];
+    char **args = argv + first + 1;
+    int nargs = argc - first - 1;
+
+    int used;
+    do {
+        if ((used = printf_format(&o, format, args, nargs, &status)) < 0) {
+            return out_done(&o, status);
+        }
+        args += used;
+        nargs -= used;
+    } while (used > 0 && nargs > 0);
+
+    if (nargs > 0) {
+        out_error(&o, "warning: ignoring excess arguments, starting with '%s'",
+                  *args);
+    }
+    return out_done(&o, status);
+}
+
+/*****************
+ * Registry
+ *****************/
+
+/* Every command the shell runs itself, sorted by name */
+static const struct builtin builtins[] = {
+    {"after", BUILTIN_AFTER, NULL, NULL, NULL, false},
+    {"bg", BUILTIN_BG, NULL, NULL, NULL, false},
+    {"cat", BUILTIN_UTIL, util_cat, cat_accepts, cat_may_block, false},
+    {"dag", BUILTIN_UTIL, dag_run, any_args, NULL, true},
+    {"echo", BUILTIN_UTIL, util_echo, no_help, NULL, false},
+    {"false", BUILTIN_UTIL, util_false, no_help, NULL, false},
+    {"fg", BUILTIN_FG, NULL, NULL, NULL, false},
+    {"hash", BUILTIN_HASH, NULL, NULL, NULL, false},
+    {"history", BUILTIN_HISTORY, NULL, NULL, NULL, false},
+    {"jobs", BUILTIN_JOBS, NULL, NULL, NULL, false},
+    {"parallel", BUILTIN_UTIL, parallel_run, any_args, NULL, true},
+    {"perfstat", BUILTIN_PERFSTAT, NULL, NULL, NULL, false},
+    {"printf", BUILTIN_UTIL, util_printf, printf_accepts, NULL, false},
+    {"prio", BUILTIN_PRIO, NULL, NULL, NULL, false},
+    {"quit", BUILTIN_QUIT, NULL, NULL, NULL, false},
+    {"stats", BUILTIN_STATS, NULL, NULL, NULL, false},
+    {"time", BUILTIN_TIME, NULL, NULL, NULL, false},
+    {"true", BUILTIN_UTIL, util_true, no_help, NULL, false},
+    {"wait", BUILTIN_WAIT, NULL, NULL, NULL, false},
+};
+
+/*
+ * compare_name - bsearch comparator of a name against a registry entry
+ */
+static int compare_name(const void *key, const void *entry) {
+    return strcmp(key, ((const struct builtin *)entry)->name);
+}
+
+/*
+ * find - Look up the registry entry of a name
+ */
+static const struct builtin *find(const char *name) {
+    return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                   sizeof(builtins[0]), compare_name);
+}
+
+/*
+ * builtin_util_name - The name of a standard utility in argv[0]: its bare
+ * name, or its path in /bin or /usr/bin
+ * Async-signal-safe
+ */
+const char *builtin_util_name(const char *argv0) {
+    static const char *const dirs[] = {"/bin/", "/usr/bin/"};
+    const char *name = argv0;
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        size_t len = strlen(dirs[i]);
+        if (strncmp(argv0, dirs[i], len) == 0) {
+            name = argv0 + len;
+            break;
+        }
+    }
+    return strchr(name, '/') == NULL ? name : NULL;
+}
+
+/*
+ * find_util - Look up the utility named by argv[0]. Those that are always a
+ * job of their own have no program in /bin or /usr/bin to stand in for, and
+ * are only found by their bare name.
+ */
+static const struct builtin *find_util(const char *argv0) {
+    const struct builtin *b = find(argv0);
+    if (b != NULL && b->job) {
+        return b;
+    }
+    const char *name = builtin_util_name(argv0);
+    if (name == NULL) {
+        return NULL;
+    }
+    b = find(name);
+    return b != NULL && b->run != NULL && !b->job ? b : NULL;
+}
+
+/*
+ * builtin_lookup - Look up how the shell should run a command
+ * Async-signal-safe
+ */
+builtin_state builtin_lookup(int argc, char **argv) {
+    const struct builtin *b = find(argv[0]);
+    if (b != NULL && b->run == NULL) {
+        return b->state;
+    }
+    b = find_util(argv[0]);
+    if (b == NULL || (builtin_external && !b->job) ||
+        !b->accepts(argc, argv)) {
+        return BUILTIN_NONE;
+    }
+    return BUILTIN_UTIL;
+}
+
+/*
+ * builtin_util_inline - Whether a utility can run in the shell process
+ * Async-signal-safe
+ */
+bool builtin_util_inline(const struct cmdline_tokens *token) {
+    const struct builtin *b = find_util(token->argv[0]);
+    if (b->job) {
+        return false;
+    }
+    return b->may_block == NULL || !b->may_block(token);
+}
+
+/*
+ * builtin_util_run - Run an in-process utility
+ * Not async-signal-safe
+ */
+int builtin_util_run(int argc, char **argv, int in_fd, int out_fd) {
+    return find_util(argv[0])->run(argc, argv, in_fd, out_fd);
+}
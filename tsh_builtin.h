@@ -0,0 +1,82 @@
+/**
+ * @file tsh_builtin.h
+ * @brief Registry of builtin commands and in-process utilities
+ *
+ * Every command name the shell handles itself is listed in one table, kept
+ * sorted by name and searched with bsearch. Besides the job control
+ * builtins (`quit`, `jobs`, `bg`, `fg`, `hash`), the table holds in-process
+ * versions of a few hot utilities: `echo`, `true`, `false`, `cat` and
+ * `printf`. They are recognized by their bare name, or by their path under
+ * /bin or /usr/bin, and produce the same bytes as the coreutils programs,
+ * so running them does not need a fork or an exec.
+ *
+ * A utility is only run in-process for the arguments it fully supports
+ * (e.g. `cat` without options); anything else, and every utility when
+ * `builtin_external` is set, is left to the external program. A utility
+ * that runs in the background, or that would read the shell's own stdin,
+ * runs in a forked child instead, so that it is a job like any other.
+ */
+
+#ifndef TSH_BUILTIN_H
+#define TSH_BUILTIN_H
+
+#include "tsh_helper.h"
+
+#include <stdbool.h>
+
+/* Defined in tsh_builtin.c */
+extern bool builtin_external; ///< Never run utilities in-process
+
+/**
+ * @brief Looks up how the shell should run a command.
+ *
+ * @param[in] argc  The number of arguments of the command.
+ * @param[in] argv  The arguments; argv[0] is the command name.
+ *
+ * @return The builtin for argv[0]; `BUILTIN_UTIL` for an in-process utility
+ *         that supports these arguments; `BUILTIN_NONE` for anything else.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+builtin_state builtin_lookup(int argc, char **argv);
+
+/**
+ * @brief Returns whether a utility found by `builtin_lookup` can run in the
+ * shell process itself, i.e. it only reads regular files, which cannot
+ * block it indefinitely.
+ *
+ * @param[in] token  A command line whose `builtin` is `BUILTIN_UTIL`.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool builtin_util_inline(const struct cmdline_tokens *token);
+
+/**
+ * @brief Returns the name of the standard utility a command runs: `argv[0]`
+ * itself if it is a bare name, or its last component if it is in `/bin` or
+ * `/usr/bin`.
+ *
+ * @param[in] argv0  The first word of a command.
+ * @return The name, within `argv0`, or NULL for a program elsewhere, which
+ *         the shell must not stand in for.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+const char *builtin_util_name(const char *argv0);
+
+/**
+ * @brief Runs an in-process utility.
+ *
+ * @param[in] argc    The number of arguments.
+ * @param[in] argv    The arguments, naming a utility for which
+ *                    `builtin_lookup` returned `BUILTIN_UTIL`.
+ * @param[in] in_fd   Descriptor to read standard input from.
+ * @param[in] out_fd  Descriptor to write standard output to.
+ *
+ * @return The exit status the external program would have had.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int builtin_util_run(int argc, char **argv, int in_fd, int out_fd);
+
+#endif /* TSH_BUILTIN_H */
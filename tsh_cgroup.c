@@ -0,0 +1,604 @@
+/**
+ * @file tsh_cgroup.c
+ * @brief One cgroup v2 per job (tsh --cgroup)
+ *
+ * See tsh_cgroup.h. Every cgroup created for a job has an entry in `cgroups`
+ * until its directory is removed: it is pending between cgroup_create and
+ * cgroup_assign, belongs to a job after that, and is stale once the job is
+ * done but processes are still left in it, e.g. after cgroup.kill until the
+ * kernel has finished them. Stale cgroups are removed by the next
+ * cgroup_create. The control files are read and written with openat, read
+ * and write only, relative to the descriptor of the cgroup, so that jobs can
+ * be signalled and listed with signals blocked.
+ *
+ * A stopped job is only frozen if some process in it would otherwise keep
+ * running. The processes that were sent SIGTSTP with the one that reported
+ * the stop may not have acted on it yet, and freezing them first would
+ * leave them frozen but not stopped, so they are told apart by the stop
+ * signals pending in /proc/PID/status.
+ */
+
+#include "tsh_cgroup.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#define NAME_SIZE 32    // Room for "tsh-PID" or "jobN"
+#define STAT_SIZE 4096  // Enough for cpu.stat, memory.peak or io.stat
+#define PROCS_CHUNK 512 // Bytes of cgroup.procs read at once
+
+/* Signals that stop a process, as bits of /proc/PID/status */
+#define STOP_SIGNALS                                                          \
+    (1ul << (SIGSTOP - 1) | 1ul << (SIGTSTP - 1) | 1ul << (SIGTTIN - 1) |     \
+     1ul << (SIGTTOU - 1))
+
+/* The cgroup of a job */
+struct job_cgroup {
+    jid_t jid;    // The job, or 0 while pending or stale
+    int fd;       // Descriptor of its directory, or -1 once stale
+    unsigned seq; // N in its name, jobN
+    bool frozen;  // cgroup.freeze was set by cgroup_freeze
+};
+
+/* Called on each process of a cgroup by for_procs */
+typedef bool proc_fn(pid_t pid, const void *arg);
+
+/* A signal sent to a job, whose process group has already received it */
+struct job_signal {
+    pid_t pgid; // The process group of the job
+    int sig;    // The signal
+};
+
+/* Global variables */
+bool cgroup_enabled = false; // Jobs are started in cgroups of their own
+
+/* Static variables */
+static int parent_fd = -1;                // The delegated directory
+static int shell_fd = -1;                 // The cgroup of the shell, tsh-PID
+static char shell_name[NAME_SIZE];        // Its name in parent_fd
+static struct job_cgroup *cgroups = NULL; // Job cgroups, in creation order
+static int ncgroups = 0;                  // Entries used in cgroups
+static int cgroups_cap = 0;               // Allocated entries of cgroups
+static unsigned next_seq = 1;             // Sequence number of the next one
+
+/* Controllers enabled for the job cgroups, when the parent has them */
+static const char *const controllers[] = {"+cpu", "+memory", "+io"};
+
+/*
+ * put_uint - Write an unsigned number in decimal, returning the end
+ * Async-signal-safe
+ */
+static char *put_uint(char *out, unsigned long value) {
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    while (n > 0) {
+        *out++ = digits[--n];
+    }
+    *out = '\0';
+    return out;
+}
+
+/*
+ * job_name - The name of the cgroup of a job, jobN
+ * Async-signal-safe
+ */
+static void job_name(char *name, unsigned seq) {
+    memcpy(name, "job", 3);
+    put_uint(name + 3, seq);
+}
+
+/*
+ * write_file - Write a string to a control file of a cgroup
+ * Async-signal-safe
+ */
+static bool write_file(int dirfd, const char *file, const char *text) {
+    int fd = openat(dirfd, file, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    size_t len = strlen(text);
+    bool ok = write(fd, text, len) == (ssize_t)len;
+    close(fd);
+    return ok;
+}
+
+/*
+ * read_file - Read a control file of a cgroup into a NUL-terminated buffer.
+ * Returns false if it is missing, i.e. its controller is not enabled.
+ * Async-signal-safe
+ */
+static bool read_file(int dirfd, const char *file, char *buf, size_t size) {
+    int fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    return true;
+}
+
+/*
+ * parse_uint - Parse the decimal number at the start of a string
+ * Async-signal-safe
+ */
+static uint64_t parse_uint(const char *p) {
+    uint64_t value = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        value = value * 10 + (uint64_t)(*p - '0');
+    }
+    return value;
+}
+
+/*
+ * find_key - The value of `key value` in a flat-keyed file such as cpu.stat
+ * Async-signal-safe
+ */
+static bool find_key(const char *text, const char *key, uint64_t *value) {
+    size_t len = strlen(key);
+    for (const char *line = text; *line != '\0';) {
+        if (strncmp(line, key, len) == 0 && line[len] == ' ') {
+            *value = parse_uint(line + len + 1);
+            return true;
+        }
+        const char *end = strchr(line, '\n');
+        if (end == NULL) {
+            break;
+        }
+        line = end + 1;
+    }
+    return false;
+}
+
+/*
+ * find_cgroup - The entry of the cgroup of a job, or NULL
+ * Async-signal-safe
+ */
+static struct job_cgroup *find_cgroup(jid_t jid) {
+    for (int i = 0; i < ncgroups; i++) {
+        if (cgroups[i].jid == jid && cgroups[i].fd >= 0) {
+            return &cgroups[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * release - Close the cgroup of an entry and remove its directory. The
+ * entry is dropped, or kept as stale if processes are still left in it.
+ * Async-signal-safe
+ */
+static void release(int i) {
+    char name[NAME_SIZE];
+    struct job_cgroup *cg = &cgroups[i];
+    if (cg->fd >= 0) {
+        close(cg->fd);
+        cg->fd = -1;
+    }
+    cg->jid = 0;
+
+    job_name(name, cg->seq);
+    if (unlinkat(shell_fd, name, AT_REMOVEDIR) == 0 || errno == ENOENT) {
+        cgroups[i] = cgroups[--ncgroups];
+    }
+}
+
+/*
+ * sweep - Remove the stale cgroups whose processes have gone
+ * Async-signal-safe
+ */
+static void sweep(void) {
+    for (int i = ncgroups - 1; i >= 0; i--) {
+        if (cgroups[i].fd < 0) {
+            release(i);
+        }
+    }
+}
+
+/*
+ * cgroup_init - Create the cgroup of the shell in a delegated directory
+ * Not async-signal-safe
+ */
+bool cgroup_init(const char *dir) {
+    struct statfs fs;
+    if (statfs(dir, &fs) < 0) {
+        perror(dir);
+        return false;
+    }
+    if (fs.f_type != CGROUP2_SUPER_MAGIC) {
+        fprintf(stderr, "%s: Not a cgroup v2 directory\n", dir);
+        return false;
+    }
+    parent_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (parent_fd < 0) {
+        perror(dir);
+        return false;
+    }
+
+    snprintf(shell_name, sizeof(shell_name), "tsh-%d", (int)getpid());
+    if (mkdirat(parent_fd, shell_name, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "%s/%s: %s\n", dir, shell_name, strerror(errno));
+        close(parent_fd);
+        parent_fd = -1;
+        return false;
+    }
+    shell_fd =
+        openat(parent_fd, shell_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (shell_fd < 0) {
+        fprintf(stderr, "%s/%s: %s\n", dir, shell_name, strerror(errno));
+        unlinkat(parent_fd, shell_name, AT_REMOVEDIR);
+        close(parent_fd);
+        parent_fd = -1;
+        return false;
+    }
+
+    // The shell stays out of its cgroup, which therefore has no processes of
+    // its own and may enable controllers for its children
+    for (size_t i = 0; i < sizeof(controllers) / sizeof(controllers[0]);
+         i++) {
+        write_file(parent_fd, "cgroup.subtree_control", controllers[i]);
+        if (!write_file(shell_fd, "cgroup.subtree_control", controllers[i]) &&
+            verbose) {
+            fprintf(stderr, "cgroup_init: %s unavailable\n",
+                    controllers[i] + 1);
+        }
+    }
+    cgroup_enabled = true;
+    return true;
+}
+
+/*
+ * cgroup_destroy - Remove the cgroup of the shell
+ * Not async-signal-safe
+ */
+void cgroup_destroy(void) {
+    if (!cgroup_enabled) {
+        return;
+    }
+    for (int i = ncgroups - 1; i >= 0; i--) {
+        release(i);
+    }
+    unlinkat(parent_fd, shell_name, AT_REMOVEDIR); // EBUSY if jobs remain
+    close(shell_fd);
+    close(parent_fd);
+    free(cgroups);
+    cgroups = NULL;
+    ncgroups = cgroups_cap = 0;
+    cgroup_enabled = false;
+}
+
+/*
+ * cgroup_create - Create a cgroup for a job about to be started
+ * Not async-signal-safe
+ */
+int cgroup_create(void) {
+    char name[NAME_SIZE];
+    if (!cgroup_enabled) {
+        return -1;
+    }
+    sweep();
+    if (ncgroups == cgroups_cap) {
+        int cap = cgroups_cap == 0 ? 16 : 2 * cgroups_cap;
+        struct job_cgroup *bigger =
+            realloc(cgroups, (size_t)cap * sizeof(*bigger));
+        if (bigger == NULL) {
+            return -1;
+        }
+        cgroups = bigger;
+        cgroups_cap = cap;
+    }
+
+    unsigned seq = next_seq++;
+    job_name(name, seq);
+    if (mkdirat(shell_fd, name, 0755) < 0) {
+        if (verbose) {
+            perror("cgroup_create: mkdir");
+        }
+        return -1;
+    }
+    int fd = openat(shell_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        if (verbose) {
+            perror("cgroup_create: open");
+        }
+        unlinkat(shell_fd, name, AT_REMOVEDIR);
+        return -1;
+    }
+
+    struct job_cgroup *cg = &cgroups[ncgroups++];
+    cg->jid = 0;
+    cg->fd = fd;
+    cg->seq = seq;
+    cg->frozen = false;
+    return fd;
+}
+
+/*
+ * cgroup_join - Move a process into a cgroup
+ * Async-signal-safe
+ */
+bool cgroup_join(int fd, pid_t pid) {
+    char text[24];
+    int olderrno = errno;
+    put_uint(text, (unsigned long)pid);
+    bool ok = write_file(fd, "cgroup.procs", text);
+    errno = olderrno;
+    return ok;
+}
+
+/*
+ * cgroup_assign - Record the cgroup created for a job
+ * Async-signal-safe
+ */
+void cgroup_assign(int fd, jid_t jid) {
+    for (int i = 0; i < ncgroups && fd >= 0; i++) {
+        if (cgroups[i].fd == fd) {
+            cgroups[i].jid = jid;
+            return;
+        }
+    }
+}
+
+/*
+ * cgroup_discard - Remove a cgroup that no job was given
+ * Async-signal-safe
+ */
+void cgroup_discard(int fd) {
+    int olderrno = errno;
+    for (int i = 0; i < ncgroups && fd >= 0; i++) {
+        if (cgroups[i].fd == fd) {
+            release(i);
+            break;
+        }
+    }
+    errno = olderrno;
+}
+
+/*
+ * for_procs - Call a function on every process listed in cgroup.procs, until
+ * it returns false. The file is read in chunks, so a PID may be split across
+ * two reads. Returns false if the function did.
+ * Async-signal-safe
+ */
+static bool for_procs(int dirfd, proc_fn *fn, const void *arg) {
+    int fd = openat(dirfd, "cgroup.procs", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return true;
+    }
+    char buf[PROCS_CHUNK];
+    pid_t pid = 0;
+    bool more = true;
+    ssize_t n;
+    while (more && (n = read(fd, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; more && i < n; i++) {
+            if (buf[i] >= '0' && buf[i] <= '9') {
+                pid = pid * 10 + (buf[i] - '0');
+            } else if (pid != 0) {
+                more = fn(pid, arg);
+                pid = 0;
+            }
+        }
+    }
+    if (more && pid != 0) {
+        more = fn(pid, arg);
+    }
+    close(fd);
+    return more;
+}
+
+/*
+ * send_outside - Send a signal to a process that left the process group of
+ * its job, for for_procs
+ * Async-signal-safe
+ */
+static bool send_outside(pid_t pid, const void *arg) {
+    const struct job_signal *js = arg;
+    if (getpgid(pid) != js->pgid) {
+        kill(pid, js->sig);
+    }
+    return true;
+}
+
+/*
+ * signal_job - Send a signal to the process group of a job, then to the
+ * processes of its cgroup outside that group. The group receives it at
+ * once, as it would without a cgroup.
+ * Async-signal-safe
+ */
+static void signal_job(struct job_cgroup *cg, int sig) {
+    struct job_signal js = {job_get_pid(cg->jid), sig};
+    kill(-js.pgid, sig);
+    for_procs(cg->fd, send_outside, &js);
+}
+
+/*
+ * hex_field - The hexadecimal value of a field of /proc/PID/status, or 0
+ * Async-signal-safe
+ */
+static unsigned long hex_field(const char *text, const char *key) {
+    const char *p = strstr(text, key);
+    unsigned long value = 0;
+    if (p == NULL) {
+        return 0;
+    }
+    for (p += strlen(key);; p++) {
+        if (*p >= '0' && *p <= '9') {
+            value = value << 4 | (unsigned long)(*p - '0');
+        } else if (*p >= 'a' && *p <= 'f') {
+            value = value << 4 | (unsigned long)(*p - 'a' + 10);
+        } else {
+            return value;
+        }
+    }
+}
+
+/*
+ * is_stopping - Whether a process is stopped, or has a stop signal pending
+ * that it will act on once it runs, for for_procs. A process that exited
+ * meanwhile counts as stopped.
+ * Async-signal-safe
+ */
+static bool is_stopping(pid_t pid, const void *unused) {
+    char path[NAME_SIZE];
+    char buf[STAT_SIZE];
+    memcpy(path, "/proc/", 6);
+    char *end = put_uint(path + 6, (unsigned long)pid);
+    memcpy(end, "/status", sizeof("/status"));
+    if (!read_file(AT_FDCWD, path, buf, sizeof(buf))) {
+        return true;
+    }
+
+    const char *state = strstr(buf, "\nState:\t");
+    if (state != NULL && state[8] != '\0' && strchr("TtZX", state[8])) {
+        return true;
+    }
+    unsigned long pending =
+        hex_field(buf, "\nSigPnd:\t") | hex_field(buf, "\nShdPnd:\t");
+    return (pending & STOP_SIGNALS) != 0;
+}
+
+/*
+ * cgroup_signal - Send a signal to every process of a job
+ * Async-signal-safe
+ */
+bool cgroup_signal(jid_t jid, int sig) {
+    struct job_cgroup *cg = find_cgroup(jid);
+    if (cg == NULL) {
+        return false;
+    }
+    int olderrno = errno;
+    if (sig != SIGKILL || !write_file(cg->fd, "cgroup.kill", "1")) {
+        signal_job(cg, sig);
+    }
+    errno = olderrno;
+    return true;
+}
+
+/*
+ * cgroup_freeze - Freeze the cgroup of a stopped job if processes in it
+ * would keep running
+ * Async-signal-safe
+ */
+bool cgroup_freeze(jid_t jid) {
+    struct job_cgroup *cg = find_cgroup(jid);
+    if (cg == NULL) {
+        return false;
+    }
+    int olderrno = errno;
+    bool ok = true;
+    if (!for_procs(cg->fd, is_stopping, NULL)) {
+        ok = cg->frozen = write_file(cg->fd, "cgroup.freeze", "1");
+    }
+    errno = olderrno;
+    return ok;
+}
+
+/*
+ * cgroup_resume - Thaw the cgroup of a job and continue its processes
+ * Async-signal-safe
+ */
+bool cgroup_resume(jid_t jid) {
+    struct job_cgroup *cg = find_cgroup(jid);
+    if (cg == NULL) {
+        return false;
+    }
+    int olderrno = errno;
+    if (cg->frozen) {
+        write_file(cg->fd, "cgroup.freeze", "0");
+        cg->frozen = false;
+    }
+    signal_job(cg, SIGCONT);
+    errno = olderrno;
+    return true;
+}
+
+/*
+ * cgroup_job_done - Release the cgroup of a job that is done
+ * Async-signal-safe
+ */
+void cgroup_job_done(jid_t jid, bool killed) {
+    struct job_cgroup *cg = find_cgroup(jid);
+    if (cg == NULL) {
+        return;
+    }
+    int olderrno = errno;
+    if (killed) {
+        write_file(cg->fd, "cgroup.kill", "1");
+    }
+    release((int)(cg - cgroups));
+    errno = olderrno;
+}
+
+/*
+ * cgroup_print - Buffer the accounting of the cgroup of a job
+ * Async-signal-safe
+ */
+bool cgroup_print(sio_t *out, const char *prefix, jid_t jid) {
+    static const char *const cpu_keys[] = {"usage_usec", "user_usec",
+                                           "system_usec"};
+    static const char *const io_keys[] = {"rbytes", "wbytes", "rios", "wios"};
+    struct job_cgroup *cg = find_cgroup(jid);
+    char buf[STAT_SIZE];
+    uint64_t value;
+    if (cg == NULL) {
+        return true;
+    }
+
+    int olderrno = errno;
+    bool ok = sio_printfb(out, "%scgroup", prefix) >= 0;
+    if (read_file(cg->fd, "cpu.stat", buf, sizeof(buf))) {
+        for (size_t k = 0; k < sizeof(cpu_keys) / sizeof(cpu_keys[0]); k++) {
+            if (find_key(buf, cpu_keys[k], &value)) {
+                ok &= sio_printfb(out, " cpu.%s %lu", cpu_keys[k],
+                                  (unsigned long)value) >= 0;
+            }
+        }
+    }
+    if (read_file(cg->fd, "memory.peak", buf, sizeof(buf))) {
+        ok &= sio_printfb(out, " memory.peak %luKiB",
+                          (unsigned long)(parse_uint(buf) / 1024)) >= 0;
+    }
+
+    // One line per device: MAJ:MIN rbytes=N wbytes=N rios=N wios=N ...
+    if (read_file(cg->fd, "io.stat", buf, sizeof(buf))) {
+        uint64_t sums[sizeof(io_keys) / sizeof(io_keys[0])] = {0};
+        for (const char *p = buf; (p = strchr(p, '=')) != NULL; p++) {
+            const char *key = p;
+            while (key > buf && key[-1] != ' ') {
+                key--;
+            }
+            for (size_t k = 0; k < sizeof(io_keys) / sizeof(io_keys[0]);
+                 k++) {
+                size_t len = strlen(io_keys[k]);
+                if ((size_t)(p - key) == len &&
+                    strncmp(key, io_keys[k], len) == 0) {
+                    sums[k] += parse_uint(p + 1);
+                }
+            }
+        }
+        for (size_t k = 0; k < sizeof(io_keys) / sizeof(io_keys[0]); k++) {
+            ok &= sio_printfb(out, " io.%s %lu", io_keys[k],
+                              (unsigned long)sums[k]) >= 0;
+        }
+    }
+    ok &= sio_printfb(out, "\n") >= 0;
+    errno = olderrno;
+    return ok;
+}
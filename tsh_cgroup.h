@@ -0,0 +1,170 @@
+/**
+ * @file tsh_cgroup.h
+ * @brief One cgroup v2 per job (tsh --cgroup)
+ *
+ * With `--cgroup DIR`, where DIR is a cgroup v2 directory delegated to the
+ * user, the shell creates `DIR/tsh-PID` for itself and, for every job it
+ * starts, a cgroup `jobN` below it. The processes of the job are created in
+ * that cgroup with clone3(CLONE_INTO_CGROUP), or join it from the child
+ * before execve with the engines that run code there (see tsh_spawn.c).
+ * Everything the job starts stays in the cgroup, even after setsid or
+ * setpgid, so the cgroup gives the shell the whole job:
+ *
+ *   - signals are sent to every process in `cgroup.procs`, not only to the
+ *     process group of the job;
+ *   - once the job is reported stopped, e.g. by Ctrl-Z, its cgroup is
+ *     frozen (`cgroup.freeze`), so that the processes that catch or ignore
+ *     SIGTSTP stop as well, and `fg` and `bg` thaw it before SIGCONT;
+ *   - a job terminated by a signal has the rest of its processes killed
+ *     with `cgroup.kill`;
+ *   - `jobs -v` shows the `cpu.stat`, `memory.peak` and `io.stat` of each
+ *     job, as far as the controllers enabled on DIR provide them.
+ *
+ * The cgroup of a job is removed once the job is done, or as soon as its
+ * last process has gone after that. If DIR is not a writable cgroup v2
+ * directory, or a cgroup cannot be created for a job, that job is started
+ * and signalled through its process group as usual.
+ *
+ * The cgroups of the jobs are kept in an array that only changes with
+ * signals blocked, so the handlers of the keyboard signals can look a job
+ * up in it.
+ */
+
+#ifndef TSH_CGROUP_H
+#define TSH_CGROUP_H
+
+#include "csapp.h"
+#include "tsh_helper.h"
+
+#include <stdbool.h>
+
+/* Defined in tsh_cgroup.c */
+extern bool cgroup_enabled; ///< Jobs are started in cgroups of their own
+
+/**
+ * @brief Creates the cgroup of the shell in a delegated cgroup v2
+ * directory, and enables the cpu, memory and io controllers for the
+ * cgroups of the jobs, as far as DIR provides them.
+ *
+ * @param[in] dir  The delegated directory.
+ * @return false, after printing a message, if no cgroup can be created
+ * there. Jobs are then started in process groups only.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool cgroup_init(const char *dir);
+
+/**
+ * @brief Removes the cgroups of the jobs that have no processes left, and
+ * that of the shell if none is left below it.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void cgroup_destroy(void);
+
+/**
+ * @brief Creates a cgroup for a job about to be started.
+ *
+ * @return A descriptor of the cgroup directory, to pass to `spawn_job` and
+ * then to `cgroup_assign` or `cgroup_discard`, or -1 without
+ * `cgroup_enabled` or if it cannot be created.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int cgroup_create(void);
+
+/**
+ * @brief Moves a process into a cgroup, by writing its PID to
+ * `cgroup.procs`.
+ *
+ * @param[in] fd   A descriptor of the cgroup, from `cgroup_create`.
+ * @param[in] pid  The process, or 0 for the calling process.
+ * @return false if the process could not be moved.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool cgroup_join(int fd, pid_t pid);
+
+/**
+ * @brief Records the cgroup created for a job, once it has been added to
+ * the job list.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void cgroup_assign(int fd, jid_t jid);
+
+/**
+ * @brief Removes a cgroup that was created for a job that could not be
+ * started or added to the job list. Does nothing if `fd` is -1.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void cgroup_discard(int fd);
+
+/**
+ * @brief Sends a signal to every process in the cgroup of a job: to its
+ * process group as a whole first, then to the processes that left it.
+ * SIGKILL is sent by the kernel, through `cgroup.kill`.
+ *
+ * @return false if the job has no cgroup, in which case nothing was sent.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool cgroup_signal(jid_t jid, int sig);
+
+/**
+ * @brief Freezes the cgroup of a job that was reported stopped, if any
+ * process in it is neither stopped nor about to act on a stop signal, e.g.
+ * because it catches or ignores SIGTSTP. Freezing stops those processes
+ * without sending them a signal; the others stay stopped by theirs.
+ *
+ * @return false if the job has no cgroup or it cannot be frozen.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool cgroup_freeze(jid_t jid);
+
+/**
+ * @brief Resumes a job: thaws its cgroup, and sends SIGCONT to the
+ * processes in it as `cgroup_signal` does, as they may also have been
+ * stopped by a signal.
+ *
+ * @return false if the job has no cgroup, in which case nothing was done.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool cgroup_resume(jid_t jid);
+
+/**
+ * @brief Releases the cgroup of a job that is done. If the job was
+ * terminated by a signal, the processes left in it are killed first.
+ *
+ * @param[in] jid     The job.
+ * @param[in] killed  Whether it was terminated by a signal.
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void cgroup_job_done(jid_t jid, bool killed);
+
+/**
+ * @brief Appends the accounting of the cgroup of a job to an output buffer,
+ * as one line of `key value` pairs preceded by `prefix`: the `usage_usec`,
+ * `user_usec` and `system_usec` of cpu.stat, `memory.peak` in KiB, and the
+ * `rbytes`, `wbytes`, `rios` and `wios` of io.stat summed over the devices,
+ * each prefixed with the name of its file. Writes nothing if the job has no
+ * cgroup, and leaves out the files its controllers do not provide.
+ *
+ * @return false if an error occurred while writing out the buffer
+ *
+ * @pre Signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool cgroup_print(sio_t *out, const char *prefix, jid_t jid);
+
+#endif /* TSH_CGROUP_H */
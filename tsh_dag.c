@@ -0,0 +1,616 @@
+/**
+ * @file tsh_dag.c
+ * @brief The `dag` builtin: run a graph of dependent commands
+ *
+ * See tsh_dag.h for the file format. The file is read into one buffer and
+ * split in place: target names, dependency names and command lines all
+ * point into it. Targets are `node`s, referred to by their index in the
+ * array of nodes; each node lists the nodes it depends on and the nodes
+ * that depend on it (`users`).
+ *
+ * Before anything runs, a depth-first search from the requested targets
+ * marks the nodes to make, rejects cycles, and yields a topological order.
+ * Walking that order backwards gives the `height` of every node, the length
+ * of the longest chain of nodes that depend on it, which is the priority
+ * among ready nodes. A node becomes ready when its last dependency is done;
+ * it runs its command lines one after the other in its own slot.
+ */
+
+#define _GNU_SOURCE // strchrnul
+
+#include "csapp.h"
+#include "tsh_builtin.h"
+#include "tsh_dag.h"
+#include "tsh_helper.h"
+#include "tsh_path.h"
+#include "tsh_runner.h"
+#include "tsh_spawn.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Progress of a node */
+typedef enum node_state {
+    NODE_WAITING, // Some dependencies are not done
+    NODE_READY,   // Can start
+    NODE_RUNNING, // One of its commands is running
+    NODE_DONE,    // All its commands succeeded
+    NODE_FAILED,  // A command failed
+    NODE_SKIPPED, // Not run, because a dependency failed or the run stopped
+} node_state;
+
+/* A target of the file */
+struct node {
+    const char *name;      // Target name
+    char **dep_names;      // Names of its dependencies, as in the file
+    int *deps;             // Indices of its dependencies
+    int ndeps;             // Entries of dep_names and deps
+    int deps_cap;          // Allocated entries of dep_names
+    int *users;            // Indices of the nodes depending on it
+    int nusers;            // Entries of users
+    int users_cap;         // Allocated entries of users
+    const char **cmds;     // Command lines
+    int ncmds;             // Entries of cmds
+    int cmds_cap;          // Allocated entries of cmds
+    int line;              // Line of the rule in the file
+    bool wanted;           // Must be made in this run
+    int mark;              // Search: 0 unseen, 1 on the path, 2 finished
+    int height;            // Longest chain of wanted nodes depending on it
+    int pending;           // Dependencies that are not done
+    int next_cmd;          // Next command line to run
+    pid_t pid;             // Process of the running command
+    node_state state;      // Progress
+    struct timespec start; // When it started
+    struct timespec end;   // When it finished
+};
+
+/* State of a run */
+struct graph {
+    char *buf;           // Contents of the file
+    struct node *nodes;  // All targets, in the order of the file
+    int nnodes;          // Entries of nodes
+    int cap;             // Allocated entries of nodes
+    int *order;           // Wanted nodes, dependencies first
+    int norder;           // Entries of order
+    bool keep_going;      // -k: keep starting targets after a failure
+    struct runner runner; // Coordinator of the commands
+};
+
+/*
+ * dag_usage - Print the usage of the builtin
+ */
+static void dag_usage(void) {
+    sio_eprintf("dag: usage: dag [-j jobs] [-k] file [target...]\n");
+}
+
+/*
+ * reserve - Make room for n entries of size bytes in *array
+ */
+static bool reserve(void *array, int *cap, int n, size_t size) {
+    if (n <= *cap) {
+        return true;
+    }
+    int bigger = *cap == 0 ? 4 : 2 * *cap;
+    bigger = bigger < n ? n : bigger;
+    void *grown = realloc(*(void **)array, (size_t)bigger * size);
+    if (grown == NULL) {
+        sio_eprintf("dag: Out of memory\n");
+        return false;
+    }
+    *(void **)array = grown;
+    *cap = bigger;
+    return true;
+}
+
+/*
+ * find_node - Index of the node of a target, or -1
+ */
+static int find_node(const struct graph *g, const char *name) {
+    for (int i = 0; i < g->nnodes; i++) {
+        if (strcmp(g->nodes[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * next_word - Split off the next white-space separated word of *p
+ */
+static char *next_word(char **p) {
+    char *word = *p;
+    while (isspace((unsigned char)*word)) {
+        word++;
+    }
+    if (*word == '\0') {
+        return NULL;
+    }
+    char *end = word;
+    while (*end != '\0' && !isspace((unsigned char)*end)) {
+        end++;
+    }
+    *p = *end != '\0' ? end + 1 : end;
+    *end = '\0';
+    return word;
+}
+
+/*
+ * add_rule - Add the node of a rule line "target: dependency..."
+ */
+static bool add_rule(struct graph *g, char *line, int lineno,
+                     const char *path) {
+    char *colon = strchr(line, ':');
+    if (colon == NULL) {
+        sio_eprintf("dag: %s:%d: missing ':'\n", path, lineno);
+        return false;
+    }
+    *colon = '\0';
+    char *rest = line;
+    char *name = next_word(&rest);
+    if (name == NULL || next_word(&rest) != NULL) {
+        sio_eprintf("dag: %s:%d: a rule needs one target\n", path, lineno);
+        return false;
+    }
+    if (find_node(g, name) >= 0) {
+        sio_eprintf("dag: %s:%d: %s: duplicate rule\n", path, lineno, name);
+        return false;
+    }
+    if (!reserve(&g->nodes, &g->cap, g->nnodes + 1, sizeof(*g->nodes))) {
+        return false;
+    }
+    struct node *node = &g->nodes[g->nnodes++];
+    memset(node, 0, sizeof(*node));
+    node->name = name;
+    node->line = lineno;
+
+    rest = colon + 1;
+    for (char *dep; (dep = next_word(&rest)) != NULL;) {
+        if (!reserve(&node->dep_names, &node->deps_cap, node->ndeps + 1,
+                     sizeof(*node->dep_names))) {
+            return false;
+        }
+        node->dep_names[node->ndeps++] = dep;
+    }
+    return true;
+}
+
+/*
+ * parse_file - Split the file into nodes and their command lines
+ */
+static bool parse_file(struct graph *g, const char *path) {
+    int lineno = 0;
+    for (char *line = g->buf; *line != '\0';) {
+        char *end = strchrnul(line, '\n');
+        bool last = *end == '\0';
+        *end = '\0';
+        lineno++;
+
+        char *text = line;
+        while (isspace((unsigned char)*text)) {
+            text++;
+        }
+        if (*text != '\0' && *text != '#') {
+            if (text == line) {
+                if (!add_rule(g, line, lineno, path)) {
+                    return false;
+                }
+            } else if (g->nnodes == 0) {
+                sio_eprintf("dag: %s:%d: command before the first rule\n",
+                            path, lineno);
+                return false;
+            } else {
+                struct node *node = &g->nodes[g->nnodes - 1];
+                if (!reserve(&node->cmds, &node->cmds_cap, node->ncmds + 1,
+                             sizeof(*node->cmds))) {
+                    return false;
+                }
+                node->cmds[node->ncmds++] = text;
+            }
+        }
+        line = last ? end : end + 1;
+    }
+    return true;
+}
+
+/*
+ * link_nodes - Resolve the dependency names and fill in the users lists
+ */
+static bool link_nodes(struct graph *g, const char *path) {
+    for (int i = 0; i < g->nnodes; i++) {
+        struct node *node = &g->nodes[i];
+        if (node->ndeps == 0) {
+            continue;
+        }
+        node->deps = malloc((size_t)node->ndeps * sizeof(*node->deps));
+        if (node->deps == NULL) {
+            sio_eprintf("dag: Out of memory\n");
+            return false;
+        }
+        for (int d = 0; d < node->ndeps; d++) {
+            int dep = find_node(g, node->dep_names[d]);
+            if (dep < 0) {
+                sio_eprintf("dag: %s:%d: no rule for %s, needed by %s\n",
+                            path, node->line, node->dep_names[d],
+                            node->name);
+                return false;
+            }
+            struct node *used = &g->nodes[dep];
+            if (!reserve(&used->users, &used->users_cap, used->nusers + 1,
+                         sizeof(*used->users))) {
+                return false;
+            }
+            used->users[used->nusers++] = i;
+            node->deps[d] = dep;
+        }
+    }
+    return true;
+}
+
+/*
+ * visit - Depth-first search from a node through its dependencies: mark
+ * them wanted, append them to the order after their dependencies, and
+ * report a cycle. path holds the nodes of the current search path.
+ */
+static bool visit(struct graph *g, int i, int *path, int depth) {
+    struct node *node = &g->nodes[i];
+    path[depth] = i;
+    if (node->mark == 2) {
+        return true;
+    }
+    if (node->mark == 1) {
+        int from = depth - 1;
+        while (path[from] != i) {
+            from--;
+        }
+        sio_eprintf("dag: dependency cycle:");
+        for (int k = from; k <= depth; k++) {
+            sio_eprintf(" %s%s", g->nodes[path[k]].name,
+                        k < depth ? " ->" : "\n");
+        }
+        return false;
+    }
+
+    node->mark = 1;
+    for (int d = 0; d < node->ndeps; d++) {
+        if (!visit(g, node->deps[d], path, depth + 1)) {
+            return false;
+        }
+    }
+    node->mark = 2;
+    node->wanted = true;
+    g->order[g->norder++] = i;
+    return true;
+}
+
+/*
+ * plan - Select the nodes to make, check for cycles and compute the
+ * priorities
+ */
+static bool plan(struct graph *g, char **targets, int ntargets) {
+    int *path = malloc(((size_t)g->nnodes + 1) * sizeof(*path));
+    g->order = malloc(((size_t)g->nnodes + 1) * sizeof(*g->order));
+    bool ok = path != NULL && g->order != NULL;
+    if (!ok) {
+        sio_eprintf("dag: Out of memory\n");
+    }
+
+    for (int t = 0; ok && t < (ntargets > 0 ? ntargets : g->nnodes); t++) {
+        int i = ntargets > 0 ? find_node(g, targets[t]) : t;
+        if (i < 0) {
+            sio_eprintf("dag: %s: no such target\n", targets[t]);
+            ok = false;
+        } else {
+            ok = visit(g, i, path, 0);
+        }
+    }
+    free(path);
+
+    for (int k = g->norder - 1; ok && k >= 0; k--) {
+        struct node *node = &g->nodes[g->order[k]];
+        node->height = 1;
+        for (int u = 0; u < node->nusers; u++) {
+            const struct node *user = &g->nodes[node->users[u]];
+            if (user->wanted && user->height + 1 > node->height) {
+                node->height = user->height + 1;
+            }
+        }
+        node->pending = node->ndeps;
+        node->state = node->ndeps == 0 ? NODE_READY : NODE_WAITING;
+    }
+    return ok;
+}
+
+/*
+ * command_child - Body of the process of a command line: parse it, open
+ * its redirections, and run it as an in-process utility or a program
+ */
+static void command_child(const struct graph *g, const char *cmdline) {
+    struct cmdline_tokens token = {0};
+
+    runner_child(&g->runner);
+
+    parseline_return result = parseline(cmdline, &token);
+    if (result == PARSELINE_ERROR || result == PARSELINE_EMPTY) {
+        _exit(1);
+    }
+    if (token.nstages > 1 ||
+        (token.builtin != BUILTIN_NONE && token.builtin != BUILTIN_UTIL)) {
+        sio_eprintf("dag: %s: %s cannot be used in a command\n",
+                    token.argv[0],
+                    token.nstages > 1 ? "pipeline" : "builtin");
+        _exit(1);
+    }
+
+    int fd;
+    if (token.infile != NULL) {
+        if ((fd = redirect_open(token.infile, false)) < 0) {
+            _exit(1);
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+    if (token.outfile != NULL) {
+        if ((fd = redirect_open(token.outfile, true)) < 0) {
+            _exit(1);
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+    if (token.builtin == BUILTIN_UTIL) {
+        _exit(builtin_util_run(token.argc, token.argv, STDIN_FILENO,
+                               STDOUT_FILENO));
+    }
+
+    struct path_cmd prog;
+    if (path_resolve(token.argv[0], &prog)) {
+        execve(prog.path, token.argv, environ);
+    }
+    report_exec_error(token.argv[0], errno);
+    _exit(127);
+}
+
+/*
+ * start_command - Start the next command line of a node. Returns false if
+ * it could not be started, in which case the node fails.
+ */
+static bool start_command(struct graph *g, struct node *node) {
+    if ((node->pid = fork()) == 0) {
+        command_child(g, node->cmds[node->next_cmd]);
+    }
+    if (node->pid < 0) {
+        perror("dag: fork error");
+        return false;
+    }
+    node->next_cmd++;
+    return true;
+}
+
+/*
+ * skip_users - Skip every wanted node that depends on a node, directly or
+ * not. Returns the number of nodes skipped.
+ */
+static int skip_users(struct graph *g, const struct node *node) {
+    int skipped = 0;
+    for (int u = 0; u < node->nusers; u++) {
+        struct node *user = &g->nodes[node->users[u]];
+        if (user->wanted && user->state == NODE_WAITING) {
+            user->state = NODE_SKIPPED;
+            skipped += 1 + skip_users(g, user);
+        }
+    }
+    return skipped;
+}
+
+/*
+ * finish - Record the end of a node and release or skip its users.
+ * Returns the number of nodes that are over, including skipped ones.
+ */
+static int finish(struct graph *g, struct node *node, bool ok) {
+    clock_gettime(CLOCK_MONOTONIC, &node->end);
+    node->pid = 0;
+    node->state = ok ? NODE_DONE : NODE_FAILED;
+    if (!ok) {
+        return 1 + skip_users(g, node);
+    }
+    for (int u = 0; u < node->nusers; u++) {
+        struct node *user = &g->nodes[node->users[u]];
+        if (user->wanted && --user->pending == 0 &&
+            user->state == NODE_WAITING) {
+            user->state = NODE_READY;
+        }
+    }
+    return 1;
+}
+
+/*
+ * next_ready - The ready node with the longest chain of users, or NULL
+ */
+static struct node *next_ready(struct graph *g) {
+    struct node *best = NULL;
+    for (int k = 0; k < g->norder; k++) {
+        struct node *node = &g->nodes[g->order[k]];
+        if (node->state == NODE_READY &&
+            (best == NULL || node->height > best->height)) {
+            best = node;
+        }
+    }
+    return best;
+}
+
+/*
+ * later - Whether a time is after another
+ */
+static bool later(struct timespec a, struct timespec b) {
+    return a.tv_sec > b.tv_sec ||
+           (a.tv_sec == b.tv_sec && a.tv_nsec > b.tv_nsec);
+}
+
+/*
+ * report_critical_path - Print the chain of nodes, each started after the
+ * previous one ended, that leads to the node that ended last
+ */
+static void report_critical_path(const struct graph *g) {
+    const struct node *last = NULL;
+    for (int k = 0; k < g->norder; k++) {
+        const struct node *node = &g->nodes[g->order[k]];
+        if ((node->state == NODE_DONE || node->state == NODE_FAILED) &&
+            (last == NULL || later(node->end, last->end))) {
+            last = node;
+        }
+    }
+    if (last == NULL) {
+        return;
+    }
+
+    const struct node **chain = malloc((size_t)g->norder * sizeof(*chain));
+    if (chain == NULL) {
+        return;
+    }
+    int n = 0;
+    for (const struct node *node = last; node != NULL;) {
+        chain[n++] = node;
+        const struct node *prev = NULL;
+        for (int d = 0; d < node->ndeps; d++) {
+            const struct node *dep = &g->nodes[node->deps[d]];
+            if (prev == NULL || later(dep->end, prev->end)) {
+                prev = dep;
+            }
+        }
+        node = prev;
+    }
+
+    dprintf(STDERR_FILENO, "dag: critical path %.3fs:",
+            runner_seconds(chain[n - 1]->start, last->end));
+    for (int k = n - 1; k >= 0; k--) {
+        dprintf(STDERR_FILENO, " %s (%.3fs)%s", chain[k]->name,
+                runner_seconds(chain[k]->start, chain[k]->end),
+                k > 0 ? " ->" : "\n");
+    }
+    free(chain);
+}
+
+/*
+ * parse_args - Parse the options of the builtin; returns the index of the
+ * file argument, or 0 if the arguments are invalid
+ */
+static int parse_args(struct graph *g, int argc, char **argv) {
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        int j;
+        if (strcmp(argv[i], "-k") == 0) {
+            g->keep_going = true;
+        } else if ((j = runner_jobs_option(&g->runner, argc, argv, &i)) < 0) {
+            return 0;
+        } else if (j == 0) {
+            dag_usage();
+            return 0;
+        }
+    }
+    if (i == argc) {
+        dag_usage();
+        return 0;
+    }
+    return i;
+}
+
+/*
+ * free_graph - Free the memory of a run
+ */
+static void free_graph(struct graph *g) {
+    for (int i = 0; i < g->nnodes; i++) {
+        free(g->nodes[i].dep_names);
+        free(g->nodes[i].deps);
+        free(g->nodes[i].users);
+        free(g->nodes[i].cmds);
+    }
+    free(g->nodes);
+    free(g->order);
+    free(g->buf);
+}
+
+/*
+ * dag_run - Run the dag builtin
+ * Not async-signal-safe
+ */
+int dag_run(int argc, char **argv, int in_fd, int out_fd) {
+    struct graph g = {0};
+    int running = 0, over = 0, failed = 0;
+    bool stopped = false;
+
+    runner_init(&g.runner, "dag");
+    int file = parse_args(&g, argc, argv);
+    if (file == 0 ||
+        (g.buf = runner_read_file(&g.runner, argv[file])) == NULL ||
+        !parse_file(&g, argv[file]) || !link_nodes(&g, argv[file]) ||
+        !plan(&g, argv + file + 1, argc - file - 1)) {
+        free_graph(&g);
+        return 1;
+    }
+
+    while (over < g.norder) {
+        struct node *node;
+        while (!stopped && running < g.runner.jobs &&
+               (node = next_ready(&g)) != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &node->start);
+            node->state = NODE_RUNNING;
+            if (node->ncmds == 0) {
+                over += finish(&g, node, true);
+            } else if (start_command(&g, node)) {
+                running++;
+            } else {
+                over += finish(&g, node, false);
+                failed++;
+                stopped = !g.keep_going;
+            }
+        }
+        if (running == 0) {
+            break; // stopped after a failure: the rest is skipped
+        }
+
+        int status;
+        pid_t pid = runner_wait(&g.runner, &status);
+        if (pid < 0) {
+            break;
+        }
+
+        node = NULL;
+        for (int k = 0; k < g.norder; k++) {
+            if (g.nodes[g.order[k]].pid == pid) {
+                node = &g.nodes[g.order[k]];
+                break;
+            }
+        }
+        if (node == NULL) {
+            continue; // a process of a command that its command left behind
+        }
+        bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (ok && node->next_cmd < node->ncmds &&
+            (ok = start_command(&g, node))) {
+            continue; // the next command line of the node, in its slot
+        }
+        running--;
+        over += finish(&g, node, ok);
+        if (!ok) {
+            failed++;
+            stopped = !g.keep_going;
+        }
+    }
+
+    int skipped = 0;
+    for (int k = 0; k < g.norder; k++) {
+        node_state state = g.nodes[g.order[k]].state;
+        skipped += state != NODE_DONE && state != NODE_FAILED;
+    }
+    int result = runner_end(&g.runner, g.norder, "target", failed, skipped);
+    report_critical_path(&g);
+
+    free_graph(&g);
+    return result;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file tsh_dag.h
+ * @brief The `dag` builtin: run a graph of dependent commands
+ *
+ * `dag [-j jobs] [-k] file [target...]` reads a make-like file of rules:
+ *
+ *     # comment
+ *     target: dependency...
+ *         command
+ *         command
+ *
+ * Each rule names one target, the targets it depends on, and the command
+ * lines (tsh syntax: words, quotes, `<` and `>`) run in order to make it,
+ * indented on the lines that follow. A target without commands only groups
+ * its dependencies. The named targets, or every target, are made together
+ * with everything they depend on, with at most `jobs` commands running at
+ * a time (by default, the number of online CPUs).
+ *
+ * As in `parallel`, the builtin runs in a forked copy of the shell that is
+ * one job in the job list, and sleeps in sigsuspend: a target is started as
+ * soon as the SIGCHLD that reports its last dependency wakes it up. Among
+ * the targets that are ready, the one with the longest chain of targets
+ * depending on it starts first. After a failure, no more targets are
+ * started unless `-k` is given, and the targets depending on a failed one
+ * are skipped.
+ *
+ * At the end, the builtin prints the number of targets, failures and
+ * skipped targets, the elapsed and CPU times, and the critical path: the
+ * chain of targets, each waiting for the previous one, that ended last.
+ *
+ * Only the bare name `dag` runs the builtin; a program such as `/bin/dag`
+ * is run as any other.
+ */
+
+#ifndef TSH_DAG_H
+#define TSH_DAG_H
+
+/**
+ * @brief Runs the `dag` builtin.
+ *
+ * @param[in] argc    The number of arguments.
+ * @param[in] argv    The arguments, starting with `dag`.
+ * @param[in] in_fd   Standard input (unused).
+ * @param[in] out_fd  Descriptor the commands write to (unused: they
+ *                    inherit standard output).
+ *
+ * @return The number of targets that failed, at most 101, or 1 if the
+ *         arguments or the file are invalid.
+ *
+ * @pre The caller is a process of its own: the function installs a SIGCHLD
+ *      handler and waits for every child.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int dag_run(int argc, char **argv, int in_fd, int out_fd);
+
+#endif /* TSH_DAG_H */
@@ -0,0 +1,105 @@
+/**
+ * @file tsh_events.c
+ * @brief Queue of reaped children from sigchld_handler to the loop
+ *
+ * See tsh_events.h. The handler and the main control flow run on the same
+ * thread, but the handler can interrupt the main flow anywhere, so the
+ * indices are accessed with atomic builtins: an event is written before
+ * `tail` is advanced past it, and read before `head` is. Both indices run
+ * freely and are reduced modulo `EVENTS_CAP` to index the slots.
+ */
+
+#include "tsh_events.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* Static variables */
+static struct reap_event ring[EVENTS_CAP]; // The slots
+static uint32_t head = 0;                  // Next event to take (main flow)
+static uint32_t tail = 0;                  // Next slot to fill (handler)
+static bool overflowed = false;            // Ring found full since checked
+static struct events_stats stats;          // Counters of the ring
+
+/*
+ * events_room - Whether another event can be posted
+ * Async-signal-safe
+ */
+bool events_room(void) {
+    uint32_t taken = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (tail - taken < EVENTS_CAP) {
+        return true;
+    }
+    stats.overflows++;
+    overflowed = true;
+    return false;
+}
+
+/*
+ * events_post - Post a reaped child
+ * Async-signal-safe
+ */
+void events_post(pid_t pid, pid_t pgid, int status, const struct rusage *ru) {
+    struct reap_event *event = &ring[tail % EVENTS_CAP];
+    event->pid = pid;
+    event->pgid = pgid;
+    event->status = status;
+    clock_gettime(CLOCK_MONOTONIC, &event->when);
+    event->ru = *ru;
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+
+    unsigned depth = tail - __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    stats.posted++;
+    if (depth > stats.max_depth) {
+        stats.max_depth = depth;
+    }
+}
+
+/*
+ * events_take - Take the oldest events
+ * Async-signal-safe
+ */
+int events_take(struct reap_event *batch, int max) {
+    uint32_t posted = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    int n = 0;
+    while (n < max && head + (uint32_t)n != posted) {
+        batch[n] = ring[(head + (uint32_t)n) % EVENTS_CAP];
+        n++;
+    }
+    __atomic_store_n(&head, head + (uint32_t)n, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ * events_pending - Whether events or children are left to handle
+ * Async-signal-safe
+ */
+bool events_pending(void) {
+    return __atomic_load_n(&tail, __ATOMIC_ACQUIRE) != head ||
+           __atomic_load_n(&overflowed, __ATOMIC_RELAXED);
+}
+
+/*
+ * events_overflowed - Whether the ring was found full since the last call
+ * Async-signal-safe
+ */
+bool events_overflowed(void) {
+    if (!overflowed) {
+        return false;
+    }
+    overflowed = false;
+    return true;
+}
+
+/*
+ * events_get_stats - Get, and optionally reset, the counters
+ * Async-signal-safe
+ */
+void events_get_stats(struct events_stats *out, bool reset) {
+    *out = stats;
+    if (reset) {
+        memset(&stats, 0, sizeof(stats));
+    }
+}
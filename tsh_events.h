@@ -0,0 +1,110 @@
+/**
+ * @file tsh_events.h
+ * @brief Queue of reaped children from sigchld_handler to the loop
+ *
+ * With the signal backend, sigchld_handler only reaps children and posts
+ * what wait4 returned to a fixed-size ring: the PID, the wait status, the
+ * time it was reaped and the resource usage. It neither touches the job
+ * list nor prints anything, and does not block signals. The loop takes the
+ * events in batches in the main control flow, and applies them to the job
+ * list with `child_event`, which prints the notifications.
+ *
+ * The ring has a single producer, the handler, and a single consumer, the
+ * main control flow, so it needs no lock: the handler only advances `tail`
+ * and the loop only advances `head`, each with release ordering once the
+ * slots are written or read. When the ring is full, the handler stops
+ * reaping and records an overflow; the children stay zombies until the
+ * loop has emptied the ring and reaps them itself.
+ */
+
+#ifndef TSH_EVENTS_H
+#define TSH_EVENTS_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define EVENTS_CAP 512 /**< Events the ring holds, a power of two */
+
+/**
+ * @brief A child state change, as reaped by the handler
+ */
+struct reap_event {
+    pid_t pid;            ///< The child
+    pid_t pgid;           ///< Its process group, if read (tsh_reaper.h)
+    int status;           ///< Its status, as reported by wait4
+    struct timespec when; ///< When it was reaped (CLOCK_MONOTONIC)
+    struct rusage ru;     ///< Its resource usage, if it terminated
+};
+
+/**
+ * @brief Counters of the ring, shown by the `stats` builtin
+ */
+struct events_stats {
+    unsigned long posted;    ///< Events posted
+    unsigned long overflows; ///< Times the handler found the ring full
+    unsigned max_depth;      ///< Most events held at once
+};
+
+/**
+ * @brief Returns whether the ring has room for another event, and records
+ * an overflow if it does not. The handler must check this before reaping.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool events_room(void);
+
+/**
+ * @brief Posts a reaped child to the ring, which must have room for it.
+ *
+ * @param[in] pid     The child.
+ * @param[in] pgid    Its process group, or 0 if it was not read.
+ * @param[in] status  Its status, as reported by wait4.
+ * @param[in] ru      Its resource usage, as reported by wait4.
+ *
+ * @remark Async-signal-safety: Async-signal-safe. Only sigchld_handler may
+ * call it.
+ */
+void events_post(pid_t pid, pid_t pgid, int status, const struct rusage *ru);
+
+/**
+ * @brief Takes the oldest events from the ring.
+ *
+ * @param[out] batch  The events, oldest first.
+ * @param[in]  max    Room in `batch`.
+ * @return The number of events taken.
+ *
+ * @remark Async-signal-safety: Async-signal-safe. Only the main control
+ * flow may call it; signals need not be blocked.
+ */
+int events_take(struct reap_event *batch, int max);
+
+/**
+ * @brief Returns whether there are events to take, or children left to reap
+ * after an overflow. Signals need not be blocked, but the answer may then
+ * be out of date by the time it is used.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool events_pending(void);
+
+/**
+ * @brief Returns whether the handler has found the ring full since the last
+ * call, in which case children may be left to reap.
+ *
+ * @pre SIGCHLD must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe. Only the main control
+ * flow may call it.
+ */
+bool events_overflowed(void);
+
+/**
+ * @brief Gets the counters of the ring, and optionally resets them.
+ *
+ * @pre SIGCHLD must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void events_get_stats(struct events_stats *stats, bool reset);
+
+#endif /* TSH_EVENTS_H */
@@ -6,22 +6,43 @@
  * related to usage, see the corresponding header file at tsh_helper.h.
  */
 
+#define _GNU_SOURCE // mremap
+
+#include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "csapp.h"
+#include "tsh_arena.h"
+#include "tsh_builtin.h"
+#include "tsh_cgroup.h"
 #include "tsh_helper.h"
+#include "tsh_history.h"
+#include "tsh_perf.h"
+#include "tsh_reaper.h"
+#include "tsh_scan.h"
 
 // Struct used to store jobs
 struct job_t {
-    pid_t pid;       // Job PID
-    jid_t jid;       // Job ID [1, 2, ...] defined in tsh_helper.c
-    job_state state; // UNDEF, BG, FG, or ST
-    char *cmdline;   // Command line
+    pid_t pid;               // Job PID
+    jid_t jid;               // Job ID [1, 2, ...] defined in tsh_helper.c
+    job_state state;         // UNDEF, BG, FG, ST, or QUEUED
+    const char *cmdline;     // Command line, interned in the arena
+    jid_t prev;              // Previous job in the same state, or 0
+    jid_t next;              // Next job in the same state, or 0
+    int nprocs;              // Processes of the job that have not terminated
+    int sig;                 // First signal that terminated one of them, or 0
+    int code;                // First non-zero exit status of one, or 0
+    bool exited;             // The process identifying it has terminated
+    struct job_usage usage;  // Resources used by its terminated processes
+    struct prio_policy prio; // Policy in the background (tsh_prio.h)
 };
 
 // Parsing states, used internally in parseline
@@ -30,23 +51,82 @@ typedef enum parse_state { ST_NORMAL, ST_INFILE, ST_OUTFILE } parse_state;
 /* Global variables */
 const char prompt[] = "tsh> "; // Command line prompt (do not change)
 bool verbose = false;          // If true, prints additional output
+bool pipelines = false;        // If true, `|` separates pipeline commands
+
+// Entry of the pid -> jid index; a PID of 0 marks a free slot. The
+// processes of a job are linked in a ring, by PID, from that of the job.
+struct pid_slot {
+    pid_t pid;
+    jid_t jid;
+    int pidfd;  // pidfd watched by the loop (tsh_loop.c), or -1
+    pid_t prev; // Previous process of the job in the ring
+    pid_t next; // Next process of the job in the ring
+};
+
+#define MAP_BITS 64          // Job IDs per word of jid_map
+#define NSTATES (QUEUED + 1) // Number of job_state values
+#define MAX_MEMBERS 256      // Processes of a job listed by jobs -l
 
 /* Static variables */
 static bool check_block = true; // If true, check that signals are blocked
-static struct job_t job_list[MAXJOBS]; // The job list
-static jid_t nextjid = 1;              // Next job ID to allocate
+static struct job_t *job_list = NULL;     // The job list, indexed by jid - 1
+static jid_t job_cap = 0;                 // Number of slots in job_list
+static uint64_t *jid_map = NULL;          // Bit jid - 1 is set if jid is used
+static struct pid_slot *pid_index = NULL; // Open-addressing pid -> jid hash
+static size_t index_mask = 0;             // Size of pid_index minus one
+static size_t index_count = 0;            // Entries used in pid_index
+static jid_t state_head[NSTATES];         // Lowest JID in each state, or 0
+static jid_t state_tail[NSTATES];         // Highest JID in each state, or 0
+static int state_count[NSTATES];          // Number of jobs in each state
+static jid_t nextjid = 1;                 // Next job ID to allocate
 
 static bool init = false;
 
+/*
+ * reserve - Make room for at least n elements of elem_size bytes in a
+ * growable array of *size elements
+ * Not async-signal-safe.
+ */
+static bool reserve(void *array, size_t *size, size_t n, size_t elem_size) {
+    if (n <= *size) {
+        return true;
+    }
+    size_t grown = *size == 0 ? 16 : 2 * *size;
+    while (grown < n) {
+        grown *= 2;
+    }
+    void *p = realloc(*(void **)array, grown * elem_size);
+    if (p == NULL) {
+        return false;
+    }
+    *(void **)array = p;
+    *size = grown;
+    return true;
+}
+
+/*
+ * free_tokens - Free the buffers of a token struct
+ * Not async-signal-safe.
+ */
+void free_tokens(struct cmdline_tokens *token) {
+    free(token->argv);
+    free(token->stages);
+    free(token->_buf);
+    memset(token, 0, sizeof(*token));
+}
+
 /*
  * parseline - Parse the command line and build the argv array.
  * Not async-signal-safe.
  */
 parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
-    const char delims[] = " \t\r\n"; // argument delimiters (white-space)
-    char *buf;                       // ptr that traverses command line
-    char *next;                      // ptr to the end of the current arg
-    char *endbuf;                    // ptr to end of cmdline string
+    struct scanner sc; // finds delimiters (white-space) and quotes
+    char *start;       // start of the copy of the command line
+    char *buf;         // ptr that traverses command line
+    char *next;        // ptr to the end of the current arg
+    char *endbuf;      // ptr to end of cmdline string
+    int n = 0;         // entries of argv used, including stage separators
+    int out_stage = 0; // stage whose output is redirected
 
     parse_state parsing_state; // indicates if the next token is the
                                // input or output file
@@ -58,29 +138,48 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
         return PARSELINE_EMPTY;
     }
 
-    strncpy(token->_buf, cmdline, MAXLINE_TSH);
-    token->_buf[MAXLINE_TSH - 1] = '\0';
+    /* Copy the line once; every token is split off in place */
+    size_t len = strlen(cmdline);
+    if (len + 1 > token->_buf_size) {
+        char *copy = realloc(token->_buf, len + 1);
+        if (copy == NULL) {
+            fprintf(stderr, "Error: command line too long\n");
+            return PARSELINE_ERROR;
+        }
+        token->_buf = copy;
+        token->_buf_size = len + 1;
+    }
+    memcpy(token->_buf, cmdline, len + 1);
 
-    buf = token->_buf;
-    endbuf = buf + strlen(buf);
+    start = buf = token->_buf;
+    endbuf = buf + len;
+    scanner_init(&sc, start, len);
 
     // initialize default values
     token->argc = 0;
     token->infile = NULL;
     token->outfile = NULL;
+    if (!reserve(&token->stages, &token->_stages_size, 1,
+                 sizeof(*token->stages))) {
+        fprintf(stderr, "Error: out of memory\n");
+        return PARSELINE_ERROR;
+    }
+    token->stages[0] = 0;
+    token->nstages = 1;
 
     /* Build the argv list */
     parsing_state = ST_NORMAL;
 
     while (buf < endbuf) {
         /* Skip the white-spaces */
-        buf += strspn(buf, delims);
+        buf = start + scan_skip_space(&sc, (size_t)(buf - start));
         if (buf >= endbuf)
             break;
 
         /* Check for I/O redirection specifiers */
         if (*buf == '<') {
-            if (token->infile) { // infile already exists
+            // infile already exists, or is not for the first command
+            if (token->infile || token->nstages > 1) {
                 if (verbose) {
                     fprintf(stderr, "Error: Ambiguous I/O redirection\n");
                 }
@@ -97,20 +196,39 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
                 return PARSELINE_ERROR;
             }
             parsing_state = ST_OUTFILE;
+            out_stage = token->nstages - 1;
+            buf++;
+            continue;
+        } else if (*buf == '|' && pipelines && parsing_state == ST_NORMAL) {
+            /* Start the next command of a pipeline */
+            if (n == token->stages[token->nstages - 1]) {
+                fprintf(stderr, "Error: missing command in pipeline\n");
+                return PARSELINE_ERROR;
+            }
+            if (!reserve(&token->argv, &token->_argv_size, (size_t)n + 1,
+                         sizeof(*token->argv)) ||
+                !reserve(&token->stages, &token->_stages_size,
+                         (size_t)token->nstages + 1, sizeof(*token->stages))) {
+                fprintf(stderr, "Error: too many arguments\n");
+                return PARSELINE_ERROR;
+            }
+            token->argv[n++] = NULL;
+            token->stages[token->nstages++] = n;
             buf++;
             continue;
         } else if (*buf == '\'' || *buf == '\"') {
             /* Detect quoted tokens */
             buf++;
-            next = strchr(buf, *(buf - 1));
+            size_t quote =
+                scan_find_quote(&sc, (size_t)(buf - start), *(buf - 1));
+            next = quote < len ? start + quote : NULL;
         } else {
             /* Find next delimiter */
-            next = buf + strcspn(buf, delims);
+            next = start + scan_find_space(&sc, (size_t)(buf - start));
         }
 
         if (next == NULL) {
-            /* Returned by strchr(); this means that the closing
-               quote was not found. */
+            /* This means that the closing quote was not found. */
             if (verbose) {
                 fprintf(stderr, "Error: unmatched %c.\n", *(buf - 1));
             }
@@ -123,8 +241,12 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
         /* Record the token as either the next argument or the i/o file */
         switch (parsing_state) {
         case ST_NORMAL:
-            token->argv[token->argc] = buf;
-            token->argc = token->argc + 1;
+            if (!reserve(&token->argv, &token->_argv_size, (size_t)n + 1,
+                         sizeof(*token->argv))) {
+                fprintf(stderr, "Error: too many arguments\n");
+                return PARSELINE_ERROR;
+            }
+            token->argv[n++] = buf;
             break;
         case ST_INFILE:
             token->infile = buf;
@@ -138,10 +260,6 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
         }
         parsing_state = ST_NORMAL;
 
-        /* Check if argv is full */
-        if (token->argc >= MAXARGS - 1)
-            break;
-
         buf = next + 1;
     }
 
@@ -151,35 +269,50 @@ parseline_return parseline(const char *cmdline, struct cmdline_tokens *token) {
     }
 
     /* The argument list must end with a NULL pointer */
-    token->argv[token->argc] = NULL;
+    if (!reserve(&token->argv, &token->_argv_size, (size_t)n + 1,
+                 sizeof(*token->argv))) {
+        fprintf(stderr, "Error: too many arguments\n");
+        return PARSELINE_ERROR;
+    }
+    token->argv[n] = NULL;
+    token->argc = token->nstages == 1 ? n : token->stages[1] - 1;
 
     if (token->argc == 0) { /* ignore blank line */
         return PARSELINE_EMPTY;
     }
 
-    if ((strcmp(token->argv[0], "quit")) == 0) { /* quit command */
-        token->builtin = BUILTIN_QUIT;
-    } else if ((strcmp(token->argv[0], "jobs")) == 0) { /* jobs command */
-        token->builtin = BUILTIN_JOBS;
-    } else if ((strcmp(token->argv[0], "bg")) == 0) { /* bg command */
-        token->builtin = BUILTIN_BG;
-    } else if ((strcmp(token->argv[0], "fg")) == 0) { /* fg command */
-        token->builtin = BUILTIN_FG;
-    } else {
-        token->builtin = BUILTIN_NONE;
-    }
-
     // Returns 5 if job runs on background; 4 if job runs on foreground
 
-    if (*token->argv[(token->argc) - 1] == '&') {
-        token->argv[--(token->argc)] = NULL;
-        if (token->argc == 0) {
+    parseline_return result = PARSELINE_FG;
+    int last_stage = token->stages[token->nstages - 1];
+    if (n > last_stage && *token->argv[n - 1] == '&') {
+        token->argv[--n] = NULL;
+        if (token->nstages == 1) {
+            token->argc = n;
+        }
+        result = PARSELINE_BG;
+    }
+
+    if (n == last_stage) {
+        if (token->nstages == 1) {
             return PARSELINE_EMPTY;
         }
-        return PARSELINE_BG;
-    } else {
-        return PARSELINE_FG;
+        fprintf(stderr, "Error: missing command in pipeline\n");
+        return PARSELINE_ERROR;
     }
+    if (token->outfile && out_stage != token->nstages - 1) {
+        if (verbose) {
+            fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+        }
+        return PARSELINE_ERROR;
+    }
+
+    // utilities only run in-process as a command of their own
+    token->builtin = builtin_lookup(token->argc, token->argv);
+    if (token->builtin == BUILTIN_UTIL && token->nstages > 1) {
+        token->builtin = BUILTIN_NONE;
+    }
+    return result;
 }
 
 /*****************
@@ -229,12 +362,20 @@ static void check_blocked(void) {
     }
 }
 
+/*
+ * job_list_set_check_blocked - Enable or disable check_blocked
+ * Async-signal-safe
+ */
+void job_list_set_check_blocked(bool check) {
+    check_block = check;
+}
+
 /*
  * get_job - Gets a reference to the job struct corresponding to a job ID. The
  * job struct may not necessarily be valid. Async-signal-safe
  */
 static struct job_t *get_job(jid_t jid) {
-    if (jid < 1 || jid > MAXJOBS) {
+    if (jid < 1 || jid > job_cap) {
         sio_eprintf("get_job: invalid jid\n");
         abort();
     }
@@ -252,42 +393,296 @@ static void clearjob(struct job_t *job) {
     job->state = UNDEF;
 }
 
+/*
+ * pid_hash - Home slot of a PID in pid_index. Consecutive PIDs land in
+ * consecutive slots of a power-of-two table, so collisions stay rare.
+ * Async-signal-safe
+ */
+static size_t pid_hash(pid_t pid) {
+    return ((uint32_t)pid * 2654435761u) & index_mask;
+}
+
+/*
+ * index_insert - Add a pid -> jid mapping; pid must not be present.
+ * Returns its slot.
+ * Async-signal-safe
+ */
+static struct pid_slot *index_insert(pid_t pid, jid_t jid) {
+    size_t i = pid_hash(pid);
+    while (pid_index[i].pid != 0) {
+        i = (i + 1) & index_mask;
+    }
+    pid_index[i].pid = pid;
+    pid_index[i].jid = jid;
+    pid_index[i].pidfd = -1;
+    pid_index[i].prev = pid;
+    pid_index[i].next = pid;
+    index_count++;
+    return &pid_index[i];
+}
+
+/*
+ * index_slot - Slot holding pid in pid_index, or the free slot ending its
+ * probe sequence. pid_index is never full, so the probe terminates.
+ * Async-signal-safe
+ */
+static size_t index_slot(pid_t pid) {
+    size_t i = pid_hash(pid);
+    while (pid_index[i].pid != 0 && pid_index[i].pid != pid) {
+        i = (i + 1) & index_mask;
+    }
+    return i;
+}
+
+/*
+ * index_remove - Remove pid from pid_index. Later entries of the probe
+ * sequence are shifted back, so no tombstones are needed.
+ * Async-signal-safe
+ */
+static void index_remove(pid_t pid) {
+    size_t i = index_slot(pid);
+    if (pid_index[i].pid == 0) {
+        return;
+    }
+    for (size_t j = (i + 1) & index_mask; pid_index[j].pid != 0;
+         j = (j + 1) & index_mask) {
+        size_t home = pid_hash(pid_index[j].pid);
+        // Entry j may move to i unless its home lies cyclically in (i, j]
+        bool stays = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!stays) {
+            pid_index[i] = pid_index[j];
+            i = j;
+        }
+    }
+    pid_index[i].pid = 0;
+    pid_index[i].jid = 0;
+    index_count--;
+}
+
+/*
+ * index_link - Add pid at the end of the ring of the job led by leader
+ * Async-signal-safe
+ */
+static void index_link(pid_t leader, pid_t pid) {
+    struct pid_slot *head = &pid_index[index_slot(leader)];
+    struct pid_slot *slot = &pid_index[index_slot(pid)];
+    slot->prev = head->prev;
+    slot->next = leader;
+    pid_index[index_slot(head->prev)].next = pid;
+    head->prev = pid;
+}
+
+/*
+ * index_unlink - Remove pid from the ring of its job, then from pid_index
+ * Async-signal-safe
+ */
+static void index_unlink(pid_t pid) {
+    struct pid_slot *slot = &pid_index[index_slot(pid)];
+    if (slot->pid == 0) {
+        return;
+    }
+    pid_index[index_slot(slot->prev)].next = slot->next;
+    pid_index[index_slot(slot->next)].prev = slot->prev;
+    index_remove(pid);
+}
+
+/*
+ * table_map - Map zero-filled memory for the job tables
+ * Async-signal-safe
+ */
+static void *table_map(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ * table_remap - Grow a mapping made by table_map. The new part is
+ * zero-filled, which leaves new job slots in the UNDEF state.
+ * Async-signal-safe
+ */
+static void *table_remap(void *old, size_t old_size, size_t size) {
+    if (old == NULL) {
+        return table_map(size);
+    }
+    void *p = mremap(old, old_size, size, MREMAP_MAYMOVE);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+/*
+ * index_reserve - Make room in pid_index for count entries while keeping it
+ * at most half full, rehashing the existing entries into a larger table
+ * Async-signal-safe
+ */
+static bool index_reserve(size_t count) {
+    size_t old_size = pid_index != NULL ? index_mask + 1 : 0;
+    if (2 * count <= old_size) {
+        return true;
+    }
+    size_t size = old_size == 0 ? 2 * MAXJOBS : old_size;
+    while (size < 2 * count) {
+        size *= 2;
+    }
+
+    struct pid_slot *index = table_map(size * sizeof(*index));
+    if (index == NULL) {
+        return false;
+    }
+    struct pid_slot *old = pid_index;
+    pid_index = index;
+    index_mask = size - 1;
+    index_count = 0;
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].pid != 0) {
+            *index_insert(old[i].pid, old[i].jid) = old[i];
+        }
+    }
+    if (old != NULL) {
+        munmap(old, old_size * sizeof(*old));
+    }
+    return true;
+}
+
+/*
+ * table_grow - Double the capacity of the job list (or create it with
+ * MAXJOBS slots), keeping room in the pid index for a leader per slot.
+ * Async-signal-safe
+ */
+static bool table_grow(void) {
+    if (job_cap > INT_MAX / 2) {
+        return false; // jid_t overflow
+    }
+    jid_t cap = job_cap == 0 ? MAXJOBS : 2 * job_cap;
+
+    if (!index_reserve(index_count + (size_t)(cap - job_cap))) {
+        return false;
+    }
+    struct job_t *list =
+        table_remap(job_list, (size_t)job_cap * sizeof(*job_list),
+                    (size_t)cap * sizeof(*job_list));
+    if (list == NULL) {
+        return false;
+    }
+    job_list = list;
+    uint64_t *map = table_remap(jid_map, (size_t)job_cap / 8, (size_t)cap / 8);
+    if (map == NULL) {
+        return false; // job_list keeps its larger size, unused
+    }
+    jid_map = map;
+    job_cap = cap;
+    return true;
+}
+
+/*
+ * state_link - Insert a job into the list of its state, which is kept in
+ * JID order. New jobs usually have the largest JID, so the insertion point
+ * is searched from the tail.
+ * Async-signal-safe
+ */
+static void state_link(struct job_t *job) {
+    jid_t after = state_tail[job->state];
+    while (after != 0 && after > job->jid) {
+        after = get_job(after)->prev;
+    }
+
+    job->prev = after;
+    job->next = after != 0 ? get_job(after)->next : state_head[job->state];
+    if (job->next != 0) {
+        get_job(job->next)->prev = job->jid;
+    } else {
+        state_tail[job->state] = job->jid;
+    }
+    if (after != 0) {
+        get_job(after)->next = job->jid;
+    } else {
+        state_head[job->state] = job->jid;
+    }
+    state_count[job->state]++;
+}
+
+/*
+ * state_unlink - Remove a job from the list of its state
+ * Async-signal-safe
+ */
+static void state_unlink(struct job_t *job) {
+    if (job->prev != 0) {
+        get_job(job->prev)->next = job->next;
+    } else {
+        state_head[job->state] = job->next;
+    }
+    if (job->next != 0) {
+        get_job(job->next)->prev = job->prev;
+    } else {
+        state_tail[job->state] = job->prev;
+    }
+    job->prev = 0;
+    job->next = 0;
+    state_count[job->state]--;
+}
+
 /*
  * init_job_list - Initialize the job list
  * Not async-signal-safe
  */
 void init_job_list(void) {
     init = true;
-    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
-        struct job_t *job = get_job(jid);
-        clearjob(job);
-        job->cmdline = NULL;
+    if (!table_grow()) {
+        perror("init_job_list error");
+        exit(1);
     }
     nextjid = 1;
+    memset(state_head, 0, sizeof(state_head));
+    memset(state_tail, 0, sizeof(state_tail));
+    memset(state_count, 0, sizeof(state_count));
 }
 
 /*
  * destroy_job_list - Destroy the job list, freeing any allocated memory
- * Not async-signal-safe (free)
+ * Not async-signal-safe
  */
 void destroy_job_list(void) {
-    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
-        struct job_t *job = get_job(jid);
-        clearjob(job);
-        free(job->cmdline);
-        job->cmdline = NULL;
+    for (jid_t jid = 1; jid <= job_cap; jid++) {
+        arena_release(get_job(jid)->cmdline);
     }
+    if (job_list != NULL) {
+        munmap(job_list, (size_t)job_cap * sizeof(*job_list));
+        munmap(jid_map, (size_t)job_cap / 8);
+        munmap(pid_index, (index_mask + 1) * sizeof(*pid_index));
+    }
+    job_list = NULL;
+    jid_map = NULL;
+    pid_index = NULL;
+    job_cap = 0;
+    index_mask = 0;
+    index_count = 0;
     nextjid = 1;
+    memset(state_head, 0, sizeof(state_head));
+    memset(state_tail, 0, sizeof(state_tail));
+    memset(state_count, 0, sizeof(state_count));
 }
 
 /*
- * maxjid - Returns largest allocated job ID
+ * maxjid - Returns largest allocated job ID, searching down from the word
+ * of jid_map that holds `from`
  * Async-signal-safe
  */
-static jid_t maxjid(void) {
-    for (jid_t jid = MAXJOBS; jid >= 1; jid--) {
-        if (job_exists(jid)) {
-            return jid;
+static jid_t maxjid(jid_t from) {
+    for (jid_t w = (from - 1) / MAP_BITS; w >= 0; w--) {
+        if (jid_map[w] != 0) {
+            return w * MAP_BITS + MAP_BITS - __builtin_clzll(jid_map[w]);
+        }
+    }
+    return 0;
+}
+
+/*
+ * free_jid - Returns the smallest unused job ID, or 0 if every slot is used
+ * Async-signal-safe
+ */
+static jid_t free_jid(void) {
+    for (jid_t w = 0; w < job_cap / MAP_BITS; w++) {
+        if (~jid_map[w] != 0) {
+            return w * MAP_BITS + __builtin_ctzll(~jid_map[w]) + 1;
         }
     }
     return 0;
@@ -300,7 +695,7 @@ static jid_t maxjid(void) {
 bool job_exists(jid_t jid) {
     check_blocked();
 
-    if (jid < 1 || jid > MAXJOBS) {
+    if (jid < 1 || jid > job_cap) {
         return false;
     }
     struct job_t *job = get_job(jid);
@@ -317,7 +712,7 @@ static void require_job_exists(char *func, jid_t jid) {
 }
 
 static void require_valid_state(char *func, jid_t jid, job_state state) {
-    if (state != FG && state != BG && state != ST) {
+    if (state != FG && state != BG && state != ST && state != QUEUED) {
         sio_eprintf("FATAL: job_set_state: invalid job state: %d\n", state);
         sio_eprintf("This means you have a bug in your code, and you need to "
                     "fix it.\n");
@@ -334,12 +729,45 @@ static void require_valid_state(char *func, jid_t jid, job_state state) {
 }
 
 /*
- * add_job - Add a job to the job list
- * Not async-signal-safe (realloc)
+ * apply_prio - Move a job to the priority of its state: its policy in the
+ * background, that of the shell in the foreground
+ * Async-signal-safe
+ */
+static bool apply_prio(const struct job_t *job) {
+    if (!prio_enabled || job->pid == 0 ||
+        (job->state != BG && job->state != FG)) {
+        return true;
+    }
+    const struct prio_policy *policy = job->state == BG ? &job->prio : NULL;
+    bool ok;
+    if (reaper_enabled) {
+        // Adopted processes of the job are not in the job list
+        ok = prio_apply_members(job->pid, policy);
+    } else {
+        ok = job->exited || prio_apply_process(job->pid, policy);
+        for (pid_t pid = pid_index[index_slot(job->pid)].next;
+             pid != job->pid; pid = pid_index[index_slot(pid)].next) {
+            ok = prio_apply_process(pid, policy) && ok;
+        }
+    }
+    if (!prio_apply_group(job->pid, policy) || !ok) {
+        if (verbose) {
+            sio_eprintf("job [%d]: Cannot apply its priority\n", job->jid);
+        }
+        return false;
+    }
+    return true;
+}
+
+/*
+ * add_job - Add a job to the job list. The command line is interned in the
+ * arena, so no heap memory is used.
+ * Async-signal-safe
  */
 jid_t add_job(pid_t pid, job_state state, const char *cmdline) {
     check_blocked();
-    if (!((state == FG && fg_job() == 0) || state == BG || state == ST)) {
+    if (!((state == FG && fg_job() == 0) || state == BG || state == ST ||
+          state == QUEUED)) {
         if (state == FG) {
             sio_eprintf("add_job: foreground job already exists\n");
             abort();
@@ -347,7 +775,7 @@ jid_t add_job(pid_t pid, job_state state, const char *cmdline) {
         sio_eprintf("add_job: invalid job state\n");
         abort();
     }
-    if (pid <= 0) {
+    if (pid < 0 || (pid == 0) != (state == QUEUED)) {
         sio_eprintf("add_job: invalid pid\n");
         abort();
     }
@@ -356,44 +784,71 @@ jid_t add_job(pid_t pid, job_state state, const char *cmdline) {
         abort();
     }
 
-    /* Ensure nextjid is available in job list */
+    /*
+     * Job IDs are handed out as one more than the largest in use. Once that
+     * runs past the end of the job list, the lowest free ID is recycled, and
+     * the list only grows when it is full.
+     */
     sio_assert(nextjid > 0);
-    if (nextjid > MAXJOBS) {
+    jid_t jid = nextjid;
+    if (jid > job_cap && (jid = free_jid()) == 0) {
+        if (!table_grow()) {
+            if (verbose) {
+                sio_eprintf("add_job: Tried to create too many jobs\n");
+            }
+            return 0;
+        }
+        jid = nextjid;
+    }
+
+    const char *stored = arena_intern(cmdline);
+    if (stored == NULL) {
         if (verbose) {
-            fprintf(stderr, "add_job: Tried to create too many jobs\n");
+            sio_eprintf("add_job: No memory for the command line\n");
         }
         return 0;
     }
 
-    struct job_t *job = get_job(nextjid);
+    struct job_t *job = get_job(jid);
     sio_assert(job->state == UNDEF);
 
-    job->jid = nextjid;
+    job->jid = jid;
     job->pid = pid;
     job->state = state;
-
-    /* Realloc new buffer for cmdline */
-    job->cmdline = realloc(job->cmdline, strlen(cmdline) + 1);
-    if (job->cmdline == NULL) {
-        sio_eprintf("Realloc error\n");
-        _exit(1);
+    job->cmdline = stored;
+    job->nprocs = 1;
+    job->sig = 0;
+    job->code = 0;
+    job->exited = false;
+    memset(&job->usage, 0, sizeof(job->usage));
+    if (pid != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &job->usage.launched);
+    }
+    job->prio = prio_default;
+    jid_map[(jid - 1) / MAP_BITS] |= (uint64_t)1 << ((jid - 1) % MAP_BITS);
+    if (pid != 0) {
+        index_insert(pid, jid);
+    }
+    state_link(job);
+    if (state == BG) {
+        apply_prio(job);
     }
-    strcpy(job->cmdline, cmdline);
 
     if (verbose) {
-        fprintf(stderr, "add_job: Added job [%d] %d %s\n", (int)job->jid,
-                (int)job->pid, job->cmdline);
+        sio_eprintf("add_job: Added job [%d] %d %s\n", (int)job->jid,
+                    (int)job->pid, job->cmdline);
     }
 
-    nextjid++;
+    if (jid == nextjid) {
+        nextjid++;
+    }
     sio_assert(nextjid > 0);
     return job->jid;
 }
 
 /*
- * delete_job - Delete a job by jid from the job list. Does not free memory
- * used by the cmdline buffer in the job struct, in order to ensure that
- * this function is async-signal-safe.
+ * delete_job - Delete a job by jid from the job list, releasing its command
+ * line in the arena. A job that has run is recorded in the history ring.
  * Async-signal-safe
  */
 bool delete_job(jid_t jid) {
@@ -407,13 +862,270 @@ bool delete_job(jid_t jid) {
     }
 
     struct job_t *job = get_job(jid);
+    if (job->pid != 0) {
+        // Processes of a pipeline that have not been reaped
+        pid_t pid;
+        while ((pid = pid_index[index_slot(job->pid)].next) != job->pid) {
+            index_unlink(pid);
+        }
+        index_remove(job->pid);
+        if (job->nprocs > 0) { // deleted before it ended
+            clock_gettime(CLOCK_MONOTONIC, &job->usage.ended);
+        }
+        history_record(jid, job->pid, job->sig, job->code, &job->usage,
+                       job->cmdline);
+    }
+    jid_map[(jid - 1) / MAP_BITS] &= ~((uint64_t)1 << ((jid - 1) % MAP_BITS));
+    state_unlink(job);
+    arena_release(job->cmdline);
+    job->cmdline = NULL;
     clearjob(job);
 
-    nextjid = maxjid() + 1;
+    if (jid == nextjid - 1) {
+        nextjid = maxjid(jid) + 1;
+    }
     sio_assert(nextjid > 0);
     return true;
 }
 
+/*
+ * job_add_process - Add another process to a job
+ * Async-signal-safe
+ */
+bool job_add_process(jid_t jid, pid_t pid) {
+    check_blocked();
+    require_job_exists("job_add_process", jid);
+
+    struct job_t *job = get_job(jid);
+    if (pid <= 0 || job->pid == 0 || !index_reserve(index_count + 1)) {
+        return false;
+    }
+    index_insert(pid, jid);
+    index_link(job->pid, pid);
+    job->nprocs++;
+    if (job->state == BG) {
+        prio_apply_process(pid, &job->prio);
+    }
+    return true;
+}
+
+/*
+ * job_set_pid - Set the process of a QUEUED job that has been started
+ * Async-signal-safe
+ */
+bool job_set_pid(jid_t jid, pid_t pid) {
+    check_blocked();
+    require_job_exists("job_set_pid", jid);
+
+    struct job_t *job = get_job(jid);
+    if (pid <= 0 || job->pid != 0 || !index_reserve(index_count + 1)) {
+        return false;
+    }
+    job->pid = pid;
+    index_insert(pid, jid);
+    clock_gettime(CLOCK_MONOTONIC, &job->usage.launched);
+    return true;
+}
+
+/*
+ * timeval_add - Add a CPU time to another
+ * Async-signal-safe
+ */
+static void timeval_add(struct timeval *sum, const struct timeval *tv) {
+    sum->tv_sec += tv->tv_sec;
+    sum->tv_usec += tv->tv_usec;
+    if (sum->tv_usec >= 1000000) {
+        sum->tv_sec++;
+        sum->tv_usec -= 1000000;
+    }
+}
+
+/*
+ * job_add_rusage - Add the resources used by a reaped process to its job
+ * Async-signal-safe
+ */
+void job_add_rusage(jid_t jid, const struct rusage *ru) {
+    check_blocked();
+    require_job_exists("job_add_rusage", jid);
+
+    struct job_usage *usage = &get_job(jid)->usage;
+    timeval_add(&usage->utime, &ru->ru_utime);
+    timeval_add(&usage->stime, &ru->ru_stime);
+    if (ru->ru_maxrss > usage->maxrss) {
+        usage->maxrss = ru->ru_maxrss;
+    }
+    usage->minflt += ru->ru_minflt;
+    usage->majflt += ru->ru_majflt;
+    usage->nvcsw += ru->ru_nvcsw;
+    usage->nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * job_add_perf - Add the counters of a reaped process to its job
+ * Async-signal-safe
+ */
+void job_add_perf(jid_t jid, const struct perf_counts *counts) {
+    check_blocked();
+    require_job_exists("job_add_perf", jid);
+    perf_add(&get_job(jid)->usage.perf, counts);
+}
+
+/*
+ * job_get_usage - Get the resources used by a job so far
+ * Async-signal-safe
+ */
+void job_get_usage(jid_t jid, struct job_usage *usage) {
+    check_blocked();
+    require_job_exists("job_get_usage", jid);
+    *usage = get_job(jid)->usage;
+}
+
+/*
+ * job_get_prio - Get the background policy of a job
+ * Async-signal-safe
+ */
+void job_get_prio(jid_t jid, struct prio_policy *policy) {
+    check_blocked();
+    require_job_exists("job_get_prio", jid);
+    *policy = get_job(jid)->prio;
+}
+
+/*
+ * job_set_prio - Set the background policy of a job
+ * Async-signal-safe
+ */
+bool job_set_prio(jid_t jid, const struct prio_policy *policy) {
+    check_blocked();
+    require_job_exists("job_set_prio", jid);
+
+    struct job_t *job = get_job(jid);
+    job->prio = *policy;
+    return job->state != BG || apply_prio(job);
+}
+
+/*
+ * put_fixed - Write sec.frac, with frac zero-padded to digits digits
+ * Async-signal-safe
+ */
+static char *put_fixed(char *out, long sec, long frac, int digits) {
+    char tmp[24];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + sec % 10);
+        sec /= 10;
+    } while (sec > 0);
+    while (n > 0) {
+        *out++ = tmp[--n];
+    }
+    *out++ = '.';
+    for (int i = digits - 1; i >= 0; i--) {
+        out[i] = (char)('0' + frac % 10);
+        frac /= 10;
+    }
+    out += digits;
+    *out++ = 's';
+    *out = '\0';
+    return out + 1;
+}
+
+/*
+ * print_usage - Buffer a resource usage as key value pairs
+ * Async-signal-safe
+ */
+bool print_usage(sio_t *out, const char *prefix,
+                 const struct job_usage *usage) {
+    struct timespec end = usage->ended;
+    if (usage->launched.tv_sec == 0 && usage->launched.tv_nsec == 0) {
+        end = usage->launched; // never started
+    } else if (end.tv_sec == 0 && end.tv_nsec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    long sec = end.tv_sec - usage->launched.tv_sec;
+    long nsec = end.tv_nsec - usage->launched.tv_nsec;
+    if (nsec < 0) {
+        sec--;
+        nsec += 1000000000L;
+    }
+
+    char real[32], user[32], sys[32];
+    put_fixed(real, sec, nsec, 9);
+    put_fixed(user, usage->utime.tv_sec, usage->utime.tv_usec, 6);
+    put_fixed(sys, usage->stime.tv_sec, usage->stime.tv_usec, 6);
+    if (sio_printfb(out,
+                    "%sreal %s user %s sys %s maxrss %ldKiB minflt %ld "
+                    "majflt %ld nvcsw %ld nivcsw %ld\n",
+                    prefix, real, user, sys, usage->maxrss, usage->minflt,
+                    usage->majflt, usage->nvcsw, usage->nivcsw) < 0) {
+        return false;
+    }
+    return usage->perf.valid == 0 || perf_print(out, prefix, &usage->perf);
+}
+
+/*
+ * job_count - Number of jobs in a state
+ * Async-signal-safe
+ */
+int job_count(job_state state) {
+    check_blocked();
+    return state >= FG && state < NSTATES ? state_count[state] : 0;
+}
+
+/*
+ * job_exit_process - Record the termination of a process of a job. The
+ * leader stays in the pid index until the job is deleted.
+ * Async-signal-safe
+ */
+int job_exit_process(jid_t jid, pid_t pid, int status,
+                     const struct timespec *when, int *job_sig) {
+    check_blocked();
+    require_job_exists("job_exit_process", jid);
+
+    struct job_t *job = get_job(jid);
+    if (pid != job->pid) {
+        index_unlink(pid);
+    } else {
+        job->exited = true;
+    }
+    if (job->sig == 0 && WIFSIGNALED(status)) {
+        job->sig = WTERMSIG(status);
+    }
+    if (job->code == 0 && WIFEXITED(status)) {
+        job->code = WEXITSTATUS(status);
+    }
+    *job_sig = job->sig;
+    if (--job->nprocs == 0) {
+        if (when != NULL) {
+            job->usage.ended = *when;
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &job->usage.ended);
+        }
+    }
+    return job->nprocs;
+}
+
+/*
+ * job_get_procs - List the processes of a job that have not terminated
+ * Async-signal-safe
+ */
+int job_get_procs(jid_t jid, pid_t *pids, int max) {
+    check_blocked();
+    require_job_exists("job_get_procs", jid);
+
+    const struct job_t *job = get_job(jid);
+    int n = 0;
+    if (job->pid == 0) {
+        return 0;
+    }
+    if (!job->exited && n < max) {
+        pids[n++] = job->pid;
+    }
+    for (pid_t pid = pid_index[index_slot(job->pid)].next;
+         pid != job->pid && n < max; pid = pid_index[index_slot(pid)].next) {
+        pids[n++] = pid;
+    }
+    return n;
+}
+
 /*
  * fg_job - Return JID of current foreground job, or 0 if no such job
  * Async-signal-safe
@@ -421,11 +1133,8 @@ bool delete_job(jid_t jid) {
 jid_t fg_job(void) {
     check_blocked();
 
-    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
-        struct job_t *jobp = get_job(jid);
-        if (jobp->state == FG) {
-            return jid;
-        }
+    if (state_head[FG] != 0) {
+        return state_head[FG];
     }
 
     if (verbose) {
@@ -434,6 +1143,37 @@ jid_t fg_job(void) {
     return 0;
 }
 
+/*
+ * job_set_pidfd - Record the pidfd the loop watches a process with
+ * Async-signal-safe
+ */
+bool job_set_pidfd(pid_t pid, int pidfd) {
+    check_blocked();
+
+    size_t slot = index_slot(pid);
+    if (pid <= 0 || pid_index[slot].pid != pid) {
+        return false;
+    }
+    pid_index[slot].pidfd = pidfd;
+    return true;
+}
+
+/*
+ * job_take_pidfd - Take back the pidfd recorded for a process
+ * Async-signal-safe
+ */
+int job_take_pidfd(pid_t pid) {
+    check_blocked();
+
+    size_t slot = index_slot(pid);
+    if (pid <= 0 || pid_index[slot].pid != pid) {
+        return -1;
+    }
+    int pidfd = pid_index[slot].pidfd;
+    pid_index[slot].pidfd = -1;
+    return pidfd;
+}
+
 /*
  * job_from_pid - Find a job (by PID) on the job list
  * Async-signal-safe
@@ -448,11 +1188,9 @@ jid_t job_from_pid(pid_t pid) {
         return 0;
     }
 
-    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
-        struct job_t *jobp = get_job(jid);
-        if (jobp->state != UNDEF && jobp->pid == pid) {
-            return jid;
-        }
+    size_t slot = index_slot(pid);
+    if (pid_index[slot].pid == pid) {
+        return pid_index[slot].jid;
     }
 
     if (verbose) {
@@ -483,7 +1221,12 @@ void job_set_state(jid_t jid, job_state state) {
     require_valid_state("job_set_state", jid, state);
 
     struct job_t *jobp = get_job(jid);
-    jobp->state = state;
+    if (jobp->state != state) {
+        state_unlink(jobp);
+        jobp->state = state;
+        state_link(jobp);
+        apply_prio(jobp);
+    }
 }
 
 /*
@@ -515,17 +1258,61 @@ const char *job_get_cmdline(jid_t jid) {
  * Async-signal-safe
  */
 bool list_jobs(int output_fd) {
+    return list_jobs_states(output_fd, JOB_STATE_BIT(FG) | JOB_STATE_BIT(BG) |
+                                           JOB_STATE_BIT(ST) |
+                                           JOB_STATE_BIT(QUEUED));
+}
+
+/*
+ * print_members - Buffer the live processes of the process group of a job
+ * Async-signal-safe
+ */
+static void print_members(sio_t *out, pid_t pgid) {
+    struct reaper_member members[MAX_MEMBERS];
+    int n = reaper_members(pgid, members, MAX_MEMBERS);
+    for (int i = 0; i < n; i++) {
+        sio_printfb(out, "    (%d) %c %s\n", members[i].pid, members[i].state,
+                    members[i].comm);
+    }
+}
+
+/*
+ * print_jobs - Print the jobs in a set of states, with the JOB_LIST_* details
+ * of each. The per-state lists are merged by JID, so only the listed jobs
+ * are visited. The listing is buffered, and written in one go unless it
+ * outgrows the buffer.
+ * Async-signal-safe
+ */
+static bool print_jobs(int output_fd, unsigned states, unsigned details) {
     check_blocked();
     if (output_fd < 0) {
         sio_eprintf("list_jobs: invalid file descriptor\n");
         abort();
     }
 
-    for (jid_t jid = 1; jid <= MAXJOBS; jid++) {
-        struct job_t *jobp = get_job(jid);
-        if (jobp->state == UNDEF) {
-            continue;
+    sio_t out;
+    sio_initb(&out, output_fd);
+
+    jid_t cursor[NSTATES] = {0};
+    for (job_state state = FG; state < NSTATES; state++) {
+        if (states & JOB_STATE_BIT(state)) {
+            cursor[state] = state_head[state];
         }
+    }
+
+    while (true) {
+        job_state state = UNDEF;
+        for (job_state s = FG; s < NSTATES; s++) {
+            if (cursor[s] != 0 &&
+                (state == UNDEF || cursor[s] < cursor[state])) {
+                state = s;
+            }
+        }
+        if (state == UNDEF) {
+            break;
+        }
+        struct job_t *jobp = get_job(cursor[state]);
+        cursor[state] = jobp->next;
 
         char *status = NULL;
         switch (jobp->state) {
@@ -538,22 +1325,56 @@ bool list_jobs(int output_fd) {
         case ST:
             status = "Stopped    ";
             break;
+        case QUEUED:
+            status = "Queued     ";
+            break;
         default:
             sio_eprintf("Invalid job state\n");
             abort();
         }
 
-        ssize_t res = sio_dprintf(output_fd, "[%d] (%d) %s%s\n", jobp->jid,
-                                  jobp->pid, status, jobp->cmdline);
-        if (res < 0) {
-            sio_eprintf("list_jobs: Error writing to output_fd: %d\n",
-                        output_fd);
-            return false;
+        if (jobp->pid != 0) {
+            sio_printfb(&out, "[%d] (%d) %s%s\n", jobp->jid, jobp->pid,
+                        status, jobp->cmdline);
+        } else { // not started yet
+            sio_printfb(&out, "[%d] (-) %s%s\n", jobp->jid, status,
+                        jobp->cmdline);
+        }
+        if ((details & JOB_LIST_MEMBERS) && jobp->pid != 0) {
+            print_members(&out, jobp->pid);
+        }
+        if (details & JOB_LIST_USAGE) {
+            print_usage(&out, "    ", &jobp->usage);
+            cgroup_print(&out, "    ", jobp->jid);
+        }
+        if (details & JOB_LIST_PRIO) {
+            char spec[PRIO_SPEC_SIZE];
+            sio_printfb(&out, "    prio %s\n", prio_format(spec, &jobp->prio));
         }
     }
 
+    if (sio_flushb(&out) < 0) {
+        sio_eprintf("list_jobs: Error writing to output_fd: %d\n", output_fd);
+        return false;
+    }
     return true;
 }
+
+/*
+ * list_jobs_states - Print the jobs in a set of states to a file descriptor
+ * Async-signal-safe
+ */
+bool list_jobs_states(int output_fd, unsigned states) {
+    return print_jobs(output_fd, states, 0);
+}
+
+/*
+ * list_jobs_details - Print the jobs in a set of states with details
+ * Async-signal-safe
+ */
+bool list_jobs_details(int output_fd, unsigned states, unsigned details) {
+    return print_jobs(output_fd, states, details);
+}
 /******************************
  * end job list helper routines
  ******************************/
@@ -567,9 +1388,49 @@ bool list_jobs(int output_fd) {
  * Not async-signal-safe
  */
 void usage(void) {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpP] [-s engine] [--pidfd] [--signalfd] "
+           "[--pipe-size bytes] [--external]\n"
+           "             [--bg-max jobs] [--psi-cpu us] [--psi-memory us] "
+           "[--perf]\n"
+           "             [--history-file file] [--subreaper] "
+           "[--cgroup dir] [--bg-prio]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -P   run pipelines (cmd | cmd ...); otherwise | is an "
+           "argument\n");
+    printf("   -s engine\n");
+    printf("        launch jobs with fork (default), vfork, posix_spawn, "
+           "clone3 or zygote\n");
+    printf("   --pidfd\n");
+    printf("        track jobs with pidfds in an epoll loop instead of a "
+           "SIGCHLD handler\n");
+    printf("   --signalfd\n");
+    printf("        receive SIGCHLD, SIGINT, SIGTSTP and SIGQUIT through a "
+           "signalfd\n");
+    printf("   --pipe-size bytes\n");
+    printf("        set the capacity of the pipes of a pipeline\n");
+    printf("   --external\n");
+    printf("        run echo, true, false, cat and printf as external "
+           "programs\n");
+    printf("   --bg-max jobs\n");
+    printf("        run at most this many background jobs; queue the others\n");
+    printf("   --psi-cpu us, --psi-memory us\n");
+    printf("        queue background jobs while CPU or memory stalls reach us "
+           "per second\n");
+    printf("   --perf\n");
+    printf("        open performance counters on every job, shown by jobs "
+           "-v\n");
+    printf("   --history-file file\n");
+    printf("        keep the ring of completed jobs (history -j) in file\n");
+    printf("   --subreaper\n");
+    printf("        adopt and reap the orphaned processes of jobs, and wait for "
+           "them\n");
+    printf("   --cgroup dir\n");
+    printf("        start every job in a cgroup of its own below the cgroup v2 "
+           "dir\n");
+    printf("   --bg-prio\n");
+    printf("        lower the CPU, I/O and OOM priority of background jobs "
+           "until fg\n");
     exit(EXIT_FAILURE);
 }
@@ -8,7 +8,21 @@
  *
  * Many of the helper routines are focused around maintaining a job list,
  * which you can only access through the routines themselves. Each job is
- * represented by a job ID ranging from 1 to `MAXJOBS`.
+ * represented by a positive job ID. The job list starts with room for
+ * `MAXJOBS` jobs and doubles in size whenever it fills up; jobs are found by
+ * PID through a hash index, and the jobs in each state are kept on a list of
+ * their own, so looking up a job by PID, finding the foreground job and
+ * listing the jobs in one state do not visit unrelated jobs.
+ *
+ * Every job also accumulates the resources used by its processes, from the
+ * `struct rusage` that reaping them with wait4 returns, together with the
+ * monotonic times it was launched and ended (see `job_usage`), and the
+ * performance counters of tsh_perf.h when they were opened on it.
+ *
+ * The processes of a job are those the shell started for it. With
+ * `--subreaper`, the processes they create are attributed to the job as
+ * well, through its process group, once the shell has adopted and reaped
+ * them (see tsh_reaper.h).
  *
  * The signal safety of each helper function is documented in this file. You
  * must ensure that any helper routines that you call within a signal handler
@@ -23,14 +37,21 @@
 #ifndef TSH_HELPER_H
 #define TSH_HELPER_H
 
+#include "tsh_perf.h"
+#include "tsh_prio.h"
+
 #include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 /* Misc manifest constants */
-#define MAXLINE_TSH 1024 /**< Max line size */
-#define MAXARGS 128      /**< Max args on a command line */
-#define MAXJOBS 64       /**< Max jobs at any point in time */
+#define MAXJOBS 64 /**< Initial capacity of the job list */
+
+/** @brief Bit representing `state` in a set of states (see list_jobs_states) */
+#define JOB_STATE_BIT(state) (1u << (state))
 
 /** @brief Integer type used for job IDs */
 typedef int jid_t;
@@ -43,16 +64,40 @@ typedef int jid_t;
  *   - ST -> FG  : fg command
  *   - ST -> BG  : bg command
  *   - BG -> FG  : fg command
+ *   - QUEUED -> BG : admitted by tsh_admit.c, or bg command
+ *   - QUEUED -> FG : fg command
  *
- * At most 1 job can be in the FG state.
+ * At most 1 job can be in the FG state. A QUEUED job has no process yet;
+ * its PID is 0 until `job_set_pid` is called.
  */
 typedef enum job_state {
-    UNDEF = 0, ///< Undefined (do not use)
-    FG = 1,    ///< Foreground job
-    BG = 2,    ///< Background job
-    ST = 3,    ///< Stopped job
+    UNDEF = 0,  ///< Undefined (do not use)
+    FG = 1,     ///< Foreground job
+    BG = 2,     ///< Background job
+    ST = 3,     ///< Stopped job
+    QUEUED = 4, ///< Background job waiting to be started
 } job_state;
 
+/**
+ * @brief Resources used by a job
+ *
+ * The CPU times, faults and context switches are summed over the processes
+ * of the job that have terminated; `maxrss` is the largest of theirs. So
+ * are the counters, if any.
+ */
+struct job_usage {
+    struct timespec launched; ///< When the job started (CLOCK_MONOTONIC)
+    struct timespec ended;    ///< When it ended or was deleted, or zero
+    struct timeval utime;     ///< User CPU time
+    struct timeval stime;     ///< System CPU time
+    long maxrss;              ///< Maximum resident set size, in KiB
+    long minflt;              ///< Page faults served without I/O
+    long majflt;              ///< Page faults that needed I/O
+    long nvcsw;               ///< Voluntary context switches
+    long nivcsw;              ///< Involuntary context switches
+    struct perf_counts perf;  ///< Performance counters (tsh_perf.h)
+};
+
 /**
  * @brief Parseline return value indicating the type of cmdline parsed
  */
@@ -67,28 +112,58 @@ typedef enum parseline_return {
  * @brief Types of builtins that can be executed by the shell
  */
 typedef enum builtin_state {
-    BUILTIN_NONE = 8,  ///< Not a builtin command
-    BUILTIN_QUIT = 9,  ///< `quit` (exit the shell)
-    BUILTIN_JOBS = 10, ///< `jobs` (list running jobs)
-    BUILTIN_BG = 11,   ///< `bg` (run job in background)
-    BUILTIN_FG = 12    ///< `fg` (run job in foreground)
+    BUILTIN_NONE = 8,      ///< Not a builtin command
+    BUILTIN_QUIT = 9,      ///< `quit` (exit the shell)
+    BUILTIN_JOBS = 10,     ///< `jobs` (list running jobs)
+    BUILTIN_BG = 11,       ///< `bg` (run job in background)
+    BUILTIN_FG = 12,       ///< `fg` (run job in foreground)
+    BUILTIN_HASH = 13,     ///< `hash` (show or update the command hash table)
+    BUILTIN_UTIL = 14,     ///< In-process utility, e.g. `echo` (tsh_builtin.h)
+    BUILTIN_AFTER = 15,    ///< `after` (start a job when others complete)
+    BUILTIN_TIME = 16,     ///< `time` (report the resources a job used)
+    BUILTIN_PERFSTAT = 17, ///< `perfstat` (`time` with performance counters)
+    BUILTIN_HISTORY = 18,  ///< `history -j` (list completed jobs)
+    BUILTIN_WAIT = 19,     ///< `wait` (wait for background jobs)
+    BUILTIN_STATS = 20,    ///< `stats` (show how often the shell woke up)
+    BUILTIN_PRIO = 21      ///< `prio` (show or change background policies)
 } builtin_state;
 
 /**
  * @brief Result of parsing a command line from parseline
+ *
+ * If `pipelines` is set, a command line may be a pipeline of several
+ * commands separated by `|`; otherwise `|` is an ordinary argument, as in
+ * the reference shell.
+ * `argv` holds the arguments of every command, each list terminated by NULL,
+ * and `stages[i]` is the index in `argv` of the first argument of command
+ * `i`. `argc` counts the arguments of the first command only, so for a
+ * single command `argv` and `argc` are as usual. The input redirection
+ * applies to the first command and the output redirection to the last.
+ *
+ * The arguments and file names point into `_buf`, a copy of the command line
+ * that is split in place. The arrays grow as needed and are kept between
+ * calls to parseline, so a token struct that is reused only allocates when
+ * it sees a longer line than before. A zero-initialized struct is ready for
+ * use; call `free_tokens` when done with it.
  */
 struct cmdline_tokens {
-    int argc;               ///< Number of arguments passed
-    char *argv[MAXARGS];    ///< The arguments list
-    char *infile;           ///< The filename for input redirection, or NULL
-    char *outfile;          ///< The filename for output redirection, or NULL
-    builtin_state builtin;  ///< Indicates if argv[0] is a builtin command
-    char _buf[MAXLINE_TSH]; ///< Internal backing buffer (do not use)
+    int argc;              ///< Number of arguments of the first command
+    char **argv;           ///< The arguments lists, each terminated by NULL
+    int nstages;           ///< Number of commands in the pipeline
+    int *stages;           ///< Index in argv of each command
+    char *infile;          ///< The filename for input redirection, or NULL
+    char *outfile;         ///< The filename for output redirection, or NULL
+    builtin_state builtin; ///< Indicates if argv[0] is a builtin command
+    char *_buf;            ///< Internal backing buffer (do not use)
+    size_t _buf_size;      ///< Allocated size of _buf (do not use)
+    size_t _argv_size;     ///< Allocated entries of argv (do not use)
+    size_t _stages_size;   ///< Allocated entries of stages (do not use)
 };
 
 /* These variables are externally defined in tsh_helper.c. */
 extern const char prompt[]; ///< Command line prompt (do not change)
 extern bool verbose;        ///< If true, prints additional output
+extern bool pipelines;      ///< If true, `|` separates pipeline commands
 
 /**
  * @brief Parses a command line into a tokens struct.
@@ -99,20 +174,24 @@ extern bool verbose;        ///< If true, prints additional output
  * command line used as a backing buffer for the other fields.
  *
  * Characters enclosed in single or double quotes are treated as a single
- * argument. The maximum number of arguments that will be parsed is `MAXARGS`.
- *
- * Only the first `MAXLINE_TSH - 1` characters of the command line will be
- * parsed. The command line is in the form:
+ * argument. There is no limit on the length of the command line or on the
+ * number of arguments. The command line is in the form:
  *
  *     command [arguments...] [< infile] [> oufile] [&]
  *
+ * or, if `pipelines` is set:
+ *
+ *     command [arguments...] [< infile] [| command [arguments...]]...
+ *         [> oufile] [&]
+ *
  * If the function cannot successfully parse the command line, it will return
  * `PARSELINE_ERROR`, and the contents of the token struct may be in an
  * inconsistent state.
  *
  * @param[in]  cmdline  The command line to parse.
  * @param[out] token    Pointer to a cmdline_tokens structure, which will
- *                      be populated with the parsed tokens.
+ *                      be populated with the parsed tokens. It must be
+ *                      zero-initialized or have been used by parseline.
  *
  * @return `PARSELINE_EMPTY`  if the command line is empty
  * @return `PARSELINE_BG`     if the user has requested a BG job
@@ -123,6 +202,15 @@ extern bool verbose;        ///< If true, prints additional output
  */
 parseline_return parseline(const char *cmdline, struct cmdline_tokens *token);
 
+/**
+ * @brief Frees the buffers of a token struct filled by `parseline`.
+ *
+ * The struct is left zero-initialized and can be passed to parseline again.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void free_tokens(struct cmdline_tokens *token);
+
 /**
  * @brief Initializes the job list.
  *
@@ -150,6 +238,20 @@ void init_job_list(void);
  */
 void destroy_job_list(void);
 
+/**
+ * @brief Enables or disables the check that signals are blocked.
+ *
+ * By default, every function that accesses the job list warns if SIGCHLD,
+ * SIGINT or SIGTSTP is not blocked. A shell that receives those signals
+ * without running handlers (e.g. through a signalfd) only accesses the job
+ * list from its main control flow, and may disable the check.
+ *
+ * @param[in] check  Whether to check the signal mask.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_list_set_check_blocked(bool check);
+
 /**
  * @brief Adds a new job to the job list.
  *
@@ -157,21 +259,24 @@ void destroy_job_list(void);
  * job, and writing the job to the job list with the given parameters. This
  * allows the job to be tracked by the functions provided in the job list.
  *
- * @param[in] pid: The process ID of the main process of the job.
+ * @param[in] pid: The process ID of the main process of the job, or 0 for a
+ *                 QUEUED job.
  * @param[in] state: The initial state of the job (should not be UNDEF).
  * @param[in] cmdline: The command line used to start the job.
  *
  * @return The JID of the added job, if successful
- * @return `0` if the job could not be added. The function may fail to add a
- *         job if there are no more job IDs available (restricted by the
- *         `MAXJOBS` constant).
+ * @return `0` if the job could not be added. The function only fails if the
+ *         job list is full and cannot be grown, or if no memory is left for
+ *         the command line.
  *
  * @pre Any signals that could modify the job list must be blocked.
  * @pre `state` must represent a valid job state other than `UNDEF`.
  * @pre If `state` is equal to `FG`, then there must currently be no
  *      other foreground job in the job list.
  *
- * @remark Async-signal-safety: Not async-signal-safe.
+ * @remark Async-signal-safety: Async-signal-safe. The command line is copied
+ *         into an arena of interned strings (see tsh_arena.h), not onto the
+ *         malloc heap.
  */
 jid_t add_job(pid_t pid, job_state state, const char *cmdline);
 
@@ -183,7 +288,9 @@ jid_t add_job(pid_t pid, job_state state, const char *cmdline);
  *
  * The shell should call this function when it becomes aware that the job
  * has ended; it does not stop any processes itself. Future calls that
- * reference this job ID will fail, unless the job ID is recycled.
+ * reference this job ID will fail, unless the job ID is recycled. A job that
+ * has been started is first recorded in the ring of completed jobs (see
+ * tsh_history.h).
  *
  * @param[in] jid The job ID of the job to delete.
  *
@@ -197,6 +304,169 @@ jid_t add_job(pid_t pid, job_state state, const char *cmdline);
  */
 bool delete_job(jid_t jid);
 
+/**
+ * @brief Adds another process to a job, such as a later command of a
+ * pipeline.
+ *
+ * A job starts with one process, the one passed to `add_job`, whose PID
+ * identifies the job. Processes added with this function can also be looked
+ * up with `job_from_pid`, and the job is only considered finished when every
+ * one of its processes has been passed to `job_exit_process`.
+ *
+ * @param[in] jid  The job ID of an existing job.
+ * @param[in] pid  The process ID of the new process.
+ *
+ * @return true on success, false if the pid index could not be grown or
+ *         the job has not been started (see `job_set_pid`).
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool job_add_process(jid_t jid, pid_t pid);
+
+/**
+ * @brief Records that a process of a job has terminated.
+ *
+ * The process can no longer be looked up with `job_from_pid`, except for the
+ * process that identifies the job, which stays until the job is deleted.
+ *
+ * @param[in]  jid      The job ID of the job the process belongs to.
+ * @param[in]  pid      The process ID of the terminated process.
+ * @param[in]  status   The status of the process, as returned by wait.
+ * @param[in]  when     When it was reaped (CLOCK_MONOTONIC), or NULL for
+ *                      now; the end of the job if it was the last one.
+ * @param[out] job_sig  The first signal that terminated any process of the
+ *                      job so far, or 0.
+ *
+ * @return The number of processes of the job that are still running. The
+ *         caller should delete the job when it reaches 0.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int job_exit_process(jid_t jid, pid_t pid, int status,
+                     const struct timespec *when, int *job_sig);
+
+/**
+ * @brief Lists the processes of a job that have not terminated.
+ *
+ * @param[in]  jid   The job ID of an existing job.
+ * @param[out] pids  Their process IDs, leader first, then in the order they
+ *                   were added.
+ * @param[in]  max   Room in `pids`; further processes are left out.
+ *
+ * @return The number of process IDs stored.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int job_get_procs(jid_t jid, pid_t *pids, int max);
+
+/**
+ * @brief Sets the process of a QUEUED job once it has been started.
+ *
+ * The job can be looked up with `job_from_pid` from then on. Its state is
+ * left unchanged; the caller moves it to `BG` or `FG`.
+ *
+ * @param[in] jid  The job ID of a QUEUED job.
+ * @param[in] pid  The process ID of its main process.
+ *
+ * @return true on success, false if the pid index could not be grown or
+ *         the job has not been started (see `job_set_pid`).
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool job_set_pid(jid_t jid, pid_t pid);
+
+/**
+ * @brief Counts the jobs in a state.
+ *
+ * @param[in] state  A job state other than `UNDEF`.
+ * @return The number of jobs in that state.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int job_count(job_state state);
+
+/**
+ * @brief Adds the resources used by a terminated process to its job.
+ *
+ * @param[in] jid  The job the process belongs to.
+ * @param[in] ru   The rusage returned by wait4 when it was reaped.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_add_rusage(jid_t jid, const struct rusage *ru);
+
+/**
+ * @brief Adds the performance counters of a terminated process to its job.
+ *
+ * @param[in] jid     The job the process belongs to.
+ * @param[in] counts  The counters returned by `perf_collect`.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_add_perf(jid_t jid, const struct perf_counts *counts);
+
+/**
+ * @brief Gets the resources used by a job so far.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_get_usage(jid_t jid, struct job_usage *usage);
+
+/**
+ * @brief Gets the policy a job runs with in the background (tsh_prio.h).
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void job_get_prio(jid_t jid, struct prio_policy *policy);
+
+/**
+ * @brief Sets the policy a job runs with in the background, and applies it
+ * at once if the job is in the `BG` state.
+ *
+ * Every job starts with `prio_default`. The policy is applied whenever the
+ * job enters the `BG` state, and the priority of the shell is restored
+ * whenever it enters the `FG` state (see `job_set_state`).
+ *
+ * @return false if the policy could not be applied in full.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `jid` must be a valid job ID
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool job_set_prio(jid_t jid, const struct prio_policy *policy);
+
+/**
+ * @brief Appends a resource usage to an output buffer as a line of `key
+ * value` pairs.
+ *
+ * The line reads `real S user S sys S maxrss NKiB minflt N majflt N nvcsw N
+ * nivcsw N`, preceded by `prefix`. `real` is the wall time between launch
+ * and end with nanosecond digits, or up to now for a job that has not ended.
+ * If the job had performance counters, they follow on a second line with
+ * the same prefix (see `perf_print`).
+ *
+ * @return false if an error occurred while writing out the buffer
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool print_usage(sio_t *out, const char *prefix,
+                 const struct job_usage *usage);
+
 /**
  * @brief Finds the current foreground job in the job list.
  *
@@ -228,8 +498,8 @@ bool job_exists(jid_t jid);
  * @brief Finds a job corresponding to a process ID.
  *
  * Each job can be identified by the process ID of the initial (root) process
- * in the job. However, there can be multiple processes in a job, which will
- * not be tracked by the job list.
+ * in the job. Other processes of the job are also found, if they were added
+ * with `job_add_process` and have not terminated yet.
  *
  * @param[in] pid The process ID to search for
  *
@@ -241,6 +511,31 @@ bool job_exists(jid_t jid);
  */
 jid_t job_from_pid(pid_t pid);
 
+/**
+ * @brief Records the pidfd a process of a job is watched with (tsh_loop.c),
+ * so that it can be found in constant time once the process is reaped.
+ *
+ * @param[in] pid    A process of a job, as for `job_from_pid`.
+ * @param[in] pidfd  Its pidfd.
+ * @return false if the process is not part of a job.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool job_set_pidfd(pid_t pid, int pidfd);
+
+/**
+ * @brief Takes back the pidfd recorded with `job_set_pidfd`, which the
+ * process no longer has afterwards.
+ *
+ * @param[in] pid  A process of a job.
+ * @return The pidfd, or -1 if none was recorded.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int job_take_pidfd(pid_t pid);
+
 /**
  * @brief Gets the process ID of a job
  *
@@ -288,6 +583,9 @@ job_state job_get_state(jid_t jid);
  * @pre `state` must represent a valid job state other than `UNDEF`.
  * @pre If `state` is equal to `FG`, then there must currently be no
  *      other foreground job in the job list.
+ * @remark With `prio_enabled`, a job entering `BG` is moved to its
+ *         background policy, and one entering `FG` back to the priority of
+ *         the shell (see tsh_prio.h).
  * @remark Async-signal-safe
  */
 void job_set_state(jid_t jid, job_state state);
@@ -309,6 +607,50 @@ void job_set_state(jid_t jid, job_state state);
  */
 bool list_jobs(int output_fd);
 
+/**
+ * @brief Writes the jobs that are in one of the given states.
+ *
+ * Jobs are written in order of their job IDs, in the same format as
+ * `list_jobs`. Each state has its own list of jobs, so only the jobs that are
+ * written are visited.
+ *
+ * @param[in] output_fd: The file descriptor to write to.
+ * @param[in] states: A set of `JOB_STATE_BIT` values.
+ * @return true if the function succeeded
+ * @return false if an error occurred while writing to the file descriptor
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `output_fd` must be a valid file descriptor open for writing.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool list_jobs_states(int output_fd, unsigned states);
+
+/** @brief Details written after each job by list_jobs_details */
+#define JOB_LIST_USAGE 0x1   /**< Its resource usage (see print_usage) */
+#define JOB_LIST_MEMBERS 0x2 /**< Its live processes (see reaper_members) */
+#define JOB_LIST_PRIO 0x4    /**< Its background policy (see tsh_prio.h) */
+
+/**
+ * @brief Writes the jobs that are in one of the given states, each followed
+ * by details on indented lines.
+ *
+ * With `JOB_LIST_MEMBERS`, every process in the process group of the job is
+ * written as `(PID) state name`, including processes the job created that
+ * are not in the job list. With `JOB_LIST_USAGE`, the resource usage of the
+ * job follows, and the accounting of its cgroup if it has one (see
+ * tsh_cgroup.h). With `JOB_LIST_PRIO`, its background policy is written as
+ * `prio POLICY`, in the format of `prio_format`.
+ *
+ * @param[in] output_fd: The file descriptor to write to.
+ * @param[in] states: A set of `JOB_STATE_BIT` values.
+ * @param[in] details: A set of `JOB_LIST_*` values.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @pre `output_fd` must be a valid file descriptor open for writing.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool list_jobs_details(int output_fd, unsigned states, unsigned details);
+
 /**
  * @brief Prints usage instructions for the tiny shell.
  * @remark Async-signal-safety: Not async-signal-safe.
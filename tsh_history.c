@@ -0,0 +1,243 @@
+/**
+ * @file tsh_history.c
+ * @brief Ring of recently completed jobs (`history -j` builtin)
+ *
+ * See tsh_history.h for the layout. An entry is written in full before
+ * `recorded` is advanced past it, so a dump of the mapping never shows a
+ * half-written entry as the latest one. Only the shell writes the ring:
+ * processes it forks do not delete jobs.
+ */
+
+#include "csapp.h"
+#include "tsh_helper.h"
+#include "tsh_history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Static variables */
+static const size_t history_size = // Size of the mapping
+    sizeof(struct history_header) + HISTORY_JOBS * sizeof(struct history_entry);
+static const char history_magic[8] = "tshhist";
+static struct history_header *header = NULL; // The mapping, or NULL
+static struct history_entry *entries = NULL; // Its entries
+
+/*
+ * map_file - Map a history file, creating it if needed
+ */
+static void *map_file(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return MAP_FAILED;
+    }
+    void *map = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 &&
+        (st.st_size == (off_t)history_size ||
+         ftruncate(fd, (off_t)history_size) == 0)) {
+        map = mmap(NULL, history_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    }
+    int err = errno;
+    close(fd);
+    errno = err;
+    return map;
+}
+
+/*
+ * history_init - Map the ring
+ * Not async-signal-safe
+ */
+bool history_init(const char *path) {
+    bool ok = true;
+    void *map = MAP_FAILED;
+    if (path != NULL && (map = map_file(path)) == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map history file: %s\n", path,
+                strerror(errno));
+        ok = false;
+    }
+    if (map == MAP_FAILED) {
+        map = mmap(NULL, history_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            perror("history_init: mmap");
+            return false;
+        }
+    }
+
+    header = map;
+    entries = (struct history_entry *)(header + 1);
+    if (memcmp(header->magic, history_magic, sizeof(history_magic)) != 0 ||
+        header->entry_size != sizeof(struct history_entry) ||
+        header->capacity != HISTORY_JOBS) {
+        memset(map, 0, history_size);
+        memcpy(header->magic, history_magic, sizeof(history_magic));
+        header->entry_size = sizeof(struct history_entry);
+        header->capacity = HISTORY_JOBS;
+    }
+    return ok;
+}
+
+/*
+ * history_record - Record a completed job
+ * Async-signal-safe
+ */
+void history_record(jid_t jid, pid_t pid, int sig, int code,
+                    const struct job_usage *usage, const char *cmdline) {
+    if (header == NULL) {
+        return;
+    }
+    struct history_entry *entry = &entries[header->recorded % HISTORY_JOBS];
+    entry->jid = jid;
+    entry->pid = pid;
+    entry->sig = sig;
+    entry->code = code;
+    clock_gettime(CLOCK_REALTIME, &entry->ended);
+    entry->usage = *usage;
+    size_t len = strnlen(cmdline, HISTORY_CMDLEN - 1);
+    memcpy(entry->cmdline, cmdline, len);
+    entry->cmdline[len] = '\0';
+
+    __atomic_signal_fence(__ATOMIC_RELEASE); // entry before the count
+    header->recorded++;
+}
+
+/*
+ * history_find - Find the latest completed job with a PID
+ * Async-signal-safe
+ */
+bool history_find(pid_t pid, struct history_entry *entry) {
+    if (header == NULL || pid <= 0) {
+        return false;
+    }
+    uint64_t kept =
+        header->recorded < HISTORY_JOBS ? header->recorded : HISTORY_JOBS;
+    for (uint64_t i = 1; i <= kept; i++) {
+        const struct history_entry *e =
+            &entries[(header->recorded - i) % HISTORY_JOBS];
+        if (e->pid == pid) {
+            *entry = *e;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * history_count - Number of jobs recorded so far
+ * Async-signal-safe
+ */
+uint64_t history_count(void) {
+    return header != NULL ? header->recorded : 0;
+}
+
+/*
+ * history_get - Get the job recorded after n others
+ * Async-signal-safe
+ */
+bool history_get(uint64_t n, struct history_entry *entry) {
+    if (header == NULL || n >= header->recorded ||
+        header->recorded - n > HISTORY_JOBS) {
+        return false;
+    }
+    *entry = entries[n % HISTORY_JOBS];
+    return true;
+}
+
+/*
+ * real_ns - Wall time a job ran for, in nanoseconds
+ */
+static long long real_ns(const struct history_entry *entry) {
+    const struct job_usage *usage = &entry->usage;
+    return (usage->ended.tv_sec - usage->launched.tv_sec) * 1000000000LL +
+           (usage->ended.tv_nsec - usage->launched.tv_nsec);
+}
+
+/*
+ * compare_slower - qsort comparator putting the slower job first
+ */
+static int compare_slower(const void *a, const void *b) {
+    long long ra = real_ns(*(const struct history_entry *const *)a);
+    long long rb = real_ns(*(const struct history_entry *const *)b);
+    return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+/*
+ * print_entry - Print one completed job, and with_usage its resource usage
+ */
+static bool print_entry(int output_fd, const struct history_entry *entry,
+                        bool with_usage) {
+    struct tm tm;
+    char when[16] = "?";
+    time_t sec = entry->ended.tv_sec;
+    if (localtime_r(&sec, &tm) != NULL) {
+        strftime(when, sizeof(when), "%H:%M:%S", &tm);
+    }
+    const char *how = entry->sig != 0 ? "signal" : "exit";
+    int value = entry->sig != 0 ? entry->sig : entry->code;
+    long long ns = real_ns(entry);
+
+    if (dprintf(output_fd, "[%d] (%d) %s %s %d real %lld.%09llds %s\n",
+                entry->jid, entry->pid, when, how, value, ns / 1000000000LL,
+                ns % 1000000000LL, entry->cmdline) < 0) {
+        return false;
+    }
+    if (!with_usage) {
+        return true;
+    }
+    sio_t out;
+    sio_initb(&out, output_fd);
+    print_usage(&out, "    ", &entry->usage);
+    return sio_flushb(&out) >= 0;
+}
+
+/*
+ * history_list - Print the completed jobs selected by a query
+ * Not async-signal-safe
+ */
+bool history_list(int output_fd, const struct history_query *query) {
+    if (header == NULL) {
+        return true;
+    }
+
+    // Select, oldest first
+    const struct history_entry *selected[HISTORY_JOBS];
+    size_t nselected = 0;
+    size_t prefix_len = query->prefix != NULL ? strlen(query->prefix) : 0;
+    uint64_t kept =
+        header->recorded < HISTORY_JOBS ? header->recorded : HISTORY_JOBS;
+    for (uint64_t i = kept; i >= 1; i--) {
+        const struct history_entry *e =
+            &entries[(header->recorded - i) % HISTORY_JOBS];
+        if (query->failed && e->sig == 0 && e->code == 0) {
+            continue;
+        }
+        if (query->prefix != NULL &&
+            strncmp(e->cmdline, query->prefix, prefix_len) != 0) {
+            continue;
+        }
+        selected[nselected++] = e;
+    }
+
+    if (query->slowest > 0) {
+        qsort(selected, nselected, sizeof(*selected), compare_slower);
+        if (nselected > (size_t)query->slowest) {
+            nselected = (size_t)query->slowest;
+        }
+    }
+    for (size_t i = 0; i < nselected; i++) {
+        if (!print_entry(output_fd, selected[i], query->with_usage)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,147 @@
+/**
+ * @file tsh_history.h
+ * @brief Ring of recently completed jobs (`history -j` builtin)
+ *
+ * When a job that has run is deleted from the job list, `delete_job`
+ * records it in a ring of the last `HISTORY_JOBS` completed jobs: its JID
+ * and PID, command line (cut to `HISTORY_CMDLEN - 1` bytes), how it ended,
+ * when it ended, and its `job_usage`. The ring has a fixed size and is
+ * filled when the loop's event dispatch applies the end of the job, so a
+ * background job that failed can still be found after its notification
+ * has scrolled away.
+ *
+ * The ring is a single mapping: a `history_header` followed by the entries.
+ * It is anonymous by default. With `--history-file FILE`, it is a shared
+ * mapping of FILE instead, so every record reaches the page cache as it is
+ * written and survives the shell crashing. A later shell given the same
+ * file keeps its entries, and lists them with `history -j`.
+ *
+ * `history -j [-fv] [-s N] [-p prefix]` lists the completed jobs, oldest
+ * first: `[jid] (pid) HH:MM:SS exit N|signal N real S cmdline`. `-f` keeps
+ * the jobs that failed, `-p` those whose command line starts with `prefix`,
+ * and `-s N` lists the N slowest of the rest, slowest first. `-v` adds the
+ * resource usage of each job, as `jobs -v` does.
+ */
+
+#ifndef TSH_HISTORY_H
+#define TSH_HISTORY_H
+
+#include "tsh_helper.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define HISTORY_JOBS 256   /**< Completed jobs kept in the ring */
+#define HISTORY_CMDLEN 128 /**< Bytes of command line kept, with the NUL */
+
+/**
+ * @brief A completed job
+ */
+struct history_entry {
+    jid_t jid;                    ///< Its job ID
+    pid_t pid;                    ///< PID of its first process
+    int sig;                      ///< Signal that terminated it, or 0
+    int code;                     ///< Non-zero exit status, or 0
+    struct timespec ended;        ///< When it ended (CLOCK_REALTIME)
+    struct job_usage usage;       ///< Resources it used
+    char cmdline[HISTORY_CMDLEN]; ///< Its command line, maybe cut
+};
+
+/**
+ * @brief Start of the mapping, followed by `capacity` entries
+ */
+struct history_header {
+    char magic[8];       ///< "tshhist" and a NUL
+    uint32_t entry_size; ///< sizeof(struct history_entry)
+    uint32_t capacity;   ///< Number of entries
+    uint64_t recorded;   ///< Jobs recorded so far; the next goes to
+                         ///< entry `recorded % capacity`
+};
+
+/**
+ * @brief Which completed jobs `history_list` prints
+ */
+struct history_query {
+    bool failed;        ///< Only jobs that failed
+    const char *prefix; ///< Only command lines starting with it, or NULL
+    int slowest;        ///< Only the N slowest, slowest first; 0 for all
+    bool with_usage;    ///< Add the resource usage of each job
+};
+
+/**
+ * @brief Maps the ring.
+ *
+ * @param[in] path  File to map, or NULL for anonymous memory. The file is
+ *                  created if needed; entries it already holds are kept if
+ *                  it has the layout of this shell, and cleared otherwise.
+ *
+ * @return false, after printing a message, if the file cannot be mapped;
+ *         the ring is then anonymous.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool history_init(const char *path);
+
+/**
+ * @brief Records a completed job, overwriting the oldest entry once the
+ * ring is full. Does nothing before `history_init`.
+ *
+ * @param[in] jid      Its job ID.
+ * @param[in] pid      Its PID.
+ * @param[in] sig      The signal that terminated it, or 0.
+ * @param[in] code     Its non-zero exit status, or 0.
+ * @param[in] usage    The resources it used.
+ * @param[in] cmdline  Its command line.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void history_record(jid_t jid, pid_t pid, int sig, int code,
+                    const struct job_usage *usage, const char *cmdline);
+
+/**
+ * @brief Finds the most recent completed job with a PID.
+ *
+ * @param[in]  pid    The PID of the job.
+ * @param[out] entry  The job.
+ * @return false if no job in the ring has that PID.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool history_find(pid_t pid, struct history_entry *entry);
+
+/**
+ * @brief Returns the number of jobs recorded so far, including those that
+ * have left the ring.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+uint64_t history_count(void);
+
+/**
+ * @brief Gets a completed job by the order in which it was recorded.
+ *
+ * @param[in]  n      Number of jobs recorded before it.
+ * @param[out] entry  The job.
+ * @return false if that job is not in the ring (yet or any more).
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool history_get(uint64_t n, struct history_entry *entry);
+
+/**
+ * @brief Prints the completed jobs selected by a query.
+ *
+ * @return false if an error occurred while writing to the file descriptor
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool history_list(int output_fd, const struct history_query *query);
+
+#endif /* TSH_HISTORY_H */
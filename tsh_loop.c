@@ -0,0 +1,962 @@
+/**
+ * @file tsh_loop.c
+ * @brief Command input and child event handling for tsh
+ *
+ * See tsh_loop.h for an overview of the backends. In `LOOP_PIDFD` mode, and
+ * whenever signals are received through a signalfd, two epoll sets are used:
+ * `ep_jobs` holds the pidfd of every job plus the signalfd, and `ep_input`
+ * holds stdin plus `ep_jobs` itself. The prompt waits on `ep_input`, so job
+ * events are handled while the user is typing, and the foreground wait sleeps
+ * on `ep_jobs`, so pending input does not wake it up.
+ *
+ * The foreground wait itself blocks in wait4 on the process group of the
+ * job, so that only its own stops and exits wake the shell up. SIGCHLD and
+ * the keyboard signals are let through to their handlers meanwhile, even
+ * with `loop_signalfd`, and wait4 is restarted after them: the keyboard
+ * handlers forward the signals to the job, and sigchld_handler reaps and
+ * posts the background jobs that change state, leaving the process group
+ * in `loop_fg_group` to wait4. Their events are applied once the wait
+ * returns, and the job list then tells in constant time whether the job is
+ * still in the foreground, so it is never scanned while waiting.
+ *
+ * In `LOOP_PIDFD` mode, the job list records the pidfd of each process
+ * (job_set_pidfd), so that a process reaped through SIGCHLD, as a
+ * subreaper or during the foreground wait, leaves the epoll set.
+ *
+ * With the signal backend, sigchld_handler only reaps children and posts
+ * them to a queue (tsh_events.c). The loop applies the queued events to the
+ * job list whenever it wakes up and before it returns a command line, and
+ * waits for input with ppoll rather than a blocking read, so that the
+ * events of jobs that finish while the user is typing are applied at once.
+ *
+ * With `--subreaper`, orphaned processes of the jobs are reparented to the
+ * shell and reaped with the rest; in `LOOP_PIDFD` mode, SIGCHLD then reaps
+ * every child, as they have no pidfd (see tsh_reaper.h).
+ *
+ * With `--cgroup`, signals are forwarded to the cgroup of the foreground job
+ * instead of its process group, and a job is frozen once it is reported
+ * stopped (see tsh_cgroup.h).
+ *
+ * Events are handled in batches: the queue, a read of the signalfd or a
+ * round of epoll events. The notifications of a batch are collected in
+ * `notes` and written together at its end, so that many jobs finishing at
+ * once cost a few writes rather than one per fragment of every message.
+ *
+ * While background jobs are queued (tsh_admit.c) or wait for other jobs
+ * (tsh_after.c), every wait also gives `release_jobs` a chance to start
+ * them, and no wait lasts longer than the current pressure hold.
+ *
+ * The `wait` builtin waits for a job by polling pidfds for its processes,
+ * opened for the duration of the wait, so that the processes of the job are
+ * reaped by PID as they exit. SIGCHLD still ends the wait, through its
+ * handler or the signalfd, as a stop of the job is only reported that way;
+ * the children it stands for are collected, and the state of the job is
+ * checked again. ppoll is never restarted after a signal handler, so Ctrl-C
+ * still ends the wait; with `loop_signalfd`, a second signalfd that only
+ * holds the keyboard signals is polled as well.
+ */
+
+#define _GNU_SOURCE // pidfd_open, signalfd, epoll_pwait
+
+#include "csapp.h"
+#include "tsh_admit.h"
+#include "tsh_after.h"
+#include "tsh_cgroup.h"
+#include "tsh_events.h"
+#include "tsh_helper.h"
+#include "tsh_loop.h"
+#include "tsh_perf.h"
+#include "tsh_reaper.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/pidfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define READ_CHUNK 4096 // Minimum free space for each read of stdin
+#define MAX_EVENTS 64   // Events fetched per epoll_wait
+
+/* Keys of the ep_input set */
+#define INPUT_KEY 0 // stdin is readable
+#define JOBS_KEY 1  // ep_jobs has events
+
+/* Global variables */
+loop_backend loop_mode = LOOP_SIGNAL; // Backend used by the loop
+bool loop_signalfd = false;           // Receive signals through a signalfd
+struct loop_stats loop_stats;         // Counters of the stats builtin
+volatile sig_atomic_t loop_fg_group;  // Group left to the foreground wait
+
+/* Static variables */
+static sigset_t loop_mask;  // Signals kept blocked for the loop's own use
+static sigset_t shell_mask; // Signal mask of the shell after loop_init
+static sigset_t exec_mask;  // Returned by loop_child_mask
+static int ep_jobs = -1;    // epoll set: job pidfds and sig_fd
+static int ep_input = -1;   // epoll set: stdin and ep_jobs
+static int sig_fd = -1;     // signalfd for the signals in loop_mask
+static int key_fd = -1;     // signalfd for the keyboard signals only
+static bool input_pollable; // stdin can be waited on with epoll
+
+static char *in_buf = NULL; // Input buffer for loop_readline
+static size_t in_cap = 0;   // Allocated size of in_buf
+static size_t in_start = 0; // Start of unconsumed input in in_buf
+static size_t in_end = 0;   // End of input read so far
+static bool in_eof = false; // End of input has been reached
+
+// Keyboard signal received with no foreground job, for the wait builtin
+static volatile sig_atomic_t interrupted = 0;
+
+// Job notifications, written at the end of the batch of events being handled
+static sio_t notes = {.sio_fd = STDOUT_FILENO};
+static int batch_depth = 0; // Nesting of batch_begin calls
+
+/*
+ * batch_begin - Hold the notifications of child_event until batch_end
+ */
+static void batch_begin(void) {
+    batch_depth++;
+}
+
+/*
+ * batch_end - Write the notifications of the batch, once the outermost one
+ * has ended
+ */
+static void batch_end(void) {
+    if (--batch_depth == 0) {
+        sio_flushb(&notes);
+    }
+}
+
+/*
+ * job_of_orphan - The job of a process the shell adopted as a subreaper,
+ * found by its process group, or 0. A process that terminated is added to
+ * the job first, so that its exit is accounted for like any other.
+ */
+static jid_t job_of_orphan(pid_t pid, pid_t pgid, int status) {
+    jid_t jid = job_from_pid(pgid);
+    if (jid == 0 || job_get_pid(jid) != pgid) {
+        return 0;
+    }
+    if ((WIFEXITED(status) || WIFSIGNALED(status)) &&
+        !job_add_process(jid, pid)) {
+        return 0;
+    }
+    return jid;
+}
+
+/*
+ * child_event - Update the job list for a child state change
+ * Async-signal-safe
+ */
+void child_event(pid_t pid, pid_t pgid, int status, const struct rusage *ru,
+                 const struct timespec *when) {
+    // Close the counters of a terminated process even if it has no job
+    struct perf_counts counts;
+    loop_stats.child_events++;
+    bool counted = (WIFEXITED(status) || WIFSIGNALED(status)) &&
+                   perf_collect(pid, &counts);
+
+    jid_t jid = job_from_pid(pid);
+    if (jid == 0 && reaper_enabled && pgid > 0) {
+        jid = job_of_orphan(pid, pgid, status);
+    }
+    if (jid == 0) {
+        return;
+    }
+
+    // Every process of a pipeline reports its own stop; the job is reported
+    // once, under the PID of its leader
+    if (WIFSTOPPED(status)) {
+        if (job_get_state(jid) != ST) {
+            job_set_state(jid, ST);
+            cgroup_freeze(jid); // what did not stop, too
+            batch_begin();
+            sio_printfb(&notes, "Job [%d] (%d) stopped by signal %d\n", jid,
+                        job_get_pid(jid), WSTOPSIG(status));
+            batch_end();
+        }
+    } else if (WIFCONTINUED(status)) {
+        job_set_state(jid, FG);
+    } else {
+        int sig;
+        if (ru != NULL) {
+            job_add_rusage(jid, ru);
+        }
+        if (counted) {
+            job_add_perf(jid, &counts);
+        }
+        int left = job_exit_process(jid, pid, status, when, &sig);
+        bool done = left == 0 && !reaper_group_alive(job_get_pid(jid));
+        after_job_exit(jid, !WIFEXITED(status) || WEXITSTATUS(status) != 0,
+                       done);
+        if (!done) {
+            return;
+        }
+        if (sig != 0) {
+            batch_begin();
+            sio_printfb(&notes, "Job [%d] (%d) terminated by signal %d\n",
+                        jid, job_get_pid(jid), sig);
+            if (verbose) {
+                struct job_usage usage;
+                job_get_usage(jid, &usage);
+                print_usage(&notes, "    ", &usage);
+            }
+            batch_end();
+        }
+        cgroup_job_done(jid, sig != 0);
+        delete_job(jid);
+    }
+}
+
+/*
+ * fg_forward - Send a signal to the processes of the foreground job: those
+ * in its cgroup if it has one, otherwise its process group
+ * Async-signal-safe
+ */
+void fg_forward(int sig) {
+    jid_t jid = fg_job();
+    if (jid == 0) {
+        interrupted = sig; // ends a wait builtin
+    } else if (!cgroup_signal(jid, sig)) {
+        // -pid to send to all processes within the group
+        kill(-job_get_pid(jid), sig);
+    }
+}
+
+/*
+ * status_from_siginfo - Encode a waitid result as a waitpid status
+ * Async-signal-safe
+ */
+static int status_from_siginfo(const siginfo_t *info) {
+    switch (info->si_code) {
+    case CLD_EXITED:
+        return W_EXITCODE(info->si_status & 0xff, 0);
+    case CLD_KILLED:
+        return W_EXITCODE(0, info->si_status);
+    case CLD_DUMPED:
+        return W_EXITCODE(0, info->si_status) | WCOREFLAG;
+    case CLD_STOPPED:
+    case CLD_TRAPPED:
+        return W_STOPCODE(info->si_status);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * job_key - epoll data for a job: the PID in the high half, the pidfd in the
+ * low half. The signalfd uses PID 0.
+ */
+static uint64_t job_key(pid_t pid, int fd) {
+    return ((uint64_t)(uint32_t)pid << 32) | (uint32_t)fd;
+}
+
+/*
+ * drop_pidfd - Remove a pidfd from ep_jobs and close it
+ */
+static void drop_pidfd(int fd) {
+    epoll_ctl(ep_jobs, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+}
+
+/*
+ * unwatch - Remove the pidfd of a process that has been reaped from ep_jobs,
+ * if it has one
+ */
+static void unwatch(pid_t pid) {
+    int fd = job_take_pidfd(pid);
+    if (fd >= 0) {
+        drop_pidfd(fd);
+    }
+}
+
+/*
+ * reap_pidfd - Collect the exit of the job whose pidfd is readable. The
+ * process is reaped by PID with wait4, which unlike waitid on the pidfd
+ * returns its resource usage; holding the pidfd of an unreaped child, the
+ * PID cannot refer to another process.
+ */
+static void reap_pidfd(pid_t pid, int fd) {
+    struct rusage ru;
+    int status;
+    if (wait4(pid, &status, WNOHANG, &ru) <= 0) {
+        return;
+    }
+    // The key holds the pidfd even if the job list could not record it
+    job_take_pidfd(pid);
+    drop_pidfd(fd);
+    child_event(pid, 0, status, &ru, NULL);
+}
+
+/*
+ * reap_stops - Collect stopped children. Exits are left for the pidfds.
+ */
+static void reap_stops(void) {
+    batch_begin();
+    while (true) {
+        siginfo_t info;
+        memset(&info, 0, sizeof(info));
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WNOHANG) < 0 ||
+            info.si_pid == 0) {
+            break;
+        }
+        child_event(info.si_pid, 0, status_from_siginfo(&info), NULL, NULL);
+    }
+    batch_end();
+}
+
+/*
+ * reap_children - Collect every child that stopped or terminated, as
+ * sigchld_handler does. In `LOOP_PIDFD` mode, this is only done as a
+ * subreaper, as orphans have no pidfd; a child that has one leaves ep_jobs.
+ */
+static void reap_children(void) {
+    struct rusage ru;
+    pid_t pid, pgid;
+    int status;
+    batch_begin();
+    while ((pid = reaper_wait(&status, &ru, &pgid, 0)) > 0) {
+        if (!WIFSTOPPED(status)) {
+            unwatch(pid);
+        }
+        child_event(pid, pgid, status, WIFSTOPPED(status) ? NULL : &ru, NULL);
+    }
+    batch_end();
+}
+
+/*
+ * drain_events - Apply the children posted by sigchld_handler to the job
+ * list, a batch at a time, then collect those it left unreaped when the
+ * queue was full
+ */
+static void drain_events(void) {
+    struct reap_event batch[MAX_EVENTS];
+    int n;
+    batch_begin();
+    while ((n = events_take(batch, MAX_EVENTS)) > 0) {
+        for (int i = 0; i < n; i++) {
+            const struct reap_event *e = &batch[i];
+            if (!WIFSTOPPED(e->status)) {
+                unwatch(e->pid); // reaped during the foreground wait
+            }
+            child_event(e->pid, e->pgid, e->status,
+                        WIFSTOPPED(e->status) ? NULL : &e->ru, &e->when);
+        }
+    }
+    if (events_overflowed()) {
+        reap_children();
+    }
+    batch_end();
+}
+
+/*
+ * drain_pending - drain_events, blocking signals only if there is something
+ * to drain
+ */
+static void drain_pending(void) {
+    if (events_pending()) {
+        sigset_t prev_all;
+        loop_block_signals(&prev_all);
+        drain_events();
+        loop_restore_signals(&prev_all);
+    }
+}
+
+/*
+ * key_signal - Act on a keyboard signal read from a signalfd, as its
+ * handler would
+ */
+static void key_signal(uint32_t signo) {
+    switch (signo) {
+    case SIGINT:
+    case SIGTSTP:
+        fg_forward((int)signo);
+        break;
+    case SIGQUIT:
+        sigquit_handler(SIGQUIT);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * read_signals - Drain a signalfd and act on every signal it held. A single
+ * read returns a batch of pending signals; SIGCHLD is acted on once per
+ * batch, however many children it stands for.
+ */
+static void read_signals(int fd) {
+    struct signalfd_siginfo fdsi[MAX_EVENTS];
+    bool chld = false;
+    ssize_t n;
+
+    while ((n = read(fd, fdsi, sizeof(fdsi))) > 0) {
+        for (size_t i = 0; i < (size_t)n / sizeof(fdsi[0]); i++) {
+            if (fdsi[i].ssi_signo == SIGCHLD) {
+                chld = true;
+            } else {
+                key_signal(fdsi[i].ssi_signo);
+            }
+        }
+    }
+
+    if (chld) {
+        if (loop_mode == LOOP_PIDFD && !reaper_enabled) {
+            reap_stops();
+        } else {
+            reap_children();
+        }
+    }
+}
+
+/*
+ * dispatch_job_events - Handle every ready event in ep_jobs without
+ * blocking. Signals are blocked while the job list is updated.
+ */
+static void dispatch_job_events(void) {
+    struct epoll_event events[MAX_EVENTS];
+    sigset_t prev_all;
+    int n;
+
+    loop_block_signals(&prev_all);
+    batch_begin();
+    do {
+        n = epoll_wait(ep_jobs, events, MAX_EVENTS, 0);
+        for (int i = 0; i < n; i++) {
+            pid_t pid = (pid_t)(events[i].data.u64 >> 32);
+            int fd = (int)(uint32_t)events[i].data.u64;
+            if (pid == 0) {
+                read_signals(sig_fd);
+            } else {
+                reap_pidfd(pid, fd);
+            }
+        }
+    } while (n == MAX_EVENTS);
+    batch_end();
+    loop_restore_signals(&prev_all);
+}
+
+/*
+ * epoll_add - Register fd in an epoll set, returning false on error
+ */
+static bool epoll_add(int epfd, int fd, uint64_t key) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = key;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+/*
+ * loop_init - Set up the selected backend
+ * Not async-signal-safe
+ */
+void loop_init(void) {
+    sigemptyset(&loop_mask);
+    if (loop_mode == LOOP_PIDFD) {
+        int probe = pidfd_open(getpid(), 0);
+        if (probe < 0) {
+            fprintf(stderr, "pidfd_open unavailable, using signal handlers\n");
+            loop_mode = LOOP_SIGNAL;
+        } else {
+            close(probe);
+            sigaddset(&loop_mask, SIGCHLD); // only needed to report stops
+        }
+    }
+    if (loop_signalfd) {
+        sigaddset(&loop_mask, SIGCHLD);
+        sigaddset(&loop_mask, SIGINT);
+        sigaddset(&loop_mask, SIGTSTP);
+        sigaddset(&loop_mask, SIGQUIT);
+        // No handler can run, so the job list needs no blocking any more
+        job_list_set_check_blocked(false);
+    }
+    if (!loop_evented()) {
+        return;
+    }
+
+    // The signals in loop_mask are only consumed through sig_fd from now on
+    if (sigprocmask(SIG_BLOCK, &loop_mask, &shell_mask) < 0) {
+        perror("sigprocmask error");
+        exit(1);
+    }
+    sigorset(&shell_mask, &shell_mask, &loop_mask);
+    sig_fd = signalfd(-1, &loop_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (loop_signalfd) {
+        sigset_t keys = loop_mask;
+        sigdelset(&keys, SIGCHLD);
+        key_fd = signalfd(-1, &keys, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+    ep_jobs = epoll_create1(EPOLL_CLOEXEC);
+    ep_input = epoll_create1(EPOLL_CLOEXEC);
+    if (sig_fd < 0 || (loop_signalfd && key_fd < 0) || ep_jobs < 0 ||
+        ep_input < 0) {
+        perror("loop_init error");
+        exit(1);
+    }
+    if (!epoll_add(ep_jobs, sig_fd, job_key(0, sig_fd)) ||
+        !epoll_add(ep_input, ep_jobs, JOBS_KEY)) {
+        perror("epoll_ctl error");
+        exit(1);
+    }
+
+    // Regular files cannot be polled; they are always readable anyway
+    input_pollable = epoll_add(ep_input, STDIN_FILENO, INPUT_KEY);
+}
+
+/*
+ * loop_evented - Whether the loop waits with epoll rather than signal
+ * handlers
+ * Async-signal-safe
+ */
+bool loop_evented(void) {
+    return loop_mode == LOOP_PIDFD || loop_signalfd;
+}
+
+/*
+ * loop_block_signals - Block every signal whose handler could access the job
+ * list. No system call is needed when signals arrive through the signalfd.
+ * Async-signal-safe
+ */
+void loop_block_signals(sigset_t *prev) {
+    if (loop_signalfd) {
+        *prev = shell_mask;
+        return;
+    }
+    sigset_t mask_all;
+    sigfillset(&mask_all);
+    sigprocmask(SIG_BLOCK, &mask_all, prev);
+}
+
+/*
+ * loop_restore_signals - Undo loop_block_signals
+ * Async-signal-safe
+ */
+void loop_restore_signals(const sigset_t *prev) {
+    if (loop_signalfd) {
+        return;
+    }
+    sigprocmask(SIG_SETMASK, prev, NULL);
+}
+
+/*
+ * jobs_waiting - Whether jobs are queued or wait for other jobs
+ */
+static bool jobs_waiting(void) {
+    return admit_waiting() || after_waiting();
+}
+
+/*
+ * release_jobs - Start the jobs whose dependencies are done and that the
+ * admission limits let through
+ */
+static void release_jobs(const sigset_t *prev) {
+    drain_events();
+    after_run();
+    admit_run(prev);
+}
+
+/*
+ * admit_sleep - Start the queued jobs that may start, and return how long
+ * the caller may sleep, in milliseconds or -1
+ */
+static int admit_sleep(void) {
+    sigset_t prev_all;
+    loop_block_signals(&prev_all);
+    release_jobs(&prev_all);
+    int timeout = admit_timeout();
+    loop_restore_signals(&prev_all);
+    return timeout;
+}
+
+/*
+ * ms_to_timespec - Convert a timeout of poll to one of ppoll
+ */
+static const struct timespec *ms_to_timespec(int ms, struct timespec *ts) {
+    if (ms < 0) {
+        return NULL;
+    }
+    ts->tv_sec = ms / 1000;
+    ts->tv_nsec = (ms % 1000) * 1000000L;
+    return ts;
+}
+
+/*
+ * wait_signaled - Sleep until stdin is readable with the signal backend,
+ * applying the children that sigchld_handler reaps meanwhile, and starting
+ * waiting jobs as that frees slots or completes their dependencies
+ */
+static void wait_signaled(void) {
+    sigset_t prev_all;
+    while (true) {
+        struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+        struct timespec ts;
+
+        loop_block_signals(&prev_all);
+        release_jobs(&prev_all);
+        int timeout = jobs_waiting() ? admit_timeout() : -1;
+        int n = ppoll(&pfd, 1, ms_to_timespec(timeout, &ts), &prev_all);
+        int err = errno;
+        loop_restore_signals(&prev_all);
+        if (n < 0 && err != EINTR) {
+            errno = err;
+            perror("ppoll error");
+            exit(1);
+        }
+        if (n > 0) {
+            return;
+        }
+    }
+}
+
+/*
+ * wait_input - Sleep until stdin is readable, handling job events meanwhile
+ */
+static void wait_input(void) {
+    if (!loop_evented()) {
+        wait_signaled();
+        return;
+    }
+    if (!input_pollable) {
+        dispatch_job_events();
+        admit_sleep();
+        return;
+    }
+
+    while (true) {
+        struct epoll_event events[2];
+        bool ready = false;
+        int n = epoll_wait(ep_input, events, 2, admit_sleep());
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait error");
+            exit(1);
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == INPUT_KEY) {
+                ready = true;
+            } else {
+                dispatch_job_events();
+            }
+        }
+        if (ready) {
+            return;
+        }
+    }
+}
+
+/*
+ * loop_readline - Read the next line of input
+ * Not async-signal-safe
+ */
+char *loop_readline(void) {
+    while (true) {
+        char *start = in_buf + in_start;
+        char *newline =
+            in_buf != NULL ? memchr(start, '\n', in_end - in_start) : NULL;
+        if (newline != NULL) {
+            *newline = '\0';
+            in_start = (size_t)(newline + 1 - in_buf);
+            drain_pending(); // the command sees the jobs as they are
+            interrupted = 0;
+            return start;
+        }
+        if (in_eof) {
+            drain_pending();
+            return NULL;
+        }
+
+        // Move the partial line to the front and make room for more
+        memmove(in_buf, start, in_end - in_start);
+        in_end -= in_start;
+        in_start = 0;
+        if (in_cap - in_end < READ_CHUNK) {
+            size_t cap = in_cap == 0 ? 2 * READ_CHUNK : 2 * in_cap;
+            char *buf = realloc(in_buf, cap);
+            if (buf == NULL) {
+                perror("realloc error");
+                exit(1);
+            }
+            in_buf = buf;
+            in_cap = cap;
+        }
+
+        wait_input();
+        ssize_t n = read(STDIN_FILENO, in_buf + in_end, in_cap - in_end);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            perror("read error");
+            exit(1);
+        }
+        if (n == 0) {
+            in_eof = true;
+        }
+        in_end += (size_t)n;
+    }
+}
+
+/*
+ * loop_interrupted - The keyboard signal received with no foreground job
+ * Not async-signal-safe
+ */
+int loop_interrupted(void) {
+    if (key_fd >= 0) {
+        read_signals(key_fd); // blocked, so they wait in the signalfd
+    }
+    return interrupted;
+}
+
+/*
+ * loop_child_mask - The mask a job starts with
+ * Not async-signal-safe
+ */
+const sigset_t *loop_child_mask(const sigset_t *prev) {
+    exec_mask = *prev;
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sigismember(&loop_mask, sig) == 1) {
+            sigdelset(&exec_mask, sig);
+        }
+    }
+    return &exec_mask;
+}
+
+/*
+ * loop_watch_job - Start tracking a new job
+ * Not async-signal-safe
+ */
+void loop_watch_job(pid_t pid, int pidfd) {
+    if (loop_mode != LOOP_PIDFD || pidfd < 0) {
+        return;
+    }
+    if (!epoll_add(ep_jobs, pidfd, job_key(pid, pidfd))) {
+        perror("epoll_ctl error");
+        close(pidfd);
+        return;
+    }
+    job_set_pidfd(pid, pidfd); // if not in a job, reap_pidfd still closes it
+}
+
+/*
+ * sleep_any - Sleep until any child changes state, a signal arrives or the
+ * pressure hold ends, and handle the job events that woke the shell up
+ */
+static void sleep_any(const sigset_t *prev_mask) {
+    int timeout = admit_timeout();
+
+    if (!loop_evented()) {
+        // wait for child process to terminate
+        if (timeout < 0) {
+            sigsuspend(prev_mask);
+        } else {
+            struct timespec ts;
+            ppoll(NULL, 0, ms_to_timespec(timeout, &ts), prev_mask);
+        }
+        drain_events();
+        return;
+    }
+
+    struct epoll_event ev;
+    int n = epoll_pwait(ep_jobs, &ev, 1, timeout, prev_mask);
+    if (n < 0 && errno != EINTR) {
+        perror("epoll_pwait error");
+        exit(1);
+    }
+    if (n > 0) {
+        dispatch_job_events();
+    }
+}
+
+/*
+ * reap_exit - Collect the exit of a process whose pidfd is readable
+ */
+static void reap_exit(pid_t pid) {
+    struct rusage ru;
+    int status;
+    if (wait4(pid, &status, WNOHANG, &ru) > 0) {
+        child_event(pid, 0, status, &ru, NULL);
+    }
+}
+
+/*
+ * sleep_exits - Sleep until a process of a job exits or a signal arrives,
+ * and collect the processes that exited, and the children that SIGCHLD
+ * reported, as one of them may be a process of the job that stopped.
+ * Returns false, without sleeping, if the processes of the job cannot be
+ * polled.
+ */
+static bool sleep_exits(jid_t jid, const sigset_t *prev_mask) {
+    pid_t pids[MAX_EVENTS];
+    struct pollfd pfds[MAX_EVENTS + 2];
+    int npids = job_get_procs(jid, pids, MAX_EVENTS);
+    int nfds = 0;
+
+    for (int i = 0; i < npids; i++) {
+        int fd = pidfd_open(pids[i], 0);
+        if (fd >= 0) {
+            pids[nfds] = pids[i];
+            pfds[nfds].fd = fd;
+            pfds[nfds].events = POLLIN;
+            pfds[nfds++].revents = 0;
+        }
+    }
+    if (nfds == 0) {
+        return false;
+    }
+    int nprocs = nfds;
+    int sig_at = -1, key_at = -1;
+    if (sig_fd >= 0) { // stops only show up as SIGCHLD
+        sig_at = nfds;
+        pfds[nfds].fd = sig_fd;
+        pfds[nfds].events = POLLIN;
+        pfds[nfds++].revents = 0;
+    }
+    if (key_fd >= 0) {
+        key_at = nfds;
+        pfds[nfds].fd = key_fd;
+        pfds[nfds].events = POLLIN;
+        pfds[nfds++].revents = 0;
+    }
+
+    // With the signal backend, sigchld_handler runs and ends ppoll
+    int n = ppoll(pfds, (nfds_t)nfds, NULL, prev_mask);
+    if (n < 0 && errno != EINTR) {
+        perror("ppoll error");
+        exit(1);
+    }
+    bool exited = false;
+    for (int i = 0; i < nprocs; i++) {
+        if (n > 0 && pfds[i].revents != 0) {
+            exited = true;
+            if (loop_mode != LOOP_PIDFD) {
+                reap_exit(pids[i]);
+            }
+        }
+        close(pfds[i].fd);
+    }
+    loop_stats.wait_wakeups++;
+    if (!loop_evented()) {
+        drain_events();
+    } else if ((exited && loop_mode == LOOP_PIDFD) ||
+               (n > 0 && sig_at >= 0 && pfds[sig_at].revents != 0)) {
+        dispatch_job_events(); // the job's own pidfds are readable too
+    }
+    if (n > 0 && key_at >= 0 && pfds[key_at].revents != 0) {
+        read_signals(key_fd);
+    }
+    return true;
+}
+
+/*
+ * loop_wait_jobs - Wait until a condition on the job list holds
+ * Not async-signal-safe
+ */
+int loop_wait_jobs(loop_done_fn *done, const void *arg,
+                   const sigset_t *prev_mask) {
+    interrupted = 0;
+    while (true) {
+        release_jobs(prev_mask);
+        if (done(arg)) {
+            return 0;
+        }
+        sleep_any(prev_mask);
+        loop_stats.wait_wakeups++;
+        if (interrupted) {
+            return interrupted;
+        }
+    }
+}
+
+/*
+ * loop_wait_job - Wait until a job has terminated, unless it is stopped
+ * Not async-signal-safe
+ */
+int loop_wait_job(jid_t jid, const sigset_t *prev_mask) {
+    interrupted = 0;
+    while (true) {
+        release_jobs(prev_mask);
+        if (!job_exists(jid) || job_get_state(jid) == ST) {
+            return 0;
+        }
+        // other waiting jobs must still be started as slots free up
+        if (jobs_waiting() || job_get_state(jid) == QUEUED ||
+            !sleep_exits(jid, prev_mask)) {
+            sleep_any(prev_mask);
+            loop_stats.wait_wakeups++;
+        }
+        if (interrupted) {
+            return interrupted;
+        }
+    }
+}
+
+/*
+ * sleep_fg - Sleep until a process of the foreground job changes state, and
+ * apply the change together with what the other jobs did meanwhile. Returns
+ * false, without sleeping, if the job has no child left to wait for.
+ */
+static bool sleep_fg(pid_t pgid, const sigset_t *prev_mask) {
+    sigset_t mask = *prev_mask;
+    sigset_t blocked;
+    struct rusage ru;
+    int status;
+
+    // sigchld_handler reaps the other jobs without ending the wait, and
+    // Ctrl-C and Ctrl-Z are forwarded to the job; wait4 is restarted after
+    // them, even with loop_signalfd
+    sigdelset(&mask, SIGCHLD);
+    sigdelset(&mask, SIGINT);
+    sigdelset(&mask, SIGTSTP);
+    sigdelset(&mask, SIGQUIT);
+    loop_fg_group = pgid;
+    sigprocmask(SIG_SETMASK, &mask, &blocked);
+    pid_t pid = wait4(-pgid, &status, WUNTRACED, &ru);
+    int err = errno;
+    sigprocmask(SIG_SETMASK, &blocked, NULL);
+    loop_fg_group = 0;
+    if (pid < 0) {
+        drain_events();
+        return err == EINTR;
+    }
+
+    batch_begin();
+    if (!WIFSTOPPED(status)) {
+        unwatch(pid);
+    }
+    child_event(pid, pgid, status, WIFSTOPPED(status) ? NULL : &ru, NULL);
+    drain_events();
+    batch_end();
+    return true;
+}
+
+/*
+ * loop_wait_fg - Wait for the foreground job to stop or terminate
+ * Not async-signal-safe
+ */
+void loop_wait_fg(pid_t pid, const sigset_t *prev_mask) {
+    jid_t jid;
+    loop_stats.fg_waits++;
+    while (true) {
+        // background jobs may be waiting for the ones that just finished,
+        // and must then be started as slots free up
+        if (jobs_waiting()) {
+            release_jobs(prev_mask);
+        } else {
+            drain_events();
+        }
+        if ((jid = fg_job()) == 0 || pid != job_get_pid(jid)) {
+            return;
+        }
+        if (jobs_waiting() || !sleep_fg(pid, prev_mask)) {
+            sleep_any(prev_mask);
+        }
+        loop_stats.fg_wakeups++;
+    }
+}
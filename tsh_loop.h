@@ -0,0 +1,257 @@
+/**
+ * @file tsh_loop.h
+ * @brief Command input and child event handling for tsh
+ *
+ * The loop owns the places where the shell sleeps: waiting for the next
+ * command line, waiting for a foreground job to stop or terminate, and
+ * waiting for background jobs in the `wait` builtin. The backend is selected
+ * once at startup and stored in `loop_mode`:
+ *
+ *   - `LOOP_SIGNAL` (default): children are reaped by sigchld_handler, which
+ *     posts them to a queue (tsh_events.h) that the loop applies to the job
+ *     list, and input is waited for with ppoll.
+ *   - `LOOP_PIDFD`: every job gets a pidfd, registered in an epoll set that
+ *     is polled together with stdin. When a pidfd becomes readable, its
+ *     process is reaped with wait4 on its PID, which reaps exactly the
+ *     process that exited and returns its resource usage. Stops, which
+ *     pidfds do not report, are picked up through a signalfd for SIGCHLD.
+ *     All job list updates happen in the main control flow, not in a signal
+ *     handler.
+ *
+ * Independently of the backend, `loop_signalfd` makes the shell receive
+ * SIGCHLD, SIGINT, SIGTSTP and SIGQUIT through a signalfd instead of signal
+ * handlers. The signals stay blocked, except while the shell sleeps in
+ * `loop_wait_fg` (see `loop_init`), and are read in batches from the same
+ * epoll set as the job events, so no handler interrupts the main control
+ * flow and the job list can be accessed without blocking signals first.
+ */
+
+#ifndef TSH_LOOP_H
+#define TSH_LOOP_H
+
+#include "tsh_helper.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/**
+ * @brief Mechanism used to learn about child state changes
+ */
+typedef enum loop_backend {
+    LOOP_SIGNAL = 0, ///< SIGCHLD handler and sigsuspend (default)
+    LOOP_PIDFD = 1   ///< pidfd per job in an epoll set
+} loop_backend;
+
+/**
+ * @brief Condition that ends `loop_wait_jobs`, called with signals blocked
+ */
+typedef bool loop_done_fn(const void *arg);
+
+/**
+ * @brief How often the shell woke up, as shown by the `stats` builtin
+ */
+struct loop_stats {
+    unsigned long fg_waits;     ///< Foreground jobs waited for
+    unsigned long fg_wakeups;   ///< Wakeups while waiting for them
+    unsigned long wait_wakeups; ///< Wakeups in the `wait` builtin
+    unsigned long child_events; ///< Child state changes applied
+};
+
+/* Defined in tsh_loop.c */
+extern loop_backend loop_mode;              ///< Backend used by the loop
+extern bool loop_signalfd;                  ///< Signals come by signalfd
+extern struct loop_stats loop_stats;        ///< Counters of the stats builtin
+extern volatile sig_atomic_t loop_fg_group; ///< Group of loop_wait_fg
+
+/**
+ * @brief Sets up the selected backend.
+ *
+ * Must be called once, after the signal handlers have been installed and
+ * before the first command is read. If the kernel does not support the
+ * selected backend, the shell falls back to `LOOP_SIGNAL`. With
+ * `loop_signalfd`, the signals read from the signalfd are blocked from now
+ * on. Their handlers still run while `loop_wait_fg` sleeps, the only time
+ * the signals are let through: the keyboard handlers forward Ctrl-C and
+ * Ctrl-Z to the job, and sigchld_handler reaps the other jobs.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void loop_init(void);
+
+/**
+ * @brief Returns whether the loop sleeps in epoll rather than in a blocking
+ * read or sigsuspend, i.e. in `LOOP_PIDFD` mode or with `loop_signalfd`.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool loop_evented(void);
+
+/**
+ * @brief Blocks the signals whose handlers could access the job list.
+ *
+ * With `loop_signalfd` there are no such handlers: `prev` is set to the
+ * current mask of the shell, and no system call is made.
+ *
+ * @param[out] prev  The previous signal mask, for `loop_restore_signals`.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void loop_block_signals(sigset_t *prev);
+
+/**
+ * @brief Restores the signal mask saved by `loop_block_signals`.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void loop_restore_signals(const sigset_t *prev);
+
+/**
+ * @brief Reads the next command line from stdin.
+ *
+ * Child events that arrive while the shell is waiting for input are handled
+ * as they come in. The trailing newline is removed. A final line that is not
+ * terminated by a newline is ignored, as is the end of input.
+ *
+ * @return The command line, valid until the next call, or NULL on EOF.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+char *loop_readline(void);
+
+/**
+ * @brief Returns the keyboard signal, SIGINT or SIGTSTP, that the user sent
+ * while no job was in the foreground since the current command line was
+ * read, or 0.
+ *
+ * A builtin that runs in the shell process checks this to stop early, as
+ * the signal has no job to be forwarded to.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int loop_interrupted(void);
+
+/**
+ * @brief Computes the signal mask a new job should start with.
+ *
+ * This is `prev` without the signals that the loop keeps blocked for its own
+ * use, so that jobs never inherit them.
+ *
+ * @param[in] prev  The mask of the shell before it blocked signals.
+ * @return Pointer to a static mask, valid until the next call.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+const sigset_t *loop_child_mask(const sigset_t *prev);
+
+/**
+ * @brief Starts tracking the leader of a newly added job.
+ *
+ * @param[in] pid    The PID of the job, which must already be in the job list.
+ * @param[in] pidfd  A pidfd for `pid` in `LOOP_PIDFD` mode; ignored otherwise.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void loop_watch_job(pid_t pid, int pidfd);
+
+/**
+ * @brief Waits until the job whose leader is `pid` leaves the foreground.
+ *
+ * The job leaves the foreground when it terminates or stops. Only its own
+ * processes wake the shell up: other jobs that stop or terminate meanwhile
+ * are reaped by sigchld_handler, which skips `loop_fg_group`, and their
+ * events are applied when the job's next one is. While jobs are queued,
+ * the shell wakes up for every job instead, so that they are started as
+ * slots free up.
+ *
+ * @param[in] pid        The PID of the foreground job.
+ * @param[in] prev_mask  The mask to wait with (signals to let through).
+ *
+ * @pre All signals must be blocked; they are blocked again on return.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void loop_wait_fg(pid_t pid, const sigset_t *prev_mask);
+
+/**
+ * @brief Waits until a condition on the job list holds, such as no
+ * background job being left.
+ *
+ * The shell wakes up for the events of every job, so this suits conditions
+ * that any job can fulfil. Queued jobs are started as usual meanwhile.
+ *
+ * @param[in] done       The condition, checked after every wakeup.
+ * @param[in] arg        Passed to `done`.
+ * @param[in] prev_mask  The mask to wait with (signals to let through).
+ *
+ * @return 0 once `done` returns true, or the signal, SIGINT or SIGTSTP,
+ *         that the user sent while no job was in the foreground.
+ *
+ * @pre All signals must be blocked; they are blocked again on return.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int loop_wait_jobs(loop_done_fn *done, const void *arg,
+                   const sigset_t *prev_mask);
+
+/**
+ * @brief Waits until a background job terminates.
+ *
+ * A stopped job is not waited for, as it cannot terminate before it is
+ * continued, and the wait also ends when the job is stopped meanwhile. The
+ * exits of the processes of the job are polled through pidfds, and SIGCHLD
+ * wakes the shell up too, as stops are only reported that way. While other
+ * jobs are queued, the wait wakes up for every job, so that the queued ones
+ * start as slots free up. A job that is still queued is waited for until it
+ * has started and terminated.
+ *
+ * @param[in] jid        The job ID of an existing job.
+ * @param[in] prev_mask  The mask to wait with (signals to let through).
+ *
+ * @return 0 once the job has terminated or is stopped, or the signal, SIGINT
+ *         or SIGTSTP, that the user sent while no job was in the foreground.
+ *
+ * @pre All signals must be blocked; they are blocked again on return.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int loop_wait_job(jid_t jid, const sigset_t *prev_mask);
+
+/**
+ * @brief Applies a child state change, in wait status form, to the job list.
+ *
+ * Stopped jobs move to `ST`, and jobs are deleted once every one of their
+ * processes has terminated. The shell's notification for a stop or a
+ * termination by signal is printed once per job; in verbose mode, the
+ * latter is followed by the resource usage of the job.
+ *
+ * With `reaper_enabled`, a process that is not in the job list is
+ * attributed to the job of its process group, as an orphan of that job,
+ * and a job is only deleted once its process group is empty as well.
+ *
+ * @param[in] pid     The PID whose state changed.
+ * @param[in] pgid    Its process group, read before it was reaped, or 0.
+ * @param[in] status  The status as reported by wait4.
+ * @param[in] ru      The resource usage of a terminated process, as
+ *                    reported by wait4, or NULL for a stop.
+ * @param[in] when    When the process was reaped (CLOCK_MONOTONIC), or
+ *                    NULL for now.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void child_event(pid_t pid, pid_t pgid, int status, const struct rusage *ru,
+                 const struct timespec *when);
+
+/**
+ * @brief Sends a signal to the process group of the foreground job, if any.
+ *
+ * If the job has a cgroup (tsh_cgroup.h), the signal is sent to every
+ * process in it instead.
+ *
+ * @param[in] sig  The signal to forward, SIGINT or SIGTSTP.
+ *
+ * @pre Any signals that could modify the job list must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void fg_forward(int sig);
+
+#endif /* TSH_LOOP_H */
@@ -0,0 +1,349 @@
+/**
+ * @file tsh_parallel.c
+ * @brief The `parallel` builtin: run a command over a list of arguments
+ *
+ * See tsh_parallel.h for the syntax. The items are collected into one array
+ * before anything runs; lines read from files are kept in buffers that live
+ * until the run is over. Each item is a `task`, which remembers the PID of
+ * its command and, with -k, the memfd its output goes to. Commands start in
+ * item order, and `flushed` counts the tasks whose output has been written
+ * out, so grouped output is emitted as soon as every earlier task is done.
+ */
+
+#define _GNU_SOURCE // memfd_create
+
+#include "csapp.h"
+#include "tsh_parallel.h"
+#include "tsh_path.h"
+#include "tsh_runner.h"
+#include "tsh_spawn.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* One command to run */
+struct task {
+    const char *item; // The argument the command runs over
+    pid_t pid;        // Its process, 0 before it starts, -1 once reaped
+    int out_fd;       // memfd holding its output with -k, otherwise -1
+};
+
+/* State of a run */
+struct run {
+    char **cmd;          // The command and its fixed arguments
+    int ncmd;            // Number of words in cmd
+    struct task *tasks;  // One per item
+    int ntasks;          // Number of items
+    int cap;             // Allocated entries of tasks
+    char **bufs;          // Contents of the files read for items
+    int nbufs;            // Number of entries in bufs
+    bool group;           // -k: collect output, emit it in item order
+    struct runner runner; // Coordinator of the commands
+};
+
+/*
+ * parallel_usage - Print the usage of the builtin
+ */
+static void parallel_usage(void) {
+    sio_eprintf("parallel: usage: parallel [-j jobs] [-k] [-u] [-a file] "
+                "command [arg...] ::: item... | :::: file...\n");
+}
+
+/*
+ * add_item - Append an item to the run
+ */
+static bool add_item(struct run *run, const char *item) {
+    if (run->ntasks == run->cap) {
+        int cap = run->cap == 0 ? 16 : 2 * run->cap;
+        struct task *tasks =
+            realloc(run->tasks, (size_t)cap * sizeof(*tasks));
+        if (tasks == NULL) {
+            sio_eprintf("parallel: Out of memory\n");
+            return false;
+        }
+        run->tasks = tasks;
+        run->cap = cap;
+    }
+    struct task *task = &run->tasks[run->ntasks++];
+    task->item = item;
+    task->pid = 0;
+    task->out_fd = -1;
+    return true;
+}
+
+/*
+ * add_file - Append the lines of a file to the run, as items
+ */
+static bool add_file(struct run *run, const char *path) {
+    char *buf = runner_read_file(&run->runner, path);
+    if (buf == NULL) {
+        return false;
+    }
+    char **bufs =
+        realloc(run->bufs, ((size_t)run->nbufs + 1) * sizeof(*bufs));
+    if (bufs == NULL) {
+        sio_eprintf("parallel: %s: Out of memory\n", path);
+        free(buf);
+        return false;
+    }
+    run->bufs = bufs;
+    run->bufs[run->nbufs++] = buf;
+
+    for (char *line = buf; *line != '\0';) {
+        char *end = strchrnul(line, '\n');
+        bool last = *end == '\0';
+        *end = '\0';
+        if (!add_item(run, line)) {
+            return false;
+        }
+        line = last ? end : end + 1;
+    }
+    return true;
+}
+
+/*
+ * parse - Parse the options, command and items of the builtin
+ */
+static bool parse(struct run *run, int argc, char **argv) {
+    const char **files = malloc((size_t)argc * sizeof(*files));
+    int nfiles = 0;
+    bool ok = false;
+    int i = 1;
+
+    if (files == NULL) {
+        return false;
+    }
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        const char *arg = argv[i];
+        int j;
+        if (strcmp(arg, "-k") == 0) {
+            run->group = true;
+        } else if (strcmp(arg, "-u") == 0) {
+            run->group = false;
+        } else if (strcmp(arg, "-a") == 0 && i + 1 < argc) {
+            files[nfiles++] = argv[++i];
+        } else if ((j = runner_jobs_option(&run->runner, argc, argv, &i)) <
+                   0) {
+            goto out;
+        } else if (j == 0) {
+            parallel_usage();
+            goto out;
+        }
+    }
+
+    run->cmd = argv + i;
+    for (; i < argc && strcmp(argv[i], ":::") != 0 &&
+           strcmp(argv[i], "::::") != 0;
+         i++) {
+        run->ncmd++;
+    }
+    if (run->ncmd == 0) {
+        parallel_usage();
+        goto out;
+    }
+
+    bool from_files = false;
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], ":::") == 0 || strcmp(argv[i], "::::") == 0) {
+            from_files = argv[i][3] == ':';
+        } else if (from_files ? !add_file(run, argv[i])
+                              : !add_item(run, argv[i])) {
+            goto out;
+        }
+    }
+    for (int f = 0; f < nfiles; f++) {
+        if (!add_file(run, files[f])) {
+            goto out;
+        }
+    }
+    ok = true;
+
+out:
+    free(files);
+    return ok;
+}
+
+/*
+ * substitute - Replace every {} of a word with an item
+ */
+static char *substitute(const char *word, const char *item) {
+    size_t count = 0;
+    for (const char *p = word; (p = strstr(p, "{}")) != NULL; p += 2) {
+        count++;
+    }
+    size_t item_len = strlen(item);
+    char *result = malloc(strlen(word) - 2 * count + count * item_len + 1);
+    if (result == NULL) {
+        return NULL;
+    }
+    char *out = result;
+    const char *p = word;
+    for (const char *brace; (brace = strstr(p, "{}")) != NULL; p = brace + 2) {
+        out = mempcpy(out, p, (size_t)(brace - p));
+        out = mempcpy(out, item, item_len);
+    }
+    strcpy(out, p);
+    return result;
+}
+
+/*
+ * task_child - Body of the process of a task: build its arguments and
+ * execute the command
+ */
+static void task_child(const struct run *run, const struct task *task) {
+    char **argv = malloc(((size_t)run->ncmd + 2) * sizeof(*argv));
+    bool replaced = false;
+    int argc = 0;
+    if (argv == NULL) {
+        _exit(1);
+    }
+    for (int i = 0; i < run->ncmd; i++) {
+        if (strstr(run->cmd[i], "{}") != NULL) {
+            replaced = true;
+            if ((argv[argc++] = substitute(run->cmd[i], task->item)) == NULL) {
+                _exit(1);
+            }
+        } else {
+            argv[argc++] = run->cmd[i];
+        }
+    }
+    if (!replaced) {
+        argv[argc++] = (char *)task->item;
+    }
+    argv[argc] = NULL;
+
+    if (task->out_fd >= 0) {
+        dup2(task->out_fd, STDOUT_FILENO);
+    }
+    runner_child(&run->runner);
+
+    struct path_cmd prog;
+    if (path_resolve(argv[0], &prog)) {
+        execve(prog.path, argv, environ);
+    }
+    report_exec_error(argv[0], errno);
+    _exit(127);
+}
+
+/*
+ * start - Start the command of a task. Returns false if it could not be
+ * started, in which case the task counts as failed.
+ */
+static bool start(struct run *run, struct task *task) {
+    if (run->group &&
+        (task->out_fd = memfd_create("parallel", MFD_CLOEXEC)) < 0) {
+        perror("parallel: memfd_create error");
+        return false;
+    }
+    if ((task->pid = fork()) == 0) {
+        task_child(run, task);
+    }
+    if (task->pid < 0) {
+        perror("parallel: fork error");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * copy_output - Write out the output collected in a memfd, with sendfile
+ * unless the kernel does not support it for the output (e.g. O_APPEND)
+ */
+static void copy_output(int fd, int out_fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return;
+    }
+    off_t offset = 0;
+    while (offset < st.st_size &&
+           sendfile(out_fd, fd, &offset, (size_t)(st.st_size - offset)) > 0) {
+    }
+
+    char buf[MAXBUF];
+    ssize_t n;
+    while (offset < st.st_size &&
+           (n = pread(fd, buf, sizeof(buf), offset)) > 0 &&
+           rio_writen(out_fd, buf, (size_t)n) == n) {
+        offset += n;
+    }
+}
+
+/*
+ * flush - Write out the grouped output of the tasks that are done, in item
+ * order, up to the first one still running
+ */
+static int flush(struct run *run, int flushed, int out_fd) {
+    for (; flushed < run->ntasks && run->tasks[flushed].pid < 0; flushed++) {
+        int fd = run->tasks[flushed].out_fd;
+        if (fd >= 0) {
+            copy_output(fd, out_fd);
+            close(fd);
+        }
+    }
+    return flushed;
+}
+
+/*
+ * parallel_run - Run the parallel builtin
+ * Not async-signal-safe
+ */
+int parallel_run(int argc, char **argv, int in_fd, int out_fd) {
+    struct run run = {0};
+    int running = 0, failed = 0, flushed = 0;
+
+    runner_init(&run.runner, "parallel");
+    if (!parse(&run, argc, argv)) {
+        return 1;
+    }
+
+    int next = 0;
+    int reaped = 0;
+    while (reaped < run.ntasks) {
+        for (; running < run.runner.jobs && next < run.ntasks; next++) {
+            if (start(&run, &run.tasks[next])) {
+                running++;
+            } else {
+                run.tasks[next].pid = -1;
+                failed++;
+                reaped++;
+            }
+        }
+
+        int status;
+        pid_t pid = runner_wait(&run.runner, &status);
+        if (pid < 0) {
+            break; // no children left, as when every fork failed
+        }
+
+        for (int i = flushed; i < next; i++) {
+            if (run.tasks[i].pid == pid) {
+                run.tasks[i].pid = -1;
+                break;
+            }
+        }
+        running--;
+        reaped++;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            failed++;
+        }
+        flushed = flush(&run, flushed, out_fd);
+    }
+    flush(&run, flushed, out_fd);
+
+    int result = runner_end(&run.runner, run.ntasks, "command", failed, -1);
+    for (int i = 0; i < run.nbufs; i++) {
+        free(run.bufs[i]);
+    }
+    free(run.bufs);
+    free(run.tasks);
+    return result;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file tsh_parallel.h
+ * @brief The `parallel` builtin: run a command over a list of arguments
+ *
+ * `parallel [-j jobs] [-k] [-u] [-a file] command [arg...] ::: item...`
+ * runs `command arg... item` once for every item, with at most `jobs`
+ * commands running at a time (by default, the number of online CPUs). An
+ * argument of the command that contains `{}` has it replaced by the item
+ * instead. Items come from the words after `:::`, from the lines of the
+ * files after `::::`, and from the lines of each `-a` file, in that order.
+ *
+ * The builtin runs in a forked copy of the shell, which is the only process
+ * of the job in the job list; the commands are its children, in the same
+ * process group, so `jobs` shows one line for the whole run and Ctrl-C or
+ * Ctrl-Z reach every command. The coordinator sleeps in sigsuspend and
+ * starts the next command as soon as SIGCHLD reports that one has exited.
+ *
+ * By default (`-u`), the commands write to the terminal as they run. With
+ * `-k`, the output of each command is collected in a memfd and written out
+ * in the order of the items, each command's output in one piece. When all
+ * commands are done, the builtin prints the number of commands and
+ * failures, the elapsed time and the CPU time used by the commands.
+ *
+ * Only the bare name `parallel` runs the builtin: `/usr/bin/parallel`, e.g.
+ * GNU parallel, is an unrelated program and is run as such.
+ */
+
+#ifndef TSH_PARALLEL_H
+#define TSH_PARALLEL_H
+
+/**
+ * @brief Runs the `parallel` builtin.
+ *
+ * @param[in] argc    The number of arguments.
+ * @param[in] argv    The arguments, starting with `parallel`.
+ * @param[in] in_fd   Standard input (unused).
+ * @param[in] out_fd  Descriptor the commands write to.
+ *
+ * @return The number of commands that failed, at most 101, or 1 if the
+ *         arguments are invalid.
+ *
+ * @pre The caller is a process of its own: the function installs a SIGCHLD
+ *      handler and waits for every child.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int parallel_run(int argc, char **argv, int in_fd, int out_fd);
+
+#endif /* TSH_PARALLEL_H */
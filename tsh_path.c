@@ -0,0 +1,358 @@
+/**
+ * @file tsh_path.c
+ * @brief Command lookup in $PATH with a hash table of resolved commands
+ *
+ * See tsh_path.h for the lookup rules. The directories of $PATH are kept in
+ * `dirs`, each with the modification time it had when it was last checked
+ * and a generation number that is incremented whenever that time changes.
+ * Every entry of the hash table records the directory it was found in and
+ * the sum of the generations of that directory and those before it at the
+ * time. As generations only grow, the sum changes whenever one of them does,
+ * so an fstat of each of these directories tells whether the entry can still
+ * be trusted: a command added to an earlier directory would now be found
+ * first.
+ */
+
+#define _GNU_SOURCE // O_PATH
+
+#include "csapp.h"
+#include "tsh_path.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MIN_BUCKETS 64 // Initial size of the hash table
+
+/* A directory of $PATH */
+struct path_dir {
+    char *path;            // The directory as written in $PATH
+    int fd;                // O_PATH descriptor, or -1 if it cannot be opened
+    struct timespec mtime; // Modification time when last checked
+    unsigned gen;          // Incremented whenever mtime changes
+};
+
+/* A resolved command; name and path are stored after the struct */
+struct path_entry {
+    struct path_entry *next; // Next entry in the same bucket
+    uint32_t hash;           // Hash of name
+    int dir;                 // Index in dirs of the directory holding it
+    unsigned gen;            // prefix_generation of that directory then
+    unsigned hits;           // Times the entry was used
+    const char *path;        // Full path, for listing and posix_spawn
+    char name[];             // The command name
+};
+
+/* Static variables */
+static char *path_env = NULL;              // $PATH the directories came from
+static struct path_dir *dirs = NULL;       // Directories of path_env
+static int ndirs = 0;                      // Number of entries in dirs
+static struct path_entry **buckets = NULL; // Chained hash table
+static size_t nbuckets = 0;                // Size of buckets, a power of two
+static size_t nentries = 0;                // Entries in the hash table
+
+/*
+ * hash_name - FNV-1a hash of a command name
+ */
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (const char *p = name; *p != '\0'; p++) {
+        hash = (hash ^ (unsigned char)*p) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * path_hash_reset - Empty the hash table
+ * Not async-signal-safe
+ */
+void path_hash_reset(void) {
+    for (size_t i = 0; i < nbuckets; i++) {
+        struct path_entry *next;
+        for (struct path_entry *e = buckets[i]; e != NULL; e = next) {
+            next = e->next;
+            free(e);
+        }
+        buckets[i] = NULL;
+    }
+    nentries = 0;
+}
+
+/*
+ * free_dirs - Close and forget the directories of $PATH
+ */
+static void free_dirs(void) {
+    for (int i = 0; i < ndirs; i++) {
+        if (dirs[i].fd >= 0) {
+            close(dirs[i].fd);
+        }
+        free(dirs[i].path);
+    }
+    free(dirs);
+    free(path_env);
+    dirs = NULL;
+    ndirs = 0;
+    path_env = NULL;
+}
+
+/*
+ * load_dirs - Open the directories of a $PATH value. An empty element
+ * stands for the current directory.
+ */
+static bool load_dirs(const char *env) {
+    int count = 1;
+    for (const char *p = env; *p != '\0'; p++) {
+        count += *p == ':';
+    }
+    if ((path_env = strdup(env)) == NULL ||
+        (dirs = calloc((size_t)count, sizeof(*dirs))) == NULL) {
+        return false;
+    }
+
+    const char *start = env;
+    while (true) {
+        const char *end = strchrnul(start, ':');
+        size_t len = (size_t)(end - start);
+        struct path_dir *dir = &dirs[ndirs++];
+        dir->path = len == 0 ? strdup(".") : strndup(start, len);
+        dir->fd = -1;
+        if (dir->path == NULL) {
+            return false;
+        }
+        dir->fd = open(dir->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        struct stat st;
+        if (dir->fd >= 0 && fstat(dir->fd, &st) == 0) {
+            dir->mtime = st.st_mtim;
+        }
+        if (*end == '\0') {
+            return true;
+        }
+        start = end + 1;
+    }
+}
+
+/*
+ * check_env - Reload the directories if $PATH changed since they were
+ * loaded; the table is emptied, as its entries may no longer be first in
+ * the search order. Returns the current value of $PATH.
+ */
+static const char *check_env(void) {
+    const char *env = getenv("PATH");
+    if (env != NULL && path_env != NULL && strcmp(env, path_env) == 0) {
+        return env;
+    }
+
+    path_hash_reset();
+    free_dirs();
+    if (env != NULL && !load_dirs(env)) {
+        perror("path_resolve error");
+        free_dirs();
+    }
+    return env;
+}
+
+/*
+ * dir_generation - Current generation of a directory, incremented here if
+ * its modification time changed
+ */
+static unsigned dir_generation(int i) {
+    struct path_dir *dir = &dirs[i];
+    struct stat st;
+    if (fstat(dir->fd, &st) == 0 &&
+        (st.st_mtim.tv_sec != dir->mtime.tv_sec ||
+         st.st_mtim.tv_nsec != dir->mtime.tv_nsec)) {
+        dir->mtime = st.st_mtim;
+        dir->gen++;
+    }
+    return dir->gen;
+}
+
+/*
+ * prefix_generation - Sum of the generations of directories 0 to i, from
+ * their recorded modification times, or checked again with `check`
+ */
+static unsigned prefix_generation(int i, bool check) {
+    unsigned sum = 0;
+    for (int j = 0; j <= i; j++) {
+        sum += check ? dir_generation(j) : dirs[j].gen;
+    }
+    return sum;
+}
+
+/*
+ * grow_table - Double the number of buckets (or create them), keeping the
+ * table at most one entry per bucket on average
+ */
+static void grow_table(void) {
+    size_t size = nbuckets == 0 ? MIN_BUCKETS : 2 * nbuckets;
+    struct path_entry **table = calloc(size, sizeof(*table));
+    if (table == NULL) {
+        return; // chains just get longer
+    }
+    for (size_t i = 0; i < nbuckets; i++) {
+        struct path_entry *next;
+        for (struct path_entry *e = buckets[i]; e != NULL; e = next) {
+            next = e->next;
+            e->next = table[e->hash & (size - 1)];
+            table[e->hash & (size - 1)] = e;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    nbuckets = size;
+}
+
+/*
+ * add_entry - Remember that name was found in directory i
+ */
+static struct path_entry *add_entry(const char *name, uint32_t hash, int i) {
+    if (nentries >= nbuckets) {
+        grow_table();
+    }
+    if (nbuckets == 0) {
+        return NULL;
+    }
+
+    size_t name_len = strlen(name);
+    size_t dir_len = strlen(dirs[i].path);
+    struct path_entry *e =
+        malloc(sizeof(*e) + 2 * name_len + dir_len + 3);
+    if (e == NULL) {
+        return NULL;
+    }
+    memcpy(e->name, name, name_len + 1);
+    char *path = e->name + name_len + 1;
+    memcpy(path, dirs[i].path, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+
+    e->hash = hash;
+    e->dir = i;
+    e->gen = prefix_generation(i, false);
+    e->hits = 0;
+    e->path = path;
+    e->next = buckets[hash & (nbuckets - 1)];
+    buckets[hash & (nbuckets - 1)] = e;
+    nentries++;
+    return e;
+}
+
+/*
+ * lookup - Find a valid entry for name, dropping it if its directory or one
+ * searched before it changed
+ */
+static struct path_entry *lookup(const char *name, uint32_t hash) {
+    if (nbuckets == 0) {
+        return NULL;
+    }
+    struct path_entry **link = &buckets[hash & (nbuckets - 1)];
+    for (struct path_entry *e = *link; e != NULL; link = &e->next, e = *link) {
+        if (e->hash != hash || strcmp(e->name, name) != 0) {
+            continue;
+        }
+        if (e->gen == prefix_generation(e->dir, true)) {
+            return e;
+        }
+        *link = e->next;
+        free(e);
+        nentries--;
+        return NULL;
+    }
+    return NULL;
+}
+
+/*
+ * probe - Whether directory i holds an executable regular file called name.
+ * Sets errno as execve would if it does not.
+ */
+static bool probe(int i, const char *name) {
+    struct stat st;
+    if (fstatat(dirs[i].fd, name, &st, 0) < 0) {
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        errno = EACCES;
+        return false;
+    }
+    return faccessat(dirs[i].fd, name, X_OK, 0) == 0;
+}
+
+/*
+ * path_resolve - Find the program to execute for a command name
+ * Not async-signal-safe
+ */
+bool path_resolve(const char *name, struct path_cmd *cmd) {
+    if (strchr(name, '/') != NULL || check_env() == NULL) {
+        cmd->dirfd = AT_FDCWD;
+        cmd->name = name;
+        cmd->path = name;
+        return access(name, X_OK) == 0;
+    }
+
+    uint32_t hash = hash_name(name);
+    struct path_entry *e = lookup(name, hash);
+    int err = ENOENT;
+    for (int i = 0; e == NULL && i < ndirs; i++) {
+        if (dirs[i].fd < 0) {
+            continue;
+        }
+        dir_generation(i); // the entry is valid for the directory as probed
+        if (probe(i, name)) {
+            if ((e = add_entry(name, hash, i)) == NULL) {
+                errno = ENOMEM;
+                return false;
+            }
+        } else if (errno == EACCES) {
+            err = EACCES; // as execvp, report it if nothing else is found
+        }
+    }
+    if (e == NULL) {
+        errno = err;
+        return false;
+    }
+
+    e->hits++;
+    cmd->dirfd = dirs[e->dir].fd;
+    cmd->name = e->name;
+    cmd->path = e->path;
+    return true;
+}
+
+/*
+ * path_hash_list - Print the hash table
+ * Not async-signal-safe
+ */
+bool path_hash_list(int fd) {
+    if (nentries == 0) {
+        return dprintf(fd, "hash: hash table empty\n") >= 0;
+    }
+    if (dprintf(fd, "hits\tcommand\n") < 0) {
+        return false;
+    }
+    for (size_t i = 0; i < nbuckets; i++) {
+        for (struct path_entry *e = buckets[i]; e != NULL; e = e->next) {
+            if (dprintf(fd, "%4u\t%s\n", e->hits, e->path) < 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * path_destroy - Free the table and close the directories
+ * Not async-signal-safe
+ */
+void path_destroy(void) {
+    path_hash_reset();
+    free(buckets);
+    buckets = NULL;
+    nbuckets = 0;
+    free_dirs();
+}
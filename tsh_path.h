@@ -0,0 +1,81 @@
+/**
+ * @file tsh_path.h
+ * @brief Command lookup in $PATH with a hash table of resolved commands
+ *
+ * A command name that contains no `/` is searched in the directories of
+ * $PATH, in order. Each directory is opened once with O_PATH, and the name
+ * is probed with faccessat relative to that descriptor, so the lookup never
+ * builds a full path. The directory descriptor is handed to the child,
+ * which executes the command with execveat.
+ *
+ * Successful lookups are remembered in a hash table, like the `hash`
+ * builtin of bash. An entry is trusted as long as the modification time of
+ * its directory is unchanged; once a file is added to or removed from the
+ * directory, the entries found there are searched again. A change of $PATH
+ * itself discards the whole table.
+ *
+ * If $PATH is not set, names are resolved relative to the current directory,
+ * as the shell always did before.
+ */
+
+#ifndef TSH_PATH_H
+#define TSH_PATH_H
+
+#include <stdbool.h>
+
+/**
+ * @brief Where to find the program of a command
+ *
+ * `dirfd` and `name` are the arguments for execveat. `path` names the same
+ * file and is used where a descriptor cannot be, e.g. by posix_spawn. For a
+ * name that contains a `/`, `dirfd` is AT_FDCWD and all three refer to the
+ * name itself.
+ */
+struct path_cmd {
+    int dirfd;        ///< Directory to resolve `name` in, or AT_FDCWD
+    const char *name; ///< File name relative to `dirfd`
+    const char *path; ///< Full path of the same file
+};
+
+/**
+ * @brief Finds the program to execute for a command name.
+ *
+ * The program must exist and be executable. Names that contain a `/` are
+ * checked as given; other names are looked up in the hash table, then in
+ * the directories of $PATH.
+ *
+ * @param[in]  name  The command name, i.e. argv[0].
+ * @param[out] cmd   Receives the location of the program. The strings are
+ *                   valid until the table is cleared.
+ *
+ * @return true if the program was found. Otherwise false, with errno set
+ *         to ENOENT or EACCES as execve would have set it.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool path_resolve(const char *name, struct path_cmd *cmd);
+
+/**
+ * @brief Writes the hash table to a file descriptor, in the format of the
+ * `hash` builtin of bash: the number of hits and the full path of each
+ * command.
+ *
+ * @return true on success, false if writing failed.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool path_hash_list(int fd);
+
+/**
+ * @brief Empties the hash table (`hash -r`).
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void path_hash_reset(void);
+
+/**
+ * @brief Frees the hash table and closes the directory descriptors.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void path_destroy(void);
+
+#endif /* TSH_PATH_H */
@@ -0,0 +1,221 @@
+/**
+ * @file tsh_perf.c
+ * @brief Performance counters for jobs, from perf_event_open(2)
+ *
+ * See tsh_perf.h for what is counted. The descriptors of each process with
+ * counters are kept in an array that only grows with signals blocked; the
+ * loop's event dispatch reads and removes an entry when it applies the exit
+ * of the process. The counters are not grouped: the kernel cannot read a group of
+ * inherited counters at once, and a failed hardware counter then does not
+ * take the others with it.
+ */
+
+#define _GNU_SOURCE // syscall
+
+#include "csapp.h"
+#include "tsh_helper.h"
+#include "tsh_perf.h"
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* A process with counters */
+struct traced {
+    pid_t pid;              // The process
+    int fd[PERF_NCOUNTERS]; // Counter descriptors, or -1
+};
+
+/* Global variables */
+bool perf_enabled = false; // Open counters on every job (--perf)
+
+/* Static variables */
+static const struct {
+    const char *name; // Name in perf_print
+    uint32_t type;    // perf_event_attr type
+    uint64_t config;  // perf_event_attr config
+} counters[PERF_NCOUNTERS] = {
+    [PERF_TASK_CLOCK] = {"task-clock", PERF_TYPE_SOFTWARE,
+                         PERF_COUNT_SW_TASK_CLOCK},
+    [PERF_CONTEXT_SWITCHES] = {"context-switches", PERF_TYPE_SOFTWARE,
+                               PERF_COUNT_SW_CONTEXT_SWITCHES},
+    [PERF_CPU_MIGRATIONS] = {"cpu-migrations", PERF_TYPE_SOFTWARE,
+                             PERF_COUNT_SW_CPU_MIGRATIONS},
+    [PERF_PAGE_FAULTS] = {"page-faults", PERF_TYPE_SOFTWARE,
+                          PERF_COUNT_SW_PAGE_FAULTS},
+    [PERF_CYCLES] = {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERF_INSTRUCTIONS] = {"instructions", PERF_TYPE_HARDWARE,
+                           PERF_COUNT_HW_INSTRUCTIONS},
+};
+static struct traced *traced = NULL; // Processes with counters
+static int ntraced = 0;              // Entries used in traced
+static int traced_cap = 0;           // Allocated entries of traced
+static bool no_hardware = false;     // Hardware counters failed to open
+static bool no_counters = false;     // Software counters failed to open
+
+/*
+ * open_counter - Open one counter on a process, inherited by its children
+ */
+static int open_counter(pid_t pid, perf_counter counter, bool on_exec) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counters[counter].type;
+    attr.config = counters[counter].config;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.inherit = 1;
+    attr.disabled = on_exec;
+    attr.enable_on_exec = on_exec;
+    return (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+                        PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * perf_attach - Open the counters on a new process
+ * Not async-signal-safe
+ */
+bool perf_attach(pid_t pid, bool on_exec) {
+    if (no_counters) {
+        return false;
+    }
+    if (ntraced == traced_cap) {
+        int cap = traced_cap == 0 ? 16 : 2 * traced_cap;
+        struct traced *bigger = realloc(traced, (size_t)cap * sizeof(*bigger));
+        if (bigger == NULL) {
+            return false;
+        }
+        traced = bigger;
+        traced_cap = cap;
+    }
+
+    struct traced *t = &traced[ntraced];
+    t->pid = pid;
+    for (perf_counter c = 0; c < PERF_NCOUNTERS; c++) {
+        t->fd[c] = -1;
+        if (counters[c].type == PERF_TYPE_HARDWARE && no_hardware) {
+            continue;
+        }
+        t->fd[c] = open_counter(pid, c, on_exec);
+        if (t->fd[c] >= 0 || errno == ESRCH) {
+            continue;
+        }
+        if (counters[c].type == PERF_TYPE_HARDWARE) {
+            no_hardware = true;
+            if (verbose) {
+                fprintf(stderr, "perf: no hardware counters (%s), counting "
+                                "software events only\n",
+                        strerror(errno));
+            }
+            continue;
+        }
+        fprintf(stderr, "perf: cannot open counters: %s\n", strerror(errno));
+        no_counters = true;
+        for (perf_counter o = 0; o < c; o++) {
+            if (t->fd[o] >= 0) {
+                close(t->fd[o]);
+            }
+        }
+        return false;
+    }
+    if (t->fd[PERF_TASK_CLOCK] < 0) { // the process is gone already
+        for (perf_counter c = 0; c < PERF_NCOUNTERS; c++) {
+            if (t->fd[c] >= 0) {
+                close(t->fd[c]);
+            }
+        }
+        return false;
+    }
+    ntraced++;
+    return true;
+}
+
+/*
+ * perf_collect - Read and close the counters of a terminated process
+ * Async-signal-safe
+ */
+bool perf_collect(pid_t pid, struct perf_counts *counts) {
+    int i = 0;
+    while (i < ntraced && traced[i].pid != pid) {
+        i++;
+    }
+    if (i == ntraced) {
+        return false;
+    }
+
+    memset(counts, 0, sizeof(*counts));
+    for (perf_counter c = 0; c < PERF_NCOUNTERS; c++) {
+        int fd = traced[i].fd[c];
+        uint64_t data[3]; // value, time enabled, time running
+        if (fd < 0) {
+            continue;
+        }
+        if (read(fd, data, sizeof(data)) == (ssize_t)sizeof(data) &&
+            data[2] > 0) {
+            counts->value[c] =
+                data[2] < data[1]
+                    ? (uint64_t)((unsigned __int128)data[0] * data[1] /
+                                 data[2])
+                    : data[0];
+            counts->valid |= 1u << c;
+        }
+        close(fd);
+    }
+    traced[i] = traced[--ntraced];
+    return true;
+}
+
+/*
+ * perf_add - Add counter values to a sum
+ * Async-signal-safe
+ */
+void perf_add(struct perf_counts *sum, const struct perf_counts *counts) {
+    for (perf_counter c = 0; c < PERF_NCOUNTERS; c++) {
+        sum->value[c] += counts->value[c];
+    }
+    sum->valid |= counts->valid;
+}
+
+/*
+ * perf_print - Buffer the counters that counted as name value pairs
+ * Async-signal-safe
+ */
+bool perf_print(sio_t *out, const char *prefix,
+                const struct perf_counts *counts) {
+    if (sio_printfb(out, "%s", prefix) < 0) {
+        return false;
+    }
+    const char *sep = "";
+    for (perf_counter c = 0; c < PERF_NCOUNTERS; c++) {
+        uint64_t value = counts->value[c];
+        ssize_t res = 0;
+        if (!(counts->valid & (1u << c))) {
+            continue;
+        }
+        if (c == PERF_TASK_CLOCK) {
+            char frac[10];
+            uint64_t ns = value % 1000000000u;
+            for (int d = 8; d >= 0; d--) {
+                frac[d] = (char)('0' + ns % 10);
+                ns /= 10;
+            }
+            frac[9] = '\0';
+            res = sio_printfb(out, "%s%s %lu.%ss", sep, counters[c].name,
+                              (unsigned long)(value / 1000000000u), frac);
+        } else {
+            res = sio_printfb(out, "%s%s %lu", sep, counters[c].name,
+                              (unsigned long)value);
+        }
+        if (res < 0) {
+            return false;
+        }
+        sep = " ";
+    }
+    return sio_printfb(out, "\n") >= 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * @file tsh_perf.h
+ * @brief Performance counters for jobs, from perf_event_open(2)
+ *
+ * With `--perf`, or for the job run by the `perfstat` builtin, the shell
+ * opens a set of counters on every process of a job: task-clock, context
+ * switches, CPU migrations and page faults, which the kernel always
+ * provides, and CPU cycles and instructions when the PMU is exposed to the
+ * shell (often not in a VM). Hardware counters are tried once; if they
+ * cannot be opened, only the software counters are used from then on.
+ *
+ * The counters are opened by the shell on the PID of the child with
+ * `inherit`, so they also count every process the job creates, and with
+ * `enable_on_exec` while the child waits for the shell before execve (see
+ * tsh_spawn.c), so they count the program from its first instruction and
+ * nothing of the shell that forked it. When the process is reaped, the
+ * counters of it and of its descendants that have exited are read and
+ * closed, and the values are added to the job (see `job_usage`). A counter
+ * that the kernel had to multiplex with others is scaled to the whole time
+ * it was enabled.
+ */
+
+#ifndef TSH_PERF_H
+#define TSH_PERF_H
+
+#include "csapp.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief Counters opened on each process
+ */
+typedef enum perf_counter {
+    PERF_TASK_CLOCK = 0,   ///< CPU time, in nanoseconds
+    PERF_CONTEXT_SWITCHES, ///< Context switches
+    PERF_CPU_MIGRATIONS,   ///< Moves to another CPU
+    PERF_PAGE_FAULTS,      ///< Page faults
+    PERF_CYCLES,           ///< CPU cycles (hardware)
+    PERF_INSTRUCTIONS,     ///< Instructions retired (hardware)
+    PERF_NCOUNTERS
+} perf_counter;
+
+/**
+ * @brief Values of the counters of a job
+ */
+struct perf_counts {
+    uint64_t value[PERF_NCOUNTERS]; ///< Value of each counter
+    unsigned valid;                 ///< Bit (1u << counter) if it counted
+};
+
+/* Defined in tsh_perf.c */
+extern bool perf_enabled; ///< Open counters on every job (--perf)
+
+/**
+ * @brief Opens the counters on a newly created process.
+ *
+ * Failing to open the software counters (e.g. perf_event_open not allowed
+ * by perf_event_paranoid or a seccomp filter) is reported once, and no more
+ * counters are opened after that.
+ *
+ * @param[in] pid      The process.
+ * @param[in] on_exec  Start counting when the process calls execve, rather
+ *                     than right away. The process must not have called it
+ *                     yet.
+ *
+ * @return false if no counter could be opened.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool perf_attach(pid_t pid, bool on_exec);
+
+/**
+ * @brief Reads and closes the counters of a process that has terminated.
+ *
+ * @param[in]  pid     The process, as reaped.
+ * @param[out] counts  The values of its counters.
+ *
+ * @return false if no counters were opened on the process.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool perf_collect(pid_t pid, struct perf_counts *counts);
+
+/**
+ * @brief Adds the values of counters to a sum.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void perf_add(struct perf_counts *sum, const struct perf_counts *counts);
+
+/**
+ * @brief Appends the counters that counted to an output buffer as one line
+ * of `name value` pairs, preceded by `prefix`. The task-clock is written in
+ * seconds.
+ *
+ * @return false if an error occurred while writing out the buffer
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool perf_print(sio_t *out, const char *prefix,
+                const struct perf_counts *counts);
+
+#endif /* TSH_PERF_H */
@@ -0,0 +1,357 @@
+/**
+ * @file tsh_prio.c
+ * @brief Lower priority for background jobs (tsh --bg-prio)
+ *
+ * See tsh_prio.h. The nice value and the I/O priority are set by the kernel
+ * on the whole process group (PRIO_PGRP, IOPRIO_WHO_PGRP). The scheduling
+ * class is set per thread and oom_score_adj per process: the processes come
+ * from the job list, or from reaper_members as a subreaper, and their
+ * threads from /proc/PID/task, read with open and getdents64 only, so that
+ * a policy can be applied with signals blocked, from job_set_state.
+ */
+
+#define _GNU_SOURCE // getdents64
+
+#include "csapp.h"
+#include "tsh_prio.h"
+#include "tsh_reaper.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MAX_MEMBERS 256 // Processes of a group listed by prio_apply_members
+#define DENTS_SIZE 4096 // Bytes of directory entries read at once
+#define PATH_SIZE 48    // Room for "/proc/PID/oom_score_adj"
+#define NICE_MAX 19     // Highest nice value
+#define OOM_MAX 1000    // Highest oom_score_adj
+#define DEFAULT_NICE 10 // Nice offset of prio_default, if it can be undone
+
+/* I/O priorities, as in linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_WHO_PGRP 2
+#define IOPRIO_IDLE (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT)
+
+/* Global variables */
+bool prio_enabled = false; // Background jobs are demoted
+struct prio_policy prio_default = {
+    .sched = SCHED_BATCH,
+    .nice = 0,
+    .io_idle = true,
+    .oom = 500,
+};
+
+/* Static variables */
+static const struct prio_policy none = {.sched = SCHED_OTHER}; // The shell's
+static int shell_sched;  // Scheduling class of the shell
+static int shell_nice;   // Its nice value
+static int shell_ioprio; // Its I/O priority
+static int shell_oom;    // Its oom_score_adj
+
+/*
+ * put_int - Append a decimal number to a string, and return its new end
+ * Async-signal-safe
+ */
+static char *put_int(char *p, int value) {
+    char digits[12];
+    int n = 0;
+    unsigned u = value < 0 ? -(unsigned)value : (unsigned)value;
+    do {
+        digits[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (value < 0) {
+        *p++ = '-';
+    }
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    *p = '\0';
+    return p;
+}
+
+/*
+ * proc_path - Build /proc/PID/name
+ * Async-signal-safe
+ */
+static void proc_path(char *path, pid_t pid, const char *name) {
+    char *p = stpcpy(path, "/proc/");
+    p = put_int(p, pid);
+    *p++ = '/';
+    strcpy(p, name);
+}
+
+/*
+ * read_oom - Read the oom_score_adj of the shell
+ */
+static bool read_oom(int *oom) {
+    FILE *fp = fopen("/proc/self/oom_score_adj", "r");
+    if (fp == NULL) {
+        return false;
+    }
+    bool ok = fscanf(fp, "%d", oom) == 1;
+    fclose(fp);
+    return ok;
+}
+
+/*
+ * prio_init - Record the priority of the shell
+ * Not async-signal-safe
+ */
+bool prio_init(void) {
+    int sched = sched_getscheduler(0);
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, 0);
+    if (sched < 0 || (nice == -1 && errno != 0)) {
+        perror("--bg-prio");
+        return false;
+    }
+    int ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    if (ioprio < 0) {
+        perror("--bg-prio: ioprio_get");
+        return false;
+    }
+    if (!read_oom(&shell_oom)) {
+        perror("--bg-prio: /proc/self/oom_score_adj");
+        return false;
+    }
+    shell_sched = sched & ~SCHED_RESET_ON_FORK;
+    shell_nice = nice;
+    shell_ioprio = ioprio;
+
+    // A nice offset can only be undone by a shell that may lower the nice
+    // value back to its own. SCHED_IDLE is left to the prio builtin: jobs
+    // that only run when nothing else does can take long to even exit.
+    struct rlimit rl;
+    if (geteuid() == 0 || (getrlimit(RLIMIT_NICE, &rl) == 0 &&
+                           rl.rlim_cur >= (rlim_t)(20 - shell_nice))) {
+        prio_default.nice = DEFAULT_NICE;
+    }
+    prio_enabled = true;
+    return true;
+}
+
+/*
+ * is_item - Whether an item of a policy is the given word
+ * Async-signal-safe
+ */
+static bool is_item(const char *item, size_t len, const char *word) {
+    return strlen(word) == len && memcmp(item, word, len) == 0;
+}
+
+/*
+ * item_value - Parse the value of a `key=N` item, from 0 to max
+ * Async-signal-safe
+ */
+static bool item_value(const char *item, size_t len, const char *key,
+                       int max, int *value) {
+    size_t key_len = strlen(key);
+    if (len <= key_len || memcmp(item, key, key_len) != 0) {
+        return false;
+    }
+    int n = 0;
+    for (size_t i = key_len; i < len; i++) {
+        if (item[i] < '0' || item[i] > '9' || n > max) {
+            return false;
+        }
+        n = n * 10 + (item[i] - '0');
+    }
+    if (n > max) {
+        return false;
+    }
+    *value = n;
+    return true;
+}
+
+/*
+ * prio_parse - Parse a comma-separated policy
+ * Async-signal-safe
+ */
+bool prio_parse(const char *spec, struct prio_policy *policy) {
+    struct prio_policy parsed = *policy;
+    const char *item = spec;
+    while (true) {
+        size_t len = strcspn(item, ",");
+        if (is_item(item, len, "none")) {
+            parsed = (struct prio_policy){.sched = SCHED_OTHER};
+        } else if (is_item(item, len, "normal")) {
+            parsed.sched = SCHED_OTHER;
+        } else if (is_item(item, len, "batch")) {
+            parsed.sched = SCHED_BATCH;
+        } else if (is_item(item, len, "idle")) {
+            parsed.sched = SCHED_IDLE;
+        } else if (is_item(item, len, "io=idle")) {
+            parsed.io_idle = true;
+        } else if (is_item(item, len, "io=normal")) {
+            parsed.io_idle = false;
+        } else if (!item_value(item, len, "nice=", NICE_MAX, &parsed.nice) &&
+                   !item_value(item, len, "oom=", OOM_MAX, &parsed.oom)) {
+            return false;
+        }
+        if (item[len] == '\0') {
+            break;
+        }
+        item += len + 1;
+    }
+    *policy = parsed;
+    return true;
+}
+
+/*
+ * prio_format - Format a policy the way prio_parse reads it
+ * Async-signal-safe
+ */
+char *prio_format(char *buf, const struct prio_policy *policy) {
+    const char *sched = policy->sched == SCHED_BATCH  ? "batch"
+                        : policy->sched == SCHED_IDLE ? "idle"
+                                                      : "normal";
+    char *p = stpcpy(buf, sched);
+    p = stpcpy(p, ",nice=");
+    p = put_int(p, policy->nice);
+    p = stpcpy(p, policy->io_idle ? ",io=idle,oom=" : ",io=normal,oom=");
+    put_int(p, policy->oom);
+    return buf;
+}
+
+/*
+ * set_sched - Set the scheduling class of every thread of a process.
+ * Returns false if one of them could not be changed.
+ * Async-signal-safe
+ */
+static bool set_sched(pid_t pid, int sched) {
+    char path[PATH_SIZE];
+    proc_path(path, pid, "task");
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return true; // exited meanwhile
+    }
+
+    const struct sched_param param = {.sched_priority = 0};
+    char dents[DENTS_SIZE] __attribute__((aligned(8)));
+    bool ok = true;
+    ssize_t n;
+    while ((n = getdents64(fd, dents, sizeof(dents))) > 0) {
+        for (ssize_t off = 0; off < n;) {
+            const struct dirent64 *d = (const struct dirent64 *)(dents + off);
+            off += d->d_reclen;
+            pid_t tid = 0;
+            for (const char *c = d->d_name; *c >= '0' && *c <= '9'; c++) {
+                tid = tid * 10 + (*c - '0');
+            }
+            if (tid != 0 && sched_setscheduler(tid, sched, &param) < 0 &&
+                errno != ESRCH) {
+                ok = false;
+            }
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+/*
+ * set_oom - Set the oom_score_adj of a process
+ * Async-signal-safe
+ */
+static bool set_oom(pid_t pid, int oom) {
+    char path[PATH_SIZE];
+    char value[12];
+    proc_path(path, pid, "oom_score_adj");
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT; // exited meanwhile
+    }
+    size_t len = (size_t)(put_int(value, oom) - value);
+    bool ok = write(fd, value, len) == (ssize_t)len;
+    close(fd);
+    return ok;
+}
+
+/*
+ * prio_apply_process - Apply the class and OOM score of a policy to a
+ * process, or restore them
+ * Async-signal-safe
+ */
+bool prio_apply_process(pid_t pid, const struct prio_policy *policy) {
+    if (!prio_enabled || pid <= 0) {
+        return true;
+    }
+    if (policy == NULL) {
+        policy = &none;
+    }
+
+    int olderrno = errno;
+    int sched = policy->sched == SCHED_OTHER ? shell_sched : policy->sched;
+    int oom = shell_oom + policy->oom;
+    if (oom > OOM_MAX) {
+        oom = OOM_MAX;
+    }
+    bool ok = set_sched(pid, sched);
+    ok = set_oom(pid, oom) && ok;
+    errno = olderrno;
+    return ok;
+}
+
+/*
+ * prio_apply_members - Apply the class and OOM score of a policy to every
+ * process of a group found in /proc, or restore them
+ * Async-signal-safe
+ */
+bool prio_apply_members(pid_t pgid, const struct prio_policy *policy) {
+    static struct reaper_member members[MAX_MEMBERS + 1]; // signals blocked
+    if (!prio_enabled || pgid <= 0) {
+        return true;
+    }
+
+    int count = reaper_members(pgid, members, MAX_MEMBERS + 1);
+    if (count > MAX_MEMBERS) {
+        sio_eprintf("prio: process group %d has more than %d processes; "
+                    "only the first %d were changed\n",
+                    (int)pgid, MAX_MEMBERS, MAX_MEMBERS);
+        count = MAX_MEMBERS;
+    }
+    bool ok = count >= 0;
+    for (int i = 0; i < count; i++) {
+        ok = prio_apply_process(members[i].pid, policy) && ok;
+    }
+    return ok;
+}
+
+/*
+ * prio_apply_group - Apply the nice value and I/O priority of a policy to
+ * a process group, or restore them
+ * Async-signal-safe
+ */
+bool prio_apply_group(pid_t pgid, const struct prio_policy *policy) {
+    if (!prio_enabled || pgid <= 0) {
+        return true;
+    }
+    if (policy == NULL) {
+        policy = &none;
+    }
+
+    int olderrno = errno;
+    int nice = shell_nice + policy->nice;
+    int ioprio = policy->io_idle ? IOPRIO_IDLE : shell_ioprio;
+    if (nice > NICE_MAX) {
+        nice = NICE_MAX;
+    }
+    bool ok = true;
+    if (setpriority(PRIO_PGRP, pgid, nice) < 0 && errno != ESRCH) {
+        ok = false;
+    }
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, pgid, ioprio) < 0 &&
+        errno != ESRCH) {
+        ok = false;
+    }
+    errno = olderrno;
+    return ok;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file tsh_prio.h
+ * @brief Lower priority for background jobs (tsh --bg-prio)
+ *
+ * Every job starts with the scheduling class, nice value, I/O priority and
+ * OOM score adjustment of the shell, so background jobs compete with the
+ * foreground job on equal terms. With `--bg-prio`, a job runs with a
+ * background policy whenever it is in the `BG` state: from `add_job`, `bg`
+ * or its start from the queue, until `fg` brings it back, when it is
+ * restored to the values of the shell. Stopped jobs keep the policy they
+ * had. A policy is made of:
+ *
+ *   - a scheduling class: `normal` (that of the shell), `batch`
+ *     (SCHED_BATCH) or `idle` (SCHED_IDLE, which only runs when nothing
+ *     else does);
+ *   - `nice=N`, added to the nice value of the shell, 0 to 19;
+ *   - `io=idle` for the idle I/O class (ioprio_set), or `io=normal`;
+ *   - `oom=N`, added to the `oom_score_adj` of the shell, 0 to 1000, so
+ *     that the OOM killer picks background jobs first.
+ *
+ * Each job has a policy of its own, copied from `prio_default` when it is
+ * added and changed by the `prio` builtin. The nice value and I/O priority
+ * are applied to the process group of the job, the scheduling class and OOM
+ * score adjustment to every process of the job in the job list, and every
+ * thread of them; the processes they create afterwards inherit it. With
+ * `--subreaper`, processes the job list does not know of are part of the
+ * job too, so every process of the group is looked up in /proc instead.
+ *
+ * The default policy is `batch,nice=10,io=idle,oom=500`. Lowering the nice
+ * value again, or leaving SCHED_IDLE, needs CAP_SYS_NICE or a high enough
+ * RLIMIT_NICE, so without either the default has no nice offset, and `fg`
+ * cannot fully restore a job given one, or `idle`, with the `prio` builtin.
+ */
+
+#ifndef TSH_PRIO_H
+#define TSH_PRIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define PRIO_SPEC_SIZE 48 /**< Room for a policy formatted by `prio_format` */
+
+/**
+ * @brief What a job runs with in the background, relative to the shell
+ */
+struct prio_policy {
+    int sched;    ///< SCHED_BATCH, SCHED_IDLE, or SCHED_OTHER: the shell's
+    int nice;     ///< Added to the nice value of the shell, 0 to 19
+    bool io_idle; ///< Idle I/O class instead of that of the shell
+    int oom;      ///< Added to the oom_score_adj of the shell, 0 to 1000
+};
+
+/* Defined in tsh_prio.c */
+extern bool prio_enabled;               ///< Background jobs are demoted
+extern struct prio_policy prio_default; ///< Policy of the jobs to be added
+
+/**
+ * @brief Records the priority of the shell, which jobs are restored to in
+ * the foreground, and leaves the nice offset out of `prio_default` if the
+ * shell could not undo it.
+ *
+ * @return false, after printing a message, if it cannot be read. Jobs then
+ * keep the priority of the shell.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool prio_init(void);
+
+/**
+ * @brief Parses a comma-separated policy, e.g. `idle,nice=5,io=idle,oom=300`
+ * or `none` for the priority of the shell.
+ *
+ * @param[in]     spec    The policy.
+ * @param[in,out] policy  Updated with the items given; the others are kept.
+ * @return false if an item is not valid, in which case `policy` is
+ * unchanged.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool prio_parse(const char *spec, struct prio_policy *policy);
+
+/**
+ * @brief Formats a policy the way `prio_parse` reads it, with every item.
+ *
+ * @param[out] buf     Room for `PRIO_SPEC_SIZE` characters.
+ * @param[in]  policy  The policy.
+ * @return `buf`.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+char *prio_format(char *buf, const struct prio_policy *policy);
+
+/**
+ * @brief Applies the scheduling class and OOM score adjustment of a
+ * background policy to a process and its threads, or restores them to those
+ * of the shell. Does nothing without `prio_enabled`.
+ *
+ * Apply it to every process of a job before `prio_apply_group`: leaving
+ * SCHED_IDLE is checked against the nice value they had.
+ *
+ * @param[in] pid     The process.
+ * @param[in] policy  The policy, or NULL for the priority of the shell.
+ * @return false if some of it could not be applied. A process that has
+ * exited is not an error.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool prio_apply_process(pid_t pid, const struct prio_policy *policy);
+
+/**
+ * @brief Like `prio_apply_process` for every process of a process group,
+ * found in /proc, for jobs whose processes are not all known (`--subreaper`).
+ * Prints a message if the group has more processes than can be listed at
+ * once, which are then left out.
+ *
+ * @param[in] pgid    The process group, the PID of a job.
+ * @param[in] policy  The policy, or NULL for the priority of the shell.
+ * @return false if some of it could not be applied.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool prio_apply_members(pid_t pgid, const struct prio_policy *policy);
+
+/**
+ * @brief Applies the nice value and I/O priority of a background policy to
+ * a process group, or restores them to those of the shell. Does nothing
+ * without `prio_enabled`.
+ *
+ * @param[in] pgid    The process group, the PID of a job.
+ * @param[in] policy  The policy, or NULL for the priority of the shell.
+ * @return false if some of it could not be applied, e.g. the nice value
+ * could not be lowered again without privileges.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool prio_apply_group(pid_t pgid, const struct prio_policy *policy);
+
+#endif /* TSH_PRIO_H */
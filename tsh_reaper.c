@@ -0,0 +1,200 @@
+/**
+ * @file tsh_reaper.c
+ * @brief Tracking of every process of a job (tsh --subreaper)
+ *
+ * See tsh_reaper.h. /proc is read with open, getdents64 and read only, so
+ * that the members of a job can be listed with signals blocked, from the
+ * same code paths as the rest of the job list.
+ */
+
+#define _GNU_SOURCE // getdents64
+
+#include "tsh_reaper.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define DENTS_SIZE 4096 // Bytes of directory entries read at once
+#define STAT_SIZE 512   // Enough for /proc/PID/stat up to the pgrp field
+
+/* Global variables */
+bool reaper_enabled = false; // The shell is a child subreaper
+
+/*
+ * reaper_init - Become a child subreaper
+ * Not async-signal-safe
+ */
+bool reaper_init(void) {
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+        perror("prctl(PR_SET_CHILD_SUBREAPER)");
+        return false;
+    }
+    reaper_enabled = true;
+    return true;
+}
+
+/*
+ * reaper_wait - Reap a child without blocking, with its process group
+ * Async-signal-safe
+ */
+pid_t reaper_wait(int *status, struct rusage *ru, pid_t *pgid, pid_t keep) {
+    *pgid = 0;
+    if (!reaper_enabled && keep == 0) {
+        return wait4(-1, status, WNOHANG | WUNTRACED, ru);
+    }
+
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_ALL, 0, &info, WEXITED | WSTOPPED | WNOHANG | WNOWAIT) < 0) {
+        return -1;
+    }
+    if (info.si_pid == 0) {
+        return 0;
+    }
+    pid_t group = getpgid(info.si_pid); // still a zombie, or stopped
+    if (keep != 0 && group == keep) {
+        return 0;
+    }
+    pid_t pid = wait4(info.si_pid, status, WNOHANG | WUNTRACED, ru);
+    if (pid > 0 && group > 0 && reaper_enabled) {
+        *pgid = group;
+    }
+    return pid;
+}
+
+/*
+ * reaper_group_alive - Whether a process group has processes left
+ * Async-signal-safe
+ */
+bool reaper_group_alive(pid_t pgid) {
+    if (!reaper_enabled || pgid <= 0) {
+        return false;
+    }
+    int olderrno = errno;
+    bool alive = kill(-pgid, 0) == 0 || errno == EPERM;
+    errno = olderrno;
+    return alive;
+}
+
+/*
+ * parse_pid - The PID named by a /proc entry, or 0 if it names none
+ */
+static pid_t parse_pid(const char *name) {
+    pid_t pid = 0;
+    if (*name == '\0') {
+        return 0;
+    }
+    for (; *name != '\0'; name++) {
+        if (*name < '0' || *name > '9') {
+            return 0;
+        }
+        pid = pid * 10 + (*name - '0');
+    }
+    return pid;
+}
+
+/*
+ * read_member - Read the name, state and process group of a process from
+ * /proc/PID/stat, which reads `pid (comm) state ppid pgrp ...`. The name
+ * may itself hold parentheses, so it ends at the last one.
+ */
+static bool read_member(int proc_fd, const char *name,
+                        struct reaper_member *member, pid_t *pgrp) {
+    char path[32];
+    char buf[STAT_SIZE];
+    size_t len = strlen(name);
+    memcpy(path, name, len);
+    memcpy(path + len, "/stat", sizeof("/stat"));
+
+    int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false; // exited meanwhile
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+
+    char *lparen = strchr(buf, '(');
+    char *rparen = strrchr(buf, ')');
+    if (lparen == NULL || rparen == NULL || rparen < lparen ||
+        rparen[1] != ' ') {
+        return false;
+    }
+    size_t comm_len = (size_t)(rparen - lparen - 1);
+    if (comm_len >= MEMBER_COMM) {
+        comm_len = MEMBER_COMM - 1;
+    }
+    memcpy(member->comm, lparen + 1, comm_len);
+    member->comm[comm_len] = '\0';
+    member->state = rparen[2];
+
+    // Skip the state and ppid fields
+    const char *p = rparen + 2;
+    for (int field = 0; field < 2; field++) {
+        while (*p != ' ' && *p != '\0') {
+            p++;
+        }
+        while (*p == ' ') {
+            p++;
+        }
+    }
+    pid_t group = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+        group = group * 10 + (*p - '0');
+    }
+    *pgrp = group;
+    return true;
+}
+
+/*
+ * reaper_members - List the processes of a process group
+ * Async-signal-safe
+ */
+int reaper_members(pid_t pgid, struct reaper_member *members, int max) {
+    int proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (proc_fd < 0) {
+        return -1;
+    }
+
+    char dents[DENTS_SIZE] __attribute__((aligned(8)));
+    int count = 0;
+    ssize_t n;
+    while (count < max &&
+           (n = getdents64(proc_fd, dents, sizeof(dents))) > 0) {
+        for (ssize_t off = 0; off < n && count < max;) {
+            const struct dirent64 *d = (const struct dirent64 *)(dents + off);
+            off += d->d_reclen;
+
+            struct reaper_member member;
+            pid_t pgrp;
+            member.pid = parse_pid(d->d_name);
+            if (member.pid == 0 ||
+                !read_member(proc_fd, d->d_name, &member, &pgrp) ||
+                pgrp != pgid) {
+                continue;
+            }
+
+            // Insert in PID order; /proc lists them so, but need not
+            int i = count++;
+            while (i > 0 && members[i - 1].pid > member.pid) {
+                members[i] = members[i - 1];
+                i--;
+            }
+            members[i] = member;
+        }
+    }
+    close(proc_fd);
+    return count;
+}
@@ -0,0 +1,92 @@
+/**
+ * @file tsh_reaper.h
+ * @brief Tracking of every process of a job (tsh --subreaper)
+ *
+ * The processes a job creates stay in its process group, but once their
+ * parent exits they are reparented to init, out of reach of the shell: they
+ * outlive the job, and nothing reaps them if init does not. With
+ * `--subreaper`, the shell marks itself as a child subreaper
+ * (PR_SET_CHILD_SUBREAPER), so that orphaned descendants are reparented to
+ * the shell instead, and reaped like its own children.
+ *
+ * The members of a job are the processes in its process group, whose ID is
+ * the PID of the job. The kernel keeps that set, so it is read from /proc
+ * when it is needed rather than copied: a copy would go stale whenever a
+ * member reaps another. An orphan is reaped before it can be looked up, so
+ * its process group is read first, while it is still a zombie, and the
+ * event is attributed to the job of that group. A job is then only done
+ * once its own processes have terminated and its group is empty.
+ */
+
+#ifndef TSH_REAPER_H
+#define TSH_REAPER_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+#define MEMBER_COMM 16 /**< Size of a process name, with its NUL */
+
+/**
+ * @brief A live process of a job, as listed by `jobs -l`
+ */
+struct reaper_member {
+    pid_t pid;              ///< The process
+    char state;             ///< Its state: R, S, T, Z...
+    char comm[MEMBER_COMM]; ///< Its name, as in /proc/PID/comm
+};
+
+/* Defined in tsh_reaper.c */
+extern bool reaper_enabled; ///< The shell is a child subreaper
+
+/**
+ * @brief Makes the shell a child subreaper (tsh --subreaper).
+ *
+ * @return false, after printing a message, if the kernel refused. The shell
+ * then goes on without it.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool reaper_init(void);
+
+/**
+ * @brief Reaps a child that stopped or terminated, without blocking.
+ *
+ * Behaves as `wait4(-1, status, WNOHANG | WUNTRACED, ru)`. With
+ * `reaper_enabled`, or a group to keep, the child is first found with
+ * waitid(WNOWAIT), so that its process group can be read before it is
+ * reaped.
+ *
+ * @param[out] status  Its status, as reported by wait4.
+ * @param[out] ru      Its resource usage, as reported by wait4.
+ * @param[out] pgid    Its process group, or 0 without `reaper_enabled`.
+ * @param[in]  keep    A process group whose children are left to the
+ *                     caller's own wait, or 0.
+ * @return The child, 0 if none has changed state or the next one is in
+ * `keep`, or -1 if there are no children.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+pid_t reaper_wait(int *status, struct rusage *ru, pid_t *pgid, pid_t keep);
+
+/**
+ * @brief Returns whether any process is left in a process group. Always
+ * false without `reaper_enabled`.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool reaper_group_alive(pid_t pgid);
+
+/**
+ * @brief Lists the processes of a process group, in increasing PID order.
+ *
+ * @param[in]  pgid     The process group, the PID of a job.
+ * @param[out] members  The processes found.
+ * @param[in]  max      Room in `members`.
+ * @return The number of processes found, at most `max`, or -1 if /proc
+ * cannot be read.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int reaper_members(pid_t pgid, struct reaper_member *members, int max);
+
+#endif /* TSH_REAPER_H */
@@ -0,0 +1,185 @@
+/**
+ * @file tsh_runner.c
+ * @brief Running many commands from a builtin (parallel, dag)
+ *
+ * See tsh_runner.h. SIGCHLD stays blocked in the coordinator except while
+ * it waits, and its handler does nothing: the signal only has to end
+ * sigsuspend, after which the children are collected with waitpid.
+ */
+
+#include "csapp.h"
+#include "tsh_runner.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * runner_sigchld - Empty handler, so that SIGCHLD ends sigsuspend
+ */
+static void runner_sigchld(int sig) {
+}
+
+/*
+ * runner_init - Start a run
+ * Not async-signal-safe
+ */
+void runner_init(struct runner *r, const char *who) {
+    sigset_t mask_chld;
+
+    clock_gettime(CLOCK_MONOTONIC, &r->begin);
+    r->who = who;
+    r->jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    r->jobs = r->jobs > 0 ? r->jobs : 1;
+
+    // SIGCHLD stays blocked except while waiting for it
+    sigemptyset(&mask_chld);
+    sigaddset(&mask_chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask_chld, &r->child_mask);
+    r->wait_mask = r->child_mask;
+    sigdelset(&r->wait_mask, SIGCHLD);
+    Signal(SIGCHLD, runner_sigchld);
+}
+
+/*
+ * runner_jobs_option - Parse a -j option
+ * Not async-signal-safe
+ */
+int runner_jobs_option(struct runner *r, int argc, char **argv, int *i) {
+    const char *arg = argv[*i];
+    if (strncmp(arg, "-j", 2) != 0 || (arg[2] == '\0' && *i + 1 >= argc)) {
+        return 0;
+    }
+    const char *count = arg[2] != '\0' ? arg + 2 : argv[++*i];
+    char *end;
+    long jobs = strtol(count, &end, 10);
+    if (*end != '\0' || jobs <= 0 || jobs > INT_MAX) {
+        sio_eprintf("%s: %s: invalid number of jobs\n", r->who, count);
+        return -1;
+    }
+    r->jobs = (int)jobs;
+    return 1;
+}
+
+/*
+ * runner_read_file - Read a whole file into a NUL-terminated buffer
+ * Not async-signal-safe
+ */
+char *runner_read_file(const struct runner *r, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        sio_eprintf("%s: %s: %s\n", r->who, path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    size_t cap = st.st_size > 0 ? (size_t)st.st_size + 1 : MAXBUF;
+    size_t len = 0;
+    char *buf = malloc(cap);
+    ssize_t n = 0;
+    while (buf != NULL && (n = read(fd, buf + len, cap - len - 1)) != 0) {
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            break;
+        }
+        len += (size_t)n;
+        if (len == cap - 1) { // the file grew, or is not a regular file
+            char *bigger = realloc(buf, 2 * cap);
+            if (bigger == NULL) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = bigger;
+            cap *= 2;
+        }
+    }
+    close(fd);
+    if (buf == NULL || n < 0) {
+        sio_eprintf("%s: %s: %s\n", r->who, path,
+                    n < 0 ? strerror(errno) : "Out of memory");
+        free(buf);
+        return NULL;
+    }
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+ * runner_child - Restore the signal handling of the shell in a command
+ * Not async-signal-safe
+ */
+void runner_child(const struct runner *r) {
+    signal(SIGCHLD, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &r->child_mask, NULL);
+}
+
+/*
+ * runner_wait - Wait for the next child to exit
+ * Not async-signal-safe
+ */
+pid_t runner_wait(const struct runner *r, int *status) {
+    while (true) {
+        pid_t pid = waitpid(-1, status, WNOHANG);
+        if (pid == 0) {
+            sigsuspend(&r->wait_mask);
+        } else if (pid > 0 || errno != EINTR) {
+            return pid; // -1: no children left, as when every fork failed
+        }
+    }
+}
+
+/*
+ * runner_seconds - Seconds from one time to a later one
+ * Async-signal-safe
+ */
+double runner_seconds(struct timespec from, struct timespec to) {
+    return (double)(to.tv_sec - from.tv_sec) +
+           (double)(to.tv_nsec - from.tv_nsec) / 1e9;
+}
+
+/*
+ * seconds - Seconds in a timeval
+ */
+static double seconds(struct timeval tv) {
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1e6;
+}
+
+/*
+ * runner_end - Print the summary of a run and return its exit status
+ * Not async-signal-safe
+ */
+int runner_end(const struct runner *r, int count, const char *noun,
+               int failed, int skipped) {
+    struct timespec end;
+    struct rusage usage;
+    char skip[32] = "";
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_CHILDREN, &usage);
+    if (skipped >= 0) {
+        snprintf(skip, sizeof(skip), ", %d skipped", skipped);
+    }
+    dprintf(STDERR_FILENO,
+            "%s: %d %s%s, %d failed%s, %.3fs elapsed, %.3fs user, "
+            "%.3fs system\n",
+            r->who, count, noun, count == 1 ? "" : "s", failed, skip,
+            runner_seconds(r->begin, end), seconds(usage.ru_utime),
+            seconds(usage.ru_stime));
+    return failed < RUNNER_MAX_STATUS ? failed : RUNNER_MAX_STATUS;
+}
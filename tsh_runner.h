@@ -0,0 +1,118 @@
+/**
+ * @file tsh_runner.h
+ * @brief Running many commands from a builtin (parallel, dag)
+ *
+ * The `parallel` and `dag` builtins run in a forked copy of the shell that
+ * starts commands as its children, at most `jobs` at a time, and sleeps in
+ * sigsuspend until SIGCHLD reports that one of them has exited. This module
+ * holds what they share: the `-j` option, reading a file of items or rules,
+ * the SIGCHLD handling of the coordinator and of its children, the wait for
+ * the next command, and the summary printed at the end of a run.
+ */
+
+#ifndef TSH_RUNNER_H
+#define TSH_RUNNER_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define RUNNER_MAX_STATUS 101 /**< Exit status for this many failures */
+
+/**
+ * @brief State of the coordinator of a run
+ */
+struct runner {
+    const char *who;       ///< Name of the builtin, for messages
+    int jobs;              ///< Most commands running at once
+    sigset_t child_mask;   ///< Signal mask to execute commands with
+    sigset_t wait_mask;    ///< Signal mask while waiting for a command
+    struct timespec begin; ///< When the run started
+};
+
+/**
+ * @brief Starts a run: records the time, sets `jobs` to the number of
+ * online CPUs, and blocks SIGCHLD, which only ends a wait from then on.
+ *
+ * @param[out] r    The runner.
+ * @param[in]  who  Name of the builtin.
+ *
+ * @pre The caller is a process of its own: a SIGCHLD handler is installed.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void runner_init(struct runner *r, const char *who);
+
+/**
+ * @brief Parses a `-j jobs` or `-jjobs` option into `r->jobs`.
+ *
+ * @param[in,out] r     The runner.
+ * @param[in]     argc  The number of arguments.
+ * @param[in]     argv  The arguments.
+ * @param[in,out] i     Index of the option; moved to its value if that is
+ *                      a separate argument.
+ * @return 1 if the option was parsed, 0 if `argv[*i]` is not a `-j`
+ *         option, -1 after printing a message if the count is invalid.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int runner_jobs_option(struct runner *r, int argc, char **argv, int *i);
+
+/**
+ * @brief Reads a whole file into a NUL-terminated buffer.
+ *
+ * @param[in] r     The runner.
+ * @param[in] path  The file.
+ * @return The contents, to be freed by the caller, or NULL after printing
+ *         a message.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+char *runner_read_file(const struct runner *r, const char *path);
+
+/**
+ * @brief Restores, in a child about to run a command, the SIGCHLD handling
+ * and signal mask the shell gave the coordinator.
+ *
+ * @param[in] r  The runner.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void runner_child(const struct runner *r);
+
+/**
+ * @brief Waits for the next child of the coordinator to exit.
+ *
+ * @param[in]  r       The runner.
+ * @param[out] status  Its status, as for waitpid.
+ * @return Its PID, or -1 if there are no children left.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+pid_t runner_wait(const struct runner *r, int *status);
+
+/**
+ * @brief Returns the seconds from one time to a later one.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+double runner_seconds(struct timespec from, struct timespec to);
+
+/**
+ * @brief Ends a run: prints the number of commands, failures and skipped
+ * commands, the elapsed time and the CPU time used by the commands.
+ *
+ * @param[in] r        The runner.
+ * @param[in] count    The number of commands, or targets.
+ * @param[in] noun     What they are, in the singular, e.g. "command".
+ * @param[in] failed   How many failed.
+ * @param[in] skipped  How many were skipped, or -1 to leave it out.
+ * @return The exit status of the builtin: `failed`, at most
+ *         `RUNNER_MAX_STATUS`.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int runner_end(const struct runner *r, int count, const char *noun,
+               int failed, int skipped);
+
+#endif /* TSH_RUNNER_H */
@@ -0,0 +1,282 @@
+/**
+ * @file tsh_scan.c
+ * @brief Character scanning for the command line tokenizer
+ *
+ * See tsh_scan.h. The SSE2 and AVX2 classifiers compare each block of the
+ * line against the four white space characters and the two quotes, and pack
+ * the comparison results into one bit per byte with movemask. Bytes past the
+ * last full block are classified one at a time, so nothing is read beyond
+ * the end of the line.
+ */
+
+#include "tsh_scan.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#else
+#define SCAN_X86 0
+#endif
+
+/* Global variables */
+scan_impl scan_mode = SCAN_AUTO; // Implementation requested for new scanners
+
+/* Static variables */
+static const char spaces[] = " \t\r\n"; // White space, as in parseline
+static uint64_t *bits = NULL;           // Bitmasks of the current line
+static size_t bits_words = 0;           // Allocated words per bitmask
+
+/*
+ * scan_supported - Whether the CPU supports an implementation
+ * Not async-signal-safe
+ */
+bool scan_supported(scan_impl impl) {
+    switch (impl) {
+    case SCAN_AUTO:
+    case SCAN_SCALAR:
+        return true;
+#if SCAN_X86
+    case SCAN_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case SCAN_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+/*
+ * scan_impl_name - Name of an implementation
+ * Async-signal-safe
+ */
+const char *scan_impl_name(scan_impl impl) {
+    switch (impl) {
+    case SCAN_AUTO:
+        return "auto";
+    case SCAN_SCALAR:
+        return "scalar";
+    case SCAN_SSE2:
+        return "sse2";
+    case SCAN_AVX2:
+        return "avx2";
+    default:
+        return "unknown";
+    }
+}
+
+/*
+ * resolve - The implementation to use for a request
+ * Not async-signal-safe
+ */
+static scan_impl resolve(scan_impl impl) {
+    static scan_impl best = SCAN_AUTO;
+    if (impl != SCAN_AUTO) {
+        return scan_supported(impl) ? impl : SCAN_SCALAR;
+    }
+    if (best == SCAN_AUTO) {
+        best = scan_supported(SCAN_AVX2)   ? SCAN_AVX2
+               : scan_supported(SCAN_SSE2) ? SCAN_SSE2
+                                           : SCAN_SCALAR;
+    }
+    return best;
+}
+
+/*
+ * classify_bytes - Classify buf[from..len) one byte at a time
+ * Async-signal-safe
+ */
+static void classify_bytes(const char *buf, size_t from, size_t len,
+                           uint64_t *space, uint64_t *squote,
+                           uint64_t *dquote) {
+    for (size_t i = from; i < len; i++) {
+        uint64_t bit = (uint64_t)1 << (i % 64);
+        char c = buf[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            space[i / 64] |= bit;
+        } else if (c == '\'') {
+            squote[i / 64] |= bit;
+        } else if (c == '"') {
+            dquote[i / 64] |= bit;
+        }
+    }
+}
+
+#if SCAN_X86
+/*
+ * classify_sse2 - Classify a line 16 bytes at a time
+ * Async-signal-safe
+ */
+static void classify_sse2(const char *buf, size_t len, uint64_t *space,
+                          uint64_t *squote, uint64_t *dquote) {
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i sq = _mm_set1_epi8('\'');
+    const __m128i dq = _mm_set1_epi8('"');
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, nl)));
+        unsigned shift = i % 64;
+        space[i / 64] |= (uint64_t)(uint32_t)_mm_movemask_epi8(ws) << shift;
+        squote[i / 64] |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+                              _mm_cmpeq_epi8(v, sq))
+                          << shift;
+        dquote[i / 64] |= (uint64_t)(uint32_t)_mm_movemask_epi8(
+                              _mm_cmpeq_epi8(v, dq))
+                          << shift;
+    }
+    classify_bytes(buf, i, len, space, squote, dquote);
+}
+
+/*
+ * classify_avx2 - Classify a line 32 bytes at a time
+ * Async-signal-safe
+ */
+__attribute__((target("avx2"))) static void
+classify_avx2(const char *buf, size_t len, uint64_t *space, uint64_t *squote,
+              uint64_t *dquote) {
+    const __m256i sp = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i sq = _mm256_set1_epi8('\'');
+    const __m256i dq = _mm256_set1_epi8('"');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        __m256i ws = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                            _mm256_cmpeq_epi8(v, tab)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                            _mm256_cmpeq_epi8(v, nl)));
+        unsigned shift = i % 64;
+        space[i / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws)
+                         << shift;
+        squote[i / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                              _mm256_cmpeq_epi8(v, sq))
+                          << shift;
+        dquote[i / 64] |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                              _mm256_cmpeq_epi8(v, dq))
+                          << shift;
+    }
+    classify_bytes(buf, i, len, space, squote, dquote);
+}
+#endif
+
+/*
+ * scanner_init - Prepare a scanner, building bitmasks for long lines
+ * Not async-signal-safe
+ */
+void scanner_init(struct scanner *sc, const char *buf, size_t len) {
+    sc->buf = buf;
+    sc->len = len;
+    sc->space = NULL;
+    sc->squote = NULL;
+    sc->dquote = NULL;
+
+    scan_impl impl = resolve(scan_mode);
+    if (impl == SCAN_SCALAR || len < SCAN_VECTOR_MIN) {
+        return;
+    }
+
+    size_t words = (len + 63) / 64;
+    if (words > bits_words) {
+        uint64_t *grown = realloc(bits, 3 * words * sizeof(*bits));
+        if (grown == NULL) {
+            return; // the scalar path needs no memory
+        }
+        bits = grown;
+        bits_words = words;
+    }
+    uint64_t *space = bits;
+    uint64_t *squote = bits + words;
+    uint64_t *dquote = bits + 2 * words;
+    memset(bits, 0, 3 * words * sizeof(*bits));
+
+#if SCAN_X86
+    if (impl == SCAN_AVX2) {
+        classify_avx2(buf, len, space, squote, dquote);
+    } else {
+        classify_sse2(buf, len, space, squote, dquote);
+    }
+#else
+    classify_bytes(buf, 0, len, space, squote, dquote);
+#endif
+
+    sc->space = space;
+    sc->squote = squote;
+    sc->dquote = dquote;
+}
+
+/*
+ * find_bit - First position at or after pos whose bit in mask equals set,
+ * or len. Bits past the end of the line are clear.
+ * Async-signal-safe
+ */
+static size_t find_bit(const uint64_t *mask, size_t len, size_t pos,
+                       bool set) {
+    size_t words = (len + 63) / 64;
+    size_t w = pos / 64;
+    if (w >= words) {
+        return len;
+    }
+
+    uint64_t word = (set ? mask[w] : ~mask[w]) & (~(uint64_t)0 << (pos % 64));
+    while (word == 0) {
+        if (++w == words) {
+            return len;
+        }
+        word = set ? mask[w] : ~mask[w];
+    }
+    size_t found = w * 64 + (size_t)__builtin_ctzll(word);
+    return found < len ? found : len;
+}
+
+/*
+ * scan_skip_space - First position at or after pos that is not white space
+ * Async-signal-safe
+ */
+size_t scan_skip_space(const struct scanner *sc, size_t pos) {
+    if (sc->space != NULL) {
+        return find_bit(sc->space, sc->len, pos, false);
+    }
+    return pos + strspn(sc->buf + pos, spaces);
+}
+
+/*
+ * scan_find_space - First position at or after pos that is white space
+ * Async-signal-safe
+ */
+size_t scan_find_space(const struct scanner *sc, size_t pos) {
+    if (sc->space != NULL) {
+        return find_bit(sc->space, sc->len, pos, true);
+    }
+    return pos + strcspn(sc->buf + pos, spaces);
+}
+
+/*
+ * scan_find_quote - First position at or after pos that holds quote
+ * Async-signal-safe
+ */
+size_t scan_find_quote(const struct scanner *sc, size_t pos, char quote) {
+    if (sc->space != NULL) {
+        return find_bit(quote == '"' ? sc->dquote : sc->squote, sc->len, pos,
+                        true);
+    }
+    const char *found = memchr(sc->buf + pos, quote, sc->len - pos);
+    return found != NULL ? (size_t)(found - sc->buf) : sc->len;
+}
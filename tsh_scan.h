@@ -0,0 +1,100 @@
+/**
+ * @file tsh_scan.h
+ * @brief Character scanning for the command line tokenizer
+ *
+ * parseline splits a command line with three primitive searches: skip white
+ * space, find the next white space, and find a closing quote. A `scanner`
+ * answers them for one line, either directly on the bytes (the scalar path,
+ * equivalent to strspn, strcspn and strchr), or from bitmasks that classify
+ * every byte of the line up front, 16 (SSE2) or 32 (AVX2) bytes at a time.
+ * With the bitmasks, each search is a count-trailing-zeros over 64 bytes.
+ *
+ * Both paths give identical answers. The vector path is only used for lines
+ * of at least `SCAN_VECTOR_MIN` bytes, where classifying the line once is
+ * cheaper than scanning it token by token.
+ */
+
+#ifndef TSH_SCAN_H
+#define TSH_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief Shortest line for which the bitmask path is used */
+#define SCAN_VECTOR_MIN 128
+
+/**
+ * @brief Implementation used to classify command lines
+ */
+typedef enum scan_impl {
+    SCAN_AUTO = 0,   ///< Best implementation supported by the CPU (default)
+    SCAN_SCALAR = 1, ///< Byte-at-a-time searches, no bitmasks
+    SCAN_SSE2 = 2,   ///< Bitmasks built 16 bytes at a time
+    SCAN_AVX2 = 3    ///< Bitmasks built 32 bytes at a time
+} scan_impl;
+
+/* Defined in tsh_scan.c */
+extern scan_impl scan_mode; ///< Implementation requested for new scanners
+
+/**
+ * @brief State of the searches over one command line.
+ */
+struct scanner {
+    const char *buf;       ///< The line being scanned
+    size_t len;            ///< Length of the line
+    const uint64_t *space; ///< Bit i set if buf[i] is white space, or NULL
+    const uint64_t *squote; ///< Bit i set if buf[i] is a single quote
+    const uint64_t *dquote; ///< Bit i set if buf[i] is a double quote
+};
+
+/**
+ * @brief Returns whether the CPU supports an implementation.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+bool scan_supported(scan_impl impl);
+
+/**
+ * @brief Returns the name of an implementation, for diagnostics.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+const char *scan_impl_name(scan_impl impl);
+
+/**
+ * @brief Prepares a scanner for a line, classifying it if it is long enough.
+ *
+ * The bitmasks are kept in a buffer shared by all scanners, which is valid
+ * until the next call to this function. The bytes of the line may be
+ * modified after this call, but only at positions that have already been
+ * scanned past.
+ *
+ * @param[out] sc   The scanner to set up.
+ * @param[in]  buf  The line to scan.
+ * @param[in]  len  The length of the line, excluding its terminating NUL.
+ *
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void scanner_init(struct scanner *sc, const char *buf, size_t len);
+
+/**
+ * @brief Returns the first position at or after `pos` that is not white
+ * space, or the length of the line.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+size_t scan_skip_space(const struct scanner *sc, size_t pos);
+
+/**
+ * @brief Returns the first position at or after `pos` that is white space,
+ * or the length of the line.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+size_t scan_find_space(const struct scanner *sc, size_t pos);
+
+/**
+ * @brief Returns the first position at or after `pos` that holds `quote`
+ * (`'` or `"`), or the length of the line if there is none.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+size_t scan_find_quote(const struct scanner *sc, size_t pos, char quote);
+
+#endif /* TSH_SCAN_H */
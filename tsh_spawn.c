@@ -0,0 +1,665 @@
+/**
+ * @file tsh_spawn.c
+ * @brief Process launch engines for tsh
+ *
+ * See tsh_spawn.h for a description of the available engines. The fork,
+ * vfork and clone3 engines share `child_exec`, which performs the same
+ * redirection, signal mask and process group setup in the child that
+ * eval() used to do after fork(). The posix_spawn engine expresses that
+ * setup as spawn attributes and file actions instead.
+ *
+ * Before anything is started, every command is resolved with path_resolve
+ * and the redirection files are opened, so that a missing program or file
+ * is reported by the shell without creating a process. A pipeline is then
+ * started one command at a time, left to right, by the same engine. Each
+ * command is described by a `spawn_cmd`: its program, the descriptors to
+ * install as stdin and stdout, and the process group to join.
+ * Passthrough commands in a pipeline are run by `passthrough_child` in a
+ * forked copy of the shell, which moves the data between pipes with
+ * splice(2) and tee(2) without copying it through user space. The same
+ * path runs an in-process utility (tsh_builtin.h) that has to be a job of
+ * its own, e.g. `echo &`, without executing the external program.
+ *
+ * When a job is to have performance counters (tsh_perf.h), its programs are
+ * started by fork whatever the engine: the child waits on a pipe until the
+ * shell has opened the counters on it, and only then calls execve. The
+ * other engines either exec before the shell regains control or create the
+ * process elsewhere.
+ *
+ * With `--cgroup`, every command joins the cgroup of its job (tsh_cgroup.h).
+ * clone3 creates the process there with CLONE_INTO_CGROUP; the engines that
+ * run code in the child move it there in child_setup, and posix_spawn and
+ * the zygote helpers, which cannot, are replaced by clone3.
+ */
+
+#define _GNU_SOURCE // clone, splice, tee, F_SETPIPE_SZ
+
+#include "csapp.h"
+#include "tsh_builtin.h"
+#include "tsh_cgroup.h"
+#include "tsh_helper.h"
+#include "tsh_path.h"
+#include "tsh_perf.h"
+#include "tsh_spawn.h"
+#include "tsh_zygote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sched.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/pidfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Size of the private stack used by the vfork engine */
+#define SPAWN_STACK_SIZE (256 * 1024)
+
+/* Bytes moved per splice or tee call by passthrough commands */
+#define PASS_CHUNK (1 << 20)
+
+/* One command of a pipeline, as handed to an engine */
+struct spawn_cmd {
+    char *const *argv;          // Arguments, terminated by NULL
+    struct path_cmd prog;       // Program to execute, from path_resolve
+    int pass;                   // passthrough_kind, or 'b' for a utility
+    int in_fd;                  // Pipe or < file to use as stdin, or -1
+    int out_fd;                 // Pipe or > file to use as stdout, or -1
+    int close_fd;               // Pipe end of the next command, or -1
+    pid_t pgid;                 // Process group to join, 0 for a new one
+    const sigset_t *child_mask; // Signal mask to restore
+    bool perf;                  // Open performance counters on it
+    int cgroup_fd;              // Cgroup of the job to join, or -1
+};
+
+/* Global variables */
+spawn_engine spawn_mode = SPAWN_FORK; // Engine used by spawn_job
+int spawn_pipe_size = 0;              // F_SETPIPE_SZ for pipes, 0 to keep
+
+/* Static variables */
+static const char *const engine_names[] = {
+    [SPAWN_FORK] = "fork",
+    [SPAWN_VFORK] = "vfork",
+    [SPAWN_POSIX] = "posix_spawn",
+    [SPAWN_CLONE3] = "clone3",
+    [SPAWN_ZYGOTE] = "zygote",
+};
+static char *vfork_stack = NULL; // Lazily mapped stack for the vfork engine
+
+/*
+ * spawn_engine_parse - Look up an engine by name
+ * Async-signal-safe
+ */
+bool spawn_engine_parse(const char *name, spawn_engine *engine) {
+    for (size_t i = 0; i < sizeof(engine_names) / sizeof(engine_names[0]);
+         i++) {
+        if (strcmp(name, engine_names[i]) == 0) {
+            *engine = (spawn_engine)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * spawn_engine_name - Name of an engine, as accepted by spawn_engine_parse
+ * Async-signal-safe
+ */
+const char *spawn_engine_name(spawn_engine engine) {
+    return engine_names[engine];
+}
+
+/*
+ * spawn_init - Prepare the selected engine
+ * Not async-signal-safe
+ */
+void spawn_init(void) {
+    if (spawn_mode == SPAWN_ZYGOTE) {
+        zygote_fill();
+    }
+}
+
+/*
+ * report_exec_error - Print the message for a failed open or execve
+ * Async-signal-safe
+ */
+void report_exec_error(const char *path, int err) {
+    if (err == ENOENT) {
+        sio_printf("%s: No such file or directory\n", path);
+    } else if (err == EACCES) {
+        sio_printf("%s: Permission denied\n", path);
+    }
+}
+
+/*
+ * redirect_open - Open the file of a < or > redirection
+ * Async-signal-safe
+ */
+int redirect_open(const char *path, bool output) {
+    int fd;
+    if (output) {
+        fd = open(path, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, REDIR_MODE);
+    } else {
+        fd = open(path, O_RDONLY | O_CLOEXEC, 0);
+    }
+    if (fd < 0) {
+        int olderrno = errno;
+        report_exec_error(path, olderrno);
+        errno = olderrno;
+    }
+    return fd;
+}
+
+/*
+ * child_setup - Install the pipes and redirections of a command and join
+ * its process group and cgroup. The descriptors are close-on-exec, and are
+ * closed explicitly only for commands that do not exec.
+ * Async-signal-safe (it also runs on the shared vfork stack)
+ */
+static void child_setup(const struct spawn_cmd *cmd) {
+    if (cmd->in_fd >= 0) {
+        dup2(cmd->in_fd, STDIN_FILENO);
+    }
+    if (cmd->out_fd >= 0) {
+        dup2(cmd->out_fd, STDOUT_FILENO);
+    }
+    setpgid(0, cmd->pgid);
+    if (cmd->cgroup_fd >= 0) {
+        cgroup_join(cmd->cgroup_fd, 0);
+    }
+}
+
+/*
+ * reset_handlers - Restore the default action of the signals the shell
+ * handles, so that one arriving once they are unblocked in the child, before
+ * execve, does not run a handler of the shell there. The vfork child shares
+ * the memory of the shell, which the sigaction wrapper of the driver
+ * (wrapper.c) writes to, so the system call is made directly. SIG_DFL is 0,
+ * so an all-zero struct selects it whatever the layout of the kernel's.
+ * Async-signal-safe (it also runs on the shared vfork stack)
+ */
+static void reset_handlers(void) {
+    static const int handled[] = {SIGINT, SIGTSTP, SIGCHLD, SIGQUIT};
+    static const unsigned long dfl[8]; // larger than any kernel sigaction
+    for (size_t i = 0; i < sizeof(handled) / sizeof(handled[0]); i++) {
+        syscall(SYS_rt_sigaction, handled[i], dfl, NULL, _NSIG / 8);
+    }
+}
+
+/*
+ * child_exec - Set up and execute a command in a newly created process. Used
+ * by every engine that runs code in the child before execve. A program found
+ * in $PATH is executed relative to the descriptor of its directory; scripts
+ * cannot be run that way, since the interpreter could not open them through
+ * the close-on-exec descriptor, and are retried by path.
+ * Async-signal-safe (it also runs on the shared vfork stack)
+ */
+static void child_exec(const struct spawn_cmd *cmd) {
+    child_setup(cmd);
+    reset_handlers();
+    sigprocmask(SIG_SETMASK, cmd->child_mask, NULL); // unblock signals
+    if (cmd->prog.dirfd != AT_FDCWD) {
+        execveat(cmd->prog.dirfd, cmd->prog.name, cmd->argv, environ, 0);
+    }
+    execve(cmd->prog.path, cmd->argv, environ);
+    report_exec_error(cmd->argv[0], errno);
+    _exit(0);
+}
+
+/*
+ * vfork_child - Entry point of a child created by the vfork engine
+ * Async-signal-safe
+ */
+static int vfork_child(void *arg) {
+    child_exec(arg);
+    return 0; // not reached
+}
+
+/*
+ * spawn_fork - Launch with fork(). With performance counters, the child
+ * waits for the end of a pipe, which the shell closes once it has opened
+ * the counters, so that they are enabled by the execve.
+ */
+static pid_t spawn_fork(const struct spawn_cmd *cmd) {
+    int gate[2] = {-1, -1};
+    if (cmd->perf && pipe2(gate, O_CLOEXEC) < 0) {
+        perror("pipe error");
+        gate[0] = gate[1] = -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (gate[0] >= 0) {
+            char c;
+            close(gate[1]);
+            while (read(gate[0], &c, 1) < 0 && errno == EINTR) {
+            }
+        }
+        child_exec(cmd);
+    }
+    if (pid < 0) {
+        perror("fork error");
+    }
+    if (gate[0] >= 0) {
+        close(gate[0]);
+        if (pid > 0) {
+            perf_attach(pid, true);
+        }
+        close(gate[1]);
+    }
+    return pid;
+}
+
+/*
+ * spawn_vfork - Launch with clone(CLONE_VM | CLONE_VFORK). The child borrows
+ * the address space of the shell, which stays suspended until the child has
+ * called execve or _exit, so the single private stack can be reused for every
+ * launch. The child only touches its own stack, errno, and the tokens.
+ */
+static pid_t spawn_vfork(const struct spawn_cmd *cmd) {
+    if (vfork_stack == NULL) {
+        void *stack = mmap(NULL, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (stack == MAP_FAILED) {
+            perror("mmap error");
+            return -1;
+        }
+        vfork_stack = stack;
+    }
+
+    pid_t pid = clone(vfork_child, vfork_stack + SPAWN_STACK_SIZE,
+                      CLONE_VM | CLONE_VFORK | SIGCHLD, (void *)cmd);
+    if (pid < 0) {
+        perror("clone error");
+    }
+    return pid;
+}
+
+/*
+ * spawn_posix - Launch with posix_spawn(). The pipes and redirection files
+ * are moved into place by file actions, and the program is executed by path.
+ */
+static pid_t spawn_posix(const struct spawn_cmd *cmd) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t pid = -1;
+
+    posix_spawn_file_actions_init(&actions);
+    if (cmd->in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, cmd->in_fd, STDIN_FILENO);
+    }
+    if (cmd->out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, cmd->out_fd, STDOUT_FILENO);
+    }
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, cmd->pgid);
+    posix_spawnattr_setsigmask(&attr, cmd->child_mask);
+
+    int err = posix_spawn(&pid, cmd->prog.path, &actions, &attr, cmd->argv,
+                          environ);
+    if (err != 0) {
+        report_exec_error(cmd->argv[0], err);
+        pid = -1;
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+}
+
+/*
+ * spawn_clone3 - Launch with the clone3 system call, with fork semantics,
+ * directly into the cgroup of the job if it has one. Falls back to fork() on
+ * kernels without clone3, or without CLONE_INTO_CGROUP (EINVAL).
+ */
+static pid_t spawn_clone3(const struct spawn_cmd *cmd, int *pidfd) {
+    struct spawn_cmd child = *cmd; // already in its cgroup
+    struct clone_args args;
+    memset(&args, 0, sizeof(args));
+    args.exit_signal = SIGCHLD;
+    if (pidfd != NULL) {
+        args.flags |= CLONE_PIDFD;
+        args.pidfd = (uint64_t)(uintptr_t)pidfd;
+    }
+    if (cmd->cgroup_fd >= 0) {
+        args.flags |= CLONE_INTO_CGROUP;
+        args.cgroup = (uint64_t)cmd->cgroup_fd;
+        child.cgroup_fd = -1;
+    }
+
+    pid_t pid = (pid_t)syscall(SYS_clone3, &args, sizeof(args));
+    if (pid == 0) {
+        child_exec(&child);
+    }
+    if (pid < 0 && cmd->cgroup_fd >= 0 && errno == EINVAL) {
+        return spawn_fork(cmd);
+    }
+    if (pid < 0 && errno == ENOSYS) {
+        if (verbose) {
+            sio_eprintf("spawn_job: clone3 unavailable, using fork\n");
+        }
+        spawn_mode = SPAWN_FORK;
+        return spawn_fork(cmd);
+    }
+    if (pid < 0) {
+        perror("clone3 error");
+    }
+    return pid;
+}
+
+/*
+ * passthrough_kind - Whether a command of a pipeline can be run by the shell
+ * itself: 'c' for `cat` without arguments, 't' for `tee FILE` between two
+ * pipes, 0 for anything else, including programs outside /bin and /usr/bin
+ * and anything with `builtin_external`.
+ */
+static int passthrough_kind(char *const *argv, bool between_pipes) {
+    const char *name = builtin_util_name(argv[0]);
+    if (name == NULL || builtin_external) {
+        return 0;
+    }
+
+    if (strcmp(name, "cat") == 0 && argv[1] == NULL) {
+        return 'c';
+    }
+    if (strcmp(name, "tee") == 0 && argv[1] != NULL && argv[1][0] != '-' &&
+        argv[2] == NULL && between_pipes) {
+        return 't';
+    }
+    return 0;
+}
+
+/*
+ * pass_copy - Copy stdin to stdout until the end of input. splice needs a
+ * pipe on one side, which a command of a pipeline always has unless it is
+ * redirected; otherwise the data is copied with read and write.
+ * Async-signal-safe
+ */
+static void pass_copy(void) {
+    ssize_t n;
+    while ((n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, PASS_CHUNK,
+                       SPLICE_F_MOVE)) > 0) {
+    }
+    if (n == 0 || errno != EINVAL) {
+        return;
+    }
+
+    char buf[MAXBUF];
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        if (rio_writen(STDOUT_FILENO, buf, (size_t)n) < 0) {
+            return;
+        }
+    }
+}
+
+/*
+ * pass_tee - Duplicate the input pipe into the output pipe with tee(2), then
+ * splice the same bytes into the file
+ * Async-signal-safe
+ */
+static void pass_tee(const char *path) {
+    int fd = redirect_open(path, true);
+    if (fd < 0) {
+        pass_copy();
+        return;
+    }
+
+    ssize_t n;
+    while ((n = tee(STDIN_FILENO, STDOUT_FILENO, PASS_CHUNK, 0)) > 0) {
+        while (n > 0) {
+            ssize_t moved = splice(STDIN_FILENO, NULL, fd, NULL, (size_t)n,
+                                   SPLICE_F_MOVE);
+            if (moved <= 0) {
+                close(fd);
+                return;
+            }
+            n -= moved;
+        }
+    }
+    close(fd);
+}
+
+/*
+ * passthrough_child - Run a passthrough command, or an in-process utility
+ * ('b'), in a forked copy of the shell. The handlers of the shell are reset
+ * first, so the process reacts to job control signals like any other command.
+ */
+static void passthrough_child(const struct spawn_cmd *cmd) {
+    static const int handled[] = {SIGINT, SIGTSTP, SIGCHLD, SIGQUIT};
+    for (size_t i = 0; i < sizeof(handled) / sizeof(handled[0]); i++) {
+        signal(handled[i], SIG_DFL);
+    }
+
+    child_setup(cmd);
+    const int pipes[] = {cmd->in_fd, cmd->out_fd, cmd->close_fd};
+    for (size_t i = 0; i < sizeof(pipes) / sizeof(pipes[0]); i++) {
+        if (pipes[i] >= 0) {
+            close(pipes[i]);
+        }
+    }
+    sigprocmask(SIG_SETMASK, cmd->child_mask, NULL);
+
+    if (cmd->pass == 'b') {
+        int argc = 0;
+        while (cmd->argv[argc] != NULL) {
+            argc++;
+        }
+        _exit(builtin_util_run(argc, (char **)cmd->argv, STDIN_FILENO,
+                               STDOUT_FILENO));
+    } else if (cmd->pass == 't') {
+        pass_tee(cmd->argv[1]);
+    } else {
+        pass_copy();
+    }
+    _exit(0);
+}
+
+/*
+ * spawn_passthrough - Launch a passthrough command with fork(), whatever the
+ * engine
+ */
+static pid_t spawn_passthrough(const struct spawn_cmd *cmd) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        passthrough_child(cmd);
+    }
+    if (pid < 0) {
+        perror("fork error");
+    }
+    if (pid > 0 && cmd->perf) {
+        perf_attach(pid, false); // counts from here, as it does not exec
+    }
+    return pid;
+}
+
+/*
+ * spawn_zygote - Launch in a pre-forked helper, or with fork() if none is
+ * ready
+ */
+static pid_t spawn_zygote(const struct spawn_cmd *cmd) {
+    pid_t pid = zygote_launch(cmd->argv, &cmd->prog, cmd->in_fd, cmd->out_fd,
+                              cmd->pgid, cmd->child_mask);
+    return pid > 0 ? pid : spawn_fork(cmd);
+}
+
+/*
+ * spawn_cmd - Start one command with the selected engine
+ */
+static pid_t spawn_cmd(const struct spawn_cmd *cmd, int *pidfd) {
+    if (cmd->pass != 0) {
+        return spawn_passthrough(cmd);
+    }
+    if (cmd->perf) {
+        return spawn_fork(cmd);
+    }
+    if (cmd->cgroup_fd >= 0 &&
+        (spawn_mode == SPAWN_POSIX || spawn_mode == SPAWN_ZYGOTE)) {
+        return spawn_clone3(cmd, pidfd);
+    }
+    switch (spawn_mode) {
+    case SPAWN_ZYGOTE:
+        return spawn_zygote(cmd);
+    case SPAWN_VFORK:
+        return spawn_vfork(cmd);
+    case SPAWN_POSIX:
+        return spawn_posix(cmd);
+    case SPAWN_CLONE3:
+        return spawn_clone3(cmd, pidfd);
+    case SPAWN_FORK:
+    default:
+        return spawn_fork(cmd);
+    }
+}
+
+/*
+ * open_pipe - Create a close-on-exec pipe, resized to spawn_pipe_size
+ */
+static bool open_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        perror("pipe error");
+        return false;
+    }
+    if (spawn_pipe_size > 0 &&
+        fcntl(fds[1], F_SETPIPE_SZ, spawn_pipe_size) < 0 && verbose) {
+        perror("spawn_job: F_SETPIPE_SZ");
+    }
+    return true;
+}
+
+/*
+ * prepare - Open the redirection files and resolve the program of every
+ * command of a pipeline, in this order as in the reference shell, before any
+ * process is created. Prints the error and returns false if a file or
+ * program is missing.
+ */
+static bool prepare(const struct cmdline_tokens *token,
+                    struct spawn_cmd *cmds, int *infd, int *outfd) {
+    bool pipeline = token->nstages > 1;
+
+    *infd = -1;
+    *outfd = -1;
+    if (token->infile != NULL &&
+        (*infd = redirect_open(token->infile, false)) < 0) {
+        return false;
+    }
+    if (token->outfile != NULL &&
+        (*outfd = redirect_open(token->outfile, true)) < 0) {
+        if (*infd >= 0) {
+            close(*infd);
+        }
+        return false;
+    }
+
+    for (int i = 0; i < token->nstages; i++) {
+        struct spawn_cmd *cmd = &cmds[i];
+        memset(cmd, 0, sizeof(*cmd));
+        cmd->argv = token->argv + token->stages[i];
+        if (token->builtin == BUILTIN_UTIL) {
+            cmd->pass = 'b';
+        } else if (pipeline) {
+            cmd->pass = passthrough_kind(cmd->argv,
+                                         i > 0 && i < token->nstages - 1);
+        }
+        if (cmd->pass == 0 && !path_resolve(cmd->argv[0], &cmd->prog)) {
+            report_exec_error(cmd->argv[0], errno);
+            if (*infd >= 0) {
+                close(*infd);
+            }
+            if (*outfd >= 0) {
+                close(*outfd);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * spawn_job - Start the processes of a job with the selected engine
+ * Not async-signal-safe
+ */
+int spawn_job(const struct cmdline_tokens *token, const sigset_t *child_mask,
+              struct spawn_proc *procs, bool want_pidfd, bool want_perf,
+              int cgroup_fd) {
+    struct spawn_cmd cmds[token->nstages];
+    int in_fd;  // stdin of the next command: < file or pipe
+    int out_fd; // > file, for the last command
+    pid_t pgid = 0;
+    int started = 0;
+
+    if (!prepare(token, cmds, &in_fd, &out_fd)) {
+        return 0;
+    }
+
+    for (int i = 0; i < token->nstages; i++) {
+        bool last = i == token->nstages - 1;
+        int fds[2] = {-1, out_fd};
+        if (!last && !open_pipe(fds)) {
+            if (out_fd >= 0) {
+                close(out_fd);
+            }
+            break;
+        }
+
+        struct spawn_cmd *cmd = &cmds[i];
+        cmd->in_fd = in_fd;
+        cmd->out_fd = fds[1];
+        cmd->close_fd = fds[0];
+        cmd->pgid = pgid;
+        cmd->child_mask = child_mask;
+        cmd->perf = want_perf;
+        cmd->cgroup_fd = cgroup_fd;
+        int pidfd = -1;
+        pid_t pid = spawn_cmd(cmd, want_pidfd ? &pidfd : NULL);
+
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+        if (fds[1] >= 0) {
+            close(fds[1]);
+        }
+        in_fd = fds[0];
+        if (pid < 0) {
+            continue; // the neighbours see the end of their pipes
+        }
+
+        // Also set the group and cgroup from the shell, so that they are in
+        // place before a signal is forwarded to it, whichever process runs
+        // first
+        if (pgid == 0) {
+            pgid = pid;
+        }
+        setpgid(pid, pgid);
+        if (cgroup_fd >= 0) {
+            cgroup_join(cgroup_fd, pid);
+        }
+
+        // The child cannot be reaped before the caller adds it to the job
+        // list, so its PID still refers to it here
+        if (want_pidfd && pidfd < 0) {
+            pidfd = pidfd_open(pid, 0);
+        }
+        procs[started].pid = pid;
+        procs[started].pidfd = pidfd;
+        started++;
+    }
+    if (in_fd >= 0) {
+        close(in_fd);
+    }
+
+    // Replace the helpers used, now that the job runs and every pipe is
+    // closed again
+    if (spawn_mode == SPAWN_ZYGOTE) {
+        zygote_fill();
+    }
+    return started;
+}
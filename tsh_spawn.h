@@ -0,0 +1,177 @@
+/**
+ * @file tsh_spawn.h
+ * @brief Interchangeable process launch engines for tsh
+ *
+ * Every non-builtin job is started through `spawn_job`, which hides the
+ * system call used to create the child process. The engine is selected once
+ * at startup (see the `-s` option of tsh) and stored in `spawn_mode`:
+ *
+ *   - `fork`         fork(), then redirect, setpgid and execve in the child.
+ *                    This duplicates the page tables of the shell.
+ *   - `vfork`        clone(CLONE_VM | CLONE_VFORK) on a private stack. The
+ *                    shell is suspended until the child calls execve or
+ *                    exits, and no page tables are copied.
+ *   - `posix_spawn`  posix_spawn with POSIX_SPAWN_SETPGROUP. Redirection
+ *                    files are opened by the shell and installed in the child
+ *                    through file actions.
+ *   - `clone3`       the raw clone3 system call with fork semantics.
+ *   - `zygote`       hand the command to a pre-forked helper process, which
+ *                    only has to call execve (see tsh_zygote.h). Falls back
+ *                    to fork when no helper is ready.
+ *
+ * All engines leave the child in its own process group with the signal mask
+ * the shell had before it blocked signals for the launch, and report errors
+ * for missing or inaccessible files with the same messages.
+ *
+ * The commands of a pipeline are connected by pipes and all join the process
+ * group of the first one, so that a signal sent to the job reaches every
+ * command. Two commands are run by the shell itself when they appear in a
+ * pipeline, since they only move data between descriptors: `cat` without
+ * arguments copies with splice(2), and `tee FILE` between two pipes
+ * duplicates the data with tee(2), so neither copies it through user space.
+ * As for builtin utilities, this applies to a bare name or a path in `/bin`
+ * or `/usr/bin` only, and not with `builtin_external`.
+ * `spawn_pipe_size` sets the capacity of the pipes with F_SETPIPE_SZ.
+ */
+
+#ifndef TSH_SPAWN_H
+#define TSH_SPAWN_H
+
+#include "tsh_helper.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/** @brief Permissions of files created by output redirection */
+#define REDIR_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+
+/**
+ * @brief System call used to create the processes of a job
+ */
+typedef enum spawn_engine {
+    SPAWN_FORK = 0,  ///< fork + execve (default)
+    SPAWN_VFORK = 1, ///< clone(CLONE_VM | CLONE_VFORK) + execve
+    SPAWN_POSIX = 2, ///< posix_spawn
+    SPAWN_CLONE3 = 3, ///< clone3 + execve
+    SPAWN_ZYGOTE = 4  ///< pre-forked helper + execve
+} spawn_engine;
+
+/**
+ * @brief A process started by spawn_job
+ */
+struct spawn_proc {
+    pid_t pid; ///< Process ID
+    int pidfd; ///< pidfd for the process, or -1
+};
+
+/* Defined in tsh_spawn.c */
+extern spawn_engine spawn_mode; ///< Engine used by spawn_job
+extern int spawn_pipe_size;     ///< Pipe capacity in bytes, 0 for default
+
+/**
+ * @brief Looks up a spawn engine by its command-line name.
+ *
+ * @param[in]  name    One of "fork", "vfork", "posix_spawn", "clone3" or
+ *                     "zygote".
+ * @param[out] engine  Set to the matching engine on success.
+ *
+ * @return true if `name` names a known engine, false otherwise.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+bool spawn_engine_parse(const char *name, spawn_engine *engine);
+
+/**
+ * @brief Returns the command-line name of a spawn engine.
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+const char *spawn_engine_name(spawn_engine engine);
+
+/**
+ * @brief Prepares the selected engine before the first job is started.
+ *
+ * For the zygote engine, this forks the pool of helpers. The other engines
+ * need no preparation.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void spawn_init(void);
+
+/**
+ * @brief Opens a redirection file, printing an error if that fails.
+ *
+ * Input files are opened read-only. Output files are created or truncated
+ * with `REDIR_MODE` permissions. If the file cannot be opened because it
+ * does not exist or because of its permissions, the same message the shell
+ * prints for a failed execve is written to stdout.
+ *
+ * @param[in] path    The file named after `<` or `>`.
+ * @param[in] output  true for output redirection, false for input.
+ *
+ * @return The new file descriptor, or -1 with errno set on failure.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+int redirect_open(const char *path, bool output);
+
+/**
+ * @brief Prints the shell's message for a failed open or execve of `path`.
+ *
+ * Only `ENOENT` and `EACCES` produce a message; other errors are silent.
+ *
+ * @remark Async-signal-safety: Async-signal-safe.
+ */
+void report_exec_error(const char *path, int err);
+
+/**
+ * @brief Starts the processes for a parsed, non-builtin command line.
+ *
+ * The program of every command is first located with `path_resolve` (see
+ * tsh_path.h), and the `<` and `>` redirection files are opened. If any of
+ * them is missing or inaccessible, the error is printed and no process is
+ * started.
+ *
+ * One process is then started for each command of the pipeline in `token`,
+ * from left to right. Each child connects its standard input and output to
+ * the pipes of its neighbours or to the redirection files, joins the
+ * process group of the first process (a new group for the first process
+ * itself), restores `child_mask`, and executes its program. Errors that are
+ * only detected in the child are reported there, and the child exits with
+ * status 0; the caller sees a process that terminates immediately, as with
+ * fork. Errors detected by the shell itself (posix_spawn) are reported, and
+ * that command is skipped.
+ *
+ * If `want_pidfd` is true, each process gets a pidfd: the clone3 engine
+ * asks for one with CLONE_PIDFD, the others call pidfd_open. It is -1 if no
+ * pidfd could be obtained.
+ *
+ * If `want_perf` is true, performance counters are opened on each process
+ * (see tsh_perf.h), and the programs are started by fork, whose child waits
+ * for the counters before it calls execve.
+ *
+ * If `cgroup_fd` is not -1, every process is placed in that cgroup (see
+ * tsh_cgroup.h) before it executes its program: clone3 creates it there,
+ * and the posix_spawn and zygote engines give way to clone3 to do so.
+ *
+ * @param[in]  token       The parsed command line.
+ * @param[in]  child_mask  Signal mask to install in the child before exec.
+ * @param[out] procs       Receives the started processes; must have room
+ *                         for `token->nstages` entries. The first one leads
+ *                         the process group.
+ * @param[in]  want_pidfd  Whether to obtain a pidfd for every process.
+ * @param[in]  want_perf   Whether to open performance counters on them.
+ * @param[in]  cgroup_fd   Cgroup of the job, from `cgroup_create`, or -1.
+ *
+ * @return The number of processes started, 0 if none was.
+ *
+ * @pre All signals must be blocked by the caller.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+int spawn_job(const struct cmdline_tokens *token, const sigset_t *child_mask,
+              struct spawn_proc *procs, bool want_pidfd, bool want_perf,
+              int cgroup_fd);
+
+#endif /* TSH_SPAWN_H */
@@ -0,0 +1,305 @@
+/**
+ * @file tsh_zygote.c
+ * @brief Pool of pre-forked helper processes for the zygote spawn engine
+ *
+ * See tsh_zygote.h for an overview. A launch request is a `zygote_msg`
+ * header, sent with sendmsg together with up to three descriptors, followed
+ * by the strings of the command: the arguments, the environment, then the
+ * name and path of the program, each NUL-terminated. The socket is a stream,
+ * so requests of any size can be sent; the helper reads exactly `size` bytes
+ * of strings after the header.
+ */
+
+#define _GNU_SOURCE // execveat
+
+#include "csapp.h"
+#include "tsh_spawn.h"
+#include "tsh_zygote.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Descriptors that may accompany a request */
+#define ZYGOTE_IN 0x1  // stdin
+#define ZYGOTE_OUT 0x2 // stdout
+#define ZYGOTE_DIR 0x4 // directory of the program, for execveat
+
+/* Header of a launch request */
+struct zygote_msg {
+    sigset_t mask; // Signal mask to execute with
+    pid_t pgid;    // Process group to join, 0 to keep its own
+    int fds;       // ZYGOTE_* flags of the descriptors sent, in that order
+    int argc;      // Number of arguments
+    int envc;      // Number of environment strings
+    size_t size;   // Bytes of strings after the header
+};
+
+/* A parked helper */
+struct zygote {
+    pid_t pid; // Process ID of the helper
+    int sock;  // Shell end of its socketpair
+};
+
+/* Static variables */
+static struct zygote pool[ZYGOTE_POOL]; // Parked helpers
+static int npool = 0;                   // Helpers in pool
+
+/*
+ * read_full - Read exactly n bytes, or fail at end of file
+ */
+static bool read_full(int fd, void *buf, size_t n) {
+    char *p = buf;
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        n -= (size_t)r;
+    }
+    return true;
+}
+
+/*
+ * unpack - Split count NUL-terminated strings off the front of *p into a
+ * NULL-terminated array
+ */
+static char **unpack(char **p, int count) {
+    char **list = malloc(((size_t)count + 1) * sizeof(*list));
+    if (list == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        list[i] = *p;
+        *p += strlen(*p) + 1;
+    }
+    list[count] = NULL;
+    return list;
+}
+
+/*
+ * helper_main - Body of a helper: wait for one request and execute it. The
+ * helper exits without a word if the shell goes away first.
+ */
+static void helper_main(int sock) {
+    struct zygote_msg msg;
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {.iov_base = &msg, .iov_len = sizeof(msg)};
+    struct msghdr hdr = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+
+    ssize_t n;
+    while ((n = recvmsg(sock, &hdr, MSG_WAITALL | MSG_CMSG_CLOEXEC)) < 0 &&
+           errno == EINTR) {
+    }
+    if (n != (ssize_t)sizeof(msg)) {
+        _exit(0);
+    }
+
+    int fds[3] = {-1, -1, -1};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fds, CMSG_DATA(cmsg), cmsg->cmsg_len - CMSG_LEN(0));
+    }
+    int next = 0;
+    int in_fd = msg.fds & ZYGOTE_IN ? fds[next++] : -1;
+    int out_fd = msg.fds & ZYGOTE_OUT ? fds[next++] : -1;
+    int dir_fd = msg.fds & ZYGOTE_DIR ? fds[next++] : AT_FDCWD;
+
+    char *strings = malloc(msg.size);
+    if (strings == NULL || !read_full(sock, strings, msg.size)) {
+        _exit(0);
+    }
+    char *p = strings;
+    char **argv = unpack(&p, msg.argc);
+    char **envp = unpack(&p, msg.envc);
+    if (argv == NULL || envp == NULL) {
+        _exit(0);
+    }
+    const char *name = p;
+    const char *path = p + strlen(p) + 1;
+
+    if (in_fd >= 0) {
+        dup2(in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        dup2(out_fd, STDOUT_FILENO);
+    }
+    if (msg.pgid != 0) {
+        setpgid(0, msg.pgid);
+    }
+    sigprocmask(SIG_SETMASK, &msg.mask, NULL);
+    if (dir_fd != AT_FDCWD) {
+        execveat(dir_fd, name, argv, envp, 0);
+    }
+    execve(path, argv, envp);
+    report_exec_error(argv[0], errno);
+    _exit(0);
+}
+
+/*
+ * fork_helper - Fork one helper into the pool
+ */
+static bool fork_helper(void) {
+    static const int handled[] = {SIGINT, SIGTSTP, SIGCHLD, SIGQUIT};
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair error");
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork error");
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        for (size_t i = 0; i < sizeof(handled) / sizeof(handled[0]); i++) {
+            signal(handled[i], SIG_DFL);
+        }
+        for (int i = 0; i < npool; i++) {
+            close(pool[i].sock);
+        }
+        close(sv[0]);
+        setpgid(0, 0);
+        helper_main(sv[1]);
+    }
+
+    close(sv[1]);
+    setpgid(pid, pid); // so that it is set whichever process runs first
+    pool[npool].pid = pid;
+    pool[npool].sock = sv[0];
+    npool++;
+    return true;
+}
+
+/*
+ * zygote_fill - Fork helpers until the pool is full
+ * Not async-signal-safe
+ */
+void zygote_fill(void) {
+    while (npool < ZYGOTE_POOL && fork_helper()) {
+    }
+}
+
+/*
+ * send_request - Hand a command to the helper listening on sock
+ */
+static bool send_request(int sock, char *const *argv,
+                         const struct path_cmd *prog, int in_fd, int out_fd,
+                         pid_t pgid, const sigset_t *child_mask) {
+    struct zygote_msg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.mask = *child_mask;
+    msg.pgid = pgid;
+
+    // Collect the strings in one buffer, so they go out in a single write
+    size_t size = strlen(prog->name) + strlen(prog->path) + 2;
+    for (; argv[msg.argc] != NULL; msg.argc++) {
+        size += strlen(argv[msg.argc]) + 1;
+    }
+    for (; environ[msg.envc] != NULL; msg.envc++) {
+        size += strlen(environ[msg.envc]) + 1;
+    }
+    char *strings = malloc(size);
+    if (strings == NULL) {
+        return false;
+    }
+    char *p = strings;
+    for (int i = 0; i < msg.argc; i++) {
+        p = stpcpy(p, argv[i]) + 1;
+    }
+    for (int i = 0; i < msg.envc; i++) {
+        p = stpcpy(p, environ[i]) + 1;
+    }
+    p = stpcpy(p, prog->name) + 1;
+    stpcpy(p, prog->path);
+    msg.size = size;
+
+    int fds[3];
+    int nfds = 0;
+    if (in_fd >= 0) {
+        msg.fds |= ZYGOTE_IN;
+        fds[nfds++] = in_fd;
+    }
+    if (out_fd >= 0) {
+        msg.fds |= ZYGOTE_OUT;
+        fds[nfds++] = out_fd;
+    }
+    if (prog->dirfd != AT_FDCWD) {
+        msg.fds |= ZYGOTE_DIR;
+        fds[nfds++] = prog->dirfd;
+    }
+
+    union {
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct iovec iov[2] = {
+        {.iov_base = &msg, .iov_len = sizeof(msg)},
+        {.iov_base = strings, .iov_len = size},
+    };
+    struct msghdr hdr = {.msg_iov = iov, .msg_iovlen = 2};
+    if (nfds > 0) {
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = CMSG_SPACE((size_t)nfds * sizeof(int));
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN((size_t)nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, (size_t)nfds * sizeof(int));
+    }
+
+    // The descriptors travel with the first byte; a long request may need
+    // more sends for the rest of the strings
+    ssize_t n = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+    size_t sent = n >= (ssize_t)sizeof(msg) ? (size_t)n - sizeof(msg) : 0;
+    while (n > 0 && sent < size) {
+        n = send(sock, strings + sent, size - sent, MSG_NOSIGNAL);
+        sent += n > 0 ? (size_t)n : 0;
+    }
+    free(strings);
+    return n > 0 && sent == size;
+}
+
+/*
+ * zygote_launch - Start a command in a helper from the pool
+ * Not async-signal-safe
+ */
+pid_t zygote_launch(char *const *argv, const struct path_cmd *prog, int in_fd,
+                    int out_fd, pid_t pgid, const sigset_t *child_mask) {
+    while (npool > 0) {
+        struct zygote z = pool[--npool];
+        bool ok = send_request(z.sock, argv, prog, in_fd, out_fd, pgid,
+                               child_mask);
+        close(z.sock);
+        if (ok) {
+            return z.pid;
+        }
+        // The helper died while parked; it is reaped like any other child
+    }
+    return -1;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file tsh_zygote.h
+ * @brief Pool of pre-forked helper processes for the zygote spawn engine
+ *
+ * With `-s zygote`, the shell forks a few helper processes ahead of time.
+ * Each helper resets the signal handlers of the shell, moves into a process
+ * group of its own and waits on its end of a socketpair. Launching a command
+ * then only sends the helper a message: the arguments, the environment, the
+ * signal mask and process group to use, and the stdin, stdout and program
+ * directory descriptors as SCM_RIGHTS. The helper installs them and calls
+ * execve, so the fork is no longer on the path from Enter to the running
+ * job. The helper becomes the process of the job, and its PID is the one
+ * tracked in the job list.
+ *
+ * The pool is refilled by `zygote_fill` once a job has been started, so the
+ * new helpers are forked while the job already runs, and never inherit the
+ * pipes of a pipeline. Helpers exit when the shell does, as their socket
+ * reaches end of file.
+ */
+
+#ifndef TSH_ZYGOTE_H
+#define TSH_ZYGOTE_H
+
+#include "tsh_path.h"
+
+#include <signal.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** @brief Number of helpers kept ready */
+#define ZYGOTE_POOL 4
+
+/**
+ * @brief Forks helpers until the pool is full.
+ *
+ * @pre All signals must be blocked, so that no handler of the shell runs in
+ *      a helper before it has reset them.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+void zygote_fill(void);
+
+/**
+ * @brief Starts a command in a helper from the pool.
+ *
+ * @param[in] argv        The arguments of the command, terminated by NULL.
+ * @param[in] prog        The program to execute, from `path_resolve`.
+ * @param[in] in_fd       Descriptor to use as stdin, or -1 to keep it.
+ * @param[in] out_fd      Descriptor to use as stdout, or -1 to keep it.
+ * @param[in] pgid        Process group to join, or 0 to lead a new one.
+ * @param[in] child_mask  Signal mask to execute the program with.
+ *
+ * @return The PID of the helper, which now runs the command, or -1 if the
+ *         pool is empty or no helper could take it. The caller should then
+ *         start the command some other way.
+ *
+ * @pre All signals must be blocked.
+ * @remark Async-signal-safety: Not async-signal-safe.
+ */
+pid_t zygote_launch(char *const *argv, const struct path_cmd *prog, int in_fd,
+                    int out_fd, pid_t pgid, const sigset_t *child_mask);
+
+#endif /* TSH_ZYGOTE_H */
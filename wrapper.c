@@ -4,9 +4,11 @@
  * correctness behaviors of a tsh implementation.
  */
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -259,6 +261,48 @@ pid_t __wrap_waitpid(pid_t pid, int *status, int options) {
 }
 
 
+/*
+ * __wrap_waitid - Link time wrapper around waitid
+ * Same synchronisation points as waitpid, for shells that reap with
+ * waitid (e.g. on a pidfd).
+ */
+int __real_waitid(idtype_t idtype, id_t id, siginfo_t *infop, int options);
+
+int __wrap_waitid(idtype_t idtype, id_t id, siginfo_t *infop, int options) {
+    if (shellsync_waitpid_before) {
+        shellsync_signal();
+        shellsync_wait();
+    }
+    int ret = __real_waitid(idtype, id, infop, options);
+    if (shellsync_waitpid_after && ret == 0 && infop->si_pid > 0) {
+        shellsync_signal();
+        shellsync_wait();
+    }
+    return ret;
+}
+
+
+/*
+ * __wrap_wait4 - Link time wrapper around wait4
+ * Same synchronisation points as waitpid, for shells that reap with wait4
+ * to collect the resource usage of their children.
+ */
+pid_t __real_wait4(pid_t pid, int *status, int options, struct rusage *ru);
+
+pid_t __wrap_wait4(pid_t pid, int *status, int options, struct rusage *ru) {
+    if (shellsync_waitpid_before) {
+        shellsync_signal();
+        shellsync_wait();
+    }
+    pid_t ret = __real_wait4(pid, status, options, ru);
+    if (shellsync_waitpid_after && ret > 0) {
+        shellsync_signal();
+        shellsync_wait();
+    }
+    return ret;
+}
+
+
 /*
  * __wrap_sigsuspend - Link time wrapper for sigsuspend
  * Sleeps before executing the call, increasing the likelihood that a signal
@@ -314,6 +358,15 @@ int __wrap_execve(const char *path, char *const argv[], char *const envp[]) {
     return __real_execve(path, argv, envp);
 }
 
+int __real_execveat(int dirfd, const char *path, char *const argv[],
+                    char *const envp[], int flags);
+
+int __wrap_execveat(int dirfd, const char *path, char *const argv[],
+                    char *const envp[], int flags) {
+    check_exec_sigset();
+    return __real_execveat(dirfd, path, argv, envp, flags);
+}
+
 int __real_execv(const char *path, char *const argv[]);
 
 int __wrap_execv(const char *path, char *const argv[]) {